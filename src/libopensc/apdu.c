@@ -215,7 +215,8 @@ int sc_apdu_set_resp(sc_context_t *ctx, sc_apdu_t *apdu, const u8 *buf,
 	if (len <= apdu->resplen)
 		apdu->resplen = len;
 
-	if (apdu->resplen != 0)
+	/* the response may have been received in place */
+	if (apdu->resplen != 0 && apdu->resp != buf)
 		memcpy(apdu->resp, buf, apdu->resplen);
 
 	return SC_SUCCESS;
@@ -540,29 +541,17 @@ sc_transmit(sc_card_t *card, sc_apdu_t *apdu)
 }
 
 
-int sc_transmit_apdu(sc_card_t *card, sc_apdu_t *apdu)
+/** Sends an APDU to the card, splitting it with command chaining if requested.
+ *  The caller holds the card lock.
+ *  @param  card  sc_card_t object for the smartcard
+ *  @param  apdu  APDU to be sent
+ *  @return SC_SUCCESS on success and an error value otherwise
+ */
+static int
+sc_transmit_locked(sc_card_t *card, sc_apdu_t *apdu)
 {
 	int r = SC_SUCCESS;
 
-	if (card == NULL || apdu == NULL)
-		return SC_ERROR_INVALID_ARGUMENTS;
-
-	LOG_FUNC_CALLED(card->ctx);
-
-	/* determine the APDU type if necessary, i.e. to use
-	 * short or extended APDUs  */
-	sc_detect_apdu_cse(card, apdu);
-	/* basic APDU consistency check */
-	r = sc_check_apdu(card, apdu);
-	if (r != SC_SUCCESS)
-		return SC_ERROR_INVALID_ARGUMENTS;
-
-	r = sc_lock(card);	/* acquire card lock*/
-	if (r != SC_SUCCESS) {
-		sc_log(card->ctx, "unable to acquire lock");
-		return r;
-	}
-
 	if ((apdu->flags & SC_APDU_FLAGS_CHAINING) != 0) {
 		/* divide et impera: transmit APDU in chunks with Lc <= max_send_size
 		 * bytes using command chaining */
@@ -635,6 +624,35 @@ int sc_transmit_apdu(sc_card_t *card, sc_apdu_t *apdu)
 			card->ops->card_reader_lock_obtained(card, 1);
 	}
 
+	return r;
+}
+
+
+int sc_transmit_apdu(sc_card_t *card, sc_apdu_t *apdu)
+{
+	int r = SC_SUCCESS;
+
+	if (card == NULL || apdu == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	LOG_FUNC_CALLED(card->ctx);
+
+	/* determine the APDU type if necessary, i.e. to use
+	 * short or extended APDUs  */
+	sc_detect_apdu_cse(card, apdu);
+	/* basic APDU consistency check */
+	r = sc_check_apdu(card, apdu);
+	if (r != SC_SUCCESS)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	r = sc_lock(card);	/* acquire card lock*/
+	if (r != SC_SUCCESS) {
+		sc_log(card->ctx, "unable to acquire lock");
+		return r;
+	}
+
+	r = sc_transmit_locked(card, apdu);
+
 	/* all done => release lock */
 	if (sc_unlock(card) != SC_SUCCESS)
 		sc_log(card->ctx, "sc_unlock failed");
@@ -643,6 +661,58 @@ int sc_transmit_apdu(sc_card_t *card, sc_apdu_t *apdu)
 }
 
 
+int sc_transmit_apdu_list(sc_card_t *card, sc_apdu_t *apdus, size_t count,
+	unsigned long flags, size_t *done)
+{
+	size_t i;
+	int r = SC_SUCCESS;
+
+	if (done)
+		*done = 0;
+	if (card == NULL || (apdus == NULL && count != 0))
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	LOG_FUNC_CALLED(card->ctx);
+
+	/* check the whole script before anything is sent to the card */
+	for (i = 0; i < count; i++) {
+		sc_detect_apdu_cse(card, &apdus[i]);
+		r = sc_check_apdu(card, &apdus[i]);
+		if (r != SC_SUCCESS) {
+			sc_log(card->ctx, "inconsistent APDU #%"SC_FORMAT_LEN_SIZE_T"u in the list", i);
+			LOG_FUNC_RETURN(card->ctx, SC_ERROR_INVALID_ARGUMENTS);
+		}
+	}
+
+	/* the lock (and with it the SM session) is held for the whole list */
+	r = sc_lock(card);
+	if (r != SC_SUCCESS) {
+		sc_log(card->ctx, "unable to acquire lock");
+		return r;
+	}
+
+	for (i = 0; i < count; i++) {
+		r = sc_transmit_locked(card, &apdus[i]);
+		if (r != SC_SUCCESS)
+			break;
+		if (done)
+			*done = i + 1;
+		if ((flags & SC_APDU_LIST_CONTINUE_ON_ERROR) == 0) {
+			r = sc_check_sw(card, apdus[i].sw1, apdus[i].sw2);
+			if (r != SC_SUCCESS) {
+				sc_log(card->ctx, "APDU #%"SC_FORMAT_LEN_SIZE_T"u failed, abort the list", i);
+				break;
+			}
+		}
+	}
+
+	if (sc_unlock(card) != SC_SUCCESS)
+		sc_log(card->ctx, "sc_unlock failed");
+
+	LOG_FUNC_RETURN(card->ctx, r);
+}
+
+
 int
 sc_bytes2apdu(sc_context_t *ctx, const u8 *buf, size_t len, sc_apdu_t *apdu)
 {
@@ -471,6 +471,9 @@ static int
 akis_card_ctl(sc_card_t *card, unsigned long cmd, void *ptr)
 {
 	switch (cmd) {
+	case SC_CARDCTL_READ_SERIALNR:
+		memset(&card->serialnr, 0, sizeof(card->serialnr));
+		/* fall through */
 	case SC_CARDCTL_GET_SERIALNR:
 		return akis_get_serialnr(card, (sc_serial_number_t *)ptr);
 	case SC_CARDCTL_LIFECYCLE_GET:
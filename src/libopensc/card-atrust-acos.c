@@ -858,6 +858,9 @@ static int atrust_acos_card_ctl(struct sc_card *card, unsigned long cmd, void *p
 
 	switch (cmd)
 	{
+	case SC_CARDCTL_READ_SERIALNR:
+		memset(&card->serialnr, 0, sizeof(card->serialnr));
+		/* fall through */
 	case SC_CARDCTL_GET_SERIALNR:
 		return acos_get_serialnr(card, (sc_serial_number_t *)ptr);
 	default:
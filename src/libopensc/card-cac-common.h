@@ -56,6 +56,9 @@ typedef struct cac_private_data {
 	list_t general_list;            /* list of general containers */
 	cac_object_t *general_current;  /* current object for _ctl function */
 	sc_path_t *aca_path;		/* ACA path to be selected before pin verification */
+	int use_cache;			/* cac_id comes from the CCC, keep data in the file cache */
+	sc_path_t selected_path;	/* path of the selected object, to name its cache entry */
+	u8 cache_generation[8];		/* CRCs of the root CCC, checked by the certificate entries */
 } cac_private_data_t;
 
 #define CAC_DATA(card) ((cac_private_data_t*)card->drv_data)
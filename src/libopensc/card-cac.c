@@ -447,6 +447,96 @@ fail:
 }
 
 
+/*
+ * File cache of a known card. The entries are keyed by the card ID from the
+ * CUID in the CCC, so they are used only on cards that have a CCC.
+ * Certificate entries start with the CRC of the root CCC they were read
+ * under, and are dropped as soon as the card presents a different CCC.
+ */
+#define CAC_CACHE_OBJECTS	"objects"
+#define CAC_CACHE_VERSION	2
+#define CAC_CACHE_CERT_HEADER_LEN	(1 + sizeof(((cac_private_data_t *)0)->cache_generation))
+
+/* certificate entries are named after the applet and the object */
+static int cac_cache_cert_name(const sc_path_t *path, char *name, size_t name_len)
+{
+	size_t n;
+
+	if (path->aid.len == 0 || path->len == 0
+	    || name_len < sizeof("cert__") + (path->aid.len + path->len) * 2)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	n = snprintf(name, name_len, "cert_");
+	sc_bin_to_hex(path->aid.value, path->aid.len, name + n, name_len - n, 0);
+	n += path->aid.len * 2;
+	name[n++] = '_';
+	sc_bin_to_hex(path->value, path->len, name + n, name_len - n, 0);
+	return SC_SUCCESS;
+}
+
+/* the generation changes with the contents of the root CCC */
+static void cac_cache_set_generation(cac_private_data_t *priv,
+	const u8 *tl, size_t tl_len, const u8 *val, size_t val_len)
+{
+	ulong2bebytes(priv->cache_generation, sc_crc32(tl, tl_len));
+	ulong2bebytes(priv->cache_generation + 4, sc_crc32(val, val_len));
+}
+
+static int cac_cache_read_cert(sc_card_t *card, cac_private_data_t *priv)
+{
+	char name[80];
+	int r;
+
+	if (!priv->use_cache)
+		return SC_ERROR_NOT_SUPPORTED;
+	r = cac_cache_cert_name(&priv->selected_path, name, sizeof(name));
+	if (r < 0)
+		return r;
+	r = sc_card_cache_read(card, priv->cac_id, priv->cac_id_len, name,
+			&priv->cache_buf, &priv->cache_buf_len);
+	if (r < 0)
+		return r;
+	if (priv->cache_buf_len <= CAC_CACHE_CERT_HEADER_LEN
+	    || priv->cache_buf[0] != CAC_CACHE_VERSION
+	    || memcmp(priv->cache_buf + 1, priv->cache_generation,
+			sizeof(priv->cache_generation)) != 0) {
+		sc_log(card->ctx, "Certificate %s in the file cache is stale", name);
+		sc_card_cache_remove(card, priv->cac_id, priv->cac_id_len, name);
+		free(priv->cache_buf);
+		priv->cache_buf = NULL;
+		priv->cache_buf_len = 0;
+		return SC_ERROR_CORRUPTED_DATA;
+	}
+	priv->cache_buf_len -= CAC_CACHE_CERT_HEADER_LEN;
+	memmove(priv->cache_buf, priv->cache_buf + CAC_CACHE_CERT_HEADER_LEN, priv->cache_buf_len);
+	sc_log(card->ctx, "Certificate %s read from the file cache", name);
+	return SC_SUCCESS;
+}
+
+static void cac_cache_write_cert(sc_card_t *card, cac_private_data_t *priv)
+{
+	char name[80];
+	u8 *buf;
+	int r;
+
+	if (!priv->use_cache || priv->cache_buf_len == 0)
+		return;
+	r = cac_cache_cert_name(&priv->selected_path, name, sizeof(name));
+	if (r < 0)
+		return;
+	buf = malloc(CAC_CACHE_CERT_HEADER_LEN + priv->cache_buf_len);
+	if (buf == NULL)
+		return;
+	buf[0] = CAC_CACHE_VERSION;
+	memcpy(buf + 1, priv->cache_generation, sizeof(priv->cache_generation));
+	memcpy(buf + CAC_CACHE_CERT_HEADER_LEN, priv->cache_buf, priv->cache_buf_len);
+	r = sc_card_cache_write(card, priv->cac_id, priv->cac_id_len, name,
+			buf, CAC_CACHE_CERT_HEADER_LEN + priv->cache_buf_len);
+	if (r < 0)
+		sc_log(card->ctx, "Failed to cache the certificate: %d", r);
+	free(buf);
+}
+
 /*
  * Callers of this may be expecting a certificate,
  * select file will have saved the object type for us
@@ -493,6 +583,11 @@ static int cac_read_binary(sc_card_t *card, unsigned int idx,
 	if (priv->object_type <= 0)
 		 LOG_FUNC_RETURN(card->ctx, SC_ERROR_INTERNAL);
 
+	/* certificates of a known card are kept decompressed in the file cache */
+	if (priv->object_type == CAC_OBJECT_TYPE_CERT
+	    && cac_cache_read_cert(card, priv) == SC_SUCCESS)
+		goto copy;
+
 	r = cac_read_file(card, CAC_FILE_TAG, &tl, &tl_len);
 	if (r < 0)  {
 		goto done;
@@ -598,6 +693,7 @@ static int cac_read_binary(sc_card_t *card, unsigned int idx,
 			sc_log(card->ctx, "Can't read zero-length certificate");
 			goto done;
 		}
+		cac_cache_write_cert(card, priv);
 		break;
 	case CAC_OBJECT_TYPE_GENERIC:
 		/* TODO
@@ -611,6 +707,7 @@ static int cac_read_binary(sc_card_t *card, unsigned int idx,
 		goto done;
 	}
 
+copy:
 	/* OK we've read the data, now copy the required portion out to the callers buffer */
 	priv->cached = 1;
 	len = MIN(count, priv->cache_buf_len-idx);
@@ -1106,6 +1203,9 @@ static int cac_select_file_by_type(sc_card_t *card, const sc_path_t *in_path, sc
 		}
 		priv->cache_buf_len = 0;
 		priv->cached = 0;
+		priv->selected_path = *in_path;
+		priv->selected_path.index = 0;
+		priv->selected_path.count = 0;
 	}
 
 	if (in_path->aid.len) {
@@ -1411,6 +1511,191 @@ static int cac_parse_cuid(sc_card_t *card, cac_private_data_t *priv, cac_cuid_t
 	priv->cac_id_len = card_id_len;
 	return SC_SUCCESS;
 }
+
+/* find the CUID in the CCC without following the rest of the container */
+static int cac_find_CCC_cuid(sc_card_t *card, cac_private_data_t *priv, const u8 *tl,
+	size_t tl_len, const u8 *val, size_t val_len)
+{
+	size_t len = 0;
+	const u8 *tl_end = tl + tl_len;
+	const u8 *val_end = val + val_len;
+	int r;
+
+	for (; (tl < tl_end) && (val < val_end); val += len) {
+		u8 tag;
+		r = sc_simpletlv_read_tag(&tl, tl_end - tl, &tag, &len);
+		if (r != SC_SUCCESS && r != SC_ERROR_TLV_END_OF_CONTENTS)
+			break;
+		if (val + len > val_end)
+			break;
+		if (tag == CAC_TAG_CUID)
+			return cac_parse_cuid(card, priv, (cac_cuid_t *)val, len);
+	}
+	return SC_ERROR_OBJECT_NOT_FOUND;
+}
+
+static size_t cac_cache_path_len(const sc_path_t *path)
+{
+	return 3 + path->len + path->aid.len;
+}
+
+static u8 *cac_cache_put_path(u8 *p, const sc_path_t *path)
+{
+	*p++ = path->type;
+	*p++ = path->len;
+	memcpy(p, path->value, path->len);
+	p += path->len;
+	*p++ = path->aid.len;
+	memcpy(p, path->aid.value, path->aid.len);
+	return p + path->aid.len;
+}
+
+static int cac_cache_get_path(const u8 **p, const u8 *end, sc_path_t *path)
+{
+	sc_mem_clear(path, sizeof(sc_path_t));
+	if (end - *p < 2)
+		return SC_ERROR_CORRUPTED_DATA;
+	path->type = *(*p)++;
+	path->len = *(*p)++;
+	if (path->len > sizeof(path->value) || (size_t)(end - *p) < path->len + 1)
+		return SC_ERROR_CORRUPTED_DATA;
+	memcpy(path->value, *p, path->len);
+	*p += path->len;
+	path->aid.len = *(*p)++;
+	if (path->aid.len > sizeof(path->aid.value) || (size_t)(end - *p) < path->aid.len)
+		return SC_ERROR_CORRUPTED_DATA;
+	memcpy(path->aid.value, *p, path->aid.len);
+	*p += path->aid.len;
+	return SC_SUCCESS;
+}
+
+/*
+ * The objects entry keeps the root CCC the lists were built from, so it is
+ * used only while the card presents the same CCC. Format: version (1 byte),
+ * length (2 bytes) and content of the TL and V files of the CCC, cert_next,
+ * number of objects, and for each object its list (0 pki, 1 general), fd,
+ * index in cac_objects (general objects only) and path.
+ */
+static int cac_cache_save_objects(sc_card_t *card, cac_private_data_t *priv,
+	const u8 *tl, size_t tl_len, const u8 *val, size_t val_len)
+{
+	list_t *lists[2] = { &priv->pki_list, &priv->general_list };
+	size_t len = 1 + 2 + tl_len + 2 + val_len + 2;
+	cac_object_t *obj;
+	u8 *buf, *p;
+	int i, j, r;
+
+	if (tl_len > 0xFFFF || val_len > 0xFFFF
+	    || list_size(&priv->pki_list) + list_size(&priv->general_list) > 0xFF)
+		return SC_ERROR_NOT_SUPPORTED;
+
+	for (i = 0; i < 2; i++) {
+		list_iterator_start(lists[i]);
+		while (list_iterator_hasnext(lists[i])) {
+			obj = list_iterator_next(lists[i]);
+			len += 3 + cac_cache_path_len(&obj->path);
+		}
+		list_iterator_stop(lists[i]);
+	}
+
+	buf = p = malloc(len);
+	if (buf == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	*p++ = CAC_CACHE_VERSION;
+	ushort2bebytes(p, tl_len);
+	memcpy(p + 2, tl, tl_len);
+	p += 2 + tl_len;
+	ushort2bebytes(p, val_len);
+	memcpy(p + 2, val, val_len);
+	p += 2 + val_len;
+	*p++ = priv->cert_next;
+	*p++ = list_size(&priv->pki_list) + list_size(&priv->general_list);
+	for (i = 0; i < 2; i++) {
+		list_iterator_start(lists[i]);
+		while (list_iterator_hasnext(lists[i])) {
+			obj = list_iterator_next(lists[i]);
+			*p++ = i;
+			*p++ = obj->fd;
+			for (j = 0; j < cac_object_count; j++) {
+				if (cac_objects[j].name == obj->name)
+					break;
+			}
+			*p++ = j;
+			p = cac_cache_put_path(p, &obj->path);
+		}
+		list_iterator_stop(lists[i]);
+	}
+
+	r = sc_card_cache_write(card, priv->cac_id, priv->cac_id_len,
+			CAC_CACHE_OBJECTS, buf, len);
+	free(buf);
+	return r;
+}
+
+static int cac_cache_load_objects(sc_card_t *card, cac_private_data_t *priv,
+	const u8 *tl, size_t tl_len, const u8 *val, size_t val_len)
+{
+	u8 *buf = NULL;
+	const u8 *p, *end;
+	size_t len = 0;
+	cac_object_t obj;
+	int i, count, pki, r;
+
+	r = sc_card_cache_read(card, priv->cac_id, priv->cac_id_len,
+			CAC_CACHE_OBJECTS, &buf, &len);
+	if (r < 0)
+		return r;
+
+	p = buf;
+	end = buf + len;
+	r = SC_ERROR_CORRUPTED_DATA;
+	if (len < 1 + 2 + tl_len + 2 + val_len + 2 || *p++ != CAC_CACHE_VERSION)
+		goto done;
+	if (bebytes2ushort(p) != tl_len || memcmp(p + 2, tl, tl_len) != 0)
+		goto done;
+	p += 2 + tl_len;
+	if (bebytes2ushort(p) != val_len || memcmp(p + 2, val, val_len) != 0)
+		goto done;
+	p += 2 + val_len;
+	priv->cert_next = *p++;
+	count = *p++;
+
+	for (i = 0; i < count; i++) {
+		if (end - p < 3)
+			goto done;
+		pki = (p[0] == 0);
+		obj.fd = p[1];
+		if (pki) {
+			obj.name = get_cac_label(obj.fd - 1);
+		} else if (p[2] < cac_object_count) {
+			obj.name = cac_objects[p[2]].name;
+		} else {
+			goto done;
+		}
+		if (obj.name == NULL)
+			goto done;
+		p += 3;
+		if (cac_cache_get_path(&p, end, &obj.path) != SC_SUCCESS)
+			goto done;
+		r = cac_add_object_to_list(pki ? &priv->pki_list : &priv->general_list, &obj);
+		if (r < 0)
+			goto done;
+		r = SC_ERROR_CORRUPTED_DATA;
+	}
+	if (p == end)
+		r = SC_SUCCESS;
+
+done:
+	if (r != SC_SUCCESS) {
+		/* start over with the card */
+		list_clear(&priv->pki_list);
+		list_clear(&priv->general_list);
+		priv->cert_next = 0;
+	}
+	free(buf);
+	return r;
+}
+
 static int cac_process_CCC(sc_card_t *card, cac_private_data_t *priv, int depth);
 
 static int cac_parse_CCC(sc_card_t *card, cac_private_data_t *priv, const u8 *tl,
@@ -1544,7 +1829,22 @@ static int cac_process_CCC(sc_card_t *card, cac_private_data_t *priv, int depth)
 	if (r < 0)
 		goto done;
 
+	/* a known card has its applet list in the file cache, skip the walk */
+	if (depth == 0 && sc_card_cache_enabled(card)
+	    && cac_find_CCC_cuid(card, priv, tl, tl_len, val, val_len) == SC_SUCCESS
+	    && priv->cac_id_len > 0) {
+		priv->use_cache = 1;
+		cac_cache_set_generation(priv, tl, tl_len, val, val_len);
+		if (cac_cache_load_objects(card, priv, tl, tl_len, val, val_len) == SC_SUCCESS) {
+			sc_log(card->ctx, "CCC objects read from the file cache");
+			goto done;
+		}
+	}
+
 	r = cac_parse_CCC(card, priv, tl, tl_len, val, val_len, depth);
+	if (r == SC_SUCCESS && depth == 0 && priv->use_cache
+	    && cac_cache_save_objects(card, priv, tl, tl_len, val, val_len) < 0)
+		sc_log(card->ctx, "Failed to cache the CCC objects");
 done:
 	if (tl)
 		free(tl);
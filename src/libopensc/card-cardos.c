@@ -1479,6 +1479,9 @@ cardos_card_ctl(sc_card_t *card, unsigned long cmd, void *ptr)
 		return cardos_lifecycle_get(card, (int *) ptr);
 	case SC_CARDCTL_LIFECYCLE_SET:
 		return cardos_lifecycle_set(card, (int *) ptr);
+	case SC_CARDCTL_READ_SERIALNR:
+		memset(&card->serialnr, 0, sizeof(card->serialnr));
+		/* fall through */
 	case SC_CARDCTL_GET_SERIALNR:
 		return cardos_get_serialnr(card, (sc_serial_number_t *)ptr);
 	}
@@ -722,6 +722,23 @@ coolkey_v1_get_object_length(u8 *obj, size_t buf_len)
 	return len;
 }
 
+/*
+ * Index of the attribute records of an object, sorted by attribute type so
+ * lookups do not need to walk the whole record list. The index is built the
+ * first time an attribute of the object is requested.
+ */
+typedef struct coolkey_attribute_index_entry {
+	CK_ATTRIBUTE_TYPE type;
+	size_t offset;		/* offset of the record from the start of the object */
+	size_t len;		/* length of the record */
+} coolkey_attribute_index_entry_t;
+
+struct coolkey_attribute_index {
+	coolkey_attribute_index_entry_t *entries;
+	size_t count;
+	int complete;		/* 0 if a corrupted record stopped the parsing */
+};
+
 /*
  * COOLKEY private data per card state
  */
@@ -743,6 +760,13 @@ typedef struct coolkey_private_data {
 	unsigned short key_id;			/* key id set by select */
 	int	algorithm;			/* saved from set_security_env */
 	int operation;				/* saved from set_security_env */
+	coolkey_object_info_t *object_info;	/* object list as returned by the token */
+	size_t object_info_count;
+	u8 *combined_object;			/* raw combined object, kept for the file cache */
+	size_t combined_object_length;
+	coolkey_cuid_t cache_cuid;		/* CUID of the file cache entry */
+	int use_cache;				/* the file cache is enabled */
+	int cache_dirty;			/* the file cache needs to be written */
 } coolkey_private_data_t;
 
 #define COOLKEY_DATA(card) ((coolkey_private_data_t*)card->drv_data)
@@ -795,11 +819,18 @@ static void coolkey_free_private_data(coolkey_private_data_t *priv)
 		o = (sc_cardctl_coolkey_object_t *)list_iterator_next(l);
 		free(o->data);
 		o->data = NULL;
+		if (o->attribute_index) {
+			free(o->attribute_index->entries);
+			free(o->attribute_index);
+			o->attribute_index = NULL;
+		}
 	}
 	list_iterator_stop(l);
 
 	list_destroy(&priv->objects_list);
 	free(priv->token_name);
+	free(priv->object_info);
+	free(priv->combined_object);
 	free(priv);
 	return;
 }
@@ -822,7 +853,7 @@ coolkey_find_object_by_id(list_t *list, unsigned long object_id)
 	static sc_cardctl_coolkey_object_t cmp = {{
 		"", 0, 0, 0, SC_PATH_TYPE_DF_NAME,
 		{ COOLKEY_AID, sizeof(COOLKEY_AID)-1 }
-	}, 0, 0, NULL};
+	}, 0, 0, NULL, NULL};
 
 	cmp.id = object_id;
 	if ((pos = list_locate(list, &cmp)) < 0)
@@ -832,6 +863,134 @@ coolkey_find_object_by_id(list_t *list, unsigned long object_id)
 }
 
 
+/*
+ * File cache of the object list. The entry is keyed by the CUID of the token
+ * and it is used only when the object list returned by the token (ids, lengths
+ * and ACLs) matches the cached one. Only objects readable without login are
+ * stored.
+ *
+ * Format: version (1 byte), number of objects (4 bytes) and for each object
+ * the coolkey_object_info_t from LIST OBJECTS, the length of the cached data
+ * (4 bytes, 0 if the data are not cached) and the data.
+ */
+#define COOLKEY_CACHE_NAME		"objects"
+#define COOLKEY_CACHE_VERSION		1
+#define COOLKEY_CACHE_HEADER_LEN	5
+#define COOLKEY_CACHE_RECORD_LEN	(sizeof(coolkey_object_info_t) + 4)
+
+static int
+coolkey_object_info_is_public(const coolkey_object_info_t *info)
+{
+	return bebytes2ushort(info->read_acl) == 0;
+}
+
+/* mark the cache dirty if a public object was read from the token */
+static void
+coolkey_cache_object_read(coolkey_private_data_t *priv, unsigned long object_id)
+{
+	size_t i;
+
+	if (!priv->use_cache)
+		return;
+	for (i = 0; i < priv->object_info_count; i++) {
+		if (bebytes2ulong(priv->object_info[i].object_id) == object_id) {
+			if (coolkey_object_info_is_public(&priv->object_info[i]))
+				priv->cache_dirty = 1;
+			return;
+		}
+	}
+}
+
+/* returns 1 and the cached data of each object if the cache entry matches the object list */
+static int
+coolkey_cache_match(const coolkey_private_data_t *priv, const u8 *buf, size_t buflen,
+	const u8 **data, size_t *data_len)
+{
+	size_t i, len;
+
+	if (buflen < COOLKEY_CACHE_HEADER_LEN || buf[0] != COOLKEY_CACHE_VERSION
+	    || bebytes2ulong(&buf[1]) != priv->object_info_count)
+		return 0;
+	buf += COOLKEY_CACHE_HEADER_LEN;
+	buflen -= COOLKEY_CACHE_HEADER_LEN;
+
+	for (i = 0; i < priv->object_info_count; i++) {
+		if (buflen < COOLKEY_CACHE_RECORD_LEN)
+			return 0;
+		if (memcmp(buf, &priv->object_info[i], sizeof(coolkey_object_info_t)) != 0)
+			return 0;
+		len = bebytes2ulong(buf + sizeof(coolkey_object_info_t));
+		buf += COOLKEY_CACHE_RECORD_LEN;
+		buflen -= COOLKEY_CACHE_RECORD_LEN;
+		if (len > buflen)
+			return 0;
+		data[i] = len ? buf : NULL;
+		data_len[i] = len;
+		buf += len;
+		buflen -= len;
+	}
+	return buflen == 0;
+}
+
+static const u8 *
+coolkey_cache_object_data(coolkey_private_data_t *priv, const coolkey_object_info_t *info, size_t *len)
+{
+	unsigned long object_id = bebytes2ulong(info->object_id);
+	sc_cardctl_coolkey_object_t *entry;
+
+	*len = 0;
+	if (!coolkey_object_info_is_public(info))
+		return NULL;
+	if (object_id == COOLKEY_COMBINED_OBJECT_ID) {
+		*len = priv->combined_object_length;
+		return priv->combined_object;
+	}
+	entry = coolkey_find_object_by_id(&priv->objects_list, object_id);
+	if (entry == NULL || entry->data == NULL
+	    || entry->length != bebytes2ulong(info->object_length))
+		return NULL;
+	*len = entry->length;
+	return entry->data;
+}
+
+static void
+coolkey_cache_save(sc_card_t *card, coolkey_private_data_t *priv)
+{
+	size_t i, len, buflen = COOLKEY_CACHE_HEADER_LEN;
+	const u8 *data;
+	u8 *buf, *p;
+	int r;
+
+	for (i = 0; i < priv->object_info_count; i++) {
+		coolkey_cache_object_data(priv, &priv->object_info[i], &len);
+		buflen += COOLKEY_CACHE_RECORD_LEN + len;
+	}
+	buf = malloc(buflen);
+	if (buf == NULL)
+		return;
+
+	p = buf;
+	*p++ = COOLKEY_CACHE_VERSION;
+	ulong2bebytes(p, priv->object_info_count);
+	p += 4;
+	for (i = 0; i < priv->object_info_count; i++) {
+		data = coolkey_cache_object_data(priv, &priv->object_info[i], &len);
+		memcpy(p, &priv->object_info[i], sizeof(coolkey_object_info_t));
+		ulong2bebytes(p + sizeof(coolkey_object_info_t), len);
+		p += COOLKEY_CACHE_RECORD_LEN;
+		if (len) {
+			memcpy(p, data, len);
+			p += len;
+		}
+	}
+
+	r = sc_card_cache_write(card, (u8 *)&priv->cache_cuid, sizeof(priv->cache_cuid),
+			COOLKEY_CACHE_NAME, buf, buflen);
+	if (r < 0)
+		sc_log(card->ctx, "Failed to write the object cache: %d", r);
+	free(buf);
+}
+
 static const sc_path_t coolkey_template_path = {
 	"", 0, 0, 0, SC_PATH_TYPE_DF_NAME,
 	{ COOLKEY_AID, sizeof(COOLKEY_AID)-1 }
@@ -1224,6 +1383,7 @@ static int coolkey_read_binary(sc_card_t *card, unsigned int idx,
 	/* cache the data in the object */
 	priv->obj->data=data;
 	data = NULL;
+	coolkey_cache_object_read(priv, priv->obj->id);
 
 done:
 	if (data)
@@ -1405,9 +1565,110 @@ coolkey_fill_object(sc_card_t *card, sc_cardctl_coolkey_object_t *obj)
 	}
 	obj_entry->data = new_obj_data;
 	obj->data = new_obj_data;
+	coolkey_cache_object_read(priv, obj->id);
 	LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
 }
 
+static int
+coolkey_compare_attribute_index_entry(const void *a, const void *b)
+{
+	const coolkey_attribute_index_entry_t *ea = a, *eb = b;
+
+	if (ea->type != eb->type)
+		return ea->type < eb->type ? -1 : 1;
+	/* keep the order of the records for duplicate attributes */
+	if (ea->offset != eb->offset)
+		return ea->offset < eb->offset ? -1 : 1;
+	return 0;
+}
+
+/*
+ * walk the attribute records of the object once and index them by type.
+ */
+static int
+coolkey_build_attribute_index(const u8 *obj, u8 object_record_type, size_t buf_len,
+	struct coolkey_attribute_index **index_out)
+{
+	struct coolkey_attribute_index *index;
+	const u8 *attr;
+	int attribute_count, i;
+
+	attr = coolkey_attribute_start(obj, object_record_type, buf_len);
+	if (attr == NULL) {
+		return SC_ERROR_CORRUPTED_DATA;
+	}
+	buf_len -= (attr-obj);
+
+	/* now get the count */
+	attribute_count = coolkey_get_attribute_count(obj, object_record_type, buf_len);
+
+	index = calloc(1, sizeof(struct coolkey_attribute_index));
+	if (index == NULL) {
+		return SC_ERROR_OUT_OF_MEMORY;
+	}
+	if (attribute_count > 0) {
+		index->entries = calloc(attribute_count, sizeof(coolkey_attribute_index_entry_t));
+		if (index->entries == NULL) {
+			free(index);
+			return SC_ERROR_OUT_OF_MEMORY;
+		}
+	}
+	index->complete = 1;
+	for (i=0; i < attribute_count; i++) {
+		coolkey_attribute_index_entry_t *entry;
+		size_t record_len = coolkey_get_attribute_record_len(attr, object_record_type, buf_len);
+		/* make sure we have the complete record */
+		if (buf_len < record_len || record_len < 4) {
+			index->complete = 0;
+			break;
+		}
+		entry = &index->entries[index->count++];
+		entry->type = coolkey_get_attribute_type(attr, object_record_type, record_len);
+		entry->offset = attr - obj;
+		entry->len = record_len;
+		/* go to the next attribute on the list */
+		buf_len -= record_len;
+		attr += record_len;
+	}
+	if (index->count > 1) {
+		qsort(index->entries, index->count, sizeof(coolkey_attribute_index_entry_t),
+			coolkey_compare_attribute_index_entry);
+	}
+	*index_out = index;
+	return SC_SUCCESS;
+}
+
+/*
+ * return the attribute index of the object. The index lives in the entry on the objects
+ * list, as the callers may hold copies of the entry made before the index was built.
+ */
+static int
+coolkey_get_attribute_index(sc_card_t *card, const sc_cardctl_coolkey_object_t *object,
+	u8 object_record_type, struct coolkey_attribute_index **index)
+{
+	coolkey_private_data_t * priv = COOLKEY_DATA(card);
+	sc_cardctl_coolkey_object_t *obj_entry;
+	int r;
+
+	if (object->attribute_index) {
+		*index = object->attribute_index;
+		return SC_SUCCESS;
+	}
+	obj_entry = coolkey_find_object_by_id(&priv->objects_list, object->id);
+	if (obj_entry == NULL || obj_entry->data != object->data) {
+		return SC_ERROR_INTERNAL; /* shouldn't happen */
+	}
+	if (obj_entry->attribute_index == NULL) {
+		r = coolkey_build_attribute_index(obj_entry->data, object_record_type,
+			obj_entry->length, &obj_entry->attribute_index);
+		if (r < 0) {
+			return r;
+		}
+	}
+	*index = obj_entry->attribute_index;
+	return SC_SUCCESS;
+}
+
 /*
  * return a parsed record for the attribute which includes value, type, and length.
  * Handled both v1 and v0 record types. determine record type from the object.
@@ -1419,10 +1680,11 @@ coolkey_find_attribute(sc_card_t *card, sc_cardctl_coolkey_attribute_t *attribut
 	u8 object_record_type;
 	CK_ATTRIBUTE_TYPE attr_type = attribute->attribute_type;
 	const u8 *obj = attribute->object->data;
-	const u8 *attr = NULL;
 	size_t buf_len = attribute->object->length;
 	coolkey_object_header_t *object_head;
-	int attribute_count,i;
+	struct coolkey_attribute_index *index = NULL;
+	size_t lo, hi;
+	int r;
 	attribute->attribute_data_type = SC_CARDCTL_COOLKEY_ATTR_TYPE_STRING;
 	attribute->attribute_length = 0;
 	attribute->attribute_value = NULL;
@@ -1431,7 +1693,7 @@ coolkey_find_attribute(sc_card_t *card, sc_cardctl_coolkey_attribute_t *attribut
 
 	if (obj == NULL) {
 		/* cast away const so we can cache the data value */
-		int r = coolkey_fill_object(card, (sc_cardctl_coolkey_object_t *)attribute->object);
+		r = coolkey_fill_object(card, (sc_cardctl_coolkey_object_t *)attribute->object);
 		if (r < 0) {
 			return r;
 		}
@@ -1454,31 +1716,30 @@ coolkey_find_attribute(sc_card_t *card, sc_cardctl_coolkey_attribute_t *attribut
 		return SC_ERROR_CORRUPTED_DATA;
 	}
 
-	/*
-	 * now loop through all the attributes in the list. first find the start of the list
-	 */
-	attr = coolkey_attribute_start(obj, object_record_type, buf_len);
-	if (attr == NULL) {
-		return SC_ERROR_CORRUPTED_DATA;
+	r = coolkey_get_attribute_index(card, attribute->object, object_record_type, &index);
+	if (r < 0) {
+		return r;
 	}
-	buf_len -= (attr-obj);
 
-	/* now get the count */
-	attribute_count = coolkey_get_attribute_count(obj, object_record_type, buf_len);
-	for (i=0; i < attribute_count; i++) {
-		size_t record_len = coolkey_get_attribute_record_len(attr, object_record_type, buf_len);
-		/* make sure we have the complete record */
-		if (buf_len < record_len || record_len < 4) {
-			return SC_ERROR_CORRUPTED_DATA;
-		}
-		/* does the attribute match the one we are looking for */
-		if (attr_type == coolkey_get_attribute_type(attr, object_record_type, record_len)) {
-			/* yup, return it */
-			return coolkey_get_attribute_data(attr, object_record_type, record_len, attribute);
-		}
-		/* go to the next attribute on the list */
-		buf_len -= record_len;
-		attr += record_len;
+	/* binary search for the first record of the attribute */
+	lo = 0;
+	hi = index->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (index->entries[mid].type < attr_type)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < index->count && index->entries[lo].type == attr_type) {
+		const coolkey_attribute_index_entry_t *entry = &index->entries[lo];
+		/* yup, return it */
+		return coolkey_get_attribute_data(obj + entry->offset, object_record_type,
+			entry->len, attribute);
+	}
+	/* the attribute may be in the part of the list we could not parse */
+	if (!index->complete) {
+		return SC_ERROR_CORRUPTED_DATA;
 	}
 	/* not find in attribute list, check the fixed attribute record */
 	if (object_record_type == COOLKEY_V1_OBJECT) {
@@ -1938,6 +2199,9 @@ static int coolkey_finish(sc_card_t *card)
 
 	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_VERBOSE);
 	if (priv) {
+		if (priv->use_cache && priv->cache_dirty) {
+			coolkey_cache_save(card, priv);
+		}
 		coolkey_free_private_data(priv);
 	}
 	return SC_SUCCESS;
@@ -2125,6 +2389,70 @@ coolkey_list_object(sc_card_t *card, u8 seq, coolkey_object_info_t *object_info)
 
 }
 
+/*
+ * Get the identifier of the file cache entry and load the cached data of the
+ * objects if the entry matches the object list of the token. The identifier is
+ * the CUID stored in the header of the combined object when the token has one,
+ * so only the header is read instead of the whole object. Otherwise it is the
+ * CPLC based CUID, which the token without a combined object needs anyway.
+ */
+static int
+coolkey_cache_load(sc_card_t *card, coolkey_private_data_t *priv, u8 **cache,
+	const u8 **data, size_t *data_len)
+{
+	global_platform_cplc_data_t cplc_data;
+	coolkey_combined_header_t header;
+	size_t cache_len = 0;
+	int combined = 0;
+	size_t i;
+	int r;
+
+	*cache = NULL;
+	for (i = 0; i < priv->object_info_count; i++) {
+		if (bebytes2ulong(priv->object_info[i].object_id) == COOLKEY_COMBINED_OBJECT_ID) {
+			combined = coolkey_object_info_is_public(&priv->object_info[i])
+				&& bebytes2ulong(priv->object_info[i].object_length) >= sizeof(header);
+			break;
+		}
+	}
+	if (combined) {
+		r = coolkey_read_object(card, COOLKEY_COMBINED_OBJECT_ID, 0, (u8 *)&header, sizeof(header),
+			priv->nonce, sizeof(priv->nonce));
+		if (r < 0)
+			return r;
+		memcpy(&priv->cache_cuid, &header.cuid, sizeof(priv->cache_cuid));
+		priv->use_cache = 1;
+	} else if (i == priv->object_info_count) {
+		/* no combined object: the CPLC is used for the CUID of the token too */
+		r = gp_select_card_manager(card);
+		if (r < 0)
+			return r;
+		r = gp_get_cplc_data(card, &cplc_data);
+		if (r < 0)
+			return r;
+		coolkey_make_cuid_from_cplc(&priv->cache_cuid, &cplc_data);
+		priv->use_cache = 1;
+	}
+	if (!priv->use_cache) {
+		sc_log(card->ctx, "No CUID available, not using the object cache");
+		return SC_SUCCESS;
+	}
+
+	r = sc_card_cache_read(card, (u8 *)&priv->cache_cuid, sizeof(priv->cache_cuid),
+			COOLKEY_CACHE_NAME, cache, &cache_len);
+	if (r == SC_SUCCESS && coolkey_cache_match(priv, *cache, cache_len, data, data_len)) {
+		sc_log(card->ctx, "Using the cached object list");
+		return SC_SUCCESS;
+	}
+	sc_log(card->ctx, "The object cache is missing or stale");
+	free(*cache);
+	*cache = NULL;
+	memset(data, 0, priv->object_info_count * sizeof(*data));
+	memset(data_len, 0, priv->object_info_count * sizeof(*data_len));
+	priv->cache_dirty = 1;
+	return SC_SUCCESS;
+}
+
 /*
  * Initialize the Coolkey data structures.
  */
@@ -2135,6 +2463,10 @@ static int coolkey_initialize(sc_card_t *card)
 	coolkey_life_cycle_t life_cycle;
 	coolkey_object_info_t object_info;
 	int combined_processed = 0;
+	u8 *cache = NULL;
+	const u8 **cached_data = NULL;
+	size_t *cached_len = NULL;
+	size_t i;
 
 	/* already found? */
 	if (card->drv_data) {
@@ -2163,26 +2495,63 @@ static int coolkey_initialize(sc_card_t *card)
 	priv->pin_count = life_cycle.pin_count;
 	priv->life_cycle = life_cycle.life_cycle;
 
-	/* walk down the list of objects and read them off the token */
+	/* walk down the list of objects on the token */
 	r = coolkey_list_object(card, COOLKEY_LIST_RESET, &object_info);
 	while (r >= 0) {
-		unsigned long object_id;
-		unsigned long object_len;
+		coolkey_object_info_t *new_info;
 
 		/* The card did not return what we expected: Lets try other objects */
 		if ((size_t)r < (sizeof(object_info)))
 			break;
 
-		/* TODO also look at the ACL... */
-
-		object_id = bebytes2ulong(object_info.object_id);
-		object_len = bebytes2ulong(object_info.object_length);
 		/* Avoid insanely large data */
-		if (object_len > MAX_FILE_SIZE) {
+		if (bebytes2ulong(object_info.object_length) > MAX_FILE_SIZE) {
 			r = SC_ERROR_CORRUPTED_DATA;
 			goto cleanup;
 		}
 
+		new_info = realloc(priv->object_info,
+			(priv->object_info_count + 1) * sizeof(coolkey_object_info_t));
+		if (new_info == NULL) {
+			r = SC_ERROR_OUT_OF_MEMORY;
+			goto cleanup;
+		}
+		priv->object_info = new_info;
+		priv->object_info[priv->object_info_count++] = object_info;
+
+		/* Read next object: error is handled on the cycle condition and below after cycle */
+		r = coolkey_list_object(card, COOLKEY_LIST_NEXT, &object_info);
+	}
+	if (r != SC_ERROR_FILE_END_REACHED) {
+		/* This means the card does not cooperate at all: bail out */
+		if (r >= 0) {
+			r = SC_ERROR_INVALID_CARD;
+		}
+		goto cleanup;
+	}
+
+	if (priv->object_info_count) {
+		cached_data = calloc(priv->object_info_count, sizeof(*cached_data));
+		cached_len = calloc(priv->object_info_count, sizeof(*cached_len));
+		if (cached_data == NULL || cached_len == NULL) {
+			r = SC_ERROR_OUT_OF_MEMORY;
+			goto cleanup;
+		}
+	}
+	if (sc_card_cache_enabled(card)) {
+		r = coolkey_cache_load(card, priv, &cache, cached_data, cached_len);
+		if (r < 0) {
+			goto cleanup;
+		}
+	}
+
+	/* now read the objects off the token, or take them from the cache */
+	for (i = 0; i < priv->object_info_count; i++) {
+		unsigned long object_id = bebytes2ulong(priv->object_info[i].object_id);
+		unsigned long object_len = bebytes2ulong(priv->object_info[i].object_length);
+
+		/* TODO also look at the ACL... */
+
 		/* the combined object is a single object that can store the other objects.
 		 * most coolkeys provisioned by TPS has a single combined object that is
 		 * compressed greatly increasing the effectiveness of compress (since lots
@@ -2190,42 +2559,64 @@ static int coolkey_initialize(sc_card_t *card)
 		 * process it separately so that we can have both combined objects managed
 		 * by TPS and user managed certs on the same token */
 		if (object_id == COOLKEY_COMBINED_OBJECT_ID) {
-			u8 *object = malloc(object_len);
-			if (object == NULL) {
-				r = SC_ERROR_OUT_OF_MEMORY;
-				break;
+			u8 *object = NULL;
+			size_t object_read_len;
+
+			if (cached_data[i] != NULL && cached_len[i] <= object_len) {
+				object_read_len = cached_len[i];
+				object = malloc(object_read_len);
+				if (object == NULL) {
+					r = SC_ERROR_OUT_OF_MEMORY;
+					goto cleanup;
+				}
+				memcpy(object, cached_data[i], object_read_len);
+			} else {
+				object = malloc(object_len);
+				if (object == NULL) {
+					r = SC_ERROR_OUT_OF_MEMORY;
+					goto cleanup;
+				}
+				r = coolkey_read_object(card, COOLKEY_COMBINED_OBJECT_ID, 0, object, object_len,
+					priv->nonce, sizeof(priv->nonce));
+				if (r < 0) {
+					free(object);
+					goto cleanup;
+				}
+				object_read_len = r;
+				coolkey_cache_object_read(priv, object_id);
 			}
-			r = coolkey_read_object(card, COOLKEY_COMBINED_OBJECT_ID, 0, object, object_len,
-				priv->nonce, sizeof(priv->nonce));
-			if (r < 0) {
+			r = coolkey_process_combined_object(card, priv, object, object_read_len);
+			if (r != SC_SUCCESS) {
 				free(object);
-				break;
+				goto cleanup;
 			}
-			r = coolkey_process_combined_object(card, priv, object, r);
-			free(object);
-			if (r != SC_SUCCESS) {
-				break;
+			/* keep the raw object around to be able to write the cache */
+			if (priv->use_cache && coolkey_object_info_is_public(&priv->object_info[i])) {
+				free(priv->combined_object);
+				priv->combined_object = object;
+				priv->combined_object_length = object_read_len;
+			} else {
+				free(object);
 			}
 			combined_processed = 1;
 		} else {
-			sc_log(card->ctx, "Add new object id=%ld, len=%lu", object_id, object_len);
-			r = coolkey_add_object(priv, object_id, NULL, object_len, 0);
+			const u8 *object_data = NULL;
+
+			if (cached_data[i] != NULL && cached_len[i] == object_len)
+				object_data = cached_data[i];
+			sc_log(card->ctx, "Add new object id=%ld, len=%lu%s", object_id, object_len,
+				object_data ? " (cached)" : "");
+			r = coolkey_add_object(priv, object_id, object_data, object_len, 0);
 			if (r != SC_SUCCESS)
 				sc_log(card->ctx, "coolkey_add_object() returned %d", r);
 		}
-
-		/* Read next object: error is handled on the cycle condition and below after cycle */
-		r = coolkey_list_object(card, COOLKEY_LIST_NEXT, &object_info);
-	}
-	if (r != SC_ERROR_FILE_END_REACHED) {
-		/* This means the card does not cooperate at all: bail out */
-		if (r >= 0) {
-			r = SC_ERROR_INVALID_CARD;
-		}
-		goto cleanup;
 	}
+
 	/* if we didn't pull the cuid from the combined object, then grab it now */
-	if (!combined_processed) {
+	if (!combined_processed && priv->use_cache) {
+		/* the CPLC was already read when loading the cache */
+		priv->cuid = priv->cache_cuid;
+	} else if (!combined_processed) {
 		global_platform_cplc_data_t cplc_data;
 		/* select the card manager, because a card with applet only will have
 		   already selected the coolkey applet */
@@ -2240,6 +2631,8 @@ static int coolkey_initialize(sc_card_t *card)
 			goto cleanup;
 		}
 		coolkey_make_cuid_from_cplc(&priv->cuid, &cplc_data);
+	}
+	if (!combined_processed) {
 		priv->token_name = (u8 *)strdup("COOLKEY");
 		if (priv->token_name == NULL) {
 			r = SC_ERROR_OUT_OF_MEMORY;
@@ -2247,10 +2640,16 @@ static int coolkey_initialize(sc_card_t *card)
 		}
 		priv->token_name_length = sizeof("COOLKEY")-1;
 	}
+	free(cache);
+	free(cached_data);
+	free(cached_len);
 	card->drv_data = priv;
 	LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
 
 cleanup:
+	free(cache);
+	free(cached_data);
+	free(cached_len);
 	if (priv) {
 		coolkey_free_private_data(priv);
 	}
@@ -68,6 +68,7 @@ extern int dnie_read_file(
 #define DNIE_CHIP_NAME "DNIe: Spanish eID card"
 #define DNIE_CHIP_SHORTNAME "dnie"
 #define DNIE_MF_NAME "Master.File"
+#define DNIE_CACHE_VERSION 1
 
 /* default user consent program (if required) */
 #define USER_CONSENT_CMD "/usr/bin/pinentry"
@@ -876,6 +877,7 @@ static int dnie_init(struct sc_card *card)
 	init_flags(card);
 
 	GET_DNIE_PRIV_DATA(card)->cwa_provider = provider;
+	GET_DNIE_PRIV_DATA(card)->use_cache = sc_card_cache_enabled(card);
 
 	LOG_FUNC_RETURN(card->ctx, res);
 }
@@ -967,6 +969,156 @@ static u8 *dnie_uncompress(sc_card_t * card, u8 * from, size_t *len)
 	return upt;
 }
 
+/**
+ * Compose the name of the file cache entry of the selected file.
+ *
+ * Decompressed files are kept in the file cache under the card serial
+ * number, so later sessions do not need to read them through the card.
+ *
+ * @param card pointer to card structure
+ * @param serial where to store the card serial number
+ * @param name where to store the entry name
+ * @param namelen size of the name buffer
+ * @return SC_SUCCESS if ok; else error code
+ */
+static int dnie_cache_entry(sc_card_t * card, sc_serial_number_t * serial,
+			    char *name, size_t namelen)
+{
+	dnie_private_data_t *priv = GET_DNIE_PRIV_DATA(card);
+	sc_path_t *path = &priv->cache_path;
+	int res;
+
+	if (!priv->use_cache || path->len == 0)
+		return SC_ERROR_NOT_SUPPORTED;
+	if (namelen < sizeof("file_") + path->len * 2)
+		return SC_ERROR_BUFFER_TOO_SMALL;
+	res = dnie_get_serialnr(card, serial);
+	if (res != SC_SUCCESS)
+		return res;
+	strcpy(name, "file_");
+	return sc_bin_to_hex(path->value, path->len, name + 5, namelen - 5, 0);
+}
+
+/**
+ * Fill the read_binary() cache from the file cache.
+ *
+ * An entry holds the format version, the length of the FCI and the FCI
+ * returned when the file was selected, followed by the decompressed data.
+ *
+ * @param card Pointer to card structure
+ * @param file_out where to store the cached FCI information, if not NULL
+ * @return SC_SUCCESS if the selected file was found in the file cache; else error code
+ */
+static int dnie_read_cached_file(sc_card_t * card, sc_file_t ** file_out)
+{
+	dnie_private_data_t *priv = GET_DNIE_PRIV_DATA(card);
+	sc_serial_number_t serial;
+	sc_file_t *file = NULL;
+	char name[80];
+	u8 *data = NULL;
+	size_t len = 0, fci_len;
+	int res;
+
+	res = dnie_cache_entry(card, &serial, name, sizeof(name));
+	if (res != SC_SUCCESS)
+		return res;
+	res = sc_card_cache_read(card, serial.value, serial.len, name, &data, &len);
+	if (res != SC_SUCCESS)
+		return res;
+	if (len < 2 || data[0] != DNIE_CACHE_VERSION || (fci_len = data[1]) == 0
+	    || len - 2 <= fci_len) {
+		sc_log(card->ctx, "%s in the file cache is not valid", name);
+		free(data);
+		return SC_ERROR_CORRUPTED_DATA;
+	}
+	if (file_out) {
+		file = sc_file_new();
+		if (file == NULL) {
+			free(data);
+			return SC_ERROR_OUT_OF_MEMORY;
+		}
+		res = card->ops->process_fci(card, file, data + 2, fci_len);
+		if (res != SC_SUCCESS) {
+			sc_file_free(file);
+			free(data);
+			return res;
+		}
+	}
+	dnie_clear_cache(priv);
+	memcpy(priv->fci, data + 2, fci_len);
+	priv->fci_len = fci_len;
+	len -= 2 + fci_len;
+	memmove(data, data + 2 + fci_len, len);
+	priv->cache = data;
+	priv->cachelen = len;
+	if (file_out) {
+		sc_file_free(*file_out);
+		*file_out = file;
+	}
+	sc_log(card->ctx, "%s read from the file cache", name);
+	return SC_SUCCESS;
+}
+
+/**
+ * Store the decompressed content of the selected file in the file cache.
+ *
+ * Only files selected with their FCI are stored, so the entry can later
+ * answer the select without sending it to the card.
+ *
+ * @param card Pointer to card structure
+ */
+static void dnie_cache_file(sc_card_t * card)
+{
+	dnie_private_data_t *priv = GET_DNIE_PRIV_DATA(card);
+	sc_serial_number_t serial;
+	char name[80];
+	u8 *data;
+	int res;
+
+	if (priv->fci_len == 0)
+		return;
+	res = dnie_cache_entry(card, &serial, name, sizeof(name));
+	if (res != SC_SUCCESS)
+		return;
+	data = malloc(2 + priv->fci_len + priv->cachelen);
+	if (data == NULL)
+		return;
+	data[0] = DNIE_CACHE_VERSION;
+	data[1] = (u8) priv->fci_len;
+	memcpy(data + 2, priv->fci, priv->fci_len);
+	memcpy(data + 2 + priv->fci_len, priv->cache, priv->cachelen);
+	res = sc_card_cache_write(card, serial.value, serial.len, name,
+			data, 2 + priv->fci_len + priv->cachelen);
+	if (res != SC_SUCCESS)
+		sc_log(card->ctx, "Cannot store the file in the file cache: %d", res);
+	free(data);
+}
+
+/**
+ * Select the DF of a file that was served from the file cache.
+ *
+ * A file found in the file cache is not selected on the card, so the
+ * card still has the previous selection. Operations that depend on the
+ * current DF select it on the card first.
+ *
+ * @param card Pointer to card structure
+ * @return SC_SUCCESS if ok; else error code
+ */
+static int dnie_sync_selection(sc_card_t * card)
+{
+	dnie_private_data_t *priv = GET_DNIE_PRIV_DATA(card);
+	sc_path_t df;
+
+	if (!priv->cache_selected)
+		return SC_SUCCESS;
+	priv->cache_selected = 0;
+	df = priv->cache_path;
+	df.len -= 2;
+	if (df.len == 0)
+		return SC_SUCCESS;
+	return card->ops->select_file(card, &df, NULL);
+}
+
 /**
  * Fill file cache for read_binary() operation.
  *
@@ -1084,6 +1236,9 @@ static int dnie_fill_cache(sc_card_t * card)
 	/* ok: as final step, set correct cache data into dnie_priv structures */
 	GET_DNIE_PRIV_DATA(card)->cache = pt;
 	GET_DNIE_PRIV_DATA(card)->cachelen = len;
+	/* only compressed files (the certificates) are worth keeping on disk */
+	if (pt != buffer)
+		dnie_cache_file(card);
 	sc_log(ctx,
 	       "fill_cache() done. length '%"SC_FORMAT_LEN_SIZE_T"u' bytes",
 	       len);
@@ -1115,9 +1270,13 @@ static int dnie_read_binary(struct sc_card *card,
 	ctx = card->ctx;
 
 	LOG_FUNC_CALLED(ctx);
-	if (idx == 0 || GET_DNIE_PRIV_DATA(card)->cache == NULL) {
+	/* a file served from the file cache already has its data in the cache */
+	if (!GET_DNIE_PRIV_DATA(card)->cache_selected
+	    && (idx == 0 || GET_DNIE_PRIV_DATA(card)->cache == NULL)) {
 		/* on first block or no cache, try to fill */
-		res = dnie_fill_cache(card);
+		res = dnie_read_cached_file(card, NULL);
+		if (res != SC_SUCCESS)
+			res = dnie_fill_cache(card);
 		if (res < 0) {
 			sc_log(ctx, "Cannot fill cache. using iso_read_binary()");
 			return iso_ops->read_binary(card, idx, buf, count, flags);
@@ -1191,6 +1350,11 @@ static int dnie_compose_and_send_apdu(sc_card_t *card, const u8 *path, size_t pa
 			LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
 		}
 		res = card->ops->process_fci(card, *file_out, apdu.resp + 2, apdu.resp[1]);
+		/* keep the FCI of the selected file for the file cache */
+		if (res == SC_SUCCESS && card->drv_data && apdu.resp[1] <= apdu.resplen - 2) {
+			memcpy(GET_DNIE_PRIV_DATA(card)->fci, apdu.resp + 2, apdu.resp[1]);
+			GET_DNIE_PRIV_DATA(card)->fci_len = apdu.resp[1];
+		}
 	}
 	LOG_FUNC_RETURN(ctx, res);
 }
@@ -1237,6 +1401,14 @@ static int dnie_select_file(struct sc_card *card,
 
 	LOG_FUNC_CALLED(ctx);
 
+	/* relative selections start from the DF the card really has selected */
+	if (in_path->type == SC_PATH_TYPE_FILE_ID || in_path->type == SC_PATH_TYPE_PARENT) {
+		res = dnie_sync_selection(card);
+		LOG_TEST_RET(ctx, res, "Cannot select the current DF");
+	}
+	GET_DNIE_PRIV_DATA(card)->cache_selected = 0;
+	GET_DNIE_PRIV_DATA(card)->fci_len = 0;
+
 	switch (in_path->type) {
 	case SC_PATH_TYPE_FILE_ID:
 		/* pathlen must be of len=2 */
@@ -1263,6 +1435,14 @@ static int dnie_select_file(struct sc_card *card,
 
 		sc_log_hex(ctx, "select_file(PATH): requested", in_path->value, in_path->len);
 
+		/* files in the file cache are served without any APDU */
+		GET_DNIE_PRIV_DATA(card)->cache_path = *in_path;
+		if (dnie_read_cached_file(card, file_out) == SC_SUCCESS) {
+			GET_DNIE_PRIV_DATA(card)->cache_selected = 1;
+			LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+		}
+		GET_DNIE_PRIV_DATA(card)->cache_path.len = 0;
+
 		/* convert to SC_PATH_TYPE_FILE_ID */
 		res = sc_lock(card); /* lock to ensure path traversal */
 		LOG_TEST_RET(ctx, res, "sc_lock() failed");
@@ -1314,6 +1494,11 @@ static int dnie_select_file(struct sc_card *card,
 
 	/* as last step clear data cache and return */
 	dnie_clear_cache(GET_DNIE_PRIV_DATA(card));
+	/* only absolute paths identify the file for the file cache */
+	if (res == SC_SUCCESS && in_path->type == SC_PATH_TYPE_PATH)
+		GET_DNIE_PRIV_DATA(card)->cache_path = *in_path;
+	else
+		GET_DNIE_PRIV_DATA(card)->cache_path.len = 0;
 	LOG_FUNC_RETURN(ctx, res);
 }
 
@@ -1711,6 +1896,8 @@ static int dnie_list_files(sc_card_t * card, u8 * buf, size_t buflen)
 	LOG_FUNC_CALLED(card->ctx);
 	if (!buf || (buflen < 2))
 		LOG_FUNC_RETURN(card->ctx, SC_ERROR_INVALID_ARGUMENTS);
+	res = dnie_sync_selection(card);
+	LOG_TEST_RET(card->ctx, res, "Cannot select the current DF");
 
 	/* compose select_file(ID) command */
 	dnie_format_apdu(card, &apdu, SC_APDU_CASE_4_SHORT, 0xA4, 0x00, 0x00, 0, 2,
@@ -1831,6 +2018,9 @@ static int dnie_card_ctl(struct sc_card *card,
 		}
 		*(int *)data = result;
 		LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
+	case SC_CARDCTL_READ_SERIALNR:
+		memset(&card->serialnr, 0, sizeof(card->serialnr));
+		/* fall through */
 		/* call card to obtain serial number */
 	case SC_CARDCTL_GET_SERIALNR:
 		result = dnie_get_serialnr(card, (sc_serial_number_t *) data);
@@ -78,6 +78,9 @@ static unsigned char PIN_ID[2] = { ENTERSAFE_USER_PIN_ID, ENTERSAFE_SO_PIN_ID };
 #define SM_PLAIN				0x00
 #define SM_SCP01				0x01
 
+/* size of the scratch buffers used to wrap and unwrap SM APDUs */
+#define SM_BUF_SIZE				4096
+
 static unsigned char g_init_key_enc[16] = {
 	0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C,
 	0x0D, 0x0E, 0x0F, 0x10
@@ -100,6 +103,21 @@ typedef struct epass2003_exdata_st {
 	unsigned char icv_mac[16];	/* instruction counter vector(for sm) */
 	unsigned char currAlg;		/* current Alg */
 	unsigned int  ecAlgFlags; 	/* Ec Alg mechanism type*/
+	/* cipher contexts keyed with the session keys, only the IV is set per APDU */
+	EVP_CIPHER_CTX *sm_enc_ctx;	/* encrypt with sk_enc */
+	EVP_CIPHER_CTX *sm_dec_ctx;	/* decrypt with sk_enc */
+	EVP_CIPHER_CTX *sm_mac_ctx;	/* encrypt with sk_mac (first half for DES) */
+	EVP_CIPHER_CTX *sm_mac2_ctx;	/* decrypt with second half of sk_mac (DES only) */
+	/* scratch buffers reused for every SM APDU */
+	unsigned char sm_buf[SM_BUF_SIZE];	/* APDU buffer */
+	unsigned char sm_data[SM_BUF_SIZE];	/* padded or decrypted data */
+	unsigned char sm_mac[SM_BUF_SIZE];	/* MAC calculation */
+	unsigned char sm_tlv[SM_BUF_SIZE];	/* encrypted data TLV */
+	/* wrapped APDU handed out by epass2003_sm_get_wrapped_apdu */
+	struct sc_apdu sm_apdu;
+	int sm_apdu_busy;
+	unsigned char sm_apdu_data[SC_MAX_EXT_APDU_BUFFER_SIZE];
+	unsigned char sm_apdu_resp[SC_MAX_EXT_APDU_BUFFER_SIZE];
 } epass2003_exdata;
 
 #define REVERSE_ORDER4(x)	(			  \
@@ -413,6 +431,95 @@ sha256_digest(const unsigned char *input, size_t length, unsigned char *output)
 }
 
 
+static void
+sm_free_ctx(epass2003_exdata *exdata)
+{
+	EVP_CIPHER_CTX_free(exdata->sm_enc_ctx);
+	EVP_CIPHER_CTX_free(exdata->sm_dec_ctx);
+	EVP_CIPHER_CTX_free(exdata->sm_mac_ctx);
+	EVP_CIPHER_CTX_free(exdata->sm_mac2_ctx);
+	exdata->sm_enc_ctx = NULL;
+	exdata->sm_dec_ctx = NULL;
+	exdata->sm_mac_ctx = NULL;
+	exdata->sm_mac2_ctx = NULL;
+}
+
+
+/* Key the SM cipher contexts with the current session keys. If this fails,
+ * the SM code falls back to one-shot cipher operations. */
+static int
+sm_init_ctx(epass2003_exdata *exdata)
+{
+	int r = SC_ERROR_INTERNAL;
+	unsigned char bKey[24] = { 0 };
+	const EVP_CIPHER *enc_cipher, *mac_cipher;
+	const unsigned char *enc_key;
+
+	if (KEY_TYPE_AES == exdata->smtype) {
+		enc_cipher = EVP_aes_128_cbc();
+		enc_key = exdata->sk_enc;
+		mac_cipher = EVP_aes_128_cbc();
+	}
+	else {
+		memcpy(&bKey[0], exdata->sk_enc, 16);
+		memcpy(&bKey[16], exdata->sk_enc, 8);
+		enc_cipher = EVP_des_ede3_cbc();
+		enc_key = bKey;
+		mac_cipher = EVP_des_cbc();
+	}
+
+	if (!exdata->sm_enc_ctx)
+		exdata->sm_enc_ctx = EVP_CIPHER_CTX_new();
+	if (!exdata->sm_dec_ctx)
+		exdata->sm_dec_ctx = EVP_CIPHER_CTX_new();
+	if (!exdata->sm_mac_ctx)
+		exdata->sm_mac_ctx = EVP_CIPHER_CTX_new();
+	if (!exdata->sm_mac2_ctx && KEY_TYPE_AES != exdata->smtype)
+		exdata->sm_mac2_ctx = EVP_CIPHER_CTX_new();
+	if (!exdata->sm_enc_ctx || !exdata->sm_dec_ctx || !exdata->sm_mac_ctx
+			|| (!exdata->sm_mac2_ctx && KEY_TYPE_AES != exdata->smtype))
+		goto out;
+
+	if (!EVP_EncryptInit_ex(exdata->sm_enc_ctx, enc_cipher, NULL, enc_key, NULL)
+			|| !EVP_DecryptInit_ex(exdata->sm_dec_ctx, enc_cipher, NULL, enc_key, NULL)
+			|| !EVP_EncryptInit_ex(exdata->sm_mac_ctx, mac_cipher, NULL, exdata->sk_mac, NULL))
+		goto out;
+
+	if (exdata->sm_mac2_ctx
+			&& !EVP_DecryptInit_ex(exdata->sm_mac2_ctx, mac_cipher, NULL, &exdata->sk_mac[8], NULL))
+		goto out;
+
+	r = SC_SUCCESS;
+out:
+	if (r != SC_SUCCESS)
+		sm_free_ctx(exdata);
+	sc_mem_clear(bKey, sizeof(bKey));
+	return r;
+}
+
+
+/* CBC operation with a keyed context from sm_init_ctx() and a fresh IV */
+static int
+sm_cipher(EVP_CIPHER_CTX *ctx, const unsigned char *iv,
+		const unsigned char *input, size_t length, unsigned char *output)
+{
+	int outl = 0;
+	int outl_tmp = 0;
+
+	if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, -1))
+		return SC_ERROR_INTERNAL;
+	EVP_CIPHER_CTX_set_padding(ctx, 0);
+
+	if (!EVP_CipherUpdate(ctx, output, &outl, input, length))
+		return SC_ERROR_INTERNAL;
+
+	if (!EVP_CipherFinal_ex(ctx, output + outl, &outl_tmp))
+		return SC_ERROR_INTERNAL;
+
+	return SC_SUCCESS;
+}
+
+
 static int
 gen_init_key(struct sc_card *card, unsigned char *key_enc, unsigned char *key_mac,
 		unsigned char *result, unsigned char key_type)
@@ -465,6 +572,9 @@ gen_init_key(struct sc_card *card, unsigned char *key_enc, unsigned char *key_ma
 		des3_encrypt_ecb(key_mac, 16, data, 16, exdata->sk_mac);
 	}
 
+	if (SC_SUCCESS != sm_init_ctx(exdata))
+		sc_log(card->ctx, "Failed to set up SM cipher contexts, using one-shot operations");
+
 	memcpy(data, g_random, 8);
 	memcpy(&data[8], &result[12], 8);
 	data[16] = 0x80;
@@ -613,25 +723,30 @@ construct_data_tlv(struct sc_card *card, struct sc_apdu *apdu, unsigned char *ap
 		unsigned char *data_tlv, size_t * data_tlv_len, const unsigned char key_type)
 {
 	size_t block_size = (KEY_TYPE_AES == key_type ? 16 : 8);
-	unsigned char pad[4096] = { 0 };
+	unsigned char *pad;
 	size_t pad_len;
 	size_t tlv_more;	/* increased tlv length */
 	unsigned char iv[16] = { 0 };
 	epass2003_exdata *exdata = NULL;
+	int r;
 
 	if (!card->drv_data) 
 		return SC_ERROR_INVALID_ARGUMENTS;
 
 	exdata = (epass2003_exdata *)card->drv_data;
+	pad = exdata->sm_data;
 
 	/* padding */
 	apdu_buf[block_size] = 0x87;
-	memcpy(pad, apdu->data, apdu->lc);
-	pad[apdu->lc] = 0x80;
 	if ((apdu->lc + 1) % block_size)
 		pad_len = ((apdu->lc + 1) / block_size + 1) * block_size;
 	else
 		pad_len = apdu->lc + 1;
+	if (pad_len > SM_BUF_SIZE)
+		return SC_ERROR_INVALID_ARGUMENTS;
+	memcpy(pad, apdu->data, apdu->lc);
+	pad[apdu->lc] = 0x80;
+	memset(pad + apdu->lc + 1, 0, pad_len - apdu->lc - 1);
 
 	/* encode Lc' */
 	if (pad_len > 0x7E) {
@@ -650,13 +765,20 @@ construct_data_tlv(struct sc_card *card, struct sc_apdu *apdu, unsigned char *ap
 	memcpy(data_tlv, &apdu_buf[block_size], tlv_more);
 
 	/* encrypt Data */
-	if (KEY_TYPE_AES == key_type)
-		aes128_encrypt_cbc(exdata->sk_enc, 16, iv, pad, pad_len, apdu_buf + block_size + tlv_more);
+	if (exdata->sm_enc_ctx)
+		r = sm_cipher(exdata->sm_enc_ctx, iv, pad, pad_len, apdu_buf + block_size + tlv_more);
+	else if (KEY_TYPE_AES == key_type)
+		r = aes128_encrypt_cbc(exdata->sk_enc, 16, iv, pad, pad_len, apdu_buf + block_size + tlv_more);
 	else
-		des3_encrypt_cbc(exdata->sk_enc, 16, iv, pad, pad_len, apdu_buf + block_size + tlv_more);
+		r = des3_encrypt_cbc(exdata->sk_enc, 16, iv, pad, pad_len, apdu_buf + block_size + tlv_more);
+	if (r != SC_SUCCESS) {
+		sc_mem_clear(pad, pad_len);
+		return r;
+	}
 
 	memcpy(data_tlv + tlv_more, apdu_buf + block_size + tlv_more, pad_len);
 	*data_tlv_len = tlv_more + pad_len;
+	sc_mem_clear(pad, pad_len);
 	return 0;
 }
 
@@ -693,16 +815,18 @@ construct_mac_tlv(struct sc_card *card, unsigned char *apdu_buf, size_t data_tlv
 		unsigned char *mac_tlv, size_t * mac_tlv_len, const unsigned char key_type)
 {
 	size_t block_size = (KEY_TYPE_AES == key_type ? 16 : 8);
-	unsigned char mac[4096] = { 0 };
+	unsigned char *mac;
 	size_t mac_len;
 	unsigned char icv[16] = { 0 };
 	int i = (KEY_TYPE_AES == key_type ? 15 : 7);
 	epass2003_exdata *exdata = NULL;
+	int r;
 
 	if (!card->drv_data) 
 		return SC_ERROR_INVALID_ARGUMENTS;
 
 	exdata = (epass2003_exdata *)card->drv_data;
+	mac = exdata->sm_mac;
 
 	if (0 == data_tlv_len && 0 == le_tlv_len) {
 		mac_len = block_size;
@@ -735,18 +859,37 @@ construct_mac_tlv(struct sc_card *card, unsigned char *apdu_buf, size_t data_tlv
 	/* calculate MAC */
 	memset(icv, 0, sizeof(icv));
 	memcpy(icv, exdata->icv_mac, 16);
-	if (KEY_TYPE_AES == key_type) {
-		aes128_encrypt_cbc(exdata->sk_mac, 16, icv, apdu_buf, mac_len, mac);
-		memcpy(mac_tlv + 2, &mac[mac_len - 16], 8);
+	if (exdata->sm_mac_ctx && KEY_TYPE_AES == key_type) {
+		r = sm_cipher(exdata->sm_mac_ctx, icv, apdu_buf, mac_len, mac);
+		if (r == SC_SUCCESS)
+			memcpy(mac_tlv + 2, &mac[mac_len - 16], 8);
+	}
+	else if (exdata->sm_mac_ctx) {
+		unsigned char iv[EVP_MAX_IV_LENGTH] = { 0 };
+		unsigned char tmp[8] = { 0 };
+		r = sm_cipher(exdata->sm_mac_ctx, icv, apdu_buf, mac_len, mac);
+		if (r == SC_SUCCESS)
+			r = sm_cipher(exdata->sm_mac2_ctx, iv, &mac[mac_len - 8], 8, tmp);
+		if (r == SC_SUCCESS)
+			r = sm_cipher(exdata->sm_mac_ctx, iv, tmp, 8, mac_tlv + 2);
+	}
+	else if (KEY_TYPE_AES == key_type) {
+		r = aes128_encrypt_cbc(exdata->sk_mac, 16, icv, apdu_buf, mac_len, mac);
+		if (r == SC_SUCCESS)
+			memcpy(mac_tlv + 2, &mac[mac_len - 16], 8);
 	}
 	else {
 		unsigned char iv[EVP_MAX_IV_LENGTH] = { 0 };
 		unsigned char tmp[8] = { 0 };
-		des_encrypt_cbc(exdata->sk_mac, 8, icv, apdu_buf, mac_len, mac);
-		des_decrypt_cbc(&exdata->sk_mac[8], 8, iv, &mac[mac_len - 8], 8, tmp);
+		r = des_encrypt_cbc(exdata->sk_mac, 8, icv, apdu_buf, mac_len, mac);
+		if (r == SC_SUCCESS)
+			r = des_decrypt_cbc(&exdata->sk_mac[8], 8, iv, &mac[mac_len - 8], 8, tmp);
 		memset(iv, 0x00, sizeof iv);
-		des_encrypt_cbc(exdata->sk_mac, 8, iv, tmp, 8, mac_tlv + 2);
+		if (r == SC_SUCCESS)
+			r = des_encrypt_cbc(exdata->sk_mac, 8, iv, tmp, 8, mac_tlv + 2);
 	}
+	if (r != SC_SUCCESS)
+		return r;
 
 	*mac_tlv_len = 2 + 8;
 	return 0;
@@ -765,7 +908,7 @@ encode_apdu(struct sc_card *card, struct sc_apdu *plain, struct sc_apdu *sm,
 		unsigned char *apdu_buf, size_t * apdu_buf_len)
 {
 	size_t block_size = 0;
-	unsigned char dataTLV[4096] = { 0 };
+	unsigned char *dataTLV;
 	size_t data_tlv_len = 0;
 	unsigned char le_tlv[256] = { 0 };
 	size_t le_tlv_len = 0;
@@ -781,6 +924,7 @@ encode_apdu(struct sc_card *card, struct sc_apdu *plain, struct sc_apdu *sm,
 	if (!card->drv_data) 
 		return SC_ERROR_INVALID_ARGUMENTS;
 	exdata = (epass2003_exdata*)card->drv_data;
+	dataTLV = exdata->sm_tlv;
 	block_size = (KEY_TYPE_DES == exdata->smtype ? 16 : 8);
 
 	sm->cse = SC_APDU_CASE_4_SHORT;
@@ -806,7 +950,8 @@ encode_apdu(struct sc_card *card, struct sc_apdu *plain, struct sc_apdu *sm,
 	if (0 != construct_mac_tlv(card, apdu_buf, data_tlv_len, le_tlv_len, mac_tlv, &mac_tlv_len, exdata->smtype))
 		return -1;
 
-	memset(apdu_buf + 4, 0, *apdu_buf_len - 4);
+	/* clear what the MAC calculation used, the rest of the buffer is untouched */
+	memset(apdu_buf + 4, 0, MIN(*apdu_buf_len, 3 * 16 + data_tlv_len + le_tlv_len) - 4);
 	sm->lc = sm->datalen = data_tlv_len + le_tlv_len + mac_tlv_len;
 	if (sm->lc > 0xFF) {
 		sm->cse = SC_APDU_CASE_4_EXT;
@@ -846,14 +991,15 @@ encode_apdu(struct sc_card *card, struct sc_apdu *plain, struct sc_apdu *sm,
 static int
 epass2003_sm_wrap_apdu(struct sc_card *card, struct sc_apdu *plain, struct sc_apdu *sm)
 {
-	unsigned char buf[4096] = { 0 };	/* APDU buffer */
-	size_t buf_len = sizeof(buf);
+	unsigned char *buf;	/* APDU buffer */
+	size_t buf_len = SM_BUF_SIZE;
 	epass2003_exdata *exdata = NULL;
 	
 	if (!card->drv_data) 
 		return SC_ERROR_INVALID_ARGUMENTS;
 	
 	exdata = (epass2003_exdata *)card->drv_data;
+	buf = exdata->sm_buf;
 
 	LOG_FUNC_CALLED(card->ctx);
 
@@ -868,7 +1014,8 @@ epass2003_sm_wrap_apdu(struct sc_card *card, struct sc_apdu *plain, struct sc_ap
 	sm->lc = plain->lc;
 	sm->le = plain->le;
 	sm->control = plain->control;
-	sm->flags = plain->flags;
+	/* the SM response buffer is not the buffer of the plain APDU */
+	sm->flags = plain->flags & ~SC_APDU_FLAGS_RESP_IN_PLACE;
 
 	switch (sm->cla & 0x0C) {
 	case 0x00:
@@ -879,7 +1026,7 @@ epass2003_sm_wrap_apdu(struct sc_card *card, struct sc_apdu *plain, struct sc_ap
 		memcpy(sm->resp, plain->resp, plain->resplen);
 		break;
 	case 0x0C:
-		memset(buf, 0, sizeof(buf));
+		memset(buf, 0, 16);
 		if (0 != encode_apdu(card, plain, sm, buf, &buf_len))
 			return SC_ERROR_CARD_CMD_FAILED;
 		break;
@@ -908,13 +1055,15 @@ decrypt_response(struct sc_card *card, unsigned char *in, size_t inlen, unsigned
 	size_t cipher_len;
 	size_t i;
 	unsigned char iv[16] = { 0 };
-	unsigned char plaintext[4096] = { 0 };
+	unsigned char *plaintext;
 	epass2003_exdata *exdata = NULL;
+	int r;
 
 	if (!card->drv_data) 
 		return SC_ERROR_INVALID_ARGUMENTS;
 
 	exdata = (epass2003_exdata *)card->drv_data;
+	plaintext = exdata->sm_data;
 
 	/* no cipher */
 	if (in[0] == 0x99)
@@ -938,14 +1087,20 @@ decrypt_response(struct sc_card *card, unsigned char *in, size_t inlen, unsigned
 		return -1;
 	}
 
-	if (cipher_len < 2 || i+cipher_len > inlen || cipher_len > sizeof plaintext)
+	if (cipher_len < 2 || i+cipher_len > inlen || cipher_len > SM_BUF_SIZE)
 		return -1;
 
 	/* decrypt */
-	if (KEY_TYPE_AES == exdata->smtype)
-		aes128_decrypt_cbc(exdata->sk_enc, 16, iv, &in[i], cipher_len - 1, plaintext);
+	if (exdata->sm_dec_ctx)
+		r = sm_cipher(exdata->sm_dec_ctx, iv, &in[i], cipher_len - 1, plaintext);
+	else if (KEY_TYPE_AES == exdata->smtype)
+		r = aes128_decrypt_cbc(exdata->sk_enc, 16, iv, &in[i], cipher_len - 1, plaintext);
 	else
-		des3_decrypt_cbc(exdata->sk_enc, 16, iv, &in[i], cipher_len - 1, plaintext);
+		r = des3_decrypt_cbc(exdata->sk_enc, 16, iv, &in[i], cipher_len - 1, plaintext);
+	if (r != SC_SUCCESS) {
+		sc_mem_clear(plaintext, cipher_len);
+		return r;
+	}
 
 	/* unpadding */
 	while (0x80 != plaintext[cipher_len - 2] && (cipher_len > 2))
@@ -956,6 +1111,7 @@ decrypt_response(struct sc_card *card, unsigned char *in, size_t inlen, unsigned
 
 	memcpy(out, plaintext, cipher_len - 2);
 	*out_len = cipher_len - 2;
+	sc_mem_clear(plaintext, cipher_len);
 	return 0;
 }
 
@@ -1003,6 +1159,7 @@ epass2003_sm_free_wrapped_apdu(struct sc_card *card,
 		struct sc_apdu *plain, struct sc_apdu **sm_apdu)
 {
 	struct sc_context *ctx = card->ctx;
+	epass2003_exdata *exdata = (epass2003_exdata *)card->drv_data;
 	int rv = SC_SUCCESS;
 
 	LOG_FUNC_CALLED(ctx);
@@ -1015,6 +1172,12 @@ epass2003_sm_free_wrapped_apdu(struct sc_card *card,
 	if (plain)
 		rv = epass2003_sm_unwrap_apdu(card, *sm_apdu, plain);
 
+	if (exdata && *sm_apdu == &exdata->sm_apdu) {
+		exdata->sm_apdu_busy = 0;
+		*sm_apdu = NULL;
+		LOG_FUNC_RETURN(ctx, rv);
+	}
+
 	if ((*sm_apdu)->data) {
 		unsigned char * p = (unsigned char *)((*sm_apdu)->data);
 		free(p);
@@ -1035,14 +1198,36 @@ epass2003_sm_get_wrapped_apdu(struct sc_card *card,
 		struct sc_apdu *plain, struct sc_apdu **sm_apdu)
 {
 	struct sc_context *ctx = card->ctx;
+	epass2003_exdata *exdata = (epass2003_exdata *)card->drv_data;
 	struct sc_apdu *apdu = NULL;
 	int rv;
 
 	LOG_FUNC_CALLED(ctx);
-	if (!plain || !sm_apdu)
+	if (!plain || !sm_apdu || !exdata)
 		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
 
 	*sm_apdu = NULL;
+
+	/* use the preallocated SM apdu unless it is still in use */
+	if (!exdata->sm_apdu_busy) {
+		apdu = &exdata->sm_apdu;
+		memset(apdu, 0, sizeof(struct sc_apdu));
+		apdu->data = exdata->sm_apdu_data;
+		apdu->resp = exdata->sm_apdu_resp;
+		apdu->datalen = SC_MAX_EXT_APDU_BUFFER_SIZE;
+		apdu->resplen = SC_MAX_EXT_APDU_BUFFER_SIZE;
+		exdata->sm_apdu_busy = 1;
+
+		rv = epass2003_sm_wrap_apdu(card, plain, apdu);
+		if (rv) {
+			exdata->sm_apdu_busy = 0;
+			LOG_FUNC_RETURN(ctx, rv);
+		}
+
+		*sm_apdu = apdu;
+		LOG_FUNC_RETURN(ctx, rv);
+	}
+
 	//construct new SM apdu from original apdu
 	apdu = calloc(1, sizeof(struct sc_apdu));
 	if (!apdu) {
@@ -1225,8 +1410,11 @@ epass2003_finish(sc_card_t *card)
 {
 	epass2003_exdata *exdata = (epass2003_exdata *)card->drv_data;
 
-	if (exdata)
+	if (exdata) {
+		sm_free_ctx(exdata);
+		sc_mem_clear(exdata, sizeof(epass2003_exdata));
 		free(exdata);
+	}
 	return SC_SUCCESS;
 }
 
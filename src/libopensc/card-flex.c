@@ -1199,6 +1199,9 @@ static int flex_card_ctl(sc_card_t *card, unsigned long cmd, void *ptr)
 	case SC_CARDCTL_CRYPTOFLEX_GENERATE_KEY:
 		return flex_generate_key(card,
 				(struct sc_cardctl_cryptoflex_genkey_info *) ptr);
+	case SC_CARDCTL_READ_SERIALNR:
+		memset(&card->serialnr, 0, sizeof(card->serialnr));
+		/* fall through */
 	case SC_CARDCTL_GET_SERIALNR:
 		return flex_get_serialnr(card, (sc_serial_number_t *) ptr);
 	}
@@ -154,6 +154,11 @@ struct gids_private_data {
 	int state;
 	u8 buffer[SC_MAX_EXT_APDU_BUFFER_SIZE];
 	size_t buffersize;
+	int use_cache;		// keep the masterfile, cmapfile and certificates in the file cache
+	u8 cardid[16];		// identifies the card in the file cache
+	size_t cardidsize;
+	u8 cardcf[6];		// cardcf seen before the last read of a cacheable file
+	int cardcfvalid;
 };
 
 static void fixup_transceive_length(const struct sc_card *card,
@@ -355,11 +360,109 @@ static int gids_write_gidsfile_without_cache(sc_card_t* card, u8* masterfile, si
 	return r;
 }
 
+// FILE CACHE
+// the minidriver increments the freshness counters of the cardcf file when
+// something changes on the card. Like the windows minidriver cache, the files
+// kept in the file cache are tagged with the cardcf seen when they were read
+// and are used only while the cardcf of the card is the same. The cardcf is
+// read once per card lock: another process may change the card only while
+// we do not hold it.
+///////////////////////////////////////////
+
+// fetch the current cardcf; cardid and cardcf are at fixed locations so this
+// does not need the masterfile
+static int gids_cache_refresh_cardcf(sc_card_t* card) {
+	struct gids_private_data* data = (struct gids_private_data*) card->drv_data;
+	size_t size;
+	int r;
+
+	data->cardcfvalid = 0;
+	if (!data->cardidsize) {
+		size = sizeof(data->cardid);
+		r = gids_get_DO(card, CARDID_FI, CARDID_DO, data->cardid, &size);
+		if (r < 0 || size == 0) {
+			// no cardid where the minidriver puts it, do not cache anything
+			data->use_cache = 0;
+			return SC_ERROR_NOT_SUPPORTED;
+		}
+		data->cardidsize = size;
+	}
+	size = sizeof(data->cardcf);
+	r = gids_get_DO(card, CARDCF_FI, CARDCF_DO, data->cardcf, &size);
+	if (r < 0 || size != sizeof(data->cardcf)) {
+		return SC_ERROR_NOT_SUPPORTED;
+	}
+	data->cardcfvalid = 1;
+	return SC_SUCCESS;
+}
+
+// read a file from the file cache if the card did not change since it was stored
+static int gids_cache_read(sc_card_t* card, const char *name, u8* response, size_t *responselen) {
+	struct gids_private_data* data = (struct gids_private_data*) card->drv_data;
+	u8 *cached = NULL;
+	size_t cachedsize = 0;
+	int r;
+
+	if (!data->use_cache) {
+		return SC_ERROR_NOT_SUPPORTED;
+	}
+	// without the lock, the card may change between two reads
+	if (!data->cardcfvalid || card->lock_count == 0) {
+		r = gids_cache_refresh_cardcf(card);
+		if (r < 0) {
+			return r;
+		}
+	}
+	r = sc_card_cache_read(card, data->cardid, data->cardidsize, name, &cached, &cachedsize);
+	if (r < 0) {
+		return r;
+	}
+	if (cachedsize < sizeof(data->cardcf) || memcmp(cached, data->cardcf, sizeof(data->cardcf)) != 0
+			|| cachedsize - sizeof(data->cardcf) > *responselen) {
+		sc_log(card->ctx, "cached %s is outdated", name);
+		free(cached);
+		return SC_ERROR_FILE_NOT_FOUND;
+	}
+	*responselen = cachedsize - sizeof(data->cardcf);
+	memcpy(response, cached + sizeof(data->cardcf), *responselen);
+	free(cached);
+	sc_log(card->ctx, "%s read from the file cache", name);
+	return SC_SUCCESS;
+}
+
+// store a file read from the card, tagged with the cardcf seen before reading it
+static void gids_cache_write(sc_card_t* card, const char *name, const u8* buffer, size_t buffersize) {
+	struct gids_private_data* data = (struct gids_private_data*) card->drv_data;
+	u8 *cached;
+	int r;
+
+	if (!data->use_cache || !data->cardcfvalid) {
+		return;
+	}
+	cached = malloc(sizeof(data->cardcf) + buffersize);
+	if (cached == NULL) {
+		return;
+	}
+	memcpy(cached, data->cardcf, sizeof(data->cardcf));
+	memcpy(cached + sizeof(data->cardcf), buffer, buffersize);
+	r = sc_card_cache_write(card, data->cardid, data->cardidsize, name, cached, sizeof(data->cardcf) + buffersize);
+	if (r < 0) {
+		sc_log(card->ctx, "unable to cache %s: %d", name, r);
+	}
+	free(cached);
+}
+
 // read the masterfile from the card
 static int gids_read_masterfile(sc_card_t* card) {
 	struct gids_private_data* data = (struct gids_private_data*) card->drv_data;
 	int r = SC_SUCCESS;
 
+	data->masterfilesize = sizeof(data->masterfile);
+	if (gids_cache_read(card, "masterfile", data->masterfile, &data->masterfilesize) == SC_SUCCESS
+			&& data->masterfilesize >= 1 && data->masterfile[0] == 1) {
+		return SC_SUCCESS;
+	}
+
 	data->masterfilesize = sizeof(data->masterfile);
 	r = gids_get_DO(card, MF_FI, MF_DO, data->masterfile, &data->masterfilesize);
 	if (r<0) {
@@ -370,6 +473,7 @@ static int gids_read_masterfile(sc_card_t* card) {
 		data->masterfilesize = sizeof(data->masterfile);
 		LOG_FUNC_RETURN(card->ctx, SC_ERROR_INVALID_CARD);
 	}
+	gids_cache_write(card, "masterfile", data->masterfile, data->masterfilesize);
 	return r;
 }
 
@@ -395,6 +499,8 @@ static int gids_update_cardcf(sc_card_t* card, int file, int container) {
 		cardcf[2] = containerfreshness & 0xFF;
 		cardcf[3] = (containerfreshness>>8) & 0xFF;
 	}
+	// the cached files are outdated from now on
+	data->cardcfvalid = 0;
 	r = gids_write_gidsfile_without_cache(card, data->masterfile, data->masterfilesize, "", "cardcf", cardcf, 6);
 	LOG_TEST_RET(card->ctx, r, "unable to update the cardcf file");
 	return r;
@@ -449,11 +555,16 @@ static int gids_read_cmapfile(sc_card_t* card) {
 
 	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_VERBOSE);
 	data->cmapfilesize = sizeof(data->cmapfile);
+	if (gids_cache_read(card, "cmapfile", data->cmapfile, &data->cmapfilesize) == SC_SUCCESS) {
+		return SC_SUCCESS;
+	}
+	data->cmapfilesize = sizeof(data->cmapfile);
 	r = gids_read_gidsfile(card, "mscp", "cmapfile", data->cmapfile, &data->cmapfilesize);
 	if (r<0) {
 		data->cmapfilesize = sizeof(data->cmapfile);
 	}
 	LOG_TEST_RET(card->ctx, r, "unable to get the cmapfile");
+	gids_cache_write(card, "cmapfile", data->cmapfile, data->cmapfilesize);
 	return r;
 }
 
@@ -662,6 +773,7 @@ static int gids_init(sc_card_t * card)
 	// invalidate the master file and cmap file cache
 	data->cmapfilesize = sizeof(data->cmapfile);
 	data->masterfilesize = sizeof(data->masterfile);
+	data->use_cache = sc_card_cache_enabled(card);
 
 	/* supported RSA keys and how padding is done */
 	flags = SC_ALGORITHM_RSA_PAD_PKCS1 | SC_ALGORITHM_RSA_HASH_NONE | SC_ALGORITHM_ONBOARD_KEY_GEN;
@@ -1059,10 +1171,19 @@ static int gids_read_binary(sc_card_t *card, unsigned int offset,
 	if (! data->currentDO || ! data->currentEFID) {
 		LOG_FUNC_RETURN(ctx, SC_ERROR_INTERNAL);
 	}
+	if (data->state != GIDS_STATE_READ_DATA_PRESENT) {
+		char cachename[20];
+		snprintf(cachename, sizeof(cachename), "cert_%04X%04X", data->currentEFID, data->currentDO);
+		data->buffersize = sizeof(data->buffer);
+		if (gids_cache_read(card, cachename, data->buffer, &(data->buffersize)) == SC_SUCCESS) {
+			data->state = GIDS_STATE_READ_DATA_PRESENT;
+		}
+	}
 	if (data->state != GIDS_STATE_READ_DATA_PRESENT) {
 		// this function is called to read the certificate only
 		u8 buffer[SC_MAX_EXT_APDU_BUFFER_SIZE];
 		size_t buffersize = sizeof(buffer);
+		char cachename[20];
 		r = gids_get_DO(card, data->currentEFID, data->currentDO, buffer, &(buffersize));
 		if (r <0) return r;
 		if (buffersize < 4) {
@@ -1086,6 +1207,8 @@ static int gids_read_binary(sc_card_t *card, unsigned int offset,
 			sc_log(card->ctx,  "unknown compression method %d", buffer[0] + (buffer[1] <<8));
 			LOG_FUNC_RETURN(card->ctx, SC_ERROR_INVALID_DATA);
 		}
+		snprintf(cachename, sizeof(cachename), "cert_%04X%04X", data->currentEFID, data->currentDO);
+		gids_cache_write(card, cachename, data->buffer, data->buffersize);
 		data->state = GIDS_STATE_READ_DATA_PRESENT;
 	}
 	if (offset >= data->buffersize) {
@@ -2120,10 +2243,15 @@ static int gids_card_ctl(sc_card_t * card, unsigned long cmd, void *ptr)
 
 static int gids_card_reader_lock_obtained(sc_card_t *card, int was_reset)
 {
+	struct gids_private_data* data = (struct gids_private_data*) card->drv_data;
 	int r = SC_SUCCESS;
 
 	SC_FUNC_CALLED(card->ctx, SC_LOG_DEBUG_VERBOSE);
 
+	// the card may have been changed or reset while it was not locked
+	if (data) {
+		data->cardcfvalid = 0;
+	}
 	if (was_reset > 0) {
 		u8 rbuf[SC_MAX_APDU_BUFFER_SIZE];
 		size_t resplen = sizeof(rbuf);
@@ -1708,6 +1708,9 @@ gpk_card_ctl(sc_card_t *card, unsigned long cmd, void *ptr)
 	case SC_CARDCTL_GPK_GENERATE_KEY:
 		return gpk_generate_key(card,
 				(struct sc_cardctl_gpk_genkey *) ptr);
+	case SC_CARDCTL_READ_SERIALNR:
+		memset(&card->serialnr, 0, sizeof(card->serialnr));
+		/* fall through */
 	case SC_CARDCTL_GET_SERIALNR:
 		return gpk_get_serialnr(card, (sc_serial_number_t *) ptr);
 	}
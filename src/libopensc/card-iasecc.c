@@ -138,6 +138,25 @@ struct iasecc_pin_policy {
 	unsigned char scbs[IASECC_MAX_SCBS];
 };
 
+/*
+ * Static attributes of the CHV and RSA private key SDOs, kept for the card session
+ * to avoid a 'GET DATA' on every PIN info query and key operation.
+ * Local SDOs are identified together with the DF they were read in.
+ */
+struct iasecc_sdo_info {
+	unsigned char sdo_class;
+	unsigned char sdo_ref;
+	struct sc_path df;
+
+	struct iasecc_pin_policy pin_policy;
+
+	size_t key_size;
+	unsigned sign_meth, sign_ref;
+	unsigned auth_meth, auth_ref;
+
+	struct iasecc_sdo_info *next;
+};
+
 static int iasecc_select_file(struct sc_card *card, const struct sc_path *path, struct sc_file **file_out);
 static int iasecc_process_fci(struct sc_card *card, struct sc_file *file, const unsigned char *buf, size_t buflen);
 static int iasecc_get_serialnr(struct sc_card *card, struct sc_serial_number *serial);
@@ -265,6 +284,73 @@ iasecc_chv_cache_is_verified(struct sc_card *card, struct sc_pin_cmd_data *pin_c
 }
 
 
+static int
+iasecc_sdo_info_df(struct sc_card *card, int local, struct sc_path *df)
+{
+	memset(df, 0, sizeof(struct sc_path));
+	if (!local)
+		return SC_SUCCESS;
+	if (!(card->cache.valid && card->cache.current_df))
+		return SC_ERROR_OBJECT_NOT_FOUND;
+	*df = card->cache.current_df->path;
+	return SC_SUCCESS;
+}
+
+
+static struct iasecc_sdo_info *
+iasecc_sdo_info_find(struct sc_card *card, unsigned sdo_class, unsigned sdo_ref, int local)
+{
+	struct iasecc_private_data *prv = (struct iasecc_private_data *) card->drv_data;
+	struct iasecc_sdo_info *si = NULL;
+	struct sc_path df;
+
+	if (iasecc_sdo_info_df(card, local, &df))
+		return NULL;
+
+	for (si = prv->sdo_info; si; si = si->next)
+		if (si->sdo_class == sdo_class && si->sdo_ref == sdo_ref
+				&& !memcmp(&si->df, &df, sizeof(struct sc_path)))
+			break;
+
+	return si;
+}
+
+
+static void
+iasecc_sdo_info_cache(struct sc_card *card, struct iasecc_sdo_info *info, int local)
+{
+	struct iasecc_private_data *prv = (struct iasecc_private_data *) card->drv_data;
+	struct iasecc_sdo_info *si = NULL;
+
+	if (iasecc_sdo_info_df(card, local, &info->df))
+		return;
+
+	si = calloc(1, sizeof(struct iasecc_sdo_info));
+	if (!si)
+		return;
+	*si = *info;
+	si->next = prv->sdo_info;
+	prv->sdo_info = si;
+}
+
+
+static void
+iasecc_sdo_info_clean(struct sc_card *card)
+{
+	struct iasecc_private_data *prv = (struct iasecc_private_data *) card->drv_data;
+	struct iasecc_sdo_info *next;
+
+	if (!prv)
+		return;
+
+	while (prv->sdo_info)   {
+		next = prv->sdo_info->next;
+		free(prv->sdo_info);
+		prv->sdo_info = next;
+	}
+}
+
+
 static int
 iasecc_select_mf(struct sc_card *card, struct sc_file **file_out)
 {
@@ -1528,6 +1614,8 @@ iasecc_finish(struct sc_card *card)
 		se_info = next;
 	}
 
+	iasecc_sdo_info_clean(card);
+
 	free(card->drv_data);
 	card->drv_data = NULL;
 
@@ -1535,6 +1623,18 @@ iasecc_finish(struct sc_card *card)
 }
 
 
+static int
+iasecc_card_reader_lock_obtained(struct sc_card *card, int was_reset)
+{
+	LOG_FUNC_CALLED(card->ctx);
+
+	if (was_reset > 0)
+		iasecc_sdo_info_clean(card);
+
+	LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
+}
+
+
 static int
 iasecc_delete_file(struct sc_card *card, const struct sc_path *path)
 {
@@ -1760,6 +1860,7 @@ iasecc_set_security_env(struct sc_card *card,
 {
 	struct sc_context *ctx = card->ctx;
 	struct iasecc_sdo sdo;
+	struct iasecc_sdo_info info, *key_info = NULL;
 	struct iasecc_private_data *prv = (struct iasecc_private_data *) card->drv_data;
 	unsigned algo_ref;
 	struct sc_apdu apdu;
@@ -1786,21 +1887,42 @@ iasecc_set_security_env(struct sc_card *card,
 	sc_log(ctx, "iasecc_set_security_env(card:%p) operation 0x%X; senv.algorithm 0x%X, senv.algorithm_ref 0x%X",
 			card, env->operation, env->algorithm, env->algorithm_ref);
 
-	memset(&sdo, 0, sizeof(sdo));
-	sdo.sdo_class = IASECC_SDO_CLASS_RSA_PRIVATE;
-	sdo.sdo_ref  = env->key_ref[0] & ~IASECC_OBJECT_REF_LOCAL;
-	rv = iasecc_sdo_get_data(card, &sdo);
-	LOG_TEST_RET(ctx, rv, "Cannot get RSA PRIVATE SDO data");
+	key_info = iasecc_sdo_info_find(card, IASECC_SDO_CLASS_RSA_PRIVATE,
+			env->key_ref[0] & ~IASECC_OBJECT_REF_LOCAL, 1);
+	if (key_info)   {
+		sc_log(ctx, "RSA PRIVATE SDO data taken from cache");
+		info = *key_info;
+	}
+	else   {
+		memset(&sdo, 0, sizeof(sdo));
+		sdo.sdo_class = IASECC_SDO_CLASS_RSA_PRIVATE;
+		sdo.sdo_ref  = env->key_ref[0] & ~IASECC_OBJECT_REF_LOCAL;
+		rv = iasecc_sdo_get_data(card, &sdo);
+		LOG_TEST_RET(ctx, rv, "Cannot get RSA PRIVATE SDO data");
 
-	/* To made by iasecc_sdo_convert_to_file() */
-	prv->key_size = *(sdo.docp.size.value + 0) * 0x100 + *(sdo.docp.size.value + 1);
-	sc_log(ctx, "prv->key_size 0x%"SC_FORMAT_LEN_SIZE_T"X", prv->key_size);
+		memset(&info, 0, sizeof(info));
+		info.sdo_class = sdo.sdo_class;
+		info.sdo_ref = sdo.sdo_ref;
 
-	rv = iasecc_sdo_convert_acl(card, &sdo, SC_AC_OP_PSO_COMPUTE_SIGNATURE, &sign_meth, &sign_ref);
-	LOG_TEST_RET(ctx, rv, "Cannot convert SC_AC_OP_SIGN acl");
+		/* To made by iasecc_sdo_convert_to_file() */
+		info.key_size = *(sdo.docp.size.value + 0) * 0x100 + *(sdo.docp.size.value + 1);
 
-	rv = iasecc_sdo_convert_acl(card, &sdo, SC_AC_OP_INTERNAL_AUTHENTICATE, &auth_meth, &auth_ref);
-	LOG_TEST_RET(ctx, rv, "Cannot convert SC_AC_OP_INT_AUTH acl");
+		rv = iasecc_sdo_convert_acl(card, &sdo, SC_AC_OP_PSO_COMPUTE_SIGNATURE, &info.sign_meth, &info.sign_ref);
+		if (!rv)
+			rv = iasecc_sdo_convert_acl(card, &sdo, SC_AC_OP_INTERNAL_AUTHENTICATE, &info.auth_meth, &info.auth_ref);
+		iasecc_sdo_free_fields(card, &sdo);
+		LOG_TEST_RET(ctx, rv, "Cannot convert SC_AC_OP_SIGN or SC_AC_OP_INT_AUTH acl");
+
+		iasecc_sdo_info_cache(card, &info, 1);
+	}
+
+	prv->key_size = info.key_size;
+	sc_log(ctx, "prv->key_size 0x%"SC_FORMAT_LEN_SIZE_T"X", prv->key_size);
+
+	sign_meth = info.sign_meth;
+	sign_ref = info.sign_ref;
+	auth_meth = info.auth_meth;
+	auth_ref = info.auth_ref;
 
 	aflags = env->algorithm_flags;
 
@@ -2115,6 +2237,7 @@ iasecc_pin_get_policy (struct sc_card *card, struct sc_pin_cmd_data *data, struc
 	struct sc_context *ctx = card->ctx;
 	struct sc_file *save_current_df = NULL, *save_current_ef = NULL;
 	struct iasecc_sdo sdo;
+	struct iasecc_sdo_info info, *pin_info = NULL;
 	struct sc_path path;
 	int rv;
 
@@ -2126,6 +2249,16 @@ iasecc_pin_get_policy (struct sc_card *card, struct sc_pin_cmd_data *data, struc
 		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ARGUMENTS);
 	}
 
+	pin_info = iasecc_sdo_info_find(card, IASECC_SDO_CLASS_CHV,
+			data->pin_reference & ~IASECC_OBJECT_REF_LOCAL,
+			data->pin_reference & IASECC_OBJECT_REF_LOCAL);
+	if (pin_info)   {
+		/* The remaining tries counter is not cached: leave it to the PIN status */
+		*pin = pin_info->pin_policy;
+		sc_log(ctx, "PIN policy taken from cache");
+		LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+	}
+
 	if (card->cache.valid && card->cache.current_df)   {
 		sc_file_dup(&save_current_df, card->cache.current_df);
 		if (save_current_df == NULL) {
@@ -2197,6 +2330,16 @@ iasecc_pin_get_policy (struct sc_card *card, struct sc_pin_cmd_data *data, struc
 		LOG_TEST_GOTO_ERR(ctx, rv, "Cannot return to saved DF");
 	}
 
+	/* Policy of the local PIN is cached for the DF it was read in. The
+	 * remaining tries change behind our back, with any verification by
+	 * this or another process, and are not kept. */
+	memset(&info, 0, sizeof(info));
+	info.sdo_class = IASECC_SDO_CLASS_CHV;
+	info.sdo_ref = data->pin_reference & ~IASECC_OBJECT_REF_LOCAL;
+	info.pin_policy = *pin;
+	info.pin_policy.tries_remaining = -1;
+	iasecc_sdo_info_cache(card, &info, data->pin_reference & IASECC_OBJECT_REF_LOCAL);
+
 	if (save_current_ef)   {
 		sc_log(ctx, "iasecc_pin_get_policy() restore current EF");
 		rv = iasecc_select_file(card, &save_current_ef->path, NULL);
@@ -2542,12 +2685,14 @@ iasecc_pin_cmd(struct sc_card *card, struct sc_pin_cmd_data *data, int *tries_le
 		rv = iasecc_pin_verify(card, data, tries_left);
 		break;
 	case SC_PIN_CMD_CHANGE:
+		iasecc_sdo_info_clean(card);
 		if (data->pin_type == SC_AC_AUT)
 			rv = iasecc_keyset_change(card, data, tries_left);
 		else
 			rv = iasecc_pin_change(card, data, tries_left);
 		break;
 	case SC_PIN_CMD_UNBLOCK:
+		iasecc_sdo_info_clean(card);
 		rv = iasecc_pin_reset(card, data, tries_left);
 		break;
 	case SC_PIN_CMD_GET_INFO:
@@ -3078,6 +3223,20 @@ iasecc_card_ctl(struct sc_card *card, unsigned long cmd, void *ptr)
 	struct iasecc_sdo *sdo = (struct iasecc_sdo *) ptr;
 
 	switch (cmd) {
+	case SC_CARDCTL_IASECC_SDO_CREATE:
+	case SC_CARDCTL_IASECC_SDO_DELETE:
+	case SC_CARDCTL_IASECC_SDO_PUT_DATA:
+	case SC_CARDCTL_IASECC_SDO_KEY_RSA_PUT_DATA:
+	case SC_CARDCTL_IASECC_SDO_GENERATE:
+		/* SDO is about to change: forget the cached SDO attributes */
+		iasecc_sdo_info_clean(card);
+		break;
+	}
+
+	switch (cmd) {
+	case SC_CARDCTL_READ_SERIALNR:
+		memset(&card->serialnr, 0, sizeof(card->serialnr));
+		/* fall through */
 	case SC_CARDCTL_GET_SERIALNR:
 		return iasecc_get_serialnr(card, (struct sc_serial_number *)ptr);
 	case SC_CARDCTL_IASECC_SDO_CREATE:
@@ -3663,6 +3822,7 @@ sc_get_driver(void)
 	/*	delete_record: Not implemented	*/
 
 	iasecc_ops.read_public_key = iasecc_read_public_key;
+	iasecc_ops.card_reader_lock_obtained = iasecc_card_reader_lock_obtained;
 
 	return &iasecc_drv;
 }
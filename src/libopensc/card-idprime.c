@@ -81,6 +81,10 @@ typedef struct idprime_private_data {
 	idprime_object_t *pki_current;	/* current pki object _ctl function */
 	int tinfo_present;		/* Token Info Label object is present*/
 	u8 tinfo_df[2];			/* DF of object with Token Info Label */
+	int use_cache;			/* certificates are kept in the file cache */
+	sc_serial_number_t serial;	/* card serial, keys the file cache */
+	unsigned index_crc;		/* checksum of the index file, validates the file cache */
+	u8 current_df[2];		/* DF of the selected file */
 } idprime_private_data_t;
 
 /* For SimCList autocopy, we need to know the size of the data elements */
@@ -183,6 +187,8 @@ static int idprime_process_index(sc_card_t *card, idprime_private_data_t *priv,
 		num_entries = buf[0];
 		r += got;
 	} while(r < num_entries * 21 + 1);
+	/* any change of the index invalidates the certificates in the file cache */
+	priv->index_crc = sc_crc32(buf, num_entries * 21 + 1);
 
 	new_object.fd = 0;
 	for (i = 0; i < num_entries; i++) {
@@ -237,6 +243,8 @@ done:
 	LOG_FUNC_RETURN(card->ctx, r);
 }
 
+static int idprime_get_serial(sc_card_t* card, sc_serial_number_t* serial);
+
 /* CPLC has 42 bytes, but we get it with 3B header */
 #define CPLC_LENGTH 45
 static int idprime_init(sc_card_t *card)
@@ -303,6 +311,12 @@ static int idprime_init(sc_card_t *card)
 		LOG_FUNC_RETURN(card->ctx, r);
 	}
 
+	/* The certificates in the file cache are bound to the card serial */
+	if (sc_card_cache_enabled(card)
+	    && idprime_get_serial(card, &priv->serial) == SC_SUCCESS) {
+		priv->use_cache = 1;
+	}
+
 	card->drv_data = priv;
 
 	switch (card->type) {
@@ -442,6 +456,80 @@ static int idprime_get_serial(sc_card_t* card, sc_serial_number_t* serial)
 	LOG_FUNC_RETURN(card->ctx, SC_SUCCESS);
 }
 
+/*
+ * Certificates are kept in the file cache, decompressed, under the card serial.
+ * Each entry starts with the checksum of the index file it was read with and
+ * it is used only while the index file of the card has the same checksum.
+ */
+static int idprime_is_cert_df(idprime_private_data_t *priv, const u8 *df)
+{
+	idprime_object_t *obj;
+	int found = 0;
+
+	list_iterator_start(&priv->pki_list);
+	while (list_iterator_hasnext(&priv->pki_list)) {
+		obj = list_iterator_next(&priv->pki_list);
+		if (memcmp(obj->df, df, sizeof(obj->df)) == 0) {
+			found = 1;
+			break;
+		}
+	}
+	list_iterator_stop(&priv->pki_list);
+	return found;
+}
+
+static int idprime_cache_read_cert(sc_card_t *card, idprime_private_data_t *priv)
+{
+	char name[16];
+	u8 *data = NULL;
+	size_t data_len = 0;
+	int r;
+
+	if (!priv->use_cache || !idprime_is_cert_df(priv, priv->current_df))
+		return SC_ERROR_NOT_SUPPORTED;
+
+	snprintf(name, sizeof(name), "cert_%02X%02X", priv->current_df[0], priv->current_df[1]);
+	r = sc_card_cache_read(card, priv->serial.value, priv->serial.len, name, &data, &data_len);
+	if (r != SC_SUCCESS)
+		return r;
+	if (data_len <= 4 || bebytes2ulong(data) != (priv->index_crc & 0xFFFFFFFF)) {
+		sc_log(card->ctx, "Cached %s does not match the index file", name);
+		free(data);
+		return SC_ERROR_FILE_NOT_FOUND;
+	}
+
+	free(priv->cache_buf);
+	priv->cache_buf_len = data_len - 4;
+	memmove(data, data + 4, priv->cache_buf_len);
+	priv->cache_buf = data;
+	priv->cached = 1;
+	sc_log(card->ctx, "%s read from the file cache", name);
+	return SC_SUCCESS;
+}
+
+static void idprime_cache_write_cert(sc_card_t *card, idprime_private_data_t *priv)
+{
+	char name[16];
+	u8 *data;
+	int r;
+
+	if (!priv->use_cache || !idprime_is_cert_df(priv, priv->current_df))
+		return;
+
+	data = malloc(priv->cache_buf_len + 4);
+	if (data == NULL)
+		return;
+	ulong2bebytes(data, priv->index_crc & 0xFFFFFFFF);
+	memcpy(data + 4, priv->cache_buf, priv->cache_buf_len);
+
+	snprintf(name, sizeof(name), "cert_%02X%02X", priv->current_df[0], priv->current_df[1]);
+	r = sc_card_cache_write(card, priv->serial.value, priv->serial.len, name,
+			data, priv->cache_buf_len + 4);
+	if (r < 0)
+		sc_log(card->ctx, "Failed to cache %s: %d", name, r);
+	free(data);
+}
+
 static int idprime_get_token_name(sc_card_t* card, char** tname)
 {
 	idprime_private_data_t * priv = card->drv_data;
@@ -507,6 +595,11 @@ static int idprime_card_ctl(sc_card_t *card, unsigned long cmd, void *ptr)
 	}
 	switch (cmd) {
 		case SC_CARDCTL_GET_SERIALNR:
+			if (priv->use_cache) {
+				/* already read when setting up the file cache */
+				memcpy(ptr, &priv->serial, sizeof(priv->serial));
+				return SC_SUCCESS;
+			}
 			return idprime_get_serial(card, (sc_serial_number_t *) ptr);
 		case SC_CARDCTL_IDPRIME_GET_TOKEN_NAME:
 			return idprime_get_token_name(card, (char **) ptr);
@@ -541,9 +634,17 @@ static int idprime_select_file(sc_card_t *card, const sc_path_t *in_path, sc_fil
 	}
 	priv->cache_buf_len = 0;
 	priv->cached = 0;
+	memset(priv->current_df, 0, sizeof(priv->current_df));
+	if (in_path->len >= 2) {
+		memcpy(priv->current_df, &in_path->value[in_path->len - 2], sizeof(priv->current_df));
+	}
 
 	r = iso_ops->select_file(card, in_path, file_out);
-	if (r == SC_SUCCESS && file_out != NULL) {
+	if (r == SC_SUCCESS && file_out != NULL
+	    && idprime_cache_read_cert(card, priv) == SC_SUCCESS) {
+		/* No need to look into the header, we already have the certificate */
+		(*file_out)->size = priv->cache_buf_len;
+	} else if (r == SC_SUCCESS && file_out != NULL) {
 		/* Try to read first bytes of the file to fix FCI in case of
 		 * compressed certififcate */
 		len = iso_ops->read_binary(card, 0, data, data_len, 0);
@@ -619,6 +720,7 @@ static int idprime_read_binary(sc_card_t *card, unsigned int offset,
 			priv->cache_buf_len = r;
 		}
 		priv->cached = 1;
+		idprime_cache_write_cert(card, priv);
 	}
 	if (offset >= priv->cache_buf_len) {
 		return 0;
@@ -538,6 +538,9 @@ static int
 itacns_card_ctl(sc_card_t *card, unsigned long cmd, void *ptr)
 {
 	switch (cmd) {
+		case SC_CARDCTL_READ_SERIALNR:
+			memset(&card->serialnr, 0, sizeof(card->serialnr));
+			/* fall through */
 		case SC_CARDCTL_GET_SERIALNR:
 		return itacns_get_serialnr(card, ptr);
 	}
@@ -55,6 +55,8 @@
 #define MYEID_CARD_CAP_PIV_EMU		0x20
 
 #define MYEID_MAX_APDU_DATA_LEN		0xFF
+/* whole AES blocks in one PSO command */
+#define MYEID_MAX_SYM_CHUNK_LEN		0xF0
 #define MYEID_MAX_RSA_KEY_LEN		4096
 
 #define MYEID_MAX_EXT_APDU_BUFFER_SIZE	(MYEID_MAX_RSA_KEY_LEN/8+16)
@@ -739,6 +741,14 @@ static int myeid_set_security_env_rsa(sc_card_t *card, const sc_security_env_t *
 		apdu.p1 = 0x81;
 		apdu.p2 = 0xB8;
 		break;
+	case SC_SEC_OPERATION_ENCRYPT_SYM:
+		apdu.p1 = 0x81;
+		apdu.p2 = 0xB8;
+		break;
+	case SC_SEC_OPERATION_DECRYPT_SYM:
+		apdu.p1 = 0x41;
+		apdu.p2 = 0xB8;
+		break;
 	default:
 		return SC_ERROR_INVALID_ARGUMENTS;
 	}
@@ -778,7 +788,8 @@ static int myeid_set_security_env_rsa(sc_card_t *card, const sc_security_env_t *
 			break;
 	    }
 
-	if (env->operation ==  SC_SEC_OPERATION_UNWRAP || env->operation == SC_SEC_OPERATION_WRAP)
+	if (env->operation ==  SC_SEC_OPERATION_UNWRAP || env->operation == SC_SEC_OPERATION_WRAP
+		|| env->operation == SC_SEC_OPERATION_ENCRYPT_SYM || env->operation == SC_SEC_OPERATION_DECRYPT_SYM)
 	{
 	    /* add IV if present */
 		for (i = 0; i < SC_SEC_ENV_MAX_PARAMS; i++)
@@ -1397,6 +1408,93 @@ static int myeid_wrap_key(struct sc_card *card, u8 *out, size_t outlen)
 	LOG_FUNC_RETURN(ctx, apdu.resplen);
 }
 
+/* Start a new CBC operation with the next IV, for cards without command chaining */
+static int myeid_restart_cbc(struct sc_card *card, const u8 *iv)
+{
+	myeid_private_data_t *priv = card->drv_data;
+	const struct sc_security_env *saved = priv->sec_env;
+	sc_security_env_t env;
+	size_t i;
+	int r;
+
+	env = *saved;
+	for (i = 0; i < SC_SEC_ENV_MAX_PARAMS; i++)
+		if (env.params[i].param_type == SC_SEC_ENV_PARAM_IV) {
+			if (env.params[i].value_len != 16)
+				return SC_ERROR_WRONG_LENGTH;
+			env.params[i].value = (void *) iv;
+		}
+	r = myeid_set_security_env(card, &env, 0);
+	priv->sec_env = saved;
+	return r;
+}
+
+/* PSO ENCIPHER or DECIPHER of whole AES blocks. Longer data is sent in
+ * chained commands, each of them returning its part of the result. */
+static int myeid_transmit_sym(struct sc_card *card, int encrypt,
+		const u8 *in, size_t inlen, u8 *out, size_t outlen)
+{
+	myeid_private_data_t *priv = card->drv_data;
+	struct sc_apdu apdu;
+	u8 rbuf[SC_MAX_APDU_BUFFER_SIZE];
+	size_t done = 0, len;
+	int r;
+
+	LOG_FUNC_CALLED(card->ctx);
+
+	if (inlen % 16 != 0)
+		LOG_TEST_RET(card->ctx, SC_ERROR_WRONG_LENGTH, "Data is not a whole number of blocks");
+	if (outlen < inlen)
+		LOG_FUNC_RETURN(card->ctx, SC_ERROR_BUFFER_TOO_SMALL);
+
+	while (done < inlen) {
+		len = MIN(inlen - done, MYEID_MAX_SYM_CHUNK_LEN);
+
+		/* Before 4.5.x every command is an operation of its own */
+		if (done > 0 && !priv->cap_chaining && priv->sec_env != NULL
+				&& (priv->sec_env->algorithm_flags & SC_ALGORITHM_AES_CBC)) {
+			r = myeid_restart_cbc(card, encrypt ? out + done - 16 : in + done - 16);
+			LOG_TEST_RET(card->ctx, r, "Failed to restart CBC operation");
+		}
+
+		/* INS: 0x2A  PERFORM SECURITY OPERATION
+		 * P1:  0x84  Resp: Cryptogram   P2: 0x80  Cmd: Plain value  (encipher)
+		 * P1:  0x80  Resp: Plain value  P2: 0x84  Cmd: Cryptogram   (decipher) */
+		sc_format_apdu(card, &apdu, SC_APDU_CASE_4_SHORT, 0x2A,
+				encrypt ? 0x84 : 0x80, encrypt ? 0x80 : 0x84);
+		if (done + len < inlen && priv->cap_chaining)
+			apdu.cla |= 0x10;
+		apdu.data = in + done;
+		apdu.datalen = apdu.lc = len;
+		apdu.resp = rbuf;
+		apdu.resplen = sizeof(rbuf);
+		apdu.le = len;
+
+		r = sc_transmit_apdu(card, &apdu);
+		LOG_TEST_RET(card->ctx, r, "APDU transmit failed");
+		r = sc_check_sw(card, apdu.sw1, apdu.sw2);
+		LOG_TEST_RET(card->ctx, r, encrypt ? "ENCIPHER returned error" : "DECIPHER returned error");
+		if (apdu.resplen != len)
+			LOG_TEST_RET(card->ctx, SC_ERROR_CARD_CMD_FAILED, "Unexpected response length");
+
+		memcpy(out + done, rbuf, len);
+		done += len;
+	}
+	LOG_FUNC_RETURN(card->ctx, (int) done);
+}
+
+static int myeid_encrypt_sym(struct sc_card *card, const u8 *in, size_t inlen,
+		u8 *out, size_t outlen)
+{
+	return myeid_transmit_sym(card, 1, in, inlen, out, outlen);
+}
+
+static int myeid_decrypt_sym(struct sc_card *card, const u8 *in, size_t inlen,
+		u8 *out, size_t outlen)
+{
+	return myeid_transmit_sym(card, 0, in, inlen, out, outlen);
+}
+
 static int myeid_unwrap_key(struct sc_card *card, const u8 *crgram, size_t crgram_len)
 {
 	myeid_private_data_t* priv;
@@ -1781,6 +1879,9 @@ static int myeid_card_ctl(struct sc_card *card, unsigned long cmd, void *ptr)
 	case SC_CARDCTL_MYEID_ACTIVATE_CARD:
 		r = myeid_activate_card(card);
 		break;
+	case SC_CARDCTL_READ_SERIALNR:
+		memset(&card->serialnr, 0, sizeof(card->serialnr));
+		/* fall through */
 	case SC_CARDCTL_GET_SERIALNR:
 		r = myeid_get_serialnr(card, (sc_serial_number_t *)ptr);
 		break;
@@ -1829,6 +1930,8 @@ static struct sc_card_driver * sc_get_driver(void)
 	myeid_ops.pin_cmd		= myeid_pin_cmd;
 	myeid_ops.wrap			= myeid_wrap_key;
 	myeid_ops.unwrap		= myeid_unwrap_key;
+	myeid_ops.encrypt_sym		= myeid_encrypt_sym;
+	myeid_ops.decrypt_sym		= myeid_decrypt_sym;
 	return &myeid_drv;
 }
 
@@ -2003,6 +2003,9 @@ static int starcos_card_ctl(sc_card_t *card, unsigned long cmd, void *ptr)
 		return starcos_gen_key(card, (sc_starcos_gen_key_data *)ptr);
 	case SC_CARDCTL_ERASE_CARD:
 		return starcos_erase_card(card);
+	case SC_CARDCTL_READ_SERIALNR:
+		memset(&card->serialnr, 0, sizeof(card->serialnr));
+		/* fall through */
 	case SC_CARDCTL_GET_SERIALNR:
 		return starcos_get_serialnr(card, (sc_serial_number_t *)ptr);
 	default:
@@ -44,6 +44,9 @@ enum {
 	SC_CARDCTL_GET_CHV_REFERENCE_IN_SE,
 	SC_CARDCTL_PKCS11_INIT_TOKEN,
 	SC_CARDCTL_PKCS11_INIT_PIN,
+	/* Like SC_CARDCTL_GET_SERIALNR, but asks the card instead of returning a
+	 * serial number cached by the driver */
+	SC_CARDCTL_READ_SERIALNR,
 
 	/*
 	 * GPK specific calls
@@ -1090,11 +1093,13 @@ typedef struct sc_cardctl_isoApplet_import_key {
 /*
  * coolkey object returned from the card control interface
  */
+struct coolkey_attribute_index;
 typedef struct sc_cardctl_coolkey_object {
         sc_path_t path;
         unsigned long id;
         size_t length;
         u8  *data;
+        struct coolkey_attribute_index *attribute_index; /* owned by the card driver */
 } sc_cardctl_coolkey_object_t;
 
 
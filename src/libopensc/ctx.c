@@ -752,6 +752,21 @@ int sc_ctx_detect_readers(sc_context_t *ctx)
 	return r;
 }
 
+int sc_ctx_detect_card_presence(sc_context_t *ctx)
+{
+	int r = SC_ERROR_NOT_SUPPORTED;
+	const struct sc_reader_driver *drv = ctx->reader_driver;
+
+	sc_mutex_lock(ctx, ctx->mutex);
+
+	if (drv->ops->refresh_card_presence != NULL)
+		r = drv->ops->refresh_card_presence(ctx);
+
+	sc_mutex_unlock(ctx, ctx->mutex);
+
+	return r;
+}
+
 sc_reader_t *sc_ctx_get_reader(sc_context_t *ctx, unsigned int i)
 {
 	return list_get_at(&ctx->readers, i);
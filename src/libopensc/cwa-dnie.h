@@ -89,6 +89,11 @@ typedef struct dnie_channel_data {
 	 struct ui_context ui_ctx;
 #endif
      dnie_channel_data_t *channel_data; /* Configuration data for the secure channel */
+     int use_cache;      /**< Keep decompressed files in the file cache */
+     sc_path_t cache_path;   /**< Path of the selected file, names its file cache entry */
+     int cache_selected; /**< The selected file was served from the file cache */
+     u8 fci[256];        /**< FCI of the selected file, stored in its file cache entry */
+     size_t fci_len;     /**< length of the FCI */
  } dnie_private_data_t;
  
 /**
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "opensc.h"
 #include "cardctl.h"
@@ -46,6 +47,10 @@
 
 #define MAX_RESP_BUFFER_SIZE 2048
 
+/* file cache entry with the verified ICC public key, and its lifetime in seconds */
+#define CWA_ICC_CACHE_ENTRY "icc_pubkey"
+#define CWA_ICC_CACHE_TTL (7 * 24 * 60 * 60)
+
 /**
  * Structure used to compose BER-TLV encoded data
  * according to iso7816-4 sect 5.2.2.
@@ -977,6 +982,185 @@ static int cwa_verify_internal_auth(sc_card_t * card,
 	LOG_FUNC_RETURN(ctx, res);
 }
 
+/**
+ * Read a previously verified ICC public key from the file cache.
+ *
+ * The entry is keyed by the ICC serial number and holds the time of the
+ * verification followed by the DER encoded public key. Entries older
+ * than CWA_ICC_CACHE_TTL seconds are ignored.
+ *
+ * @param card pointer to card data
+ * @param icc_pubkey where to store the public key
+ * @return SC_SUCCESS if a valid entry was found; else error code
+ */
+static int cwa_icc_cache_read(sc_card_t * card, EVP_PKEY ** icc_pubkey)
+{
+	struct sm_cwa_session *sm = &card->sm_ctx.info.session.cwa;
+	const unsigned char *p;
+	u8 *buf = NULL;
+	size_t buflen = 0;
+	time_t verified;
+	time_t now = time(NULL);
+	int res;
+
+	if (!sc_card_cache_enabled(card))
+		return SC_ERROR_NOT_SUPPORTED;
+	res = sc_card_cache_read(card, sm->icc.sn, sizeof(sm->icc.sn),
+			CWA_ICC_CACHE_ENTRY, &buf, &buflen);
+	if (res != SC_SUCCESS)
+		return res;
+	res = SC_ERROR_FILE_NOT_FOUND;
+	if (buflen <= 4)
+		goto end;
+	verified = (time_t) bebytes2ulong(buf);
+	if (verified > now || now - verified > CWA_ICC_CACHE_TTL) {
+		sc_log(card->ctx, "Cached ICC public key expired");
+		goto end;
+	}
+	p = buf + 4;
+	*icc_pubkey = d2i_PUBKEY(NULL, &p, buflen - 4);
+	if (*icc_pubkey)
+		res = SC_SUCCESS;
+ end:
+	free(buf);
+	return res;
+}
+
+/**
+ * Store the verified ICC public key in the file cache.
+ *
+ * @param card pointer to card data
+ * @param icc_pubkey verified public key of the card
+ */
+static void cwa_icc_cache_write(sc_card_t * card, EVP_PKEY * icc_pubkey)
+{
+	struct sm_cwa_session *sm = &card->sm_ctx.info.session.cwa;
+	u8 *buf = NULL;
+	u8 *p;
+	int len;
+
+	if (!sc_card_cache_enabled(card))
+		return;
+	len = i2d_PUBKEY(icc_pubkey, NULL);
+	if (len <= 0)
+		return;
+	buf = malloc(4 + len);
+	if (!buf)
+		return;
+	ulong2bebytes(buf, (unsigned long) time(NULL));
+	p = buf + 4;
+	if (i2d_PUBKEY(icc_pubkey, &p) == len)
+		sc_card_cache_write(card, sm->icc.sn, sizeof(sm->icc.sn),
+				CWA_ICC_CACHE_ENTRY, buf, 4 + len);
+	free(buf);
+}
+
+/**
+ * Remove the cached ICC public key.
+ *
+ * @param card pointer to card data
+ */
+static void cwa_icc_cache_remove(sc_card_t * card)
+{
+	struct sm_cwa_session *sm = &card->sm_ctx.info.session.cwa;
+
+	sc_card_cache_remove(card, sm->icc.sn, sizeof(sm->icc.sn),
+			CWA_ICC_CACHE_ENTRY);
+}
+
+/**
+ * Retrieve the verified ICC public key.
+ *
+ * Reads the ICC intermediate CA and ICC certificates from the card,
+ * verifies the chain and extracts the public key of the ICC certificate.
+ * A public key verified in an earlier session is taken from the file
+ * cache instead, so no certificate is read nor verified.
+ *
+ * @param card pointer to card data
+ * @param provider cwa14890 info provider
+ * @param icc_pubkey where to store the ICC public key
+ * @param cached set to 1 if the key was taken from the file cache
+ * @return SC_SUCCESS if ok; else error code
+ */
+static int cwa_get_icc_pubkey(sc_card_t * card, cwa_provider_t * provider,
+			      EVP_PKEY ** icc_pubkey, int *cached)
+{
+	X509 *icc_cert = NULL;
+	X509 *ca_cert = NULL;
+	char *msg = NULL;
+	sc_context_t *ctx = card->ctx;
+	int res;
+
+	LOG_FUNC_CALLED(ctx);
+	*cached = 0;
+	if (cwa_icc_cache_read(card, icc_pubkey) == SC_SUCCESS) {
+		sc_log(ctx, "Using cached ICC public key, skip certificate verification");
+		*cached = 1;
+		LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+	}
+
+	/* Read Intermediate CA from card */
+	if (!provider->cwa_get_icc_intermediate_ca_cert) {
+		sc_log(ctx,
+		       "Step 8.4.1.6: Skip Retrieving ICC intermediate CA");
+		ca_cert = NULL;
+	} else {
+		sc_log(ctx, "Step 8.4.1.7: Retrieving ICC intermediate CA");
+		res =
+		    provider->cwa_get_icc_intermediate_ca_cert(card, &ca_cert);
+		if (res != SC_SUCCESS) {
+			msg =
+			    "Cannot get ICC intermediate CA certificate from provider";
+			goto get_icc_pubkey_end;
+		}
+	}
+
+	/* Read ICC certificate from card */
+	sc_log(ctx, "Step 8.4.1.8: Retrieve ICC certificate");
+	res = provider->cwa_get_icc_cert(card, &icc_cert);
+	if (res != SC_SUCCESS) {
+		msg = "Cannot get ICC certificate from provider";
+		goto get_icc_pubkey_end;
+	}
+
+	/* Verify icc Card certificate chain */
+	/* Notice that Some implementations doesn't verify cert chain
+	 * but simply verifies that icc_cert is a valid certificate */
+	if (ca_cert) {
+		sc_log(ctx, "Verifying ICC certificate chain");
+		res =
+		    cwa_verify_icc_certificates(card, provider, ca_cert,
+						icc_cert);
+		if (res != SC_SUCCESS) {
+			res = SC_ERROR_SM_AUTHENTICATION_FAILED;
+			msg = "Icc Certificates verification failed";
+			goto get_icc_pubkey_end;
+		}
+	} else {
+		sc_log(ctx, "Cannot verify Certificate chain. skip step");
+	}
+
+	/* Extract public key from ICC certificate */
+	*icc_pubkey = X509_get_pubkey(icc_cert);
+	if (!*icc_pubkey) {
+		msg = "Cannot extract ICC public key";
+		res = SC_ERROR_SM_AUTHENTICATION_FAILED;
+		goto get_icc_pubkey_end;
+	}
+	/* only a verified certificate chain is worth remembering */
+	if (ca_cert)
+		cwa_icc_cache_write(card, *icc_pubkey);
+	res = SC_SUCCESS;
+ get_icc_pubkey_end:
+	if (icc_cert)
+		X509_free(icc_cert);
+	if (ca_cert)
+		X509_free(ca_cert);
+	if (res != SC_SUCCESS)
+		sc_log(ctx, "%s", msg);
+	LOG_FUNC_RETURN(ctx, res);
+}
+
 /**
  * Create Secure Messaging channel.
  *
@@ -1007,9 +1191,8 @@ int cwa_create_secure_channel(sc_card_t * card,
 	char *msg = "Success";
 
 	/* data to get and parse certificates */
-	X509 *icc_cert = NULL;
-	X509 *ca_cert = NULL;
 	EVP_PKEY *icc_pubkey = NULL;
+	int icc_cached = 0;
 	EVP_PKEY *ifd_privkey = NULL;
 	sc_context_t *ctx = NULL;
 	struct sm_cwa_session * sm = &card->sm_ctx.info.session.cwa;
@@ -1079,51 +1262,12 @@ int cwa_create_secure_channel(sc_card_t * card,
 	 * Notice that this code inverts ICC and IFD certificate standard
 	 * checking sequence.
 	 */
-
-	/* Read Intermediate CA from card */
-	if (!provider->cwa_get_icc_intermediate_ca_cert) {
-		sc_log(ctx,
-		       "Step 8.4.1.6: Skip Retrieving ICC intermediate CA");
-		ca_cert = NULL;
-	} else {
-		sc_log(ctx, "Step 8.4.1.7: Retrieving ICC intermediate CA");
-		res =
-		    provider->cwa_get_icc_intermediate_ca_cert(card, &ca_cert);
-		if (res != SC_SUCCESS) {
-			msg =
-			    "Cannot get ICC intermediate CA certificate from provider";
-			goto csc_end;
-		}
-	}
-
-	/* Read ICC certificate from card */
-	sc_log(ctx, "Step 8.4.1.8: Retrieve ICC certificate");
-	res = provider->cwa_get_icc_cert(card, &icc_cert);
+	res = cwa_get_icc_pubkey(card, provider, &icc_pubkey, &icc_cached);
 	if (res != SC_SUCCESS) {
-		msg = "Cannot get ICC certificate from provider";
+		msg = "Cannot get verified ICC public key";
 		goto csc_end;
 	}
 
-	/* Verify icc Card certificate chain */
-	/* Notice that Some implementations doesn't verify cert chain
-	 * but simply verifies that icc_cert is a valid certificate */
-	if (ca_cert) {
-		sc_log(ctx, "Verifying ICC certificate chain");
-		res =
-		    cwa_verify_icc_certificates(card, provider, ca_cert,
-						icc_cert);
-		if (res != SC_SUCCESS) {
-			res = SC_ERROR_SM_AUTHENTICATION_FAILED;
-			msg = "Icc Certificates verification failed";
-			goto csc_end;
-		}
-	} else {
-		sc_log(ctx, "Cannot verify Certificate chain. skip step");
-	}
-
-	/* Extract public key from ICC certificate */
-	icc_pubkey = X509_get_pubkey(icc_cert);
-
 	/* Select Root CA in card for ifd certificate verification */
 	sc_log(ctx,
 	       "Step 8.4.1.2: Select Root CA in card for IFD cert verification");
@@ -1334,10 +1478,9 @@ int cwa_create_secure_channel(sc_card_t * card,
 	res = SC_SUCCESS;
  csc_end:
 	free(tlv);
-	if (icc_cert)
-		X509_free(icc_cert);
-	if (ca_cert)
-		X509_free(ca_cert);
+	/* do not trust a cached ICC public key the card failed to match */
+	if (res != SC_SUCCESS && icc_cached)
+		cwa_icc_cache_remove(card);
 	if (icc_pubkey)
 		EVP_PKEY_free(icc_pubkey);
 	if (ifd_privkey)
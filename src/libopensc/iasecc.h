@@ -123,6 +123,8 @@ struct iasecc_io_buffer_sizes {
 	size_t recv_sc;
 };
 
+struct iasecc_sdo_info;
+
 struct iasecc_private_data {
 	struct iasecc_version version;
 	struct iasecc_io_buffer_sizes max_sizes;
@@ -132,6 +134,7 @@ struct iasecc_private_data {
 	unsigned op_method, op_ref;
 
 	struct iasecc_se_info *se_info;
+	struct iasecc_sdo_info *sdo_info;
 };
 
 #endif
@@ -160,6 +160,52 @@ int _sc_card_add_xeddsa_alg(struct sc_card *card, unsigned int key_length,
 		unsigned long flags, unsigned long ext_flags,
 		struct sc_object_id *curve_oid);
 
+/********************************************************************/
+/*             card driver file cache                               */
+/********************************************************************/
+
+/**
+ * Checks whether card drivers may keep data in the file cache, that is
+ * whether use_file_caching is enabled in the pkcs15 framework block.
+ * @param  card  sc_card_t object
+ * @return 1 if the cache may be used, 0 otherwise
+ */
+int sc_card_cache_enabled(struct sc_card *card);
+/**
+ * Reads an entry of the file cache owned by the card driver.
+ * @param  card    sc_card_t object, the entry belongs to its driver
+ * @param  id      unique identifier of the card (e.g. serial number)
+ * @param  id_len  length of the identifier
+ * @param  name    name of the entry, only letters, digits, '-' and '_'
+ * @param  buf     pointer to the newly allocated buffer with the entry
+ * @param  buflen  length of the entry
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_card_cache_read(struct sc_card *card, const u8 *id, size_t id_len,
+		const char *name, u8 **buf, size_t *buflen);
+/**
+ * Writes an entry of the file cache owned by the card driver.
+ * @param  card    sc_card_t object, the entry belongs to its driver
+ * @param  id      unique identifier of the card (e.g. serial number)
+ * @param  id_len  length of the identifier
+ * @param  name    name of the entry, only letters, digits, '-' and '_'
+ * @param  buf     data of the entry
+ * @param  buflen  length of the data
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_card_cache_write(struct sc_card *card, const u8 *id, size_t id_len,
+		const char *name, const u8 *buf, size_t buflen);
+/**
+ * Removes an entry of the file cache owned by the card driver.
+ * @param  card    sc_card_t object, the entry belongs to its driver
+ * @param  id      unique identifier of the card (e.g. serial number)
+ * @param  id_len  length of the identifier
+ * @param  name    name of the entry
+ * @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_card_cache_remove(struct sc_card *card, const u8 *id, size_t id_len,
+		const char *name);
+
 /********************************************************************/
 /*                 pkcs1 padding/encoding functions                 */
 /********************************************************************/
@@ -262,7 +308,7 @@ int sc_apdu_get_octets(sc_context_t *ctx, const sc_apdu_t *apdu, u8 **buf,
  * Sets the status bytes and return data in the APDU
  * @param  ctx     sc_context_t object
  * @param  apdu    the apdu to which the data should be written
- * @param  buf     returned data
+ * @param  buf     returned data, may be apdu->resp if it was received in place
  * @param  len     length of the returned data
  * @return SC_SUCCESS on success and an error code otherwise
  */
@@ -59,6 +59,8 @@ extern "C" {
 #define SC_SEC_OPERATION_DERIVE         0x0004
 #define SC_SEC_OPERATION_WRAP		0x0005
 #define SC_SEC_OPERATION_UNWRAP		0x0006
+#define SC_SEC_OPERATION_ENCRYPT_SYM	0x0007
+#define SC_SEC_OPERATION_DECRYPT_SYM	0x0008
 
 /* sc_security_env flags */
 #define SC_SEC_ENV_ALG_REF_PRESENT	0x0001
@@ -223,6 +225,8 @@ extern "C" {
 #define SC_EVENT_READER_ATTACHED	0x0004
 #define SC_EVENT_READER_DETACHED	0x0008
 #define SC_EVENT_READER_EVENTS		(SC_EVENT_READER_ATTACHED|SC_EVENT_READER_DETACHED)
+/* Report reader events without adjusting the list of readers */
+#define SC_EVENT_NO_READER_DETECTION	0x0100
 
 #define MAX_FILE_SIZE 65535
 
@@ -518,6 +522,9 @@ struct sc_reader_operations {
 	int (*reset)(struct sc_reader *, int);
 	/* Used to pass in PC/SC handles to minidriver */
 	int (*use_reader)(struct sc_context *ctx, void *pcsc_context_handle, void *pcsc_card_handle);
+	/* Refresh the card presence of all readers at once, see
+	 * sc_ctx_detect_card_presence() */
+	int (*refresh_card_presence)(struct sc_context *ctx);
 };
 
 /*
@@ -805,6 +812,15 @@ struct sc_card_operations {
 	int (*wrap)(struct sc_card *card, u8 *out, size_t outlen);
 
 	int (*unwrap)(struct sc_card *card, const u8 *crgram, size_t crgram_len);
+
+	/* Symmetric encryption and decryption with the key of the current
+	 * security environment. The data is a whole number of blocks, no
+	 * padding is done; the driver chains commands as needed.
+	 * Return the number of bytes written to out. */
+	int (*encrypt_sym)(struct sc_card *card, const u8 *in, size_t inlen,
+			u8 *out, size_t outlen);
+	int (*decrypt_sym)(struct sc_card *card, const u8 *in, size_t inlen,
+			u8 *out, size_t outlen);
 };
 
 typedef struct sc_card_driver {
@@ -820,6 +836,17 @@ typedef struct sc_card_driver {
  * @struct sc_thread_context_t
  * Structure for the locking function to use when using libopensc
  * in a multi-threaded application.
+ *
+ * With a thread context, threads may share one sc_context_t:
+ * - cards in different readers can be used concurrently, each sc_card_t
+ *   has its own lock and each PC/SC reader its own PC/SC context, I/O
+ *   buffers and state (see src/tests/threadtest.c);
+ * - threads using the same card are serialized by sc_lock();
+ * - sc_wait_for_event() may block in one thread while other threads use
+ *   cards, and sc_cancel() may interrupt it from any thread;
+ * - sc_ctx_detect_readers(), sc_set_card_driver() and sc_release_context()
+ *   change the context and must not run while other threads use readers
+ *   or cards of the context.
  */
 typedef struct {
 	/** the version number of this structure (0 for this version) */
@@ -886,6 +913,20 @@ typedef struct sc_context {
  */
 int sc_transmit_apdu(struct sc_card *card, struct sc_apdu *apdu);
 
+/** Sends a list of APDUs to the card
+ *  All APDUs are checked before the first one is sent, and the card lock
+ *  is held for the whole list. Unless SC_APDU_LIST_CONTINUE_ON_ERROR is
+ *  set, the list is aborted at the first APDU with error status words.
+ *  @param  card   struct sc_card object to which the APDUs should be send
+ *  @param  apdus  array of sc_apdu_t objects to be send in order
+ *  @param  count  number of APDUs in the array
+ *  @param  flags  SC_APDU_LIST_* flags
+ *  @param  done   if not NULL, receives the number of APDUs completed
+ *  @return SC_SUCCESS on success and an error code otherwise
+ */
+int sc_transmit_apdu_list(struct sc_card *card, struct sc_apdu *apdus, size_t count,
+		unsigned long flags, size_t *done);
+
 void sc_format_apdu(struct sc_card *card, struct sc_apdu *apdu,
 		int cse, int ins, int p1, int p2);
 
@@ -1000,6 +1041,18 @@ int sc_release_context(sc_context_t *ctx);
  */
 int sc_ctx_detect_readers(sc_context_t *ctx);
 
+/**
+ * Refreshes the card presence state of all readers with a single query to
+ * the reader subsystem. The next sc_detect_card_presence() of every reader
+ * returns the refreshed state without querying the reader again, so polling
+ * many readers costs one round trip. A refreshed state that is not used
+ * right away expires, and the reader is then queried on its own.
+ * @param  ctx  OpenSC context
+ * @return SC_SUCCESS on success, SC_ERROR_NOT_SUPPORTED if the reader driver
+ *         can only query the readers one by one and an error code otherwise.
+ */
+int sc_ctx_detect_card_presence(sc_context_t *ctx);
+
 /**
  * In windows: get configuration option from environment or from registers.
  * @param env name of environment variable
@@ -1104,7 +1157,11 @@ int sc_detect_card_presence(sc_reader_t *reader);
  *
  * In case of a reader event (attached/detached), the list of reader is
  * adjusted accordingly. This means that a subsequent call to
- * `sc_ctx_detect_readers()` is not needed.
+ * `sc_ctx_detect_readers()` is not needed. With SC_EVENT_NO_READER_DETECTION
+ * the list is left alone and a reader event is reported, possibly without
+ * an event reader, so that the caller can detect the readers while no other
+ * thread uses them. The reader states are then kept until the caller frees
+ * them.
  *
  * @note Only PC/SC backend implements this. An infinite timeout on macOS does
  * not detect reader events (use a limited timeout instead if needed).
@@ -1116,6 +1173,7 @@ int sc_detect_card_presence(sc_reader_t *reader);
  *   - SC_EVENT_CARD_INSERTED
  *	 - SC_EVENT_READER_ATTACHED
  *	 - SC_EVENT_READER_DETACHED
+ *   and optionally SC_EVENT_NO_READER_DETECTION
  * @param event_reader (OUT) the reader on which the event was detected
  * @param event (OUT) the events that occurred. This is also ORed
  *   from the constants listed above.
@@ -1397,6 +1455,14 @@ int sc_unwrap(struct sc_card *card, const u8 * data,
 int sc_wrap(struct sc_card *card, const u8 * data,
 			 size_t data_len, u8 * out, size_t outlen);
 
+/********************************************************************/
+/*               Symmetric encryption and decryption                */
+/********************************************************************/
+int sc_encrypt_sym(struct sc_card *card, const u8 * in,
+			 size_t inlen, u8 * out, size_t outlen);
+int sc_decrypt_sym(struct sc_card *card, const u8 * in,
+			 size_t inlen, u8 * out, size_t outlen);
+
 /********************************************************************/
 /*             sc_path_t handling functions                         */
 /********************************************************************/
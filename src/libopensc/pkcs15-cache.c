@@ -32,6 +32,7 @@
 #include <limits.h>
 #include <errno.h>
 #include <assert.h>
+#include <ctype.h>
 
 #include "internal.h"
 #include "pkcs15.h"
@@ -221,3 +222,145 @@ int sc_pkcs15_cache_file(struct sc_pkcs15_card *p15card,
 	}
 	return 0;
 }
+
+int sc_card_cache_enabled(struct sc_card *card)
+{
+	scconf_block *conf_block;
+
+	if (card == NULL || card->driver == NULL)
+		return 0;
+
+	conf_block = sc_get_conf_block(card->ctx, "framework", "pkcs15", 1);
+	if (conf_block == NULL)
+		return 0;
+
+	return scconf_get_bool(conf_block, "use_file_caching", 0);
+}
+
+static int generate_card_cache_filename(struct sc_card *card,
+					const u8 *id, size_t id_len, const char *name,
+					char *buf, size_t bufsize)
+{
+	char dir[PATH_MAX];
+	const char *c;
+	size_t u;
+	int r;
+
+	if (card == NULL || card->driver == NULL || id == NULL || id_len == 0
+			|| name == NULL || buf == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	/* the name becomes part of a file name */
+	for (c = name; *c; c++) {
+		if (!isalnum((unsigned char)*c) && *c != '-' && *c != '_')
+			return SC_ERROR_INVALID_ARGUMENTS;
+	}
+
+	r = sc_get_cache_dir(card->ctx, dir, sizeof(dir));
+	if (r)
+		return r;
+
+	snprintf(dir + strlen(dir), sizeof(dir) - strlen(dir), "/%s_",
+			card->driver->short_name);
+	for (u = 0; u < id_len; u++)
+		snprintf(dir + strlen(dir), sizeof(dir) - strlen(dir),
+				"%02X", id[u]);
+	snprintf(dir + strlen(dir), sizeof(dir) - strlen(dir), "_%s", name);
+
+	strlcpy(buf, dir, bufsize);
+	return SC_SUCCESS;
+}
+
+int sc_card_cache_read(struct sc_card *card, const u8 *id, size_t id_len,
+		const char *name, u8 **buf, size_t *buflen)
+{
+	char fname[PATH_MAX];
+	int rv;
+	FILE *f;
+	struct stat stbuf;
+	u8 *data = NULL;
+
+	if (buf == NULL || buflen == NULL)
+		return SC_ERROR_INVALID_ARGUMENTS;
+
+	rv = generate_card_cache_filename(card, id, id_len, name, fname, sizeof(fname));
+	if (rv != SC_SUCCESS)
+		return rv;
+	sc_log(card->ctx, "read cached file %s", fname);
+
+	f = fopen(fname, "rb");
+	if (!f)
+		return SC_ERROR_FILE_NOT_FOUND;
+	if (fstat(fileno(f), &stbuf) || stbuf.st_size <= 0) {
+		fclose(f);
+		return SC_ERROR_FILE_NOT_FOUND;
+	}
+
+	data = malloc((size_t)stbuf.st_size);
+	if (data == NULL) {
+		fclose(f);
+		return SC_ERROR_OUT_OF_MEMORY;
+	}
+
+	if ((size_t)stbuf.st_size != fread(data, 1, (size_t)stbuf.st_size, f)) {
+		fclose(f);
+		free(data);
+		return SC_ERROR_FILE_NOT_FOUND;
+	}
+	fclose(f);
+
+	*buf = data;
+	*buflen = (size_t)stbuf.st_size;
+	return SC_SUCCESS;
+}
+
+int sc_card_cache_write(struct sc_card *card, const u8 *id, size_t id_len,
+		const char *name, const u8 *buf, size_t buflen)
+{
+	char fname[PATH_MAX];
+	int r;
+	FILE *f;
+	size_t c;
+
+	r = generate_card_cache_filename(card, id, id_len, name, fname, sizeof(fname));
+	if (r != SC_SUCCESS)
+		return r;
+
+	f = fopen(fname, "wb");
+	/* If the open failed because the cache directory does
+	 * not exist, create it and a re-try the fopen() call.
+	 */
+	if (f == NULL && errno == ENOENT) {
+		if ((r = sc_make_cache_dir(card->ctx)) < 0)
+			return r;
+		f = fopen(fname, "wb");
+	}
+	if (f == NULL)
+		return SC_ERROR_FILE_NOT_FOUND;
+
+	c = fwrite(buf, 1, buflen, f);
+	fclose(f);
+	if (c != buflen) {
+		sc_log(card->ctx,
+			 "fwrite() wrote only %"SC_FORMAT_LEN_SIZE_T"u bytes",
+			 c);
+		unlink(fname);
+		return SC_ERROR_INTERNAL;
+	}
+	return SC_SUCCESS;
+}
+
+int sc_card_cache_remove(struct sc_card *card, const u8 *id, size_t id_len,
+		const char *name)
+{
+	char fname[PATH_MAX];
+	int r;
+
+	r = generate_card_cache_filename(card, id, id_len, name, fname, sizeof(fname));
+	if (r != SC_SUCCESS)
+		return r;
+
+	if (unlink(fname) != 0 && errno != ENOENT)
+		return SC_ERROR_INTERNAL;
+	return SC_SUCCESS;
+}
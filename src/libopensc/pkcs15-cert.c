@@ -35,8 +35,10 @@
 #include "asn1.h"
 #include "pkcs15.h"
 
+/* With 'take', the certificate keeps the buffer of 'der' instead of a copy
+ * when the certificate spans all of it, and der->value is set to NULL */
 static int
-parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_cert *cert)
+parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_cert *cert, int take)
 {
 	int r;
 	struct sc_algorithm_id sig_alg;
@@ -93,10 +95,15 @@ parse_x509_cert(sc_context_t *ctx, struct sc_pkcs15_der *der, struct sc_pkcs15_c
 		LOG_TEST_RET(ctx, SC_ERROR_INVALID_ASN1_OBJECT, "X.509 certificate not found");
 
 	data_len = objlen + (obj - buf);
-	cert->data.value = malloc(data_len);
-	if (!cert->data.value)
-		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
-	memcpy(cert->data.value, buf, data_len);
+	if (take && data_len == buflen) {
+		cert->data.value = buf;
+		der->value = NULL;
+	} else {
+		cert->data.value = malloc(data_len);
+		if (!cert->data.value)
+			LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+		memcpy(cert->data.value, buf, data_len);
+	}
 	cert->data.len = data_len;
 
 	r = sc_asn1_decode(ctx, asn1_cert, obj, objlen, NULL, NULL);
@@ -355,7 +362,7 @@ sc_pkcs15_pubkey_from_cert(struct sc_context *ctx,
 	if (cert == NULL)
 		return SC_ERROR_OUT_OF_MEMORY;
 
-	rv = parse_x509_cert(ctx, cert_blob, cert);
+	rv = parse_x509_cert(ctx, cert_blob, cert, 0);
 
 	*out = cert->key;
 	cert->key = NULL;
@@ -397,7 +404,8 @@ sc_pkcs15_read_certificate(struct sc_pkcs15_card *p15card, const struct sc_pkcs1
 		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
 	}
 	memset(cert, 0, sizeof(struct sc_pkcs15_cert));
-	if (parse_x509_cert(ctx, &der, cert)) {
+	/* the certificate takes over the buffer read from the card or cache */
+	if (parse_x509_cert(ctx, &der, cert, 1)) {
 		free(der.value);
 		sc_pkcs15_free_certificate(cert);
 		LOG_FUNC_RETURN(ctx, SC_ERROR_INVALID_ASN1_OBJECT);
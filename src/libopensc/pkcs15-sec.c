@@ -457,6 +457,84 @@ int sc_pkcs15_unwrap(struct sc_pkcs15_card *p15card,
 	LOG_FUNC_RETURN(ctx, r);
 }
 
+/*
+ * Symmetric encryption or decryption with a secret key of the card.
+ * The input is a whole number of blocks and no padding is done here, so
+ * that a long message can be processed in parts; with CBC the caller
+ * passes the last cipher block of the previous part as IV of the next one.
+ */
+static int crypt_sym(struct sc_pkcs15_card *p15card,
+		const struct sc_pkcs15_object *obj,
+		int operation, unsigned long flags,
+		const u8 * in, size_t inlen, u8 *out, size_t outlen,
+		const u8 * param, size_t paramlen)
+{
+	sc_context_t *ctx = p15card->card->ctx;
+	int r;
+	sc_algorithm_info_t *alg_info = NULL;
+	sc_security_env_t senv;
+	const struct sc_pkcs15_skey_info *skey = (const struct sc_pkcs15_skey_info *) obj->data;
+	unsigned long pad_flags = 0, sec_flags = 0;
+	sc_sec_env_param_t senv_param;
+
+	LOG_FUNC_CALLED(ctx);
+
+	if ((obj->type & SC_PKCS15_TYPE_CLASS_MASK) != SC_PKCS15_TYPE_SKEY)
+		LOG_TEST_RET(ctx, SC_ERROR_NOT_SUPPORTED, "Key type not supported");
+	if (operation == SC_SEC_OPERATION_ENCRYPT_SYM
+			&& !(skey->usage & SC_PKCS15_PRKEY_USAGE_ENCRYPT))
+		LOG_TEST_RET(ctx, SC_ERROR_NOT_ALLOWED, "This key cannot be used for encryption");
+	if (operation == SC_SEC_OPERATION_DECRYPT_SYM
+			&& !(skey->usage & SC_PKCS15_PRKEY_USAGE_DECRYPT))
+		LOG_TEST_RET(ctx, SC_ERROR_NOT_ALLOWED, "This key cannot be used for decryption");
+	if (inlen % 16 != 0)
+		LOG_TEST_RET(ctx, SC_ERROR_WRONG_LENGTH, "Data is not a whole number of blocks");
+	if (outlen < inlen)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_BUFFER_TOO_SMALL);
+
+	r = format_senv(p15card, obj, &senv, &alg_info);
+	LOG_TEST_RET(ctx, r, "Could not initialize security environment");
+	senv.operation = operation;
+
+	r = sc_get_encoding_flags(ctx, flags, alg_info->flags, &pad_flags, &sec_flags);
+	LOG_TEST_RET(ctx, r, "cannot encode security operation flags");
+	if ((sec_flags & SC_ALGORITHM_AES_CBC_PAD) == SC_ALGORITHM_AES_CBC_PAD)
+		LOG_TEST_RET(ctx, SC_ERROR_NOT_SUPPORTED, "Padding is done by the caller");
+	senv.algorithm_flags = sec_flags;
+
+	if ((sec_flags & SC_ALGORITHM_AES_CBC) > 0) {
+		senv_param = (sc_sec_env_param_t) { SC_SEC_ENV_PARAM_IV, (void*) param, paramlen };
+		LOG_TEST_RET(ctx, sec_env_add_param(&senv, &senv_param), "failed to add IV to security environment");
+	}
+
+	r = use_key(p15card, obj, &senv,
+			operation == SC_SEC_OPERATION_ENCRYPT_SYM ? sc_encrypt_sym : sc_decrypt_sym,
+			in, inlen, out, outlen);
+	LOG_TEST_RET(ctx, r, "use_key() failed");
+
+	LOG_FUNC_RETURN(ctx, r);
+}
+
+int sc_pkcs15_encrypt_sym(struct sc_pkcs15_card *p15card,
+		const struct sc_pkcs15_object *obj,
+		unsigned long flags,
+		const u8 * in, size_t inlen, u8 *out, size_t outlen,
+		const u8 * param, size_t paramlen)
+{
+	return crypt_sym(p15card, obj, SC_SEC_OPERATION_ENCRYPT_SYM, flags,
+			in, inlen, out, outlen, param, paramlen);
+}
+
+int sc_pkcs15_decrypt_sym(struct sc_pkcs15_card *p15card,
+		const struct sc_pkcs15_object *obj,
+		unsigned long flags,
+		const u8 * in, size_t inlen, u8 *out, size_t outlen,
+		const u8 * param, size_t paramlen)
+{
+	return crypt_sym(p15card, obj, SC_SEC_OPERATION_DECRYPT_SYM, flags,
+			in, inlen, out, outlen, param, paramlen);
+}
+
 /*
  * Wrap a key and return a cryptogram
  * <key> is the wrapping key
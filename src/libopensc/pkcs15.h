@@ -697,6 +697,18 @@ int sc_pkcs15_wrap(struct sc_pkcs15_card *p15card,
 		u8 * cryptogram, size_t* crgram_len,
 		const u8 * param, size_t paramlen);
 
+int sc_pkcs15_encrypt_sym(struct sc_pkcs15_card *p15card,
+		const struct sc_pkcs15_object *key,
+		unsigned long flags,
+		const u8 * in, size_t inlen, u8 *out, size_t outlen,
+		const u8 * param, size_t paramlen);
+
+int sc_pkcs15_decrypt_sym(struct sc_pkcs15_card *p15card,
+		const struct sc_pkcs15_object *key,
+		unsigned long flags,
+		const u8 * in, size_t inlen, u8 *out, size_t outlen,
+		const u8 * param, size_t paramlen);
+
 int sc_pkcs15_compute_signature(struct sc_pkcs15_card *p15card,
 				const struct sc_pkcs15_object *prkey_obj,
 				unsigned long alg_flags, const u8 *in,
@@ -26,6 +26,7 @@
 #ifdef ENABLE_PCSC	/* empty file without pcsc */
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -97,6 +98,9 @@ void APDU_LOG(u8 *rbuf, uint16_t rsize)
 #define APDU_LOG(rbuf, rsize)
 #endif
 
+/* How long a state from pcsc_refresh_card_presence() stays current, in ms */
+#define PCSC_REFRESHED_STATE_TTL 500
+
 struct pcsc_global_private_data {
 	int cardmod;
 	SCARDCONTEXT pcsc_ctx;
@@ -130,10 +134,33 @@ struct pcsc_global_private_data {
 
 	sc_reader_t *attached_reader;
 	sc_reader_t *removed_reader;
+
+	/* PnP notification state to skip listing an unchanged set of readers */
+	SCARD_READERSTATE pnp_state;
+	int pnp_unsupported;
+	/* features of the readers seen so far */
+	struct pcsc_reader_features *features;
+};
+
+/* Features detected with SCardControl, reused for readers of the same model */
+struct pcsc_reader_features {
+	char *model;
+	int id_vendor, id_product;
+	DWORD verify_ioctl, verify_ioctl_start, verify_ioctl_finish;
+	DWORD modify_ioctl, modify_ioctl_start, modify_ioctl_finish;
+	DWORD pace_ioctl, pin_properties_ioctl, get_tlv_properties;
+	unsigned long capabilities;
+	size_t max_send_size, max_recv_size;
+	char *vendor;
+	unsigned char version_major, version_minor;
+	struct pcsc_reader_features *next;
 };
 
 struct pcsc_private_data {
 	struct pcsc_global_private_data *gpriv;
+	/* PC/SC serializes all calls on a context, so every reader has its own
+	 * context for its card handle. Readers can then be used in parallel. */
+	SCARDCONTEXT pcsc_ctx;
 	SCARDHANDLE pcsc_card;
 	SCARD_READERSTATE reader_state;
 	DWORD verify_ioctl;
@@ -149,13 +176,23 @@ struct pcsc_private_data {
 	DWORD pin_properties_ioctl;
 
 	DWORD get_tlv_properties;
+	int id_vendor, id_product;
 
 	int locked;
+	/* reader_state was refreshed by pcsc_refresh_card_presence() at
+	 * state_refreshed_at and not yet reported by pcsc_detect_card_presence() */
+	int state_refreshed;
+	unsigned long long state_refreshed_at;
+
+	/* I/O buffers reused by all transmits, see pcsc_transmit() */
+	u8 *sbuf, *rbuf;
+	size_t sbuflen, rbuflen;
 };
 
 static int pcsc_detect_card_presence(sc_reader_t *reader);
 static int pcsc_reconnect(sc_reader_t * reader, DWORD action);
 static int pcsc_connect(sc_reader_t *reader);
+static void pcsc_free_reader_features(struct pcsc_global_private_data *gpriv);
 
 static DWORD pcsc_reset_action(const char *str)
 {
@@ -299,10 +336,33 @@ static int pcsc_internal_transmit(sc_reader_t *reader,
 	return SC_SUCCESS;
 }
 
+/* Grow a per-reader I/O buffer to hold at least len bytes. The buffers are
+ * locked in memory, as they carry PINs and keys, and are cleared after
+ * every use over the bytes actually transferred. */
+static int pcsc_reserve_buffer(u8 **buf, size_t *buflen, size_t len)
+{
+	u8 *p;
+
+	if (*buf != NULL && *buflen >= len)
+		return SC_SUCCESS;
+	if (len < SC_MAX_APDU_BUFFER_SIZE)
+		len = SC_MAX_APDU_BUFFER_SIZE;
+	p = sc_mem_secure_alloc(len);
+	if (p == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	if (*buf != NULL)
+		sc_mem_secure_free(*buf, *buflen);
+	*buf = p;
+	*buflen = len;
+
+	return SC_SUCCESS;
+}
+
 static int pcsc_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
 {
-	size_t ssize, rsize, rbuflen = 0;
-	u8 *sbuf = NULL, *rbuf = NULL;
+	struct pcsc_private_data *priv = reader->drv_data;
+	size_t ssize, rsize, rbuflen;
+	u8 *rbuf;
 	int r;
 
 	/* we always use a at least 258 byte size big return buffer
@@ -310,26 +370,47 @@ static int pcsc_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
 	 * seems to require a larger than necessary return buffer).
 	 * The buffer for the returned data needs to be at least 2 bytes
 	 * larger than the expected data length to store SW1 and SW2. */
-	rsize = rbuflen = apdu->resplen <= 256 ? 258 : apdu->resplen + 2;
-	rbuf     = malloc(rbuflen);
-	if (rbuf == NULL) {
-		r = SC_ERROR_OUT_OF_MEMORY;
-		goto out;
+	rbuflen = apdu->resplen <= 256 ? 258 : apdu->resplen + 2;
+
+	/* the transmit buffers are used under the card lock only, so they
+	 * can be shared by all transmits on the reader */
+	ssize = sc_apdu_get_length(apdu, reader->active_protocol);
+	if (ssize == 0)
+		return SC_ERROR_INTERNAL;
+	r = pcsc_reserve_buffer(&priv->sbuf, &priv->sbuflen, ssize);
+	if (r != SC_SUCCESS)
+		return r;
+
+	if ((apdu->flags & SC_APDU_FLAGS_RESP_IN_PLACE) && apdu->resp != NULL
+			&& apdu->resplen >= 258 && apdu->resplen >= apdu->le + 2) {
+		/* receive directly into the buffer of the caller, which holds
+		 * the data and SW1 SW2 within resplen bytes */
+		rbuf = apdu->resp;
+		rbuflen = apdu->resplen;
+	} else {
+		r = pcsc_reserve_buffer(&priv->rbuf, &priv->rbuflen, rbuflen);
+		if (r != SC_SUCCESS)
+			return r;
+		rbuf = priv->rbuf;
 	}
+	rsize = rbuflen;
 
 	/* encode and log the APDU */
-	r = sc_apdu_get_octets(reader->ctx, apdu, &sbuf, &ssize, reader->active_protocol);
-	if (r != SC_SUCCESS)
+	if (sc_apdu2bytes(reader->ctx, apdu, reader->active_protocol,
+				priv->sbuf, ssize) != SC_SUCCESS) {
+		r = SC_ERROR_INTERNAL;
 		goto out;
+	}
 	if (reader->name)
 		sc_log(reader->ctx, "reader '%s'", reader->name);
-	sc_apdu_log(reader->ctx, sbuf, ssize, 1);
+	sc_apdu_log(reader->ctx, priv->sbuf, ssize, 1);
 
-	r = pcsc_internal_transmit(reader, sbuf, ssize,
+	r = pcsc_internal_transmit(reader, priv->sbuf, ssize,
 				rbuf, &rsize, apdu->control);
 	if (r < 0) {
 		/* unable to transmit ... most likely a reader problem */
 		sc_log(reader->ctx, "unable to transmit");
+		rsize = rbuflen;
 		goto out;
 	}
 	sc_apdu_log(reader->ctx, rbuf, rsize, 0);
@@ -338,31 +419,51 @@ static int pcsc_transmit(sc_reader_t *reader, sc_apdu_t *apdu)
 	r = sc_apdu_set_resp(reader->ctx, apdu, rbuf, rsize);
 
 out:
-	if (sbuf != NULL) {
-		sc_mem_clear(sbuf, ssize);
-		free(sbuf);
-	}
-	if (rbuf != NULL) {
-		sc_mem_clear(rbuf, rbuflen);
-		free(rbuf);
-	}
+	sc_mem_clear(priv->sbuf, ssize);
+	if (rbuf != apdu->resp)
+		sc_mem_clear(rbuf, rsize);
 
 	return r;
 }
 
-/* Calls SCardGetStatusChange on the reader to set ATR and associated flags
- * (card present/changed) */
-static int refresh_attributes(sc_reader_t *reader)
+/* Returns the PC/SC context of the reader, establishing it if needed.
+ * Falls back to the global context if no context can be established. */
+static SCARDCONTEXT pcsc_reader_context(sc_reader_t *reader)
 {
 	struct pcsc_private_data *priv = reader->drv_data;
-	int old_flags = reader->flags;
-	DWORD state, prev_state;
 	LONG rv;
 
-	sc_log(reader->ctx, "%s check", reader->name);
+	if (priv->pcsc_ctx == (SCARDCONTEXT)-1 && !priv->gpriv->cardmod) {
+		rv = priv->gpriv->SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &priv->pcsc_ctx);
+		if (rv != SCARD_S_SUCCESS) {
+			PCSC_TRACE(reader, "SCardEstablishContext(reader) failed", rv);
+			priv->pcsc_ctx = -1;
+		}
+	}
 
-	if (reader->ctx->flags & SC_CTX_FLAG_TERMINATE)
-		return SC_ERROR_NOT_ALLOWED;
+	return priv->pcsc_ctx != (SCARDCONTEXT)-1 ? priv->pcsc_ctx : priv->gpriv->pcsc_ctx;
+}
+
+static void pcsc_release_reader_context(sc_reader_t *reader)
+{
+	struct pcsc_private_data *priv = reader->drv_data;
+
+	if (priv->pcsc_ctx != (SCARDCONTEXT)-1) {
+		if (!(reader->ctx->flags & SC_CTX_FLAG_TERMINATE)) {
+			/* the card handle was opened through this context: close it first */
+			if (priv->pcsc_card)
+				priv->gpriv->SCardDisconnect(priv->pcsc_card, SCARD_LEAVE_CARD);
+			priv->gpriv->SCardReleaseContext(priv->pcsc_ctx);
+		}
+		priv->pcsc_card = 0;
+		priv->pcsc_ctx = -1;
+	}
+}
+
+/* Prepares the reader state for the next SCardGetStatusChange */
+static void prepare_reader_state(sc_reader_t *reader)
+{
+	struct pcsc_private_data *priv = reader->drv_data;
 
 	if (priv->reader_state.szReader == NULL || reader->ctx->flags & SC_READER_REMOVED) {
 		priv->reader_state.szReader = reader->name;
@@ -371,8 +472,15 @@ static int refresh_attributes(sc_reader_t *reader)
 	} else {
 		priv->reader_state.dwCurrentState = priv->reader_state.dwEventState;
 	}
+}
 
-	rv = priv->gpriv->SCardGetStatusChange(priv->gpriv->pcsc_ctx, 0, &priv->reader_state, 1);
+/* Sets ATR and associated flags (card present/changed) from the reader state
+ * returned by SCardGetStatusChange */
+static int update_attributes(sc_reader_t *reader, LONG rv)
+{
+	struct pcsc_private_data *priv = reader->drv_data;
+	int old_flags = reader->flags;
+	DWORD state, prev_state;
 
 	if (rv != SCARD_S_SUCCESS) {
 		if (rv == (LONG)SCARD_E_TIMEOUT) {
@@ -401,6 +509,12 @@ static int refresh_attributes(sc_reader_t *reader)
  		}
 
 		PCSC_TRACE(reader, "SCardGetStatusChange failed", rv);
+		if (rv == (LONG)SCARD_E_INVALID_HANDLE || rv == (LONG)SCARD_E_NO_SERVICE) {
+			/* the card handle goes with the context: the card has to be reconnected */
+			if (old_flags & SC_READER_CARD_PRESENT)
+				reader->flags |= SC_READER_CARD_CHANGED;
+			pcsc_release_reader_context(reader);
+		}
 		return pcsc_to_opensc_error(rv);
 	}
 	state = priv->reader_state.dwEventState;
@@ -468,12 +582,129 @@ static int refresh_attributes(sc_reader_t *reader)
 	return SC_SUCCESS;
 }
 
+/* Calls SCardGetStatusChange on the reader to set ATR and associated flags
+ * (card present/changed) */
+static int refresh_attributes(sc_reader_t *reader)
+{
+	struct pcsc_private_data *priv = reader->drv_data;
+	LONG rv;
+
+	sc_log(reader->ctx, "%s check", reader->name);
+
+	if (reader->ctx->flags & SC_CTX_FLAG_TERMINATE)
+		return SC_ERROR_NOT_ALLOWED;
+
+	priv->state_refreshed = 0;
+	prepare_reader_state(reader);
+	/* the state is queried on the global context, as for all readers at
+	 * once in pcsc_refresh_card_presence(); the context of the reader is
+	 * for its card handle */
+	rv = priv->gpriv->SCardGetStatusChange(priv->gpriv->pcsc_ctx,
+			0, &priv->reader_state, 1);
+
+	return update_attributes(reader, rv);
+}
+
+/* Milliseconds since some fixed point in the past, 0 if unknown */
+static unsigned long long pcsc_clock_ms(void)
+{
+#ifdef _WIN32
+	return GetTickCount64();
+#else
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+	return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+/* Refreshes the state of all readers with a single SCardGetStatusChange. The
+ * next pcsc_detect_card_presence() of every reader reports this state without
+ * querying PC/SC again, unless more than PCSC_REFRESHED_STATE_TTL
+ * milliseconds passed: then the state is no longer current. */
+static int pcsc_refresh_card_presence(sc_context_t *ctx)
+{
+	struct pcsc_global_private_data *gpriv = (struct pcsc_global_private_data *) ctx->reader_drv_data;
+	SCARD_READERSTATE *states = NULL;
+	sc_reader_t **readers = NULL;
+	size_t count = 0, i;
+	unsigned long long now;
+	LONG rv;
+
+	LOG_FUNC_CALLED(ctx);
+
+	if (!gpriv || gpriv->cardmod)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_NOT_SUPPORTED);
+	if (ctx->flags & SC_CTX_FLAG_TERMINATE)
+		LOG_FUNC_RETURN(ctx, SC_ERROR_NOT_ALLOWED);
+	if (sc_ctx_get_reader_count(ctx) == 0)
+		LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+
+	states = calloc(sc_ctx_get_reader_count(ctx), sizeof(SCARD_READERSTATE));
+	readers = calloc(sc_ctx_get_reader_count(ctx), sizeof(sc_reader_t *));
+	if (!states || !readers) {
+		free(states);
+		free(readers);
+		LOG_FUNC_RETURN(ctx, SC_ERROR_OUT_OF_MEMORY);
+	}
+
+	for (i = 0; i < sc_ctx_get_reader_count(ctx); i++) {
+		sc_reader_t *reader = sc_ctx_get_reader(ctx, i);
+		struct pcsc_private_data *priv = reader->drv_data;
+
+		if (reader->flags & SC_READER_REMOVED || priv == NULL)
+			continue;
+		prepare_reader_state(reader);
+		states[count] = priv->reader_state;
+		readers[count] = reader;
+		count++;
+	}
+
+	rv = count ? gpriv->SCardGetStatusChange(gpriv->pcsc_ctx, 0, states, count) : SCARD_S_SUCCESS;
+	if (rv != SCARD_S_SUCCESS && rv != (LONG)SCARD_E_TIMEOUT) {
+		/* e.g. one of the readers is gone; let every reader find out on its own */
+		PCSC_LOG(ctx, "SCardGetStatusChange(all readers) failed", rv);
+		free(states);
+		free(readers);
+		LOG_FUNC_RETURN(ctx, pcsc_to_opensc_error(rv));
+	}
+
+	now = pcsc_clock_ms();
+	for (i = 0; i < count; i++) {
+		struct pcsc_private_data *priv = readers[i]->drv_data;
+
+		priv->reader_state = states[i];
+		priv->state_refreshed = now != 0 && update_attributes(readers[i], rv) == SC_SUCCESS;
+		priv->state_refreshed_at = now;
+	}
+	sc_log(ctx, "Refreshed %lu readers", (unsigned long) count);
+
+	free(states);
+	free(readers);
+	LOG_FUNC_RETURN(ctx, SC_SUCCESS);
+}
+
 static int pcsc_detect_card_presence(sc_reader_t *reader)
 {
-	int rv;
+	struct pcsc_private_data *priv = reader->drv_data;
+	int rv, changed = 0;
 	LOG_FUNC_CALLED(reader->ctx);
 
+	if (priv->state_refreshed) {
+		unsigned long long now = pcsc_clock_ms();
+
+		priv->state_refreshed = 0;
+		if (now >= priv->state_refreshed_at
+				&& now - priv->state_refreshed_at <= PCSC_REFRESHED_STATE_TTL)
+			LOG_FUNC_RETURN(reader->ctx, reader->flags);
+		/* query again, without losing a change seen in the refresh */
+		sc_log(reader->ctx, "%s: refreshed state is outdated", reader->name);
+		changed = reader->flags & SC_READER_CARD_CHANGED;
+	}
+
 	rv = refresh_attributes(reader);
+	reader->flags |= changed;
 	if (rv != SC_SUCCESS)
 		LOG_FUNC_RETURN(reader->ctx, rv);
 	LOG_FUNC_RETURN(reader->ctx, reader->flags);
@@ -616,13 +847,21 @@ static int pcsc_connect(sc_reader_t *reader)
 
 
 	if (!priv->gpriv->cardmod) {
-		rv = priv->gpriv->SCardConnect(priv->gpriv->pcsc_ctx, reader->name,
+		rv = priv->gpriv->SCardConnect(pcsc_reader_context(reader), reader->name,
 				priv->gpriv->connect_exclusive ? SCARD_SHARE_EXCLUSIVE : SCARD_SHARE_SHARED,
 				protocol, &card_handle, &active_proto);
+		if (rv == (LONG)SCARD_E_INVALID_HANDLE || rv == (LONG)SCARD_E_NO_SERVICE
+				|| rv == (LONG)SCARD_E_SERVICE_STOPPED) {
+			/* the context of the reader did not survive a restart of the service */
+			pcsc_release_reader_context(reader);
+			rv = priv->gpriv->SCardConnect(pcsc_reader_context(reader), reader->name,
+					priv->gpriv->connect_exclusive ? SCARD_SHARE_EXCLUSIVE : SCARD_SHARE_SHARED,
+					protocol, &card_handle, &active_proto);
+		}
 #ifdef __APPLE__
 		if (rv == (LONG)SCARD_E_SHARING_VIOLATION) {
 			sleep(1); /* Try again to compete with Tokend probes */
-			rv = priv->gpriv->SCardConnect(priv->gpriv->pcsc_ctx, reader->name,
+			rv = priv->gpriv->SCardConnect(pcsc_reader_context(reader), reader->name,
 					priv->gpriv->connect_exclusive ? SCARD_SHARE_EXCLUSIVE : SCARD_SHARE_SHARED,
 					protocol, &card_handle, &active_proto);
 		}
@@ -671,6 +910,8 @@ static int pcsc_disconnect(sc_reader_t * reader)
 		LONG rv = priv->gpriv->SCardDisconnect(priv->pcsc_card, priv->gpriv->disconnect_action);
 		PCSC_TRACE(reader, "SCardDisconnect returned", rv);
 	}
+	if (!priv->gpriv->cardmod)
+		priv->pcsc_card = 0;
 	reader->flags = 0;
 	return SC_SUCCESS;
 }
@@ -755,6 +996,13 @@ static int pcsc_release(sc_reader_t *reader)
 {
 	struct pcsc_private_data *priv = reader->drv_data;
 
+	if (priv) {
+		pcsc_release_reader_context(reader);
+		if (priv->sbuf)
+			sc_mem_secure_clear_free(priv->sbuf, priv->sbuflen);
+		if (priv->rbuf)
+			sc_mem_secure_clear_free(priv->rbuf, priv->rbuflen);
+	}
 	free(priv);
 	return SC_SUCCESS;
 }
@@ -962,6 +1210,7 @@ out:
 	if (gpriv != NULL) {
 		if (gpriv->dlhandle != NULL)
 			sc_dlclose(gpriv->dlhandle);
+		pcsc_free_reader_features(gpriv);
 		free(gpriv);
 	}
 
@@ -1222,6 +1471,8 @@ static void detect_reader_features(sc_reader_t *reader, SCARDHANDLE card_handle)
 	/* Some readers claim to have PinPAD support even if they have not */
 	if ((reader->capabilities & SC_READER_CAP_PIN_PAD) &&
 		part10_get_vendor_product(reader, card_handle, &id_vendor, &id_product) == SC_SUCCESS) {
+		priv->id_vendor = id_vendor;
+		priv->id_product = id_product;
 		/* HID Global OMNIKEY 3x21/6121 Smart Card Reader, fixed in libccid 1.4.29 (remove when last supported OS is using 1.4.29) */
 		if ((id_vendor == 0x076B && id_product == 0x3031) ||
 			(id_vendor == 0x076B && id_product == 0x6632)) {
@@ -1302,7 +1553,10 @@ static void detect_reader_features(sc_reader_t *reader, SCARDHANDLE card_handle)
 		}
 
 		/* debug the product and vendor ID of the reader */
-		part10_get_vendor_product(reader, card_handle, NULL, NULL);
+		if (part10_get_vendor_product(reader, card_handle, &id_vendor, &id_product) == SC_SUCCESS) {
+			priv->id_vendor = id_vendor;
+			priv->id_product = id_product;
+		}
 	}
 
 	if(gpriv->SCardGetAttrib != NULL) {
@@ -1325,6 +1579,194 @@ static void detect_reader_features(sc_reader_t *reader, SCARDHANDLE card_handle)
 	}
 }
 
+/* The model of a reader is its name without the slot numbers, which
+ * pcsc-lite appends as " %02X %02X" */
+static char *reader_model(const char *name)
+{
+	size_t len = strlen(name);
+	char *model;
+
+#ifndef _WIN32
+	if (len > 6 && name[len - 6] == ' ' && name[len - 3] == ' '
+			&& isxdigit((unsigned char) name[len - 5]) && isxdigit((unsigned char) name[len - 4])
+			&& isxdigit((unsigned char) name[len - 2]) && isxdigit((unsigned char) name[len - 1]))
+		len -= 6;
+#endif
+	model = malloc(len + 1);
+	if (model) {
+		memcpy(model, name, len);
+		model[len] = '\0';
+	}
+
+	return model;
+}
+
+static void pcsc_free_reader_features(struct pcsc_global_private_data *gpriv)
+{
+	while (gpriv->features) {
+		struct pcsc_reader_features *next = gpriv->features->next;
+
+		free(gpriv->features->model);
+		free(gpriv->features->vendor);
+		free(gpriv->features);
+		gpriv->features = next;
+	}
+}
+
+/* Looks up the features seen before for a reader of the same model and with
+ * the same USB vendor and product IDs. For a model that reports its IDs, they
+ * are read with its known GET_TLV_PROPERTIES IOCTL alone, and the other
+ * IOCTLs of detect_reader_features() are skipped. */
+static struct pcsc_reader_features *pcsc_find_reader_features(sc_reader_t *reader,
+		SCARDHANDLE card_handle)
+{
+	struct pcsc_private_data *priv = reader->drv_data;
+	struct pcsc_reader_features *f;
+	char *model = reader_model(reader->name);
+	int id_vendor = -1, id_product = -1, ids_read = 0, r;
+
+	if (!model)
+		return NULL;
+	for (f = priv->gpriv->features; f; f = f->next) {
+		if (strcmp(f->model, model))
+			continue;
+		if (!f->get_tlv_properties)
+			/* the model does not tell its IDs */
+			break;
+		if (!ids_read) {
+			priv->get_tlv_properties = f->get_tlv_properties;
+			r = part10_get_vendor_product(reader, card_handle, &id_vendor, &id_product);
+			priv->get_tlv_properties = 0;
+			if (r != SC_SUCCESS) {
+				f = NULL;
+				break;
+			}
+			ids_read = 1;
+		}
+		if (f->id_vendor == id_vendor && f->id_product == id_product)
+			break;
+	}
+	free(model);
+
+	return f;
+}
+
+/* Applies the features found by pcsc_find_reader_features() */
+static void pcsc_apply_reader_features(sc_reader_t *reader, const struct pcsc_reader_features *f)
+{
+	struct pcsc_private_data *priv = reader->drv_data;
+
+	sc_log(reader->ctx, "%s: using features of %s (%04x:%04x)", reader->name,
+			f->model, f->id_vendor & 0xffff, f->id_product & 0xffff);
+	priv->verify_ioctl = f->verify_ioctl;
+	priv->verify_ioctl_start = f->verify_ioctl_start;
+	priv->verify_ioctl_finish = f->verify_ioctl_finish;
+	priv->modify_ioctl = f->modify_ioctl;
+	priv->modify_ioctl_start = f->modify_ioctl_start;
+	priv->modify_ioctl_finish = f->modify_ioctl_finish;
+	priv->pace_ioctl = f->pace_ioctl;
+	priv->pin_properties_ioctl = f->pin_properties_ioctl;
+	priv->get_tlv_properties = f->get_tlv_properties;
+	priv->id_vendor = f->id_vendor;
+	priv->id_product = f->id_product;
+	reader->capabilities |= f->capabilities;
+	reader->max_send_size = f->max_send_size;
+	reader->max_recv_size = f->max_recv_size;
+	if (f->vendor) {
+		free(reader->vendor);
+		reader->vendor = strdup(f->vendor);
+	}
+	reader->version_major = f->version_major;
+	reader->version_minor = f->version_minor;
+}
+
+/* Remembers the features detected by detect_reader_features() */
+static void pcsc_save_reader_features(sc_reader_t *reader, unsigned long capabilities)
+{
+	struct pcsc_private_data *priv = reader->drv_data;
+	struct pcsc_reader_features *f = calloc(1, sizeof *f);
+
+	if (!f)
+		return;
+	f->model = reader_model(reader->name);
+	if (!f->model || (reader->vendor && !(f->vendor = strdup(reader->vendor)))) {
+		free(f->model);
+		free(f);
+		return;
+	}
+	f->id_vendor = priv->id_vendor;
+	f->id_product = priv->id_product;
+	f->verify_ioctl = priv->verify_ioctl;
+	f->verify_ioctl_start = priv->verify_ioctl_start;
+	f->verify_ioctl_finish = priv->verify_ioctl_finish;
+	f->modify_ioctl = priv->modify_ioctl;
+	f->modify_ioctl_start = priv->modify_ioctl_start;
+	f->modify_ioctl_finish = priv->modify_ioctl_finish;
+	f->pace_ioctl = priv->pace_ioctl;
+	f->pin_properties_ioctl = priv->pin_properties_ioctl;
+	f->get_tlv_properties = priv->get_tlv_properties;
+	f->capabilities = reader->capabilities & ~capabilities;
+	f->max_send_size = reader->max_send_size;
+	f->max_recv_size = reader->max_recv_size;
+	f->version_major = reader->version_major;
+	f->version_minor = reader->version_minor;
+
+	f->next = priv->gpriv->features;
+	priv->gpriv->features = f;
+}
+
+/* Checks the PnP notification pseudo reader. Returns 0 if the set of readers
+ * did not change since the last listing. */
+static int pcsc_readers_changed(sc_context_t *ctx)
+{
+#ifdef __APPLE__
+	/* OS X 10.6.2 - 10.12.6 do not support PnP notification */
+	(void) ctx;
+	return 1;
+#else
+	struct pcsc_global_private_data *gpriv = (struct pcsc_global_private_data *) ctx->reader_drv_data;
+	LONG rv;
+
+	if (gpriv->pnp_state.szReader == NULL || gpriv->pcsc_ctx == (SCARDCONTEXT)-1)
+		return 1;
+
+	rv = gpriv->SCardGetStatusChange(gpriv->pcsc_ctx, 0, &gpriv->pnp_state, 1);
+	if (rv == (LONG)SCARD_E_TIMEOUT)
+		return 0;
+	/* changed or failed: list the readers again and re-arm the notification */
+	gpriv->pnp_state.szReader = NULL;
+	if (rv != SCARD_S_SUCCESS)
+		PCSC_LOG(ctx, "SCardGetStatusChange(PnP) failed", rv);
+	return 1;
+#endif
+}
+
+/* Records the current PnP notification state before listing the readers */
+static void pcsc_arm_pnp_notification(sc_context_t *ctx)
+{
+#ifndef __APPLE__
+	struct pcsc_global_private_data *gpriv = (struct pcsc_global_private_data *) ctx->reader_drv_data;
+	LONG rv;
+
+	if (gpriv->pnp_unsupported)
+		return;
+
+	gpriv->pnp_state.szReader = "\\\\?PnP?\\Notification";
+	gpriv->pnp_state.dwCurrentState = SCARD_STATE_UNAWARE;
+	gpriv->pnp_state.dwEventState = SCARD_STATE_UNAWARE;
+	rv = gpriv->SCardGetStatusChange(gpriv->pcsc_ctx, 0, &gpriv->pnp_state, 1);
+	if (rv != SCARD_S_SUCCESS || gpriv->pnp_state.dwEventState & SCARD_STATE_UNKNOWN) {
+		sc_log(ctx, "PnP notification not supported");
+		gpriv->pnp_unsupported = gpriv->pnp_state.dwEventState & SCARD_STATE_UNKNOWN;
+		gpriv->pnp_state.szReader = NULL;
+		return;
+	}
+	gpriv->pnp_state.dwCurrentState = gpriv->pnp_state.dwEventState & ~SCARD_STATE_CHANGED;
+#else
+	(void) ctx;
+#endif
+}
+
 int pcsc_add_reader(sc_context_t *ctx,
 	   	char *reader_name, size_t reader_name_len,
 		sc_reader_t **out_reader)
@@ -1347,6 +1789,7 @@ int pcsc_add_reader(sc_context_t *ctx,
 	}
 
 	priv->gpriv = gpriv;
+	priv->pcsc_ctx = -1;
 
 	reader->drv_data = priv;
 	reader->ops = &pcsc_ops;
@@ -1377,7 +1820,7 @@ err1:
 static int pcsc_detect_readers(sc_context_t *ctx)
 {
 	struct pcsc_global_private_data *gpriv = (struct pcsc_global_private_data *) ctx->reader_drv_data;
-	DWORD active_proto, reader_buf_size = 0;
+	DWORD active_proto, reader_buf_size = 0, buf_size = 0;
 	SCARDHANDLE card_handle;
 	LONG rv;
 	char *reader_buf = NULL, *reader_name;
@@ -1398,10 +1841,17 @@ static int pcsc_detect_readers(sc_context_t *ctx)
 		goto out;
 	}
 
-	sc_log(ctx, "Probing PC/SC readers");
 	gpriv->attached_reader = NULL;
 	gpriv->removed_reader = NULL;
 
+	if (!pcsc_readers_changed(ctx)) {
+		sc_log(ctx, "PC/SC readers unchanged");
+		ret = SC_SUCCESS;
+		goto out;
+	}
+
+	sc_log(ctx, "Probing PC/SC readers");
+
 	do {
 		if (gpriv->pcsc_ctx == (SCARDCONTEXT)-1) {
 			/*
@@ -1466,14 +1916,27 @@ static int pcsc_detect_readers(sc_context_t *ctx)
 		}
 	} while (rv != SCARD_S_SUCCESS);
 
-	/* The +2 below is to make sure we have zero terminators, in case we get invalid data */
-	reader_buf = calloc(reader_buf_size+2, sizeof(char));
-	if (!reader_buf) {
-		ret = SC_ERROR_OUT_OF_MEMORY;
-		goto out;
-	}
-	rv = gpriv->SCardListReaders(gpriv->pcsc_ctx, mszGroups, reader_buf,
-			(LPDWORD) &reader_buf_size);
+	/* Arm the notification before listing: a reader attached from now on
+	 * is either in the list or reported by the next pcsc_readers_changed() */
+	pcsc_arm_pnp_notification(ctx);
+
+	/* A reader may come between the size query and the listing */
+	do {
+		rv = gpriv->SCardListReaders(gpriv->pcsc_ctx, mszGroups, NULL,
+				(LPDWORD) &reader_buf_size);
+		if (rv != SCARD_S_SUCCESS)
+			break;
+		buf_size = reader_buf_size;
+		free(reader_buf);
+		/* The +2 below is to make sure we have zero terminators, in case we get invalid data */
+		reader_buf = calloc(buf_size+2, sizeof(char));
+		if (!reader_buf) {
+			ret = SC_ERROR_OUT_OF_MEMORY;
+			goto out;
+		}
+		rv = gpriv->SCardListReaders(gpriv->pcsc_ctx, mszGroups, reader_buf,
+				(LPDWORD) &reader_buf_size);
+	} while (rv != SCARD_S_SUCCESS && reader_buf_size > buf_size);
 	if (rv != SCARD_S_SUCCESS) {
 		PCSC_LOG(ctx, "SCardListReaders failed", rv);
 		ret = pcsc_to_opensc_error(rv);
@@ -1557,8 +2020,18 @@ static int pcsc_detect_readers(sc_context_t *ctx)
 		}
 
 		if (rv == SCARD_S_SUCCESS) {
+			unsigned long capabilities = reader->capabilities;
+			struct pcsc_reader_features *features;
+
+			features = pcsc_find_reader_features(reader, card_handle);
+			if (features) {
+				pcsc_apply_reader_features(reader, features);
+				gpriv->SCardDisconnect(card_handle, SCARD_LEAVE_CARD);
+				continue;
+			}
 			detect_reader_features(reader, card_handle);
 			gpriv->SCardDisconnect(card_handle, SCARD_LEAVE_CARD);
+			pcsc_save_reader_features(reader, capabilities);
 		}
 	}
 
@@ -1793,7 +2266,20 @@ out:
 	if (r < 0 && r != SC_ERROR_EVENT_TIMEOUT)
 		detect_readers = 1;
 
-	if (detect_readers) {
+	if (detect_readers && (event_mask & SC_EVENT_NO_READER_DETECTION)) {
+		/* The caller detects the readers. Without knowing whether a
+		 * reader was attached or removed, report the hotplug event as an
+		 * attached reader. */
+		if (detected_hotplug && event_reader && event && !*event) {
+			*event = SC_EVENT_READER_ATTACHED;
+			r = SC_SUCCESS;
+		}
+		detected_hotplug = 0;
+		/* readers are never deleted from the list, keep their states
+		 * unless an error occurred */
+		if (r == SC_SUCCESS)
+			detect_readers = 0;
+	} else if (detect_readers) {
 		pcsc_detect_readers(ctx);
 	}
 
@@ -2586,6 +3072,7 @@ struct sc_reader_driver * sc_get_pcsc_driver(void)
 	pcsc_ops.detect_readers = pcsc_detect_readers;
 	pcsc_ops.transmit = pcsc_transmit;
 	pcsc_ops.detect_card_presence = pcsc_detect_card_presence;
+	pcsc_ops.refresh_card_presence = pcsc_refresh_card_presence;
 	pcsc_ops.lock = pcsc_lock;
 	pcsc_ops.unlock = pcsc_unlock;
 	pcsc_ops.release = pcsc_release;
@@ -306,6 +306,13 @@ typedef struct sc_file {
 #define SC_APDU_FLAGS_NO_RETRY_WL	0x00000004UL
 /* APDU is from Secure Messaging  */
 #define SC_APDU_FLAGS_NO_SM		0x00000008UL
+/* the reader driver may receive the response, SW1 SW2 included, directly
+ * into the resplen bytes of resp, without a copy
+ */
+#define SC_APDU_FLAGS_RESP_IN_PLACE	0x00000010UL
+
+/* sc_transmit_apdu_list(): do not stop at APDUs with error status words */
+#define SC_APDU_LIST_CONTINUE_ON_ERROR	0x00000001UL
 
 #define SC_APDU_ALLOCATE_FLAG		0x01
 #define SC_APDU_ALLOCATE_FLAG_DATA	0x02
@@ -30,6 +30,8 @@
 #include "common/compat_strnlen.h"
 #ifdef ENABLE_OPENSSL
 #include <openssl/sha.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
 #else
 #define SHA_DIGEST_LENGTH	20
 #endif
@@ -41,6 +43,8 @@
 
 struct pkcs15_slot_data {
 	struct sc_pkcs15_object *auth_obj;
+	/* Bit of this slot in the 'slots' mask of the objects, 0 if none left */
+	unsigned long slot_bit;
 };
 #define slot_data(p)		((struct pkcs15_slot_data *) (p))
 #define slot_data_auth(p)	(((p) && slot_data(p)) ? slot_data(p)->auth_obj : NULL)
@@ -59,11 +63,37 @@ struct pkcs15_slot_data {
 	attr->ulValueLen = size;
 
 #define MAX_OBJECTS	128
+#ifdef ENABLE_OPENSSL
+/* HMAC_DRBG (NIST SP 800-90A) state seeded from the card, see pkcs15_get_random() */
+#define RANDOM_POOL_SEED_LEN	48
+struct pkcs15_random_pool {
+	unsigned char			key[SHA256_DIGEST_LENGTH];
+	unsigned char			v[SHA256_DIGEST_LENGTH];
+	/* bytes that may still be generated before seeding again, 0 if unseeded */
+	size_t				left;
+#if !defined(_WIN32)
+	pid_t				pid;
+#endif
+};
+#endif
+
+/* PIN status last read from the card, see pkcs15_get_pin_info() */
+struct pkcs15_pin_status {
+	struct sc_pkcs15_object *	auth_obj;
+	unsigned int			cache_generation;
+	sc_timestamp_t			expires;
+};
+
 struct pkcs15_fw_data {
 	struct sc_pkcs15_card *		p15_card;
 	struct pkcs15_any_object *	objects[MAX_OBJECTS];
 	unsigned int			num_objects;
+	unsigned int			num_slots;
 	unsigned int			locked;
+	struct pkcs15_pin_status	pin_status[SC_PKCS15_MAX_PINS];
+#ifdef ENABLE_OPENSSL
+	struct pkcs15_random_pool	random_pool;
+#endif
 	unsigned char user_puk[64];
 	unsigned int user_puk_len;
 };
@@ -72,6 +102,8 @@ struct pkcs15_any_object {
 	struct sc_pkcs11_object		base;
 	unsigned int			refcount;
 	size_t				size;
+	/* Slots of the card listing this object, see pkcs15_slot_bit() */
+	unsigned long			slots;
 	struct sc_pkcs15_object *	p15_object;
 	struct pkcs15_pubkey_object *	related_pubkey;
 	struct pkcs15_cert_object *	related_cert;
@@ -83,6 +115,9 @@ struct pkcs15_cert_object {
 
 	struct sc_pkcs15_cert_info *	cert_info;
 	struct sc_pkcs15_cert *		cert_data;
+	/* object owning cert_data, when it is shared with an object of the same
+	 * certificate; a reference to it is held */
+	struct pkcs15_cert_object *	cert_owner;
 };
 #define cert_flags		base.base.flags
 #define cert_p15obj		base.p15_object
@@ -137,6 +172,9 @@ struct pkcs15_skey_object {
 
 	struct sc_pkcs15_skey_info *info;
 	struct sc_pkcs15_skey *valueXXXX;
+	/* session key held in memory only: the PKCS#15 object, its info
+	 * and the key value are freed together with this object */
+	int owned;
 };
 
 #define is_skey(obj) ((__p15_type(obj) & SC_PKCS15_TYPE_CLASS_MASK) == SC_PKCS15_TYPE_SKEY)
@@ -213,6 +251,9 @@ static CK_RV	get_ec_pubkey_point(struct sc_pkcs15_pubkey *, CK_ATTRIBUTE_PTR);
 static CK_RV	get_ec_pubkey_params(struct sc_pkcs15_pubkey *, CK_ATTRIBUTE_PTR);
 static int	lock_card(struct pkcs15_fw_data *);
 static int	unlock_card(struct pkcs15_fw_data *);
+static CK_RV	pkcs15_skey_set_value(struct pkcs15_skey_object *, const CK_BYTE *, CK_ULONG);
+static CK_RV	pkcs15_prkey_decrypt(struct sc_pkcs11_session *, void *, CK_MECHANISM_PTR,
+					CK_BYTE_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG_PTR);
 static int	reselect_app_df(sc_pkcs15_card_t *p15card);
 
 #ifdef USE_PKCS15_INIT
@@ -397,6 +438,9 @@ pkcs15_unbind(struct sc_pkcs11_card *p11card)
 		}
 		fw_data->p15_card = NULL;
 
+#ifdef ENABLE_OPENSSL
+		sc_mem_clear(&fw_data->random_pool, sizeof(fw_data->random_pool));
+#endif
 		free(fw_data);
 		p11card->fws_data[idx] = NULL;
 	}
@@ -519,6 +563,20 @@ __pkcs15_release_object(struct pkcs15_any_object *obj)
 	return 0;
 }
 
+/* Free a secret key that was only held in memory, see pkcs15_create_secret_key() */
+static void
+pkcs15_free_session_skey(struct sc_pkcs15_object *p15_object)
+{
+	struct sc_pkcs15_skey_info *info = (struct sc_pkcs15_skey_info *) p15_object->data;
+
+	if (info) {
+		if (info->data.value)
+			sc_mem_secure_clear_free(info->data.value, info->data.len);
+		free(info);
+	}
+	free(p15_object);
+}
+
 #ifdef USE_PKCS15_INIT
 static int
 __pkcs15_delete_object(struct pkcs15_fw_data *fw_data, struct pkcs15_any_object *obj)
@@ -540,6 +598,62 @@ __pkcs15_delete_object(struct pkcs15_fw_data *fw_data, struct pkcs15_any_object
 }
 #endif
 
+/* Refresh the tries left and login state of a PIN. Applications ask for the
+ * token info very often, so the status read from the card is reused for
+ * 'pin_status_ttl' milliseconds, unless the card was reset or the PIN was
+ * used in between (see 'cache_generation'). The reader is asked for a card
+ * change, like a new PC/SC event counter, before a cached status is used:
+ * C_GetTokenInfo() does not run card_detect() while the token is present. */
+static int
+pkcs15_get_pin_info(struct sc_pkcs11_card *p11card, struct pkcs15_fw_data *fw_data,
+		struct sc_pkcs15_object *auth)
+{
+	struct pkcs15_pin_status *status = NULL;
+	sc_timestamp_t now = 0;
+	unsigned int i;
+	int cached, rv;
+
+	if (sc_pkcs11_conf.pin_status_ttl > 0) {
+		for (i = 0; i < SC_PKCS15_MAX_PINS; i++) {
+			if (fw_data->pin_status[i].auth_obj == auth
+					|| fw_data->pin_status[i].auth_obj == NULL) {
+				status = &fw_data->pin_status[i];
+				break;
+			}
+		}
+		now = get_current_time();
+		cached = status && status->auth_obj == auth
+				&& status->cache_generation == p11card->cache_generation
+				&& now != 0 && now < status->expires;
+		if (cached) {
+			rv = sc_detect_card_presence(p11card->reader);
+			if (rv >= 0 && (!(rv & SC_READER_CARD_PRESENT) || (rv & SC_READER_CARD_CHANGED))) {
+				sc_log(context, "%s: card changed, reading the PIN status again",
+						p11card->reader->name);
+				/* leave the change to the next card_detect() */
+				p11card->card_changed = 1;
+				p11card->cache_generation++;
+				cached = 0;
+			} else if (rv < 0 && rv != SC_ERROR_NOT_SUPPORTED) {
+				cached = 0;
+			}
+		}
+		if (cached) {
+			sc_log(context, "Using cached status of PIN '%.*s'",
+					(int) sizeof auth->label, auth->label);
+			return SC_SUCCESS;
+		}
+	}
+
+	rv = sc_pkcs15_get_pin_info(fw_data->p15_card, auth);
+	if (status && rv == SC_SUCCESS && now != 0) {
+		status->auth_obj = auth;
+		status->cache_generation = p11card->cache_generation;
+		status->expires = now + sc_pkcs11_conf.pin_status_ttl;
+	}
+	return rv;
+}
+
 CK_RV C_GetTokenInfo(CK_SLOT_ID slotID, CK_TOKEN_INFO_PTR pInfo)
 {
 	struct sc_pkcs11_slot *slot;
@@ -594,7 +708,7 @@ CK_RV C_GetTokenInfo(CK_SLOT_ID slotID, CK_TOKEN_INFO_PTR pInfo)
 			goto out;
 		}
 
-		sc_pkcs15_get_pin_info(p15card, auth);
+		pkcs15_get_pin_info(slot->p11card, fw_data, auth);
 
 		if (pin_info->tries_left >= 0) {
 			if (pin_info->tries_left == 1 || pin_info->max_tries == 1)
@@ -1017,22 +1131,60 @@ pkcs15_bind_related_objects(struct pkcs15_fw_data *fw_data)
 }
 
 
+/* Looks for an object of the same certificate that was read already */
+static struct pkcs15_cert_object *
+pkcs15_cert_find_read(struct pkcs15_fw_data *fw_data, struct pkcs15_cert_object *cert)
+{
+	struct sc_pkcs15_cert_info *info = cert->cert_info;
+	unsigned int i;
+
+	for (i = 0; i < fw_data->num_objects; i++) {
+		struct pkcs15_cert_object *other = (struct pkcs15_cert_object *) fw_data->objects[i];
+		struct sc_pkcs15_cert_info *other_info;
+
+		if (other == cert || !is_cert(fw_data->objects[i]) || !other->cert_data)
+			continue;
+		other_info = other->cert_info;
+		if (info->value.len) {
+			if (info->value.len == other_info->value.len
+					&& !memcmp(info->value.value, other_info->value.value, info->value.len))
+				return other->cert_owner ? other->cert_owner : other;
+		} else if (info->path.len && !other_info->value.len
+				&& sc_compare_path(&info->path, &other_info->path)
+				&& info->path.index == other_info->path.index
+				&& info->path.count == other_info->path.count) {
+			return other->cert_owner ? other->cert_owner : other;
+		}
+	}
+
+	return NULL;
+}
+
 /* We deferred reading of the cert until needed, as it may be
  * a private object, so we must wait till login to read  */
 static int
 check_cert_data_read(struct pkcs15_fw_data *fw_data, struct pkcs15_cert_object *cert)
 {
 	struct pkcs15_pubkey_object *obj2;
-	int rv;
+	struct pkcs15_cert_object *owner;
+	int rv = 0;
 
 	if (!cert)
 		return SC_ERROR_OBJECT_NOT_FOUND;
 
 	if (cert->cert_data)
 		return 0;
-	rv = sc_pkcs15_read_certificate(fw_data->p15_card, cert->cert_info, &cert->cert_data);
-	if (rv < 0)
-		return rv;
+	/* Keep a single copy of a certificate listed more than once */
+	owner = pkcs15_cert_find_read(fw_data, cert);
+	if (owner) {
+		owner->base.refcount++;
+		cert->cert_owner = owner;
+		cert->cert_data = owner->cert_data;
+	} else {
+		rv = sc_pkcs15_read_certificate(fw_data->p15_card, cert->cert_info, &cert->cert_data);
+		if (rv < 0)
+			return rv;
+	}
 
 	obj2 = cert->cert_pubkey;
 	/* make a copy of public key from the cert data */
@@ -1049,11 +1201,25 @@ check_cert_data_read(struct pkcs15_fw_data *fw_data, struct pkcs15_cert_object *
 }
 
 
+/* The objects of one application are shared by all the slots created for it.
+ * Each of these slots gets a bit in the object 'slots' mask, so that checking
+ * whether an object is already listed in a slot does not need to scan the
+ * slot's object list. */
+static unsigned long
+pkcs15_slot_bit(struct sc_pkcs11_slot *slot)
+{
+	struct pkcs15_slot_data *data = slot_data(slot->fw_data);
+
+	return data ? data->slot_bit : 0;
+}
+
+
 static void
 pkcs15_add_object(struct sc_pkcs11_slot *slot, struct pkcs15_any_object *obj,
 		  CK_OBJECT_HANDLE_PTR pHandle)
 {
 	unsigned int i;
+	unsigned long slot_bit;
 	struct pkcs15_fw_data *card_fw_data;
 	CK_OBJECT_HANDLE handle =
 		(CK_OBJECT_HANDLE)(uintptr_t)obj; /* cast pointer to long, will truncate on Win64 */
@@ -1063,7 +1229,8 @@ pkcs15_add_object(struct sc_pkcs11_slot *slot, struct pkcs15_any_object *obj,
 	if (obj->base.flags & (SC_PKCS11_OBJECT_HIDDEN | SC_PKCS11_OBJECT_RECURS))
 		return;
 
-	if (list_contains(&slot->objects, obj))
+	slot_bit = pkcs15_slot_bit(slot);
+	if (slot_bit != 0 ? (obj->slots & slot_bit) != 0 : list_contains(&slot->objects, obj) != 0)
 		return;
 
 	if (pHandle != NULL)
@@ -1074,6 +1241,7 @@ pkcs15_add_object(struct sc_pkcs11_slot *slot, struct pkcs15_any_object *obj,
 		   slot->id, obj->base.handle, handle);
 	obj->base.handle = handle;
 	obj->base.flags |= SC_PKCS11_OBJECT_SEEN;
+	obj->slots |= slot_bit;
 	obj->refcount++;
 
 	/* Add related objects
@@ -1240,8 +1408,12 @@ pkcs15_create_slot(struct sc_pkcs11_card *p11card, struct pkcs15_fw_data *fw_dat
 	slot->slot_info.flags |= CKF_TOKEN_PRESENT;
 
 	/* Fill in the slot/token info from pkcs15 data */
-	if (fw_data)
+	if (fw_data) {
 		pkcs15_init_slot(fw_data->p15_card, slot, auth, app_info);
+		/* Slots beyond the width of the mask fall back to list lookups */
+		if (slot->fw_data && fw_data->num_slots < sizeof(unsigned long) * 8)
+			slot_data(slot->fw_data)->slot_bit = 1UL << fw_data->num_slots++;
+	}
 	else {
 		/* Token is not initialized, announce pinpad capability nevertheless */
 		if (slot->reader->capabilities & SC_READER_CAP_PIN_PAD)
@@ -1382,7 +1554,7 @@ int slot_get_logged_in_state(struct sc_pkcs11_slot *slot)
 	pin_info = (struct sc_pkcs15_auth_info *)pin_obj->data;
 	if (!pin_info)
 		goto out;
-	sc_pkcs15_get_pin_info(p15card, pin_obj);
+	pkcs15_get_pin_info(slot->p11card, fw_data, pin_obj);
 	logged_in = pin_info->logged_in;
 out:
 	return logged_in;
@@ -1669,6 +1841,8 @@ pkcs15_create_tokens(struct sc_pkcs11_card *p11card, struct sc_app_info *app_inf
 		sc_log(context, "Now create slot without AUTH object");
 		pkcs15_create_slot(p11card, fw_data, NULL, app_info, &slot);
 		sc_log(context, "Created slot without AUTH object: %p", slot);
+		if (slot)
+			slot->fw_data_idx = idx;
 	}
 
 	if (slot)   {
@@ -1704,6 +1878,8 @@ pkcs15_login(struct sc_pkcs11_slot *slot, CK_USER_TYPE userType,
 	if (slot->p11card == NULL)
 		return sc_to_cryptoki_error(SC_ERROR_INVALID_CARD, "C_Login");
 	p11card = slot->p11card;
+	/* Whatever the outcome, the PIN status read before may be outdated */
+	p11card->cache_generation++;
 
 	fw_data = (struct pkcs15_fw_data *) p11card->fws_data[slot->fw_data_idx];
 	if (!fw_data)
@@ -1873,6 +2049,7 @@ pkcs15_logout(struct sc_pkcs11_slot *slot)
 
 	if (!p11card)
 		return sc_to_cryptoki_error(SC_ERROR_INVALID_CARD, "C_Logout");
+	p11card->cache_generation++;
 	fw_data = (struct pkcs15_fw_data *) p11card->fws_data[slot->fw_data_idx];
 	if (!fw_data)
 		return sc_to_cryptoki_error(SC_ERROR_INTERNAL, "C_Logout");
@@ -1920,6 +2097,7 @@ pkcs15_change_pin(struct sc_pkcs11_slot *slot,
 
 	if (!p11card)
 		return sc_to_cryptoki_error(SC_ERROR_INVALID_CARD, "C_SetPin");
+	p11card->cache_generation++;
 	fw_data = (struct pkcs15_fw_data *) p11card->fws_data[slot->fw_data_idx];
 	if (!fw_data)
 		return sc_to_cryptoki_error(SC_ERROR_INTERNAL, "C_SetPin");
@@ -2110,6 +2288,7 @@ pkcs15_init_pin(struct sc_pkcs11_slot *slot, CK_CHAR_PTR pPin, CK_ULONG ulPinLen
 	struct sc_pkcs15_object	*auth_obj = NULL;
 	struct sc_pkcs15_auth_info *auth_info = NULL;
 	struct sc_cardctl_pkcs11_init_pin p11args;
+	unsigned long slot_bit;
 	int rc;
 
 	memset(&p11args, 0, sizeof(p11args));
@@ -2118,6 +2297,7 @@ pkcs15_init_pin(struct sc_pkcs11_slot *slot, CK_CHAR_PTR pPin, CK_ULONG ulPinLen
 
 	if (!p11card)
 		return CKR_TOKEN_NOT_RECOGNIZED;
+	p11card->cache_generation++;
 	rc = sc_card_ctl(p11card->card, SC_CARDCTL_PKCS11_INIT_PIN, &p11args);
 	if (rc != SC_ERROR_NOT_SUPPORTED) {
 		if (rc == SC_SUCCESS)
@@ -2182,9 +2362,12 @@ pkcs15_init_pin(struct sc_pkcs11_slot *slot, CK_CHAR_PTR pPin, CK_ULONG ulPinLen
 	if (rc < 0)
 		return sc_to_cryptoki_error(rc, "C_InitPIN");
 
-	/* Re-initialize the slot */
+	/* Re-initialize the slot, it keeps listing the same objects */
+	slot_bit = pkcs15_slot_bit(slot);
 	free(slot->fw_data);
 	pkcs15_init_slot(fw_data->p15_card, slot, auth_obj, slot->app_info);
+	if (slot->fw_data)
+		slot_data(slot->fw_data)->slot_bit = slot_bit;
 
 	return CKR_OK;
 }
@@ -2448,6 +2631,10 @@ pkcs15_create_secret_key(struct sc_pkcs11_slot *slot, struct sc_profile *profile
 		case CKK_AES:
 			args.algorithm = SC_ALGORITHM_AES;
 			break;
+		case CKK_CHACHA20:
+			/* only usable as a session key in memory */
+			args.algorithm = SC_ALGORITHM_UNDEFINED;
+			break;
 		case CKK_DES3:
 			args.algorithm = SC_ALGORITHM_3DES;
 			break;
@@ -2502,6 +2689,12 @@ pkcs15_create_secret_key(struct sc_pkcs11_slot *slot, struct sc_profile *profile
 		case CKA_UNWRAP:
 			args.usage |= pkcs15_check_bool_cka(attr, SC_PKCS15_PRKEY_USAGE_UNWRAP);
 			break;
+		case CKA_SIGN:
+			args.usage |= pkcs15_check_bool_cka(attr, SC_PKCS15_PRKEY_USAGE_SIGN);
+			break;
+		case CKA_VERIFY:
+			args.usage |= pkcs15_check_bool_cka(attr, SC_PKCS15_PRKEY_USAGE_VERIFY);
+			break;
 		case CKA_EXTRACTABLE:
 			if (pkcs15_check_bool_cka(attr, 1))
 				args.access_flags |= SC_PKCS15_PRKEY_ACCESS_EXTRACTABLE;
@@ -2515,7 +2708,8 @@ pkcs15_create_secret_key(struct sc_pkcs11_slot *slot, struct sc_profile *profile
 		}
 	}
 
-	/* If creating a PKCS#11 session object, i.e. one that is only in memory */
+	/* If creating a PKCS#11 session object, i.e. one that is only in memory.
+	 * The value is kept in locked memory and used by the software mechanisms. */
 	if (_token == FALSE && (fw_data->p15_card->card->caps & SC_CARD_CAP_ONCARD_SESSION_OBJECTS) == 0) {
 
 		/* TODO Have 3 choices as to how to create the object.
@@ -2547,10 +2741,16 @@ pkcs15_create_secret_key(struct sc_pkcs11_slot *slot, struct sc_profile *profile
 		skey_info->native = 0; /* card can not use this */
 		skey_info->access_flags = 0; /* looks like not needed */
 		skey_info->key_type = key_type; /* PKCS#11 CKK_* */
-		skey_info->data.value = args.key.data;
-		skey_info->data.len = args.key.data_len;
+		if (args.key.data) {
+			skey_info->data.value = sc_mem_secure_alloc(args.key.data_len);
+			if (skey_info->data.value == NULL) {
+				rv = CKR_HOST_MEMORY;
+				goto out;
+			}
+			memcpy(skey_info->data.value, args.key.data, args.key.data_len);
+			skey_info->data.len = args.key.data_len;
+		}
 		skey_info->value_len = args.value_len * 8; /* key length comes in number of bytes, use length in bits in PKCS#15. */
-		args.key.data = NULL;
 		key_obj->session_object = 1;
 	}
 	else {
@@ -2566,15 +2766,27 @@ pkcs15_create_secret_key(struct sc_pkcs11_slot *slot, struct sc_profile *profile
 	}
 
 	/* Create a new pkcs11 object for it */
-	__pkcs15_create_secret_key_object(fw_data, key_obj, &key_any_obj);
+	rc = __pkcs15_create_secret_key_object(fw_data, key_obj, &key_any_obj);
+	if (rc < 0) {
+		rv = sc_to_cryptoki_error(rc, "C_CreateObject");
+		goto out;
+	}
+	if (temp_object) {
+		/* from now on released with the PKCS#11 object */
+		((struct pkcs15_skey_object *) key_any_obj)->owned = 1;
+		temp_object = FALSE;
+	}
 	pkcs15_add_object(slot, key_any_obj, phObject);
 
 	rv = CKR_OK;
 
 out:
-	free(args.key.data); /* if allocated */
-	if (temp_object)
-		free(key_obj); /* do not free if the object was created by pkcs15init. It will be freed in C_Finalize */
+	if (args.key.data) {
+		sc_mem_clear(args.key.data, args.key.data_len);
+		free(args.key.data);
+	}
+	if (temp_object && key_obj)
+		pkcs15_free_session_skey(key_obj); /* do not free if the object was created by pkcs15init. It will be freed in C_Finalize */
 	return rv;
 }
 
@@ -3379,6 +3591,7 @@ pkcs15_skey_destroy(struct sc_pkcs11_session *session, void *object)
 	struct pkcs15_any_object *any_obj = (struct pkcs15_any_object*) object;
 	struct sc_pkcs11_card *p11card = session->slot->p11card;
 	struct pkcs15_fw_data *fw_data = NULL;
+	struct sc_pkcs15_object *p15_object = NULL;
 	int rv;
 
 	if (!p11card)
@@ -3397,6 +3610,9 @@ pkcs15_skey_destroy(struct sc_pkcs11_session *session, void *object)
 	/* Oppose to pkcs15_add_object */
 	--any_obj->refcount; /* correct refcount */
 	list_delete(&session->slot->objects, any_obj);
+	any_obj->slots &= ~pkcs15_slot_bit(session->slot);
+	if (((struct pkcs15_skey_object *) any_obj)->owned)
+		p15_object = any_obj->p15_object;
 	/* Delete object in pkcs15 */
 	rv = __pkcs15_delete_object(fw_data, any_obj);
 
@@ -3404,6 +3620,8 @@ pkcs15_skey_destroy(struct sc_pkcs11_session *session, void *object)
 
 	if (rv < 0)
 		return sc_to_cryptoki_error(rv, "C_DestroyObject");
+	if (p15_object)
+		pkcs15_free_session_skey(p15_object);
 
 	return CKR_OK;
 #endif
@@ -3467,6 +3685,7 @@ pkcs15_any_destroy(struct sc_pkcs11_session *session, void *object)
 				 * and was created from certificate. */
 				--ao_pubkey->refcount;
 				list_delete(&session->slot->objects, ao_pubkey);
+				ao_pubkey->slots &= ~pkcs15_slot_bit(session->slot);
 				/* Delete public key object in pkcs15 */
 				if (pubkey->pub_data)   {
 					sc_log(context, "Found pub_data %p", pubkey->pub_data);
@@ -3485,6 +3704,7 @@ pkcs15_any_destroy(struct sc_pkcs11_session *session, void *object)
 		/* Oppose to pkcs15_add_object */
 		--any_obj->refcount; /* correct refcount */
 		list_delete(&session->slot->objects, any_obj);
+		any_obj->slots &= ~pkcs15_slot_bit(session->slot);
 		/* Delete object in pkcs15 */
 		rv = __pkcs15_delete_object(fw_data, any_obj);
 	}
@@ -3500,6 +3720,105 @@ pkcs15_any_destroy(struct sc_pkcs11_session *session, void *object)
 }
 
 
+#ifdef ENABLE_OPENSSL
+/* out = HMAC-SHA256(pool->key, data); out may be the key or the value */
+static int
+random_pool_hmac(struct pkcs15_random_pool *pool, const unsigned char *data, size_t data_len,
+		unsigned char *out)
+{
+	unsigned char md[SHA256_DIGEST_LENGTH];
+	unsigned int md_len = sizeof(md);
+
+	if (!HMAC(EVP_sha256(), pool->key, sizeof(pool->key), data, data_len, md, &md_len))
+		return SC_ERROR_INTERNAL;
+	memcpy(out, md, sizeof(md));
+	sc_mem_clear(md, sizeof(md));
+	return SC_SUCCESS;
+}
+
+
+/* HMAC_DRBG update function: mixes 'data' into the key and value */
+static int
+random_pool_update(struct pkcs15_random_pool *pool, const unsigned char *data, size_t data_len)
+{
+	unsigned char buf[SHA256_DIGEST_LENGTH + 1 + RANDOM_POOL_SEED_LEN];
+	unsigned char round;
+	int rv = SC_SUCCESS;
+
+	for (round = 0; round < 2 && rv == SC_SUCCESS; round++) {
+		memcpy(buf, pool->v, sizeof(pool->v));
+		buf[sizeof(pool->v)] = round;
+		if (data_len)
+			memcpy(buf + sizeof(pool->v) + 1, data, data_len);
+		rv = random_pool_hmac(pool, buf, sizeof(pool->v) + 1 + data_len, pool->key);
+		if (rv == SC_SUCCESS)
+			rv = random_pool_hmac(pool, pool->v, sizeof(pool->v), pool->v);
+		if (!data_len)
+			break;
+	}
+	sc_mem_clear(buf, sizeof(buf));
+	return rv;
+}
+
+
+/* Serve random bytes from a DRBG seeded with card output, so that small
+ * requests do not cost one or more GET CHALLENGE round trips each. The card
+ * is asked for a new seed after 'random_reseed_interval' bytes. */
+static int
+random_pool_generate(struct sc_card *card, struct pkcs15_random_pool *pool,
+		unsigned char *out, size_t len)
+{
+	unsigned char seed[RANDOM_POOL_SEED_LEN];
+	int rv;
+
+#if !defined(_WIN32)
+	/* Never hand out the same bytes in a forked child */
+	if (pool->pid != getpid())
+		pool->left = 0;
+#endif
+	if (pool->left < len) {
+		rv = sc_get_challenge(card, seed, sizeof(seed));
+		if (rv != SC_SUCCESS)
+			return rv;
+		if (pool->left == 0) {
+			/* instantiate */
+			memset(pool->key, 0x00, sizeof(pool->key));
+			memset(pool->v, 0x01, sizeof(pool->v));
+		}
+		rv = random_pool_update(pool, seed, sizeof(seed));
+		sc_mem_clear(seed, sizeof(seed));
+		if (rv != SC_SUCCESS) {
+			pool->left = 0;
+			return rv;
+		}
+		pool->left = sc_pkcs11_conf.random_reseed_interval;
+#if !defined(_WIN32)
+		pool->pid = getpid();
+#endif
+	}
+
+	pool->left -= len;
+	while (len > 0) {
+		size_t n = len < sizeof(pool->v) ? len : sizeof(pool->v);
+
+		rv = random_pool_hmac(pool, pool->v, sizeof(pool->v), pool->v);
+		if (rv != SC_SUCCESS) {
+			pool->left = 0;
+			return rv;
+		}
+		memcpy(out, pool->v, n);
+		out += n;
+		len -= n;
+	}
+
+	rv = random_pool_update(pool, NULL, 0);
+	if (rv != SC_SUCCESS)
+		pool->left = 0;
+	return rv;
+}
+#endif
+
+
 static CK_RV
 pkcs15_get_random(struct sc_pkcs11_slot *slot, CK_BYTE_PTR p, CK_ULONG len)
 {
@@ -3515,6 +3834,13 @@ pkcs15_get_random(struct sc_pkcs11_slot *slot, CK_BYTE_PTR p, CK_ULONG len)
 	if (!fw_data->p15_card)
 		return sc_to_cryptoki_error(SC_ERROR_INVALID_CARD, "C_GenerateRandom");
 
+#ifdef ENABLE_OPENSSL
+	/* Large requests would reseed anyway, let the card answer them */
+	if (len < sc_pkcs11_conf.random_reseed_interval) {
+		rc = random_pool_generate(fw_data->p15_card->card, &fw_data->random_pool, p, (size_t)len);
+		return sc_to_cryptoki_error(rc, "C_GenerateRandom");
+	}
+#endif
 	rc = sc_get_challenge(fw_data->p15_card->card, p, (size_t)len);
 	return sc_to_cryptoki_error(rc, "C_GenerateRandom");
 }
@@ -3637,10 +3963,14 @@ pkcs15_cert_release(void *obj)
 {
 	struct pkcs15_cert_object *cert = (struct pkcs15_cert_object *) obj;
 	struct sc_pkcs15_cert      *cert_data = cert->cert_data;
+	struct pkcs15_cert_object  *owner = cert->cert_owner;
 
-	if (__pkcs15_release_object((struct pkcs15_any_object *) obj) == 0)
-		if (cert_data) /* may never have been read */
+	if (__pkcs15_release_object((struct pkcs15_any_object *) obj) == 0) {
+		if (owner)
+			pkcs15_cert_release(owner);
+		else if (cert_data) /* may never have been read */
 			sc_pkcs15_free_certificate(cert_data);
+	}
 }
 
 
@@ -3834,7 +4164,9 @@ struct sc_pkcs11_object_ops pkcs15_cert_ops = {
 	NULL,	/* derive */
 	NULL,	/* can_do */
 	NULL,	/* init_params */
-	NULL	/* wrap_key */
+	NULL,	/* wrap_key */
+	NULL,	/* encrypt */
+	NULL	/* get_secret */
 };
 
 /*
@@ -4340,6 +4672,29 @@ pkcs15_prkey_unwrap(struct sc_pkcs11_session *session, void *obj,
 	    return CKR_ARGUMENTS_BAD;
 	}
 
+	/* A session key held in memory gets the value deciphered by the card,
+	 * which is never longer than the modulus of the unwrapping key */
+	if (is_skey(targetKeyObj) && ((struct pkcs15_skey_object *) targetKeyObj)->owned) {
+		size_t value_size = BYTES4BITS(prkey->prv_info->modulus_length);
+		CK_BYTE *value;
+		CK_ULONG value_len;
+		CK_RV ck_rv;
+
+		if (value_size == 0)
+			value_size = ulWrappedKeyLen;
+		value = sc_mem_secure_alloc(value_size);
+		if (value == NULL)
+			return CKR_HOST_MEMORY;
+		value_len = value_size;
+		ck_rv = pkcs15_prkey_decrypt(session, obj, pMechanism,
+				pWrappedKey, ulWrappedKeyLen, value, &value_len);
+		if (ck_rv == CKR_OK)
+			ck_rv = pkcs15_skey_set_value((struct pkcs15_skey_object *) targetKeyObj,
+					value, value_len);
+		sc_mem_secure_clear_free(value, value_size);
+		return ck_rv;
+	}
+
 	/* See which of the alternative keys supports unwrap */
 	while (prkey && !(prkey->prv_info->usage & SC_PKCS15_PRKEY_USAGE_UNWRAP))
 		prkey = prkey->prv_next;
@@ -4726,7 +5081,9 @@ struct sc_pkcs11_object_ops pkcs15_prkey_ops = {
 	pkcs15_prkey_derive,
 	pkcs15_prkey_can_do,
 	pkcs15_prkey_init_params,
-	NULL	/* wrap_key */
+	NULL,	/* wrap_key */
+	NULL,	/* encrypt */
+	NULL	/* get_secret */
 };
 
 /*
@@ -4985,7 +5342,9 @@ struct sc_pkcs11_object_ops pkcs15_pubkey_ops = {
 	NULL,	/* derive */
 	NULL,	/* can_do */
 	NULL,	/* init_params */
-	NULL	/* wrap_key */
+	NULL,	/* wrap_key */
+	NULL,	/* encrypt */
+	NULL	/* get_secret */
 };
 
 
@@ -5165,7 +5524,9 @@ struct sc_pkcs11_object_ops pkcs15_dobj_ops = {
 	NULL,	/* derive */
 	NULL,	/* can_do */
 	NULL,	/* init_params */
-	NULL	/* wrap_key */
+	NULL,	/* wrap_key */
+	NULL,	/* encrypt */
+	NULL	/* get_secret */
 };
 
 /* PKCS#15 Data Object*/
@@ -5230,7 +5591,9 @@ struct sc_pkcs11_object_ops pkcs15_profile_ops = {
 	NULL,	/* derive */
 	NULL,	/* can_do */
 	NULL,	/* init_params */
-	NULL	/* wrap_key */
+	NULL,	/* wrap_key */
+	NULL,	/* encrypt */
+	NULL	/* get_secret */
 };
 
 
@@ -5240,7 +5603,30 @@ struct sc_pkcs11_object_ops pkcs15_profile_ops = {
 static void
 pkcs15_skey_release(void *object)
 {
-	__pkcs15_release_object((struct pkcs15_any_object *) object);
+	struct pkcs15_skey_object *skey = (struct pkcs15_skey_object*) object;
+	struct sc_pkcs15_object *p15_object = skey->owned ? skey->base.p15_object : NULL;
+
+	if (__pkcs15_release_object((struct pkcs15_any_object *) object) == 0 && p15_object)
+		pkcs15_free_session_skey(p15_object);
+}
+
+
+/* Key values are kept in locked memory */
+static CK_RV
+pkcs15_skey_set_value(struct pkcs15_skey_object *skey, const CK_BYTE *value, CK_ULONG len)
+{
+	u8 *copy;
+
+	copy = sc_mem_secure_alloc(len);
+	if (copy == NULL)
+		return CKR_HOST_MEMORY;
+	memcpy(copy, value, len);
+
+	if (skey->info->data.value)
+		sc_mem_secure_clear_free(skey->info->data.value, skey->info->data.len);
+	skey->info->data.value = copy;
+	skey->info->data.len = len;
+	return CKR_OK;
 }
 
 
@@ -5257,13 +5643,8 @@ pkcs15_skey_set_attribute(struct sc_pkcs11_session *session,
 
 	switch (attr->type) {
 	case CKA_VALUE:
-		if (attr->pValue) {
-			skey->info->data.value = calloc(1,attr->ulValueLen);
-			if (!skey->info->data.value)
-				return CKR_HOST_MEMORY;
-			memcpy(skey->info->data.value, attr->pValue, attr->ulValueLen);
-			skey->info->data.len = attr->ulValueLen;
-		}
+		if (attr->pValue)
+			return pkcs15_skey_set_value(skey, attr->pValue, attr->ulValueLen);
 		break;
 	default:
 		return pkcs15_set_attrib(session, skey->base.p15_object, attr);
@@ -5407,6 +5788,32 @@ pkcs15_skey_unwrap(struct sc_pkcs11_session *session, void *obj,
 	if (skey == NULL)
 		return CKR_KEY_FUNCTION_NOT_PERMITTED;
 
+#ifdef ENABLE_OPENSSL
+	/* Both keys in memory: unwrap in software */
+	if (skey->info->data.value && targetKeyObj->owned) {
+		void *cipher = NULL;
+		CK_BYTE *value;
+		CK_ULONG value_len = ulWrappedKeyLen;
+		CK_RV ck_rv;
+
+		ck_rv = sc_pkcs11_openssl_cipher_init(pMechanism, skey->info->data.value,
+				skey->info->data.len, 0, &cipher);
+		if (ck_rv != CKR_OK)
+			return ck_rv;
+		value = sc_mem_secure_alloc(ulWrappedKeyLen);
+		if (value == NULL) {
+			sc_pkcs11_openssl_cipher_free(cipher);
+			return CKR_HOST_MEMORY;
+		}
+		ck_rv = sc_pkcs11_openssl_cipher(cipher, pWrappedKey, ulWrappedKeyLen, value, &value_len);
+		sc_pkcs11_openssl_cipher_free(cipher);
+		if (ck_rv == CKR_OK)
+			ck_rv = pkcs15_skey_set_value(targetKeyObj, value, value_len);
+		sc_mem_secure_clear_free(value, ulWrappedKeyLen);
+		return ck_rv;
+	}
+#endif
+
 	sc_log(context, "Using mechanism %lx.", pMechanism->mechanism);
 	/* Select the proper padding mechanism */
 	switch (pMechanism->mechanism) {
@@ -5523,7 +5930,116 @@ pkcs15_skey_wrap(struct sc_pkcs11_session *session, void *obj,
 
 
 /*
- *  Secret key objects, currently used only to retrieve derived session key
+ * Encryption, decryption and HMAC with session keys held in memory are done
+ * by the software mechanisms (see get_secret); the card only wraps and
+ * unwraps with its own secret keys, and encrypts or decrypts whole blocks.
+ * Padding and the parts of a multi-part operation are handled by the caller.
+ */
+static CK_RV
+pkcs15_skey_crypt(struct sc_pkcs11_session *session, void *obj,
+		CK_MECHANISM_PTR pMechanism, int encrypt,
+		CK_BYTE_PTR pIn, CK_ULONG ulInLen,
+		CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+	struct sc_pkcs11_card *p11card;
+	struct pkcs15_fw_data *fw_data = NULL;
+	struct pkcs15_skey_object *skey = (struct pkcs15_skey_object *) obj;
+	const char *name = encrypt ? "C_Encrypt" : "C_Decrypt";
+	unsigned long flags = 0;
+	int rv;
+
+	if (session == NULL || pMechanism == NULL || obj == NULL || pulOutLen == NULL)
+		return CKR_ARGUMENTS_BAD;
+
+	p11card = session->slot->p11card;
+	if (!p11card)
+		return sc_to_cryptoki_error(SC_ERROR_INVALID_CARD, name);
+	fw_data = (struct pkcs15_fw_data *) p11card->fws_data[session->slot->fw_data_idx];
+	if (!fw_data)
+		return sc_to_cryptoki_error(SC_ERROR_INTERNAL, name);
+	if (!fw_data->p15_card)
+		return sc_to_cryptoki_error(SC_ERROR_INVALID_CARD, name);
+
+	if (skey->prv_p15obj == NULL
+			|| !(skey->info->usage & (encrypt ? SC_PKCS15_PRKEY_USAGE_ENCRYPT : SC_PKCS15_PRKEY_USAGE_DECRYPT)))
+		return CKR_KEY_FUNCTION_NOT_PERMITTED;
+
+	switch (pMechanism->mechanism) {
+	case CKM_AES_ECB:
+		flags |= SC_ALGORITHM_AES_ECB;
+		break;
+	case CKM_AES_CBC:	/* pMechanism->pParameter contains IV */
+		flags |= SC_ALGORITHM_AES_CBC;
+		break;
+	default:
+		return CKR_MECHANISM_INVALID;
+	}
+
+	if (pOut == NULL) {
+		*pulOutLen = ulInLen;
+		return CKR_OK;
+	}
+
+	rv = sc_lock(p11card->card);
+	if (rv < 0)
+		return sc_to_cryptoki_error(rv, name);
+
+	if (encrypt)
+		rv = sc_pkcs15_encrypt_sym(fw_data->p15_card, skey->prv_p15obj, flags,
+				pIn, ulInLen, pOut, *pulOutLen,
+				pMechanism->pParameter, pMechanism->ulParameterLen);
+	else
+		rv = sc_pkcs15_decrypt_sym(fw_data->p15_card, skey->prv_p15obj, flags,
+				pIn, ulInLen, pOut, *pulOutLen,
+				pMechanism->pParameter, pMechanism->ulParameterLen);
+
+	sc_unlock(p11card->card);
+
+	if (rv == SC_ERROR_BUFFER_TOO_SMALL)
+		*pulOutLen = ulInLen;
+	if (rv < 0)
+		return sc_to_cryptoki_error(rv, name);
+
+	*pulOutLen = rv;
+	return CKR_OK;
+}
+
+static CK_RV
+pkcs15_skey_decrypt(struct sc_pkcs11_session *session, void *obj,
+		CK_MECHANISM_PTR pMechanism,
+		CK_BYTE_PTR pEncryptedData, CK_ULONG ulEncryptedDataLen,
+		CK_BYTE_PTR pData, CK_ULONG_PTR pulDataLen)
+{
+	return pkcs15_skey_crypt(session, obj, pMechanism, 0,
+			pEncryptedData, ulEncryptedDataLen, pData, pulDataLen);
+}
+
+static CK_RV
+pkcs15_skey_encrypt(struct sc_pkcs11_session *session, void *obj,
+		CK_MECHANISM_PTR pMechanism,
+		CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+		CK_BYTE_PTR pEncryptedData, CK_ULONG_PTR pulEncryptedDataLen)
+{
+	return pkcs15_skey_crypt(session, obj, pMechanism, 1,
+			pData, ulDataLen, pEncryptedData, pulEncryptedDataLen);
+}
+
+static CK_RV
+pkcs15_skey_get_secret(struct sc_pkcs11_session *session, void *obj,
+		const CK_BYTE **pValue, CK_ULONG_PTR pulValueLen)
+{
+	struct pkcs15_skey_object *skey = (struct pkcs15_skey_object *) obj;
+
+	if (skey->info == NULL || skey->info->data.value == NULL || skey->info->data.len == 0)
+		return CKR_KEY_FUNCTION_NOT_PERMITTED;
+
+	*pValue = skey->info->data.value;
+	*pulValueLen = skey->info->data.len;
+	return CKR_OK;
+}
+
+/*
+ *  Secret key objects: derived or unwrapped session keys, and the keys of the card
  */
 struct sc_pkcs11_object_ops pkcs15_skey_ops = {
 	pkcs15_skey_release,
@@ -5532,13 +6048,15 @@ struct sc_pkcs11_object_ops pkcs15_skey_ops = {
 	sc_pkcs11_any_cmp_attribute,
 	pkcs15_skey_destroy,
 	NULL,	/* get_size */
-	NULL,	/* sign */
+	NULL,	/* sign: HMAC is done in software, see get_secret */
 	pkcs15_skey_unwrap,
-	NULL,	/* decrypt */
+	pkcs15_skey_decrypt,
 	NULL,	/* derive */
 	NULL,	/* can_do */
 	NULL,	/* init_params */
-	pkcs15_skey_wrap /* wrap_key */
+	pkcs15_skey_wrap, /* wrap_key */
+	pkcs15_skey_encrypt,
+	pkcs15_skey_get_secret
 };
 
 /*
@@ -6117,6 +6635,70 @@ static int sc_pkcs11_register_aes_mechanisms(struct sc_pkcs11_card *p11card, int
 	return CKR_OK;
 }
 
+#ifdef ENABLE_OPENSSL
+/*
+ * AES and HMAC in software, for the session keys held in memory.
+ * Registered after the card mechanisms, so that an AES mechanism
+ * of the card is extended rather than listed twice.
+ */
+static int register_session_key_mechanisms(struct sc_pkcs11_card *p11card)
+{
+	static const CK_MECHANISM_TYPE aes_mechs[] = {
+		CKM_AES_ECB, CKM_AES_CBC, CKM_AES_CBC_PAD, CKM_AES_CTR, CKM_AES_GCM
+	};
+	static const CK_MECHANISM_TYPE hmac_mechs[] = {
+		CKM_SHA_1_HMAC, CKM_SHA224_HMAC, CKM_SHA256_HMAC, CKM_SHA384_HMAC, CKM_SHA512_HMAC
+	};
+	CK_MECHANISM_INFO mech_info;
+	sc_pkcs11_mechanism_type_t *mt;
+	size_t i;
+	int rc;
+
+	memset(&mech_info, 0, sizeof(mech_info));
+	mech_info.ulMinKeySize = 128;
+	mech_info.ulMaxKeySize = 256;
+	for (i = 0; i < sizeof(aes_mechs) / sizeof(aes_mechs[0]); i++) {
+		mech_info.flags = CKF_ENCRYPT | CKF_DECRYPT;
+		/* AEAD: also message-based, with an IV and AAD per message */
+		if (aes_mechs[i] == CKM_AES_GCM)
+			mech_info.flags |= CKF_MESSAGE_ENCRYPT | CKF_MESSAGE_DECRYPT | CKF_MULTI_MESSAGE;
+		mt = sc_pkcs11_new_fw_mechanism(aes_mechs[i], &mech_info, CKK_AES, NULL, NULL);
+		if (!mt)
+			return CKR_HOST_MEMORY;
+		rc = sc_pkcs11_register_mechanism(p11card, mt);
+		if (rc != CKR_OK)
+			return rc;
+	}
+
+#ifdef HAVE_OPENSSL_CHACHA20_POLY1305
+	mech_info.flags = CKF_ENCRYPT | CKF_DECRYPT
+		| CKF_MESSAGE_ENCRYPT | CKF_MESSAGE_DECRYPT | CKF_MULTI_MESSAGE;
+	mech_info.ulMinKeySize = 256;
+	mech_info.ulMaxKeySize = 256;
+	mt = sc_pkcs11_new_fw_mechanism(CKM_CHACHA20_POLY1305, &mech_info, CKK_CHACHA20, NULL, NULL);
+	if (!mt)
+		return CKR_HOST_MEMORY;
+	rc = sc_pkcs11_register_mechanism(p11card, mt);
+	if (rc != CKR_OK)
+		return rc;
+#endif
+
+	mech_info.flags = CKF_SIGN | CKF_VERIFY;
+	mech_info.ulMinKeySize = 1;
+	mech_info.ulMaxKeySize = 512;
+	for (i = 0; i < sizeof(hmac_mechs) / sizeof(hmac_mechs[0]); i++) {
+		mt = sc_pkcs11_new_fw_mechanism(hmac_mechs[i], &mech_info, CKK_GENERIC_SECRET, NULL, NULL);
+		if (!mt)
+			return CKR_HOST_MEMORY;
+		rc = sc_pkcs11_register_mechanism(p11card, mt);
+		if (rc != CKR_OK)
+			return rc;
+	}
+
+	return CKR_OK;
+}
+#endif
+
 /*
  * Mechanism handling
  * FIXME: We should consult the card's algorithm list to
@@ -6395,6 +6977,15 @@ register_mechanisms(struct sc_pkcs11_card *p11card)
 			return rc;
 	}
 
+#ifdef ENABLE_OPENSSL
+	/* Only where session keys can come from the card, unless configured */
+	if ((card->caps & SC_CARD_CAP_UNWRAP_KEY) == SC_CARD_CAP_UNWRAP_KEY
+			|| sc_pkcs11_conf.session_key_mechanisms) {
+		rc = register_session_key_mechanisms(p11card);
+		if (rc != CKR_OK)
+			return rc;
+	}
+#endif
 
 	return CKR_OK;
 }
@@ -41,6 +41,14 @@ struct signature_data {
 	sc_pkcs11_operation_t *md;
 	CK_BYTE			*buffer;
 	unsigned int	buffer_len;
+	/* input held back from the card by multi-part AES */
+	CK_BYTE			held[16];
+	unsigned int	held_len;
+#ifdef ENABLE_OPENSSL
+	/* software cipher or HMAC, for secret keys held in host memory */
+	void			*cipher;
+	void			*mac;
+#endif
 };
 
 static struct signature_data *
@@ -56,9 +64,25 @@ signature_data_release(struct signature_data *data)
 		return;
 	sc_pkcs11_release_operation(&data->md);
 	sc_mem_secure_clear_free(data->buffer, data->buffer_len);
+	sc_mem_clear(data->held, sizeof(data->held));
+#ifdef ENABLE_OPENSSL
+	sc_pkcs11_openssl_cipher_free(data->cipher);
+	sc_pkcs11_openssl_mac_free(data->mac);
+#endif
 	free(data);
 }
 
+#ifdef ENABLE_OPENSSL
+/* Secret keys kept in host memory are used by OpenSSL, not by the card */
+static int
+get_host_secret(struct sc_pkcs11_session *session, struct sc_pkcs11_object *key,
+		const CK_BYTE **value, CK_ULONG *value_len)
+{
+	return key->ops->get_secret != NULL
+		&& key->ops->get_secret(session, key, value, value_len) == CKR_OK;
+}
+#endif
+
 static CK_RV
 signature_data_buffer_append(struct signature_data *data,
 		const CK_BYTE *in, unsigned int in_len)
@@ -463,6 +487,10 @@ sc_pkcs11_signature_init(sc_pkcs11_operation_t *operation,
 {
 	struct hash_signature_info *info;
 	struct signature_data *data;
+#ifdef ENABLE_OPENSSL
+	const CK_BYTE *value;
+	CK_ULONG value_len;
+#endif
 	CK_RV rv;
 	int can_do_it = 0;
 
@@ -499,6 +527,25 @@ sc_pkcs11_signature_init(sc_pkcs11_operation_t *operation,
 		}
 	}
 
+#ifdef ENABLE_OPENSSL
+	if (get_host_secret(operation->session, key, &value, &value_len)) {
+		rv = sc_pkcs11_openssl_mac_init(operation->type->mech, value, value_len, &data->mac);
+		if (rv != CKR_OK) {
+			signature_data_release(data);
+			LOG_FUNC_RETURN(context, (int) rv);
+		}
+		operation->priv_data = data;
+		LOG_FUNC_RETURN(context, CKR_OK);
+	}
+#endif
+
+	/* Keys without a sign operation, like secret keys kept on the card,
+	 * only sign in software from their value above */
+	if (key->ops->sign == NULL) {
+		signature_data_release(data);
+		LOG_FUNC_RETURN(context, CKR_KEY_FUNCTION_NOT_PERMITTED);
+	}
+
 	/* If this is a signature with hash operation,
 	 * and card cannot perform itself signature with hash operation,
 	 * set up the hash operation */
@@ -533,6 +580,12 @@ sc_pkcs11_signature_update(sc_pkcs11_operation_t *operation,
 	LOG_FUNC_CALLED(context);
 	sc_log(context, "data part length %li", ulPartLen);
 	data = (struct signature_data *) operation->priv_data;
+#ifdef ENABLE_OPENSSL
+	if (data->mac) {
+		rv = sc_pkcs11_openssl_mac_update(data->mac, pPart, ulPartLen);
+		LOG_FUNC_RETURN(context, (int) rv);
+	}
+#endif
 	if (data->md) {
 		rv = data->md->type->md_update(data->md, pPart, ulPartLen);
 		LOG_FUNC_RETURN(context, (int) rv);
@@ -552,6 +605,12 @@ sc_pkcs11_signature_final(sc_pkcs11_operation_t *operation,
 
 	LOG_FUNC_CALLED(context);
 	data = (struct signature_data *) operation->priv_data;
+#ifdef ENABLE_OPENSSL
+	if (data->mac) {
+		rv = sc_pkcs11_openssl_mac_final(data->mac, pSignature, pulSignatureLen);
+		LOG_FUNC_RETURN(context, (int) rv);
+	}
+#endif
 	if (data->md) {
 		sc_pkcs11_operation_t	*md = data->md;
 		CK_BYTE hash[64];
@@ -581,6 +640,13 @@ sc_pkcs11_signature_size(sc_pkcs11_operation_t *operation, CK_ULONG_PTR pLength)
 	CK_ATTRIBUTE attr_key_type = { CKA_KEY_TYPE, &key_type, sizeof(key_type) };
 	CK_RV rv;
 
+#ifdef ENABLE_OPENSSL
+	if (((struct signature_data *) operation->priv_data)->mac) {
+		*pLength = sc_pkcs11_openssl_mac_size(((struct signature_data *) operation->priv_data)->mac);
+		LOG_FUNC_RETURN(context, CKR_OK);
+	}
+#endif
+
 	key = ((struct signature_data *) operation->priv_data)->key;
 	/*
 	 * EC and GOSTR do not have CKA_MODULUS_BITS attribute.
@@ -731,6 +797,8 @@ sc_pkcs11_verify_init(sc_pkcs11_operation_t *operation,
 {
 	struct hash_signature_info *info;
 	struct signature_data *data;
+	const CK_BYTE *value;
+	CK_ULONG value_len;
 	CK_RV rv;
 
 	if (!(data = new_signature_data()))
@@ -761,6 +829,16 @@ sc_pkcs11_verify_init(sc_pkcs11_operation_t *operation,
 		}
 	}
 
+	if (get_host_secret(operation->session, key, &value, &value_len)) {
+		rv = sc_pkcs11_openssl_mac_init(operation->type->mech, value, value_len, &data->mac);
+		if (rv != CKR_OK) {
+			signature_data_release(data);
+			LOG_FUNC_RETURN(context, (int) rv);
+		}
+		operation->priv_data = data;
+		return CKR_OK;
+	}
+
 	/* If this is a verify with hash operation, set up the
 	 * hash operation */
 	info = (struct hash_signature_info *) operation->type->mech_data;
@@ -791,6 +869,8 @@ sc_pkcs11_verify_update(sc_pkcs11_operation_t *operation,
 	struct signature_data *data;
 
 	data = (struct signature_data *) operation->priv_data;
+	if (data->mac)
+		return sc_pkcs11_openssl_mac_update(data->mac, pPart, ulPartLen);
 	if (data->md) {
 		sc_pkcs11_operation_t	*md = data->md;
 
@@ -821,6 +901,9 @@ sc_pkcs11_verify_final(sc_pkcs11_operation_t *operation,
 	if (pSignature == NULL)
 		return CKR_ARGUMENTS_BAD;
 
+	if (data->mac)
+		return sc_pkcs11_openssl_mac_verify(data->mac, pSignature, ulSignatureLen);
+
 	key = data->key;
 	rv = key->ops->get_attribute(operation->session, key, &attr_key_type);
 	if (rv != CKR_OK)
@@ -890,6 +973,10 @@ sc_pkcs11_decr_init(struct sc_pkcs11_session *session,
 	if (rv != CKR_OK)
 		LOG_FUNC_RETURN(context, (int) rv);
 
+	if (pMechanism->pParameter &&
+	    pMechanism->ulParameterLen > sizeof(operation->mechanism_params))
+		LOG_FUNC_RETURN(context, CKR_MECHANISM_PARAM_INVALID);
+
 	rv = session_start_operation(session, SC_PKCS11_OPERATION_DECRYPT, mt, &operation);
 	if (rv != CKR_OK)
 		return rv;
@@ -903,13 +990,8 @@ sc_pkcs11_decr_init(struct sc_pkcs11_session *session,
 	rv = mt->decrypt_init(operation, key);
 
 	/* Validate the mechanism parameters */
-	if (key->ops->init_params) {
+	if (rv == CKR_OK && key->ops->init_params)
 		rv = key->ops->init_params(operation->session, &operation->mechanism);
-		if (rv != CKR_OK) {
-			/* Probably bad arguments */
-			LOG_FUNC_RETURN(context, (int) rv);
-		}
-	}
 
 	if (rv != CKR_OK)
 		session_stop_operation(session, SC_PKCS11_OPERATION_DECRYPT);
@@ -938,6 +1020,388 @@ sc_pkcs11_decr(struct sc_pkcs11_session *session,
 	return rv;
 }
 
+CK_RV
+sc_pkcs11_decr_update(struct sc_pkcs11_session *session,
+		CK_BYTE_PTR pEncryptedPart, CK_ULONG ulEncryptedPartLen,
+		CK_BYTE_PTR pPart, CK_ULONG_PTR pulPartLen)
+{
+	sc_pkcs11_operation_t *op;
+	CK_RV rv;
+
+	rv = session_get_operation(session, SC_PKCS11_OPERATION_DECRYPT, &op);
+	if (rv != CKR_OK)
+		return rv;
+
+	if (op->type->decrypt_update == NULL)
+		rv = CKR_KEY_TYPE_INCONSISTENT;
+	else
+		rv = op->type->decrypt_update(op, pEncryptedPart, ulEncryptedPartLen,
+				pPart, pulPartLen);
+
+	if (rv != CKR_OK && rv != CKR_BUFFER_TOO_SMALL)
+		session_stop_operation(session, SC_PKCS11_OPERATION_DECRYPT);
+
+	return rv;
+}
+
+CK_RV
+sc_pkcs11_decr_final(struct sc_pkcs11_session *session,
+		CK_BYTE_PTR pLastPart, CK_ULONG_PTR pulLastPartLen)
+{
+	sc_pkcs11_operation_t *op;
+	CK_RV rv;
+
+	rv = session_get_operation(session, SC_PKCS11_OPERATION_DECRYPT, &op);
+	if (rv != CKR_OK)
+		return rv;
+
+	if (op->type->decrypt_final == NULL)
+		rv = CKR_KEY_TYPE_INCONSISTENT;
+	else
+		rv = op->type->decrypt_final(op, pLastPart, pulLastPartLen);
+
+	if (rv != CKR_BUFFER_TOO_SMALL && (pLastPart != NULL || rv != CKR_OK))
+		session_stop_operation(session, SC_PKCS11_OPERATION_DECRYPT);
+
+	return rv;
+}
+
+/*
+ * Initialize an encryption context. When we get here, we know
+ * the key object is capable of encrypting _something_
+ */
+CK_RV
+sc_pkcs11_encr_init(struct sc_pkcs11_session *session,
+			CK_MECHANISM_PTR pMechanism,
+			struct sc_pkcs11_object *key,
+			CK_KEY_TYPE key_type)
+{
+	struct sc_pkcs11_card *p11card;
+	sc_pkcs11_operation_t *operation;
+	sc_pkcs11_mechanism_type_t *mt;
+	CK_RV rv;
+
+	if (!session || !session->slot
+	 || !(p11card = session->slot->p11card))
+		return CKR_ARGUMENTS_BAD;
+
+	/* See if we support this mechanism type */
+	mt = sc_pkcs11_find_mechanism(p11card, pMechanism->mechanism, CKF_ENCRYPT);
+	if (mt == NULL || mt->encrypt_init == NULL)
+		return CKR_MECHANISM_INVALID;
+
+	/* See if compatible with key type */
+	rv = _validate_key_type(mt, key_type);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, (int) rv);
+
+	if (pMechanism->pParameter &&
+	    pMechanism->ulParameterLen > sizeof(operation->mechanism_params))
+		LOG_FUNC_RETURN(context, CKR_MECHANISM_PARAM_INVALID);
+
+	rv = session_start_operation(session, SC_PKCS11_OPERATION_ENCRYPT, mt, &operation);
+	if (rv != CKR_OK)
+		return rv;
+
+	memcpy(&operation->mechanism, pMechanism, sizeof(CK_MECHANISM));
+	if (pMechanism->pParameter) {
+		memcpy(&operation->mechanism_params, pMechanism->pParameter,
+		       pMechanism->ulParameterLen);
+		operation->mechanism.pParameter = &operation->mechanism_params;
+	}
+	rv = mt->encrypt_init(operation, key);
+
+	if (rv != CKR_OK)
+		session_stop_operation(session, SC_PKCS11_OPERATION_ENCRYPT);
+
+	return rv;
+}
+
+CK_RV
+sc_pkcs11_encr(struct sc_pkcs11_session *session,
+		CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+		CK_BYTE_PTR pEncryptedData, CK_ULONG_PTR pulEncryptedDataLen)
+{
+	sc_pkcs11_operation_t *op;
+	CK_RV rv;
+
+	rv = session_get_operation(session, SC_PKCS11_OPERATION_ENCRYPT, &op);
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = op->type->encrypt(op, pData, ulDataLen,
+			pEncryptedData, pulEncryptedDataLen);
+
+	if (rv != CKR_BUFFER_TOO_SMALL && (pEncryptedData != NULL || rv != CKR_OK))
+		session_stop_operation(session, SC_PKCS11_OPERATION_ENCRYPT);
+
+	return rv;
+}
+
+CK_RV
+sc_pkcs11_encr_update(struct sc_pkcs11_session *session,
+		CK_BYTE_PTR pPart, CK_ULONG ulPartLen,
+		CK_BYTE_PTR pEncryptedPart, CK_ULONG_PTR pulEncryptedPartLen)
+{
+	sc_pkcs11_operation_t *op;
+	CK_RV rv;
+
+	rv = session_get_operation(session, SC_PKCS11_OPERATION_ENCRYPT, &op);
+	if (rv != CKR_OK)
+		return rv;
+
+	if (op->type->encrypt_update == NULL)
+		rv = CKR_KEY_TYPE_INCONSISTENT;
+	else
+		rv = op->type->encrypt_update(op, pPart, ulPartLen,
+				pEncryptedPart, pulEncryptedPartLen);
+
+	if (rv != CKR_OK && rv != CKR_BUFFER_TOO_SMALL)
+		session_stop_operation(session, SC_PKCS11_OPERATION_ENCRYPT);
+
+	return rv;
+}
+
+CK_RV
+sc_pkcs11_encr_final(struct sc_pkcs11_session *session,
+		CK_BYTE_PTR pLastEncryptedPart, CK_ULONG_PTR pulLastEncryptedPartLen)
+{
+	sc_pkcs11_operation_t *op;
+	CK_RV rv;
+
+	rv = session_get_operation(session, SC_PKCS11_OPERATION_ENCRYPT, &op);
+	if (rv != CKR_OK)
+		return rv;
+
+	if (op->type->encrypt_final == NULL)
+		rv = CKR_KEY_TYPE_INCONSISTENT;
+	else
+		rv = op->type->encrypt_final(op, pLastEncryptedPart, pulLastEncryptedPartLen);
+
+	if (rv != CKR_BUFFER_TOO_SMALL && (pLastEncryptedPart != NULL || rv != CKR_OK))
+		session_stop_operation(session, SC_PKCS11_OPERATION_ENCRYPT);
+
+	return rv;
+}
+
+/*
+ * Message-based encryption and decryption (PKCS#11 3.0). The key is set up
+ * once; every message then brings its own IV, AAD and tag. Only done in
+ * software, for secret keys held in host memory: keys stored on the card
+ * are rejected, because sc_pkcs15_encrypt_sym() and sc_pkcs15_decrypt_sym()
+ * only offer AES-ECB and AES-CBC, and no AEAD mode.
+ */
+CK_RV
+sc_pkcs11_msg_init(struct sc_pkcs11_session *session, int op_type,
+			CK_MECHANISM_PTR pMechanism,
+			struct sc_pkcs11_object *key,
+			CK_KEY_TYPE key_type)
+{
+#ifdef ENABLE_OPENSSL
+	struct sc_pkcs11_card *p11card;
+	sc_pkcs11_operation_t *operation;
+	sc_pkcs11_mechanism_type_t *mt;
+	struct signature_data *data;
+	const CK_BYTE *value;
+	CK_ULONG value_len;
+	CK_RV rv;
+
+	if (!session || !session->slot
+	 || !(p11card = session->slot->p11card))
+		return CKR_ARGUMENTS_BAD;
+
+	/* See if we support this mechanism type */
+	mt = sc_pkcs11_find_mechanism(p11card, pMechanism->mechanism,
+			op_type == SC_PKCS11_OPERATION_MESSAGE_ENCRYPT
+			? CKF_MESSAGE_ENCRYPT : CKF_MESSAGE_DECRYPT);
+	if (mt == NULL)
+		return CKR_MECHANISM_INVALID;
+
+	/* See if compatible with key type */
+	rv = _validate_key_type(mt, key_type);
+	if (rv != CKR_OK)
+		LOG_FUNC_RETURN(context, (int) rv);
+
+	/* The per message parameters come with each message */
+	if (pMechanism->pParameter != NULL || pMechanism->ulParameterLen != 0)
+		LOG_FUNC_RETURN(context, CKR_MECHANISM_PARAM_INVALID);
+
+	if (!get_host_secret(session, key, &value, &value_len)) {
+		sc_log(context, "Message-based ciphers need a session key held in host memory");
+		LOG_FUNC_RETURN(context, CKR_KEY_FUNCTION_NOT_PERMITTED);
+	}
+
+	if (!(data = new_signature_data()))
+		return CKR_HOST_MEMORY;
+	data->key = key;
+
+	rv = session_start_operation(session, op_type, mt, &operation);
+	if (rv != CKR_OK) {
+		signature_data_release(data);
+		return rv;
+	}
+	memcpy(&operation->mechanism, pMechanism, sizeof(CK_MECHANISM));
+	operation->priv_data = data;
+
+	return CKR_OK;
+#else
+	return CKR_MECHANISM_INVALID;
+#endif
+}
+
+#ifdef ENABLE_OPENSSL
+static CK_RV
+msg_cipher_init(sc_pkcs11_operation_t *op, int op_type,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pAssociatedData, CK_ULONG ulAssociatedDataLen, void **cipher)
+{
+	struct signature_data *data = (struct signature_data *) op->priv_data;
+	const CK_BYTE *value;
+	CK_ULONG value_len;
+
+	/* the key may have been destroyed in the mean time, also by closing
+	 * the session that created it */
+	if (list_locate(&op->session->slot->objects, data->key) < 0
+			|| !get_host_secret(op->session, data->key, &value, &value_len))
+		return CKR_KEY_HANDLE_INVALID;
+
+	return sc_pkcs11_openssl_message_init(op->mechanism.mechanism, value, value_len,
+			op_type == SC_PKCS11_OPERATION_MESSAGE_ENCRYPT,
+			pParameter, ulParameterLen,
+			pAssociatedData, ulAssociatedDataLen, cipher);
+}
+#endif
+
+/* A whole message in one call; the operation stays active for the next one */
+CK_RV
+sc_pkcs11_msg_crypt(struct sc_pkcs11_session *session, int op_type,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pAssociatedData, CK_ULONG ulAssociatedDataLen,
+		CK_BYTE_PTR pIn, CK_ULONG ulInLen,
+		CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+#ifdef ENABLE_OPENSSL
+	sc_pkcs11_operation_t *op;
+	struct signature_data *data;
+	void *cipher = NULL;
+	CK_ULONG out_len;
+	CK_RV rv;
+
+	rv = session_get_operation(session, op_type, &op);
+	if (rv != CKR_OK)
+		return rv;
+	data = (struct signature_data *) op->priv_data;
+	if (data->cipher)
+		return CKR_OPERATION_ACTIVE;
+
+	/* AEAD: the output is as long as the input, the tag is kept apart */
+	if (pOut == NULL) {
+		*pulOutLen = ulInLen;
+		return CKR_OK;
+	}
+	if (*pulOutLen < ulInLen) {
+		*pulOutLen = ulInLen;
+		return CKR_BUFFER_TOO_SMALL;
+	}
+
+	out_len = *pulOutLen;
+	rv = msg_cipher_init(op, op_type, pParameter, ulParameterLen,
+			pAssociatedData, ulAssociatedDataLen, &cipher);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_openssl_cipher(cipher, pIn, ulInLen, pOut, pulOutLen);
+	sc_pkcs11_openssl_cipher_free(cipher);
+	/* never leave unauthenticated plaintext behind */
+	if (rv == CKR_ENCRYPTED_DATA_INVALID)
+		sc_mem_clear(pOut, out_len);
+
+	return rv;
+#else
+	return CKR_OPERATION_NOT_INITIALIZED;
+#endif
+}
+
+CK_RV
+sc_pkcs11_msg_begin(struct sc_pkcs11_session *session, int op_type,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pAssociatedData, CK_ULONG ulAssociatedDataLen)
+{
+#ifdef ENABLE_OPENSSL
+	sc_pkcs11_operation_t *op;
+	struct signature_data *data;
+	CK_RV rv;
+
+	rv = session_get_operation(session, op_type, &op);
+	if (rv != CKR_OK)
+		return rv;
+	data = (struct signature_data *) op->priv_data;
+	if (data->cipher)
+		return CKR_OPERATION_ACTIVE;
+
+	return msg_cipher_init(op, op_type, pParameter, ulParameterLen,
+			pAssociatedData, ulAssociatedDataLen, &data->cipher);
+#else
+	return CKR_OPERATION_NOT_INITIALIZED;
+#endif
+}
+
+CK_RV
+sc_pkcs11_msg_next(struct sc_pkcs11_session *session, int op_type,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pIn, CK_ULONG ulInLen,
+		CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen,
+		CK_FLAGS flags)
+{
+#ifdef ENABLE_OPENSSL
+	sc_pkcs11_operation_t *op;
+	struct signature_data *data;
+	CK_ULONG out_len;
+	CK_RV rv;
+
+	rv = session_get_operation(session, op_type, &op);
+	if (rv != CKR_OK)
+		return rv;
+	data = (struct signature_data *) op->priv_data;
+	if (data->cipher == NULL)
+		return CKR_OPERATION_NOT_INITIALIZED;
+
+	out_len = pOut != NULL ? *pulOutLen : 0;
+	if (flags & CKF_END_OF_MESSAGE) {
+		/* decryption releases the whole message once the tag is verified */
+		if (pParameter != NULL)
+			rv = sc_pkcs11_openssl_message_params(data->cipher, pParameter, ulParameterLen);
+		if (rv == CKR_OK)
+			rv = sc_pkcs11_openssl_cipher(data->cipher, pIn, ulInLen, pOut, pulOutLen);
+	}
+	else
+		rv = sc_pkcs11_openssl_cipher_update(data->cipher, pIn, ulInLen, pOut, pulOutLen);
+	if (rv == CKR_BUFFER_TOO_SMALL || (rv == CKR_OK && pOut == NULL))
+		return rv;
+	if (rv == CKR_ENCRYPTED_DATA_INVALID)
+		sc_mem_clear(pOut, out_len);
+
+	if (rv != CKR_OK || (flags & CKF_END_OF_MESSAGE)) {
+		sc_pkcs11_openssl_cipher_free(data->cipher);
+		data->cipher = NULL;
+	}
+	return rv;
+#else
+	return CKR_OPERATION_NOT_INITIALIZED;
+#endif
+}
+
+CK_RV
+sc_pkcs11_msg_final(struct sc_pkcs11_session *session, int op_type)
+{
+	sc_pkcs11_operation_t *op;
+	CK_RV rv;
+
+	rv = session_get_operation(session, op_type, &op);
+	if (rv != CKR_OK)
+		return rv;
+
+	return session_stop_operation(session, op_type);
+}
+
 CK_RV
 sc_pkcs11_wrap(struct sc_pkcs11_session *session,
 	CK_MECHANISM_PTR pMechanism,
@@ -1134,6 +1598,224 @@ out:
 }
 
 
+/*
+ * AES with a secret key of the card. The card is given whole blocks, so the
+ * parts of a multi-part operation are streamed to it as they come: a partial
+ * block is held back for the next part, as is the last block of a CBC_PAD
+ * decryption, until its padding can be checked in the final call. The CBC
+ * chaining value is carried from part to part in the IV of the mechanism
+ * parameter, so that each part is an operation of its own for the card.
+ */
+static int
+is_card_block_cipher(sc_pkcs11_operation_t *operation)
+{
+	switch (operation->mechanism.mechanism) {
+	case CKM_AES_ECB:
+	case CKM_AES_CBC:
+	case CKM_AES_CBC_PAD:
+		return 1;
+	}
+	return 0;
+}
+
+static CK_RV
+card_block_cipher_init(sc_pkcs11_operation_t *operation)
+{
+	if (operation->mechanism.mechanism != CKM_AES_ECB
+			&& (operation->mechanism.pParameter == NULL
+				|| operation->mechanism.ulParameterLen != 16))
+		return CKR_MECHANISM_PARAM_INVALID;
+	return CKR_OK;
+}
+
+/* Whole blocks, without padding */
+static CK_RV
+card_block_cipher(sc_pkcs11_operation_t *operation, int encrypt,
+		CK_BYTE_PTR pIn, CK_ULONG ulInLen,
+		CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+	struct signature_data *data = (struct signature_data*) operation->priv_data;
+	struct sc_pkcs11_object *key = data->key;
+	CK_MECHANISM mech = operation->mechanism;
+	CK_BYTE next_iv[16] = {0};
+	CK_RV rv;
+
+	if ((encrypt ? key->ops->encrypt : key->ops->decrypt) == NULL)
+		return CKR_KEY_FUNCTION_NOT_PERMITTED;
+
+	if (mech.mechanism == CKM_AES_CBC_PAD)
+		mech.mechanism = CKM_AES_CBC;
+	if (mech.mechanism == CKM_AES_CBC && !encrypt)
+		memcpy(next_iv, pIn + ulInLen - sizeof(next_iv), sizeof(next_iv));
+
+	if (encrypt)
+		rv = key->ops->encrypt(operation->session, key, &mech,
+				pIn, ulInLen, pOut, pulOutLen);
+	else
+		rv = key->ops->decrypt(operation->session, key, &mech,
+				pIn, ulInLen, pOut, pulOutLen);
+	if (rv != CKR_OK)
+		return rv;
+	if (*pulOutLen != ulInLen)
+		return CKR_DEVICE_ERROR;
+
+	/* The last cipher block is the IV of the next part */
+	if (mech.mechanism == CKM_AES_CBC)
+		memcpy(operation->mechanism.pParameter,
+				encrypt ? pOut + ulInLen - sizeof(next_iv) : next_iv, sizeof(next_iv));
+	return CKR_OK;
+}
+
+static CK_RV
+card_block_cipher_update(sc_pkcs11_operation_t *operation, int encrypt,
+		CK_BYTE_PTR pIn, CK_ULONG ulInLen,
+		CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+	struct signature_data *data = (struct signature_data*) operation->priv_data;
+	CK_ULONG total, keep, len;
+	CK_BYTE tail[16];
+	CK_BYTE *buf;
+	CK_RV rv;
+
+	total = data->held_len + ulInLen;
+	keep = total % 16;
+	if (keep == 0 && total > 0 && !encrypt
+			&& operation->mechanism.mechanism == CKM_AES_CBC_PAD)
+		keep = 16;
+	len = total - keep;
+
+	if (pOut == NULL) {
+		*pulOutLen = len;
+		return CKR_OK;
+	}
+	if (*pulOutLen < len) {
+		*pulOutLen = len;
+		return CKR_BUFFER_TOO_SMALL;
+	}
+	if (len == 0) {
+		memcpy(data->held + data->held_len, pIn, ulInLen);
+		data->held_len += ulInLen;
+		*pulOutLen = 0;
+		return CKR_OK;
+	}
+
+	/* pIn and pOut may be the same buffer */
+	memcpy(tail, pIn + ulInLen - keep, keep);
+	buf = malloc(len);
+	if (buf == NULL)
+		return CKR_HOST_MEMORY;
+	memcpy(buf, data->held, data->held_len);
+	memcpy(buf + data->held_len, pIn, len - data->held_len);
+
+	rv = card_block_cipher(operation, encrypt, buf, len, pOut, pulOutLen);
+	sc_mem_clear(buf, len);
+	free(buf);
+	if (rv == CKR_OK) {
+		memcpy(data->held, tail, keep);
+		data->held_len = keep;
+	}
+	sc_mem_clear(tail, sizeof(tail));
+	return rv;
+}
+
+static CK_RV
+card_block_cipher_final(sc_pkcs11_operation_t *operation, int encrypt,
+		CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+	struct signature_data *data = (struct signature_data*) operation->priv_data;
+	CK_BYTE block[16], iv[16];
+	CK_ULONG len = sizeof(block), pad, i;
+	CK_RV rv;
+
+	if (operation->mechanism.mechanism != CKM_AES_CBC_PAD) {
+		if (data->held_len != 0)
+			return encrypt ? CKR_DATA_LEN_RANGE : CKR_ENCRYPTED_DATA_LEN_RANGE;
+		*pulOutLen = 0;
+		return CKR_OK;
+	}
+
+	if (encrypt) {
+		if (pOut == NULL) {
+			*pulOutLen = sizeof(block);
+			return CKR_OK;
+		}
+		if (*pulOutLen < sizeof(block)) {
+			*pulOutLen = sizeof(block);
+			return CKR_BUFFER_TOO_SMALL;
+		}
+		pad = sizeof(block) - data->held_len;
+		memcpy(block, data->held, data->held_len);
+		memset(block + data->held_len, (int) pad, pad);
+		rv = card_block_cipher(operation, 1, block, sizeof(block), pOut, pulOutLen);
+		sc_mem_clear(block, sizeof(block));
+		return rv;
+	}
+
+	if (data->held_len != sizeof(block))
+		return CKR_ENCRYPTED_DATA_LEN_RANGE;
+	/* The length is only known after decryption, give an upper bound */
+	if (pOut == NULL) {
+		*pulOutLen = sizeof(block);
+		return CKR_OK;
+	}
+
+	/* Decrypting moves the IV on, keep it for a retry with a bigger buffer */
+	memcpy(iv, operation->mechanism.pParameter, sizeof(iv));
+	rv = card_block_cipher(operation, 0, data->held, sizeof(block), block, &len);
+	if (rv == CKR_OK) {
+		pad = block[sizeof(block) - 1];
+		if (pad == 0 || pad > sizeof(block))
+			rv = CKR_ENCRYPTED_DATA_INVALID;
+		for (i = 1; rv == CKR_OK && i < pad; i++)
+			if (block[sizeof(block) - 1 - i] != pad)
+				rv = CKR_ENCRYPTED_DATA_INVALID;
+	}
+	if (rv == CKR_OK && *pulOutLen < sizeof(block) - pad) {
+		*pulOutLen = sizeof(block) - pad;
+		memcpy(operation->mechanism.pParameter, iv, sizeof(iv));
+		rv = CKR_BUFFER_TOO_SMALL;
+	}
+	if (rv == CKR_OK) {
+		*pulOutLen = sizeof(block) - pad;
+		memcpy(pOut, block, *pulOutLen);
+	}
+	sc_mem_clear(block, sizeof(block));
+	return rv;
+}
+
+/* Single-part: the whole message as one part and the final call */
+static CK_RV
+card_block_cipher_oneshot(sc_pkcs11_operation_t *operation, int encrypt,
+		CK_BYTE_PTR pIn, CK_ULONG ulInLen,
+		CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+	CK_ULONG len, last;
+	CK_RV rv;
+
+	len = ulInLen;
+	if (encrypt && operation->mechanism.mechanism == CKM_AES_CBC_PAD)
+		len = (ulInLen / 16 + 1) * 16;
+	if (pOut == NULL) {
+		*pulOutLen = len;
+		return CKR_OK;
+	}
+	if (*pulOutLen < len) {
+		*pulOutLen = len;
+		return CKR_BUFFER_TOO_SMALL;
+	}
+
+	len = *pulOutLen;
+	rv = card_block_cipher_update(operation, encrypt, pIn, ulInLen, pOut, &len);
+	if (rv != CKR_OK)
+		return rv;
+	last = *pulOutLen - len;
+	rv = card_block_cipher_final(operation, encrypt, pOut + len, &last);
+	if (rv != CKR_OK)
+		return rv;
+	*pulOutLen = len + last;
+	return CKR_OK;
+}
+
 /*
  * Initialize a decrypt operation
  */
@@ -1142,6 +1824,10 @@ sc_pkcs11_decrypt_init(sc_pkcs11_operation_t *operation,
 			struct sc_pkcs11_object *key)
 {
 	struct signature_data *data;
+#ifdef ENABLE_OPENSSL
+	const CK_BYTE *value;
+	CK_ULONG value_len;
+#endif
 	CK_RV rv;
 
 	if (!(data = new_signature_data()))
@@ -1161,6 +1847,25 @@ sc_pkcs11_decrypt_init(sc_pkcs11_operation_t *operation,
 		}
 	}
 
+#ifdef ENABLE_OPENSSL
+	if (get_host_secret(operation->session, key, &value, &value_len)) {
+		rv = sc_pkcs11_openssl_cipher_init(&operation->mechanism,
+				value, value_len, 0, &data->cipher);
+		if (rv != CKR_OK) {
+			signature_data_release(data);
+			LOG_FUNC_RETURN(context, (int) rv);
+		}
+	}
+	else
+#endif
+	if (is_card_block_cipher(operation)) {
+		rv = card_block_cipher_init(operation);
+		if (rv != CKR_OK) {
+			signature_data_release(data);
+			LOG_FUNC_RETURN(context, (int) rv);
+		}
+	}
+
 	operation->priv_data = data;
 	return CKR_OK;
 }
@@ -1175,6 +1880,16 @@ sc_pkcs11_decrypt(sc_pkcs11_operation_t *operation,
 
 	data = (struct signature_data*) operation->priv_data;
 
+#ifdef ENABLE_OPENSSL
+	if (data->cipher)
+		return sc_pkcs11_openssl_cipher(data->cipher,
+				pEncryptedData, ulEncryptedDataLen, pData, pulDataLen);
+#endif
+
+	if (is_card_block_cipher(operation))
+		return card_block_cipher_oneshot(operation, 0,
+				pEncryptedData, ulEncryptedDataLen, pData, pulDataLen);
+
 	key = data->key;
 	return key->ops->decrypt(operation->session,
 				key, &operation->mechanism,
@@ -1182,6 +1897,153 @@ sc_pkcs11_decrypt(sc_pkcs11_operation_t *operation,
 				pData, pulDataLen);
 }
 
+static CK_RV
+sc_pkcs11_decrypt_update(sc_pkcs11_operation_t *operation,
+		CK_BYTE_PTR pEncryptedPart, CK_ULONG ulEncryptedPartLen,
+		CK_BYTE_PTR pPart, CK_ULONG_PTR pulPartLen)
+{
+#ifdef ENABLE_OPENSSL
+	struct signature_data *data = (struct signature_data*) operation->priv_data;
+
+	if (data->cipher)
+		return sc_pkcs11_openssl_cipher_update(data->cipher,
+				pEncryptedPart, ulEncryptedPartLen, pPart, pulPartLen);
+#endif
+	if (is_card_block_cipher(operation))
+		return card_block_cipher_update(operation, 0,
+				pEncryptedPart, ulEncryptedPartLen, pPart, pulPartLen);
+	return CKR_KEY_TYPE_INCONSISTENT;
+}
+
+static CK_RV
+sc_pkcs11_decrypt_final(sc_pkcs11_operation_t *operation,
+		CK_BYTE_PTR pLastPart, CK_ULONG_PTR pulLastPartLen)
+{
+#ifdef ENABLE_OPENSSL
+	struct signature_data *data = (struct signature_data*) operation->priv_data;
+
+	if (data->cipher)
+		return sc_pkcs11_openssl_cipher_final(data->cipher, pLastPart, pulLastPartLen);
+#endif
+	if (is_card_block_cipher(operation))
+		return card_block_cipher_final(operation, 0, pLastPart, pulLastPartLen);
+	return CKR_KEY_TYPE_INCONSISTENT;
+}
+
+/*
+ * Initialize an encrypt operation
+ */
+static CK_RV
+sc_pkcs11_encrypt_init(sc_pkcs11_operation_t *operation,
+			struct sc_pkcs11_object *key)
+{
+	struct signature_data *data;
+#ifdef ENABLE_OPENSSL
+	const CK_BYTE *value;
+	CK_ULONG value_len;
+#endif
+	CK_RV rv;
+
+	if (!(data = new_signature_data()))
+		return CKR_HOST_MEMORY;
+
+	data->key = key;
+
+	if (key->ops->can_do)   {
+		rv = key->ops->can_do(operation->session, key, operation->type->mech, CKF_ENCRYPT);
+		if ((rv != CKR_OK) && (rv != CKR_FUNCTION_NOT_SUPPORTED))   {
+			free(data);
+			LOG_FUNC_RETURN(context, (int) rv);
+		}
+	}
+
+#ifdef ENABLE_OPENSSL
+	if (get_host_secret(operation->session, key, &value, &value_len)) {
+		rv = sc_pkcs11_openssl_cipher_init(&operation->mechanism,
+				value, value_len, 1, &data->cipher);
+		if (rv != CKR_OK) {
+			signature_data_release(data);
+			LOG_FUNC_RETURN(context, (int) rv);
+		}
+	}
+	else
+#endif
+	if (is_card_block_cipher(operation)) {
+		rv = card_block_cipher_init(operation);
+		if (rv != CKR_OK) {
+			signature_data_release(data);
+			LOG_FUNC_RETURN(context, (int) rv);
+		}
+	}
+
+	operation->priv_data = data;
+	return CKR_OK;
+}
+
+static CK_RV
+sc_pkcs11_encrypt(sc_pkcs11_operation_t *operation,
+		CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+		CK_BYTE_PTR pEncryptedData, CK_ULONG_PTR pulEncryptedDataLen)
+{
+	struct signature_data *data;
+	struct sc_pkcs11_object *key;
+
+	data = (struct signature_data*) operation->priv_data;
+
+#ifdef ENABLE_OPENSSL
+	if (data->cipher)
+		return sc_pkcs11_openssl_cipher(data->cipher,
+				pData, ulDataLen, pEncryptedData, pulEncryptedDataLen);
+#endif
+
+	if (is_card_block_cipher(operation))
+		return card_block_cipher_oneshot(operation, 1,
+				pData, ulDataLen, pEncryptedData, pulEncryptedDataLen);
+
+	key = data->key;
+	if (key->ops->encrypt == NULL)
+		return CKR_KEY_FUNCTION_NOT_PERMITTED;
+	return key->ops->encrypt(operation->session,
+				key, &operation->mechanism,
+				pData, ulDataLen,
+				pEncryptedData, pulEncryptedDataLen);
+}
+
+static CK_RV
+sc_pkcs11_encrypt_update(sc_pkcs11_operation_t *operation,
+		CK_BYTE_PTR pPart, CK_ULONG ulPartLen,
+		CK_BYTE_PTR pEncryptedPart, CK_ULONG_PTR pulEncryptedPartLen)
+{
+#ifdef ENABLE_OPENSSL
+	struct signature_data *data = (struct signature_data*) operation->priv_data;
+
+	if (data->cipher)
+		return sc_pkcs11_openssl_cipher_update(data->cipher,
+				pPart, ulPartLen, pEncryptedPart, pulEncryptedPartLen);
+#endif
+	if (is_card_block_cipher(operation))
+		return card_block_cipher_update(operation, 1,
+				pPart, ulPartLen, pEncryptedPart, pulEncryptedPartLen);
+	return CKR_KEY_TYPE_INCONSISTENT;
+}
+
+static CK_RV
+sc_pkcs11_encrypt_final(sc_pkcs11_operation_t *operation,
+		CK_BYTE_PTR pLastEncryptedPart, CK_ULONG_PTR pulLastEncryptedPartLen)
+{
+#ifdef ENABLE_OPENSSL
+	struct signature_data *data = (struct signature_data*) operation->priv_data;
+
+	if (data->cipher)
+		return sc_pkcs11_openssl_cipher_final(data->cipher,
+				pLastEncryptedPart, pulLastEncryptedPartLen);
+#endif
+	if (is_card_block_cipher(operation))
+		return card_block_cipher_final(operation, 1,
+				pLastEncryptedPart, pulLastEncryptedPartLen);
+	return CKR_KEY_TYPE_INCONSISTENT;
+}
+
 static CK_RV
 sc_pkcs11_derive(sc_pkcs11_operation_t *operation,
 	    struct sc_pkcs11_object *basekey,
@@ -1275,9 +2137,17 @@ sc_pkcs11_new_fw_mechanism(CK_MECHANISM_TYPE mech,
 	if (pInfo->flags & CKF_DERIVE) {
 		mt->derive = sc_pkcs11_derive;
 	}
+	if (pInfo->flags & CKF_ENCRYPT) {
+		mt->encrypt_init = sc_pkcs11_encrypt_init;
+		mt->encrypt = sc_pkcs11_encrypt;
+		mt->encrypt_update = sc_pkcs11_encrypt_update;
+		mt->encrypt_final = sc_pkcs11_encrypt_final;
+	}
 	if (pInfo->flags & CKF_DECRYPT) {
 		mt->decrypt_init = sc_pkcs11_decrypt_init;
 		mt->decrypt = sc_pkcs11_decrypt;
+		mt->decrypt_update = sc_pkcs11_decrypt_update;
+		mt->decrypt_final = sc_pkcs11_decrypt_final;
 	}
 
 	return mt;
@@ -465,6 +465,9 @@ void load_pkcs11_parameters(struct sc_pkcs11_config *conf, sc_context_t * ctx)
 	conf->pin_unblock_style = SC_PKCS11_PIN_UNBLOCK_NOT_ALLOWED;
 	conf->create_puk_slot = 0;
 	conf->create_slots_flags = SC_PKCS11_SLOT_CREATE_ALL;
+	conf->pin_status_ttl = 1000;
+	conf->random_reseed_interval = 0;
+	conf->session_key_mechanisms = 0;
 
 	conf_block = sc_get_conf_block(ctx, "pkcs11", NULL, 1);
 	if (!conf_block)
@@ -478,6 +481,11 @@ void load_pkcs11_parameters(struct sc_pkcs11_config *conf, sc_context_t * ctx)
 		conf->lock_login = 1;
 	conf->lock_login = scconf_get_bool(conf_block, "lock_login", conf->lock_login);
 	conf->init_sloppy = scconf_get_bool(conf_block, "init_sloppy", conf->init_sloppy);
+	conf->pin_status_ttl = scconf_get_int(conf_block, "pin_status_ttl", conf->pin_status_ttl);
+	conf->random_reseed_interval = scconf_get_int(conf_block, "random_reseed_interval",
+			conf->random_reseed_interval);
+	conf->session_key_mechanisms = scconf_get_bool(conf_block, "session_key_mechanisms",
+			conf->session_key_mechanisms);
 
 	unblock_style = (char *)scconf_get_str(conf_block, "user_pin_unblock_style", NULL);
 	if (unblock_style && !strcmp(unblock_style, "set_pin_in_unlogged_session"))
@@ -506,8 +514,10 @@ void load_pkcs11_parameters(struct sc_pkcs11_config *conf, sc_context_t * ctx)
 
 	sc_log(ctx, "PKCS#11 options: max_virtual_slots=%d slots_per_card=%d "
 		 "lock_login=%d atomic=%d pin_unblock_style=%d "
-		 "create_slots_flags=0x%X",
+		 "create_slots_flags=0x%X pin_status_ttl=%u "
+		 "random_reseed_interval=%u session_key_mechanisms=%d",
 		 conf->max_virtual_slots, conf->slots_per_card,
 		 conf->lock_login, conf->atomic, conf->pin_unblock_style,
-		 conf->create_slots_flags);
+		 conf->create_slots_flags, conf->pin_status_ttl,
+		 conf->random_reseed_interval, conf->session_key_mechanisms);
 }
@@ -22,6 +22,7 @@
 #include "config.h"
 
 #ifdef ENABLE_OPENSSL		/* empty file without openssl */
+#include <limits.h>
 #include <string.h>
 #include <openssl/bn.h>
 #include <openssl/evp.h>
@@ -61,7 +62,8 @@ static sc_pkcs11_mechanism_type_t openssl_sha1_mech = {
 	sc_pkcs11_openssl_md_final,
 	NULL, NULL, NULL, NULL,	/* sign_* */
 	NULL, NULL, NULL,	/* verif_* */
-	NULL, NULL,		/* decrypt_* */
+	NULL, NULL, NULL, NULL,	/* encrypt_* */
+	NULL, NULL, NULL, NULL,	/* decrypt_* */
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
@@ -80,7 +82,8 @@ static sc_pkcs11_mechanism_type_t openssl_sha224_mech = {
 	sc_pkcs11_openssl_md_final,
 	NULL, NULL, NULL, NULL,	/* sign_* */
 	NULL, NULL, NULL,	/* verif_* */
-	NULL, NULL,		/* decrypt_* */
+	NULL, NULL, NULL, NULL,	/* encrypt_* */
+	NULL, NULL, NULL, NULL,	/* decrypt_* */
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
@@ -99,7 +102,8 @@ static sc_pkcs11_mechanism_type_t openssl_sha256_mech = {
 	sc_pkcs11_openssl_md_final,
 	NULL, NULL, NULL, NULL,	/* sign_* */
 	NULL, NULL, NULL,	/* verif_* */
-	NULL, NULL,		/* decrypt_* */
+	NULL, NULL, NULL, NULL,	/* encrypt_* */
+	NULL, NULL, NULL, NULL,	/* decrypt_* */
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
@@ -118,7 +122,8 @@ static sc_pkcs11_mechanism_type_t openssl_sha384_mech = {
 	sc_pkcs11_openssl_md_final,
 	NULL, NULL, NULL, NULL,	/* sign_* */
 	NULL, NULL, NULL,	/* verif_* */
-	NULL, NULL,		/* decrypt_* */
+	NULL, NULL, NULL, NULL,	/* encrypt_* */
+	NULL, NULL, NULL, NULL,	/* decrypt_* */
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
@@ -137,7 +142,8 @@ static sc_pkcs11_mechanism_type_t openssl_sha512_mech = {
 	sc_pkcs11_openssl_md_final,
 	NULL, NULL, NULL, NULL,	/* sign_* */
 	NULL, NULL, NULL,	/* verif_* */
-	NULL, NULL,		/* decrypt_* */
+	NULL, NULL, NULL, NULL,	/* encrypt_* */
+	NULL, NULL, NULL, NULL,	/* decrypt_* */
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
@@ -156,7 +162,8 @@ static sc_pkcs11_mechanism_type_t openssl_gostr3411_mech = {
 	sc_pkcs11_openssl_md_final,
 	NULL, NULL, NULL, NULL,	/* sign_* */
 	NULL, NULL, NULL,	/* verif_* */
-	NULL, NULL,		/* decrypt_* */
+	NULL, NULL, NULL, NULL,	/* encrypt_* */
+	NULL, NULL, NULL, NULL,	/* decrypt_* */
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
@@ -175,7 +182,8 @@ static sc_pkcs11_mechanism_type_t openssl_md5_mech = {
 	sc_pkcs11_openssl_md_final,
 	NULL, NULL, NULL, NULL,	/* sign_* */
 	NULL, NULL, NULL,	/* verif_* */
-	NULL, NULL,		/* decrypt_* */
+	NULL, NULL, NULL, NULL,	/* encrypt_* */
+	NULL, NULL, NULL, NULL,	/* decrypt_* */
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
@@ -194,7 +202,8 @@ static sc_pkcs11_mechanism_type_t openssl_ripemd160_mech = {
 	sc_pkcs11_openssl_md_final,
 	NULL, NULL, NULL, NULL,	/* sign_* */
 	NULL, NULL, NULL,	/* verif_* */
-	NULL, NULL,		/* decrypt_* */
+	NULL, NULL, NULL, NULL,	/* encrypt_* */
+	NULL, NULL, NULL, NULL,	/* decrypt_* */
 	NULL,			/* derive */
 	NULL,			/* wrap */
 	NULL,			/* unwrap */
@@ -210,6 +219,92 @@ static void * dup_mem(void *in, size_t in_len)
 	return out;
 }
 
+/*
+ * The digest algorithms are looked up once, at C_Initialize. With OpenSSL 3
+ * the EVP_sha*() objects would be fetched from the providers again at every
+ * EVP_DigestInit_ex(), so the implementations are fetched here instead.
+ */
+enum {
+	OPENSSL_MD_SHA1,
+	OPENSSL_MD_SHA224,
+	OPENSSL_MD_SHA256,
+	OPENSSL_MD_SHA384,
+	OPENSSL_MD_SHA512,
+	OPENSSL_MD_MD5,
+	OPENSSL_MD_RIPEMD160,
+	OPENSSL_MD_MAX
+};
+
+static const EVP_MD *openssl_md[OPENSSL_MD_MAX];
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static EVP_MD *openssl_md_fetched[OPENSSL_MD_MAX];
+#endif
+
+void
+sc_pkcs11_openssl_init(void)
+{
+	static const struct {
+		const char *name;
+		const EVP_MD *(*get)(void);
+	} digests[OPENSSL_MD_MAX] = {
+		{ "SHA1",	EVP_sha1 },
+		{ "SHA224",	EVP_sha224 },
+		{ "SHA256",	EVP_sha256 },
+		{ "SHA384",	EVP_sha384 },
+		{ "SHA512",	EVP_sha512 },
+		{ "MD5",	EVP_md5 },
+		{ "RIPEMD160",	EVP_ripemd160 },
+	};
+	int i;
+
+	for (i = 0; i < OPENSSL_MD_MAX; i++) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		/* not all of them are in the default provider */
+		if (openssl_md_fetched[i] == NULL)
+			openssl_md_fetched[i] = EVP_MD_fetch(NULL, digests[i].name, NULL);
+		if (openssl_md_fetched[i] != NULL) {
+			openssl_md[i] = openssl_md_fetched[i];
+			continue;
+		}
+#endif
+		openssl_md[i] = digests[i].get();
+	}
+}
+
+void
+sc_pkcs11_openssl_cleanup(void)
+{
+	int i;
+
+	for (i = 0; i < OPENSSL_MD_MAX; i++) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		EVP_MD_free(openssl_md_fetched[i]);
+		openssl_md_fetched[i] = NULL;
+#endif
+		openssl_md[i] = NULL;
+	}
+}
+
+static const EVP_MD *
+openssl_digest(int idx)
+{
+	if (openssl_md[idx] == NULL)
+		sc_pkcs11_openssl_init();
+	return openssl_md[idx];
+}
+
+/* The templates stay untouched, so that the tokens of several readers can
+ * register their mechanisms at the same time */
+static void register_openssl_digest(struct sc_pkcs11_card *p11card,
+		const sc_pkcs11_mechanism_type_t *tmpl, const EVP_MD *md)
+{
+	sc_pkcs11_mechanism_type_t *mt = dup_mem((void *) tmpl, sizeof *tmpl);
+
+	if (mt)
+		mt->mech_data = md;
+	sc_pkcs11_register_mechanism(p11card, mt);
+}
+
 void
 sc_pkcs11_register_openssl_mechanisms(struct sc_pkcs11_card *p11card)
 {
@@ -259,24 +354,17 @@ sc_pkcs11_register_openssl_mechanisms(struct sc_pkcs11_card *p11card)
 #endif
 #endif /* !defined(OPENSSL_NO_ENGINE) */
 
-	openssl_sha1_mech.mech_data = EVP_sha1();
-	sc_pkcs11_register_mechanism(p11card, dup_mem(&openssl_sha1_mech, sizeof openssl_sha1_mech));
-	openssl_sha224_mech.mech_data = EVP_sha224();
-	sc_pkcs11_register_mechanism(p11card, dup_mem(&openssl_sha224_mech, sizeof openssl_sha224_mech));
-	openssl_sha256_mech.mech_data = EVP_sha256();
-	sc_pkcs11_register_mechanism(p11card, dup_mem(&openssl_sha256_mech, sizeof openssl_sha256_mech));
-	openssl_sha384_mech.mech_data = EVP_sha384();
-	sc_pkcs11_register_mechanism(p11card, dup_mem(&openssl_sha384_mech, sizeof openssl_sha384_mech));
-	openssl_sha512_mech.mech_data = EVP_sha512();
-	sc_pkcs11_register_mechanism(p11card, dup_mem(&openssl_sha512_mech, sizeof openssl_sha512_mech));
+	register_openssl_digest(p11card, &openssl_sha1_mech, openssl_digest(OPENSSL_MD_SHA1));
+	register_openssl_digest(p11card, &openssl_sha224_mech, openssl_digest(OPENSSL_MD_SHA224));
+	register_openssl_digest(p11card, &openssl_sha256_mech, openssl_digest(OPENSSL_MD_SHA256));
+	register_openssl_digest(p11card, &openssl_sha384_mech, openssl_digest(OPENSSL_MD_SHA384));
+	register_openssl_digest(p11card, &openssl_sha512_mech, openssl_digest(OPENSSL_MD_SHA512));
 	if (!FIPS_mode()) {
-		openssl_md5_mech.mech_data = EVP_md5();
-		sc_pkcs11_register_mechanism(p11card, dup_mem(&openssl_md5_mech, sizeof openssl_md5_mech));
-		openssl_ripemd160_mech.mech_data = EVP_ripemd160();
-		sc_pkcs11_register_mechanism(p11card, dup_mem(&openssl_ripemd160_mech, sizeof openssl_ripemd160_mech));
+		register_openssl_digest(p11card, &openssl_md5_mech, openssl_digest(OPENSSL_MD_MD5));
+		register_openssl_digest(p11card, &openssl_ripemd160_mech, openssl_digest(OPENSSL_MD_RIPEMD160));
 	}
-	openssl_gostr3411_mech.mech_data = EVP_get_digestbynid(NID_id_GostR3411_94);
-	sc_pkcs11_register_mechanism(p11card, dup_mem(&openssl_gostr3411_mech, sizeof openssl_gostr3411_mech));
+	register_openssl_digest(p11card, &openssl_gostr3411_mech,
+			EVP_get_digestbynid(NID_id_GostR3411_94));
 }
 
 
@@ -286,6 +374,48 @@ sc_pkcs11_register_openssl_mechanisms(struct sc_pkcs11_card *p11card)
 #define DIGEST_CTX(op) \
 	(op ? (EVP_MD_CTX *) (op)->priv_data : NULL)
 
+/* Digest contexts are kept by the session when an operation ends and
+ * EVP_DigestInit_ex() sets them up again for the next one, instead of
+ * allocating a new context for every message. */
+static EVP_MD_CTX *md_ctx_get(struct sc_pkcs11_session *session)
+{
+	EVP_MD_CTX *md_ctx;
+	int i;
+
+	for (i = 0; session && i < SC_PKCS11_MD_CTX_POOL_SIZE; i++) {
+		if (session->md_ctx_pool[i] != NULL) {
+			md_ctx = session->md_ctx_pool[i];
+			session->md_ctx_pool[i] = NULL;
+			return md_ctx;
+		}
+	}
+	return EVP_MD_CTX_create();
+}
+
+static void md_ctx_put(struct sc_pkcs11_session *session, EVP_MD_CTX *md_ctx)
+{
+	int i;
+
+	for (i = 0; session && i < SC_PKCS11_MD_CTX_POOL_SIZE; i++) {
+		if (session->md_ctx_pool[i] == NULL) {
+			session->md_ctx_pool[i] = md_ctx;
+			return;
+		}
+	}
+	EVP_MD_CTX_destroy(md_ctx);
+}
+
+void sc_pkcs11_openssl_md_pool_free(struct sc_pkcs11_session *session)
+{
+	int i;
+
+	for (i = 0; i < SC_PKCS11_MD_CTX_POOL_SIZE; i++) {
+		if (session->md_ctx_pool[i] != NULL)
+			EVP_MD_CTX_destroy(session->md_ctx_pool[i]);
+		session->md_ctx_pool[i] = NULL;
+	}
+}
+
 static CK_RV sc_pkcs11_openssl_md_init(sc_pkcs11_operation_t *op)
 {
 	sc_pkcs11_mechanism_type_t *mt;
@@ -295,10 +425,10 @@ static CK_RV sc_pkcs11_openssl_md_init(sc_pkcs11_operation_t *op)
 	if (!op || !(mt = op->type) || !(md = (EVP_MD *) mt->mech_data))
 		return CKR_ARGUMENTS_BAD;
 
-	if (!(md_ctx = EVP_MD_CTX_create()))
+	if (!(md_ctx = md_ctx_get(op->session)))
 		return CKR_HOST_MEMORY;
-	if (!EVP_DigestInit(md_ctx, md)) {
-		EVP_MD_CTX_destroy(md_ctx);
+	if (!EVP_DigestInit_ex(md_ctx, md, NULL)) {
+		md_ctx_put(op->session, md_ctx);
 		return CKR_GENERAL_ERROR;
 	}
 	op->priv_data = md_ctx;
@@ -320,6 +450,7 @@ static CK_RV sc_pkcs11_openssl_md_final(sc_pkcs11_operation_t *op,
 				CK_BYTE_PTR pDigest, CK_ULONG_PTR pulDigestLen)
 {
 	EVP_MD_CTX *md_ctx = DIGEST_CTX(op);
+	unsigned int len;
 
 	if (!md_ctx)
 		return CKR_ARGUMENTS_BAD;
@@ -329,8 +460,10 @@ static CK_RV sc_pkcs11_openssl_md_final(sc_pkcs11_operation_t *op,
 		*pulDigestLen = EVP_MD_CTX_size(md_ctx);
 		return CKR_BUFFER_TOO_SMALL;
 	}
-	if (!EVP_DigestFinal(md_ctx, pDigest, (unsigned *) pulDigestLen))
+	/* _ex keeps the context for the next operation of the session */
+	if (!EVP_DigestFinal_ex(md_ctx, pDigest, &len))
 		return CKR_GENERAL_ERROR;
+	*pulDigestLen = len;
 
 	return CKR_OK;
 }
@@ -340,11 +473,651 @@ static void sc_pkcs11_openssl_md_release(sc_pkcs11_operation_t *op)
 	if (op) {
 		EVP_MD_CTX	*md_ctx = DIGEST_CTX(op);
 		if (md_ctx)
-			EVP_MD_CTX_destroy(md_ctx);
+			md_ctx_put(op->session, md_ctx);
 		op->priv_data = NULL;
 	}
 }
 
+/*
+ * Software AES and ChaCha20-Poly1305 for secret keys held in host memory
+ */
+struct openssl_cipher {
+	EVP_CIPHER_CTX	*ctx;
+	CK_MECHANISM_TYPE mech;
+	int		encrypt;
+	int		padding;
+	CK_ULONG	block_size;
+	CK_ULONG	buffered;	/* input kept back by the EVP context */
+	CK_ULONG	tag_len;	/* AEAD only */
+	CK_BYTE		*tag;		/* message-based API: tag kept apart from the data */
+	CK_BYTE		held[16];	/* AEAD decryption: last bytes, maybe the tag */
+	CK_ULONG	held_len;
+	CK_BYTE		*plain;		/* AEAD decryption: output until the tag is verified */
+	CK_ULONG	plain_len;
+	CK_ULONG	plain_size;
+};
+
+static const EVP_CIPHER *
+openssl_aes_cipher(CK_MECHANISM_TYPE mech, CK_ULONG key_len)
+{
+	switch (mech) {
+	case CKM_AES_ECB:
+		return key_len == 16 ? EVP_aes_128_ecb()
+			: key_len == 24 ? EVP_aes_192_ecb()
+			: key_len == 32 ? EVP_aes_256_ecb() : NULL;
+	case CKM_AES_CBC:
+	case CKM_AES_CBC_PAD:
+		return key_len == 16 ? EVP_aes_128_cbc()
+			: key_len == 24 ? EVP_aes_192_cbc()
+			: key_len == 32 ? EVP_aes_256_cbc() : NULL;
+	case CKM_AES_CTR:
+		return key_len == 16 ? EVP_aes_128_ctr()
+			: key_len == 24 ? EVP_aes_192_ctr()
+			: key_len == 32 ? EVP_aes_256_ctr() : NULL;
+	case CKM_AES_GCM:
+		return key_len == 16 ? EVP_aes_128_gcm()
+			: key_len == 24 ? EVP_aes_192_gcm()
+			: key_len == 32 ? EVP_aes_256_gcm() : NULL;
+#ifdef HAVE_OPENSSL_CHACHA20_POLY1305
+	case CKM_CHACHA20_POLY1305:
+		return key_len == 32 ? EVP_chacha20_poly1305() : NULL;
+#endif
+	}
+	return NULL;
+}
+
+/* iv_len is only set for the AEAD ciphers, which take the AAD right away */
+static CK_RV
+openssl_cipher_new(CK_MECHANISM_TYPE mech, const CK_BYTE *key, CK_ULONG key_len,
+		const CK_BYTE *iv, CK_ULONG iv_len, const CK_BYTE *aad, CK_ULONG aad_len,
+		int encrypt, struct openssl_cipher **cipher)
+{
+	struct openssl_cipher *c;
+	const EVP_CIPHER *evp_cipher;
+	int len;
+
+	evp_cipher = openssl_aes_cipher(mech, key_len);
+	if (evp_cipher == NULL)
+		return CKR_KEY_SIZE_RANGE;
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL)
+		return CKR_HOST_MEMORY;
+	c->ctx = EVP_CIPHER_CTX_new();
+	if (c->ctx == NULL) {
+		free(c);
+		return CKR_HOST_MEMORY;
+	}
+	c->mech = mech;
+	c->encrypt = encrypt;
+	c->padding = mech == CKM_AES_CBC_PAD;
+
+	if (!EVP_CipherInit_ex(c->ctx, evp_cipher, NULL, NULL, NULL, encrypt)
+			|| (iv_len && !EVP_CIPHER_CTX_ctrl(c->ctx, EVP_CTRL_GCM_SET_IVLEN, (int) iv_len, NULL))
+			|| !EVP_CipherInit_ex(c->ctx, NULL, NULL, key, iv, encrypt)
+			|| !EVP_CIPHER_CTX_set_padding(c->ctx, c->padding)
+			|| (aad_len > 0 && !EVP_CipherUpdate(c->ctx, NULL, &len, aad, (int) aad_len))) {
+		sc_pkcs11_openssl_cipher_free(c);
+		return CKR_GENERAL_ERROR;
+	}
+	c->block_size = EVP_CIPHER_CTX_block_size(c->ctx);
+
+	*cipher = c;
+	return CKR_OK;
+}
+
+CK_RV
+sc_pkcs11_openssl_cipher_init(CK_MECHANISM_PTR pMechanism,
+		const CK_BYTE *key, CK_ULONG key_len, int encrypt, void **cipher)
+{
+	struct openssl_cipher *c;
+	const CK_BYTE *iv = NULL, *aad = NULL;
+	CK_ULONG iv_len = 0, aad_len = 0, tag_len = 0;
+	CK_GCM_PARAMS *gcm;
+#ifdef HAVE_OPENSSL_CHACHA20_POLY1305
+	CK_SALSA20_CHACHA20_POLY1305_PARAMS *chacha;
+#endif
+	CK_RV rv;
+
+	switch (pMechanism->mechanism) {
+	case CKM_AES_ECB:
+		break;
+	case CKM_AES_CBC:
+	case CKM_AES_CBC_PAD:
+		if (pMechanism->pParameter == NULL || pMechanism->ulParameterLen != 16)
+			return CKR_MECHANISM_PARAM_INVALID;
+		iv = pMechanism->pParameter;
+		break;
+	case CKM_AES_CTR:
+		/* OpenSSL increments the whole block, so a counter
+		 * narrower than 128 bits only differs when it wraps */
+		if (pMechanism->pParameter == NULL
+				|| pMechanism->ulParameterLen != sizeof(CK_AES_CTR_PARAMS)
+				|| ((CK_AES_CTR_PARAMS *) pMechanism->pParameter)->ulCounterBits == 0
+				|| ((CK_AES_CTR_PARAMS *) pMechanism->pParameter)->ulCounterBits > 128)
+			return CKR_MECHANISM_PARAM_INVALID;
+		iv = ((CK_AES_CTR_PARAMS *) pMechanism->pParameter)->cb;
+		break;
+	case CKM_AES_GCM:
+		if (pMechanism->pParameter == NULL
+				|| pMechanism->ulParameterLen != sizeof(CK_GCM_PARAMS))
+			return CKR_MECHANISM_PARAM_INVALID;
+		gcm = (CK_GCM_PARAMS *) pMechanism->pParameter;
+		if (gcm->pIv == NULL || gcm->ulIvLen == 0 || gcm->ulIvLen > INT_MAX
+				|| (gcm->pAAD == NULL && gcm->ulAADLen > 0) || gcm->ulAADLen > INT_MAX
+				|| gcm->ulTagBits < 32 || gcm->ulTagBits > 128 || gcm->ulTagBits % 8)
+			return CKR_MECHANISM_PARAM_INVALID;
+		iv = gcm->pIv;
+		iv_len = gcm->ulIvLen;
+		aad = gcm->pAAD;
+		aad_len = gcm->ulAADLen;
+		tag_len = gcm->ulTagBits / 8;
+		break;
+#ifdef HAVE_OPENSSL_CHACHA20_POLY1305
+	case CKM_CHACHA20_POLY1305:
+		if (pMechanism->pParameter == NULL
+				|| pMechanism->ulParameterLen != sizeof(CK_SALSA20_CHACHA20_POLY1305_PARAMS))
+			return CKR_MECHANISM_PARAM_INVALID;
+		chacha = (CK_SALSA20_CHACHA20_POLY1305_PARAMS *) pMechanism->pParameter;
+		/* EVP_chacha20_poly1305() is the RFC 7539 construction with a
+		 * 96 bit nonce; the original 64 bit nonce variant is not offered */
+		if (chacha->pNonce == NULL || chacha->ulNonceLen != 12
+				|| (chacha->pAAD == NULL && chacha->ulAADLen > 0) || chacha->ulAADLen > INT_MAX)
+			return CKR_MECHANISM_PARAM_INVALID;
+		iv = chacha->pNonce;
+		iv_len = chacha->ulNonceLen;
+		aad = chacha->pAAD;
+		aad_len = chacha->ulAADLen;
+		tag_len = 16;
+		break;
+#endif
+	default:
+		return CKR_MECHANISM_INVALID;
+	}
+
+	rv = openssl_cipher_new(pMechanism->mechanism, key, key_len,
+			iv, iv_len, aad, aad_len, encrypt, &c);
+	if (rv != CKR_OK)
+		return rv;
+	c->tag_len = tag_len;
+
+	*cipher = c;
+	return CKR_OK;
+}
+
+/*
+ * Message-based API: every message has its own IV and AAD, the tag is
+ * passed in the message parameters instead of following the data.
+ */
+static CK_RV
+openssl_message_params(CK_MECHANISM_TYPE mech, int encrypt,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE **iv, CK_ULONG *iv_len, CK_BYTE **tag, CK_ULONG *tag_len)
+{
+	CK_GCM_MESSAGE_PARAMS *gcm;
+#ifdef HAVE_OPENSSL_CHACHA20_POLY1305
+	CK_SALSA20_CHACHA20_POLY1305_MSG_PARAMS *chacha;
+#endif
+	CK_ULONG fixed;
+
+	switch (mech) {
+	case CKM_AES_GCM:
+		if (pParameter == NULL || ulParameterLen != sizeof(CK_GCM_MESSAGE_PARAMS))
+			return CKR_MECHANISM_PARAM_INVALID;
+		gcm = (CK_GCM_MESSAGE_PARAMS *) pParameter;
+		if (gcm->pIv == NULL || gcm->ulIvLen == 0 || gcm->ulIvLen > INT_MAX
+				|| gcm->pTag == NULL
+				|| gcm->ulTagBits < 32 || gcm->ulTagBits > 128 || gcm->ulTagBits % 8)
+			return CKR_MECHANISM_PARAM_INVALID;
+		if (encrypt && gcm->ivGenerator != CKG_NO_GENERATE) {
+			/* Only a random IV is generated here, counters
+			 * are left to the caller */
+			fixed = gcm->ulIvFixedBits / 8;
+			if (gcm->ivGenerator != CKG_GENERATE_RANDOM
+					|| gcm->ulIvFixedBits % 8 || fixed >= gcm->ulIvLen)
+				return CKR_MECHANISM_PARAM_INVALID;
+			if (RAND_bytes((CK_BYTE *) gcm->pIv + fixed, (int) (gcm->ulIvLen - fixed)) != 1)
+				return CKR_GENERAL_ERROR;
+		}
+		*iv = gcm->pIv;
+		*iv_len = gcm->ulIvLen;
+		*tag = gcm->pTag;
+		*tag_len = gcm->ulTagBits / 8;
+		return CKR_OK;
+#ifdef HAVE_OPENSSL_CHACHA20_POLY1305
+	case CKM_CHACHA20_POLY1305:
+		if (pParameter == NULL || ulParameterLen != sizeof(CK_SALSA20_CHACHA20_POLY1305_MSG_PARAMS))
+			return CKR_MECHANISM_PARAM_INVALID;
+		chacha = (CK_SALSA20_CHACHA20_POLY1305_MSG_PARAMS *) pParameter;
+		/* RFC 7539 nonce only, see sc_pkcs11_openssl_cipher_init() */
+		if (chacha->pNonce == NULL || chacha->ulNonceLen != 12
+				|| chacha->pTag == NULL)
+			return CKR_MECHANISM_PARAM_INVALID;
+		*iv = chacha->pNonce;
+		*iv_len = chacha->ulNonceLen;
+		*tag = chacha->pTag;
+		*tag_len = 16;
+		return CKR_OK;
+#endif
+	}
+	return CKR_MECHANISM_INVALID;
+}
+
+CK_RV
+sc_pkcs11_openssl_message_init(CK_MECHANISM_TYPE mech,
+		const CK_BYTE *key, CK_ULONG key_len, int encrypt,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pAssociatedData, CK_ULONG ulAssociatedDataLen, void **cipher)
+{
+	struct openssl_cipher *c;
+	CK_BYTE *iv, *tag;
+	CK_ULONG iv_len, tag_len;
+	CK_RV rv;
+
+	if ((pAssociatedData == NULL && ulAssociatedDataLen > 0) || ulAssociatedDataLen > INT_MAX)
+		return CKR_ARGUMENTS_BAD;
+	rv = openssl_message_params(mech, encrypt, pParameter, ulParameterLen,
+			&iv, &iv_len, &tag, &tag_len);
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = openssl_cipher_new(mech, key, key_len, iv, iv_len,
+			pAssociatedData, ulAssociatedDataLen, encrypt, &c);
+	if (rv != CKR_OK)
+		return rv;
+	c->tag_len = tag_len;
+	c->tag = tag;
+
+	*cipher = c;
+	return CKR_OK;
+}
+
+/* The parameters of the last part of a message name where the tag goes */
+CK_RV
+sc_pkcs11_openssl_message_params(void *cipher, CK_VOID_PTR pParameter, CK_ULONG ulParameterLen)
+{
+	struct openssl_cipher *c = (struct openssl_cipher *) cipher;
+	CK_BYTE *iv, *tag;
+	CK_ULONG iv_len, tag_len;
+	CK_RV rv;
+
+	if (c == NULL || c->tag == NULL)
+		return CKR_ARGUMENTS_BAD;
+	/* no new IV is generated in the middle of a message */
+	rv = openssl_message_params(c->mech, 0, pParameter, ulParameterLen,
+			&iv, &iv_len, &tag, &tag_len);
+	if (rv != CKR_OK)
+		return rv;
+	if (tag_len != c->tag_len)
+		return CKR_MECHANISM_PARAM_INVALID;
+	c->tag = tag;
+	return CKR_OK;
+}
+
+/* Output length of the next update, or of an update followed by the final
+ * step. Exact, except after padding removal where it is an upper bound. */
+static CK_ULONG
+openssl_cipher_out_len(struct openssl_cipher *c, CK_ULONG in_len, int final)
+{
+	CK_ULONG total, keep;
+
+	if (c->tag_len && !c->encrypt) {
+		/* AEAD decryption releases nothing before the tag is verified */
+		if (!final)
+			return 0;
+		if (c->tag != NULL)
+			return c->plain_len + in_len;
+		total = c->held_len + in_len;
+		return c->plain_len + (total > c->tag_len ? total - c->tag_len : 0);
+	}
+	if (c->tag_len && c->tag == NULL)
+		return in_len + (final ? c->tag_len : 0);
+
+	total = c->buffered + in_len;
+	if (final)
+		return c->padding && c->encrypt ? total - total % c->block_size + c->block_size : total;
+	keep = total % c->block_size;
+	/* the last block may carry the padding, EVP keeps it until the end */
+	if (keep == 0 && total > 0 && c->padding && !c->encrypt)
+		keep = c->block_size;
+	return total - keep;
+}
+
+static void
+openssl_aead_plain_clear(struct openssl_cipher *c)
+{
+	if (c->plain != NULL) {
+		sc_mem_clear(c->plain, c->plain_size);
+		free(c->plain);
+	}
+	c->plain = NULL;
+	c->plain_len = 0;
+	c->plain_size = 0;
+}
+
+/* AEAD decryption: decrypts into c->plain, which the final step releases
+ * once the tag is verified. The ciphers are stream ciphers, the output is as
+ * long as the input. */
+static CK_RV
+openssl_aead_decrypt_update(struct openssl_cipher *c, const CK_BYTE *in, CK_ULONG in_len)
+{
+	CK_BYTE *plain;
+	CK_ULONG size, plain_len = c->plain_len;
+	int len;
+
+	if (in_len == 0)
+		return CKR_OK;
+	if (c->plain_size - plain_len < in_len) {
+		size = plain_len + in_len;
+		if (size < in_len)
+			return CKR_DATA_LEN_RANGE;
+		if (size < 2 * c->plain_size)
+			size = 2 * c->plain_size;
+		plain = malloc(size);
+		if (plain == NULL)
+			return CKR_HOST_MEMORY;
+		if (plain_len)
+			memcpy(plain, c->plain, plain_len);
+		openssl_aead_plain_clear(c);
+		c->plain = plain;
+		c->plain_len = plain_len;
+		c->plain_size = size;
+	}
+	if (!EVP_CipherUpdate(c->ctx, c->plain + plain_len, &len, in, (int) in_len))
+		return CKR_GENERAL_ERROR;
+	c->plain_len += len;
+	return CKR_OK;
+}
+
+CK_RV
+sc_pkcs11_openssl_cipher_update(void *cipher, CK_BYTE_PTR pIn, CK_ULONG ulInLen,
+		CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+	struct openssl_cipher *c = (struct openssl_cipher *) cipher;
+	CK_ULONG need, total, from_held, from_in, done = 0;
+	CK_RV rv;
+	int len;
+
+	if (c == NULL || pulOutLen == NULL || (pIn == NULL && ulInLen > 0))
+		return CKR_ARGUMENTS_BAD;
+	if (ulInLen > INT_MAX)
+		return CKR_DATA_LEN_RANGE;
+
+	need = openssl_cipher_out_len(c, ulInLen, 0);
+	if (pOut == NULL) {
+		*pulOutLen = need;
+		return CKR_OK;
+	}
+	if (*pulOutLen < need) {
+		*pulOutLen = need;
+		return CKR_BUFFER_TOO_SMALL;
+	}
+
+	if (c->tag_len && !c->encrypt) {
+		from_held = 0;
+		from_in = ulInLen;
+		if (c->tag == NULL) {
+			/* The tag ends the ciphertext: keep the last bytes seen
+			 * back until we know whether more data is coming */
+			total = c->held_len + ulInLen;
+			total = total > c->tag_len ? total - c->tag_len : 0;
+			from_held = total < c->held_len ? total : c->held_len;
+			from_in = total - from_held;
+		}
+		rv = openssl_aead_decrypt_update(c, c->held, from_held);
+		if (rv == CKR_OK)
+			rv = openssl_aead_decrypt_update(c, pIn, from_in);
+		if (rv != CKR_OK) {
+			openssl_aead_plain_clear(c);
+			return rv;
+		}
+		c->held_len -= from_held;
+		memmove(c->held, c->held + from_held, c->held_len);
+		if (ulInLen > from_in) {
+			memcpy(c->held + c->held_len, pIn + from_in, ulInLen - from_in);
+			c->held_len += ulInLen - from_in;
+		}
+	}
+	else if (ulInLen > 0) {
+		if (!EVP_CipherUpdate(c->ctx, pOut, &len, pIn, (int) ulInLen))
+			return CKR_GENERAL_ERROR;
+		done = len;
+		c->buffered = c->buffered + ulInLen - done;
+	}
+
+	*pulOutLen = done;
+	return CKR_OK;
+}
+
+CK_RV
+sc_pkcs11_openssl_cipher_final(void *cipher, CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+	struct openssl_cipher *c = (struct openssl_cipher *) cipher;
+	CK_ULONG need;
+	int len;
+
+	if (c == NULL || pulOutLen == NULL)
+		return CKR_ARGUMENTS_BAD;
+	if (!c->padding && c->buffered > 0)
+		return c->encrypt ? CKR_DATA_LEN_RANGE : CKR_ENCRYPTED_DATA_LEN_RANGE;
+	if (c->tag_len && c->tag == NULL && !c->encrypt && c->held_len < c->tag_len)
+		return CKR_ENCRYPTED_DATA_LEN_RANGE;
+
+	need = openssl_cipher_out_len(c, 0, 1);
+	if (pOut == NULL) {
+		*pulOutLen = need;
+		return CKR_OK;
+	}
+	if (*pulOutLen < need) {
+		*pulOutLen = need;
+		return CKR_BUFFER_TOO_SMALL;
+	}
+
+	if (c->tag_len && !c->encrypt) {
+		CK_BYTE rest[16];
+
+		/* release the plaintext only with a valid tag */
+		if (!EVP_CIPHER_CTX_ctrl(c->ctx, EVP_CTRL_GCM_SET_TAG, (int) c->tag_len,
+					c->tag ? c->tag : c->held)) {
+			openssl_aead_plain_clear(c);
+			return CKR_GENERAL_ERROR;
+		}
+		if (!EVP_CipherFinal_ex(c->ctx, rest, &len)) {
+			openssl_aead_plain_clear(c);
+			return CKR_ENCRYPTED_DATA_INVALID;
+		}
+		if (c->plain_len)
+			memcpy(pOut, c->plain, c->plain_len);
+		*pulOutLen = c->plain_len;
+		openssl_aead_plain_clear(c);
+		return CKR_OK;
+	}
+	if (!EVP_CipherFinal_ex(c->ctx, pOut, &len))
+		return c->encrypt ? CKR_GENERAL_ERROR : CKR_ENCRYPTED_DATA_INVALID;
+	*pulOutLen = len;
+
+	if (c->tag_len && c->encrypt) {
+		if (!EVP_CIPHER_CTX_ctrl(c->ctx, EVP_CTRL_GCM_GET_TAG, (int) c->tag_len,
+					c->tag ? c->tag : pOut + len))
+			return CKR_GENERAL_ERROR;
+		if (c->tag == NULL)
+			*pulOutLen += c->tag_len;
+	}
+	return CKR_OK;
+}
+
+/* Single-part operation: update and final into one buffer */
+CK_RV
+sc_pkcs11_openssl_cipher(void *cipher, CK_BYTE_PTR pIn, CK_ULONG ulInLen,
+		CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+	struct openssl_cipher *c = (struct openssl_cipher *) cipher;
+	CK_ULONG need, len, final_len;
+	CK_RV rv;
+
+	if (c == NULL || pulOutLen == NULL)
+		return CKR_ARGUMENTS_BAD;
+
+	need = openssl_cipher_out_len(c, ulInLen, 1);
+	if (pOut == NULL) {
+		*pulOutLen = need;
+		return CKR_OK;
+	}
+	if (*pulOutLen < need) {
+		*pulOutLen = need;
+		return CKR_BUFFER_TOO_SMALL;
+	}
+
+	len = *pulOutLen;
+	rv = sc_pkcs11_openssl_cipher_update(c, pIn, ulInLen, pOut, &len);
+	if (rv != CKR_OK)
+		return rv;
+	final_len = *pulOutLen - len;
+	rv = sc_pkcs11_openssl_cipher_final(c, pOut + len, &final_len);
+	if (rv == CKR_OK)
+		*pulOutLen = len + final_len;
+	return rv;
+}
+
+void
+sc_pkcs11_openssl_cipher_free(void *cipher)
+{
+	struct openssl_cipher *c = (struct openssl_cipher *) cipher;
+
+	if (c == NULL)
+		return;
+	EVP_CIPHER_CTX_free(c->ctx);
+	openssl_aead_plain_clear(c);
+	sc_mem_clear(c, sizeof(*c));
+	free(c);
+}
+
+/*
+ * Software HMAC for secret keys held in host memory
+ */
+struct openssl_mac {
+	EVP_MD_CTX	*ctx;
+	EVP_PKEY	*pkey;
+	CK_ULONG	len;
+};
+
+CK_RV
+sc_pkcs11_openssl_mac_init(CK_MECHANISM_TYPE mech,
+		const CK_BYTE *key, CK_ULONG key_len, void **mac)
+{
+	struct openssl_mac *m;
+	const EVP_MD *md;
+
+	switch (mech) {
+	case CKM_SHA_1_HMAC:
+		md = EVP_sha1();
+		break;
+	case CKM_SHA224_HMAC:
+		md = EVP_sha224();
+		break;
+	case CKM_SHA256_HMAC:
+		md = EVP_sha256();
+		break;
+	case CKM_SHA384_HMAC:
+		md = EVP_sha384();
+		break;
+	case CKM_SHA512_HMAC:
+		md = EVP_sha512();
+		break;
+	default:
+		return CKR_MECHANISM_INVALID;
+	}
+	if (key_len > INT_MAX)
+		return CKR_KEY_SIZE_RANGE;
+
+	m = calloc(1, sizeof(*m));
+	if (m == NULL)
+		return CKR_HOST_MEMORY;
+	m->len = EVP_MD_size(md);
+	m->pkey = EVP_PKEY_new_mac_key(EVP_PKEY_HMAC, NULL, key, (int) key_len);
+	m->ctx = EVP_MD_CTX_create();
+	if (m->pkey == NULL || m->ctx == NULL
+			|| EVP_DigestSignInit(m->ctx, NULL, md, NULL, m->pkey) != 1) {
+		sc_pkcs11_openssl_mac_free(m);
+		return CKR_GENERAL_ERROR;
+	}
+
+	*mac = m;
+	return CKR_OK;
+}
+
+CK_RV
+sc_pkcs11_openssl_mac_update(void *mac, CK_BYTE_PTR pData, CK_ULONG ulDataLen)
+{
+	struct openssl_mac *m = (struct openssl_mac *) mac;
+
+	if (m == NULL || (pData == NULL && ulDataLen > 0))
+		return CKR_ARGUMENTS_BAD;
+	if (ulDataLen > 0 && EVP_DigestSignUpdate(m->ctx, pData, ulDataLen) != 1)
+		return CKR_GENERAL_ERROR;
+	return CKR_OK;
+}
+
+CK_RV
+sc_pkcs11_openssl_mac_final(void *mac, CK_BYTE_PTR pSignature, CK_ULONG_PTR pulSignatureLen)
+{
+	struct openssl_mac *m = (struct openssl_mac *) mac;
+	size_t len;
+
+	if (m == NULL || pulSignatureLen == NULL)
+		return CKR_ARGUMENTS_BAD;
+	if (pSignature == NULL || *pulSignatureLen < m->len) {
+		*pulSignatureLen = m->len;
+		return pSignature == NULL ? CKR_OK : CKR_BUFFER_TOO_SMALL;
+	}
+
+	len = *pulSignatureLen;
+	if (EVP_DigestSignFinal(m->ctx, pSignature, &len) != 1)
+		return CKR_GENERAL_ERROR;
+	*pulSignatureLen = len;
+	return CKR_OK;
+}
+
+CK_RV
+sc_pkcs11_openssl_mac_verify(void *mac, CK_BYTE_PTR pSignature, CK_ULONG ulSignatureLen)
+{
+	struct openssl_mac *m = (struct openssl_mac *) mac;
+	unsigned char md[EVP_MAX_MD_SIZE];
+	size_t len = sizeof(md);
+	CK_RV rv;
+
+	if (m == NULL || pSignature == NULL)
+		return CKR_ARGUMENTS_BAD;
+	if (ulSignatureLen != m->len)
+		return CKR_SIGNATURE_LEN_RANGE;
+
+	if (EVP_DigestSignFinal(m->ctx, md, &len) != 1)
+		return CKR_GENERAL_ERROR;
+	rv = len == m->len && CRYPTO_memcmp(md, pSignature, len) == 0
+		? CKR_OK : CKR_SIGNATURE_INVALID;
+	OPENSSL_cleanse(md, sizeof(md));
+	return rv;
+}
+
+CK_ULONG
+sc_pkcs11_openssl_mac_size(void *mac)
+{
+	return mac ? ((struct openssl_mac *) mac)->len : 0;
+}
+
+void
+sc_pkcs11_openssl_mac_free(void *mac)
+{
+	struct openssl_mac *m = (struct openssl_mac *) mac;
+
+	if (m == NULL)
+		return;
+	if (m->ctx)
+		EVP_MD_CTX_destroy(m->ctx);
+	EVP_PKEY_free(m->pkey);
+	free(m);
+}
+
 #if !defined(OPENSSL_NO_EC)
 
 static void reverse(unsigned char *buf, size_t len)
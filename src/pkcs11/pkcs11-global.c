@@ -66,6 +66,11 @@ static pthread_mutex_t c_initialize_m = PTHREAD_MUTEX_INITIALIZER;
 #define C_INITIALIZE_M_LOCK  pthread_mutex_lock(&c_initialize_m);
 #define C_INITIALIZE_M_UNLOCK pthread_mutex_unlock(&c_initialize_m);
 
+/* mutex protecting in_finalize, which is read without the global lock */
+static pthread_mutex_t in_finalize_m = PTHREAD_MUTEX_INITIALIZER;
+#define IN_FINALIZE_M_LOCK  pthread_mutex_lock(&in_finalize_m);
+#define IN_FINALIZE_M_UNLOCK pthread_mutex_unlock(&in_finalize_m);
+
 CK_RV mutex_create(void **mutex)
 {
 	pthread_mutex_t *m;
@@ -109,6 +114,8 @@ static CK_C_INITIALIZE_ARGS _def_locks = {
 CRITICAL_SECTION c_initialize_cs = {0};
 #define C_INITIALIZE_M_LOCK EnterCriticalSection(&c_initialize_cs);
 #define C_INITIALIZE_M_UNLOCK LeaveCriticalSection(&c_initialize_cs);
+#define IN_FINALIZE_M_LOCK
+#define IN_FINALIZE_M_UNLOCK
 
 CK_RV mutex_create(void **mutex)
 {
@@ -152,19 +159,296 @@ static CK_C_INITIALIZE_ARGS _def_locks = {
 #else /* PKCS11_THREAD_LOCKING */
 #define C_INITIALIZE_M_LOCK
 #define C_INITIALIZE_M_UNLOCK
+#define IN_FINALIZE_M_LOCK
+#define IN_FINALIZE_M_UNLOCK
 
 #endif /* PKCS11_THREAD_LOCKING */
 
+static void set_in_finalize(int value)
+{
+	IN_FINALIZE_M_LOCK
+	in_finalize = value;
+	IN_FINALIZE_M_UNLOCK
+}
+
+static int get_in_finalize(void)
+{
+	int value;
+
+	IN_FINALIZE_M_LOCK
+	value = in_finalize;
+	IN_FINALIZE_M_UNLOCK
+
+	return value;
+}
+
 static CK_C_INITIALIZE_ARGS_PTR	global_locking;
 static CK_C_INITIALIZE_ARGS app_locking = {
 	NULL, NULL, NULL, NULL, 0, NULL };
 static void *global_lock = NULL;
+/* Cleared when the application passes CKF_LIBRARY_CANT_CREATE_OS_THREADS */
+static int can_create_threads = 1;
 #ifdef HAVE_OS_LOCKING
 static CK_C_INITIALIZE_ARGS_PTR default_mutex_funcs = &_def_locks;
 #else
 static CK_C_INITIALIZE_ARGS_PTR default_mutex_funcs = NULL;
 #endif
 
+#if defined(PKCS11_THREAD_LOCKING) && defined(HAVE_PTHREAD) && defined(PCSCLITE_GOOD)
+#define SC_PKCS11_EVENT_PUMP
+/* C_Finalize cancels the wait of the event pump again after this many
+ * milliseconds, in case the first sc_cancel() came before the wait began */
+#define EVENT_PUMP_CANCEL_INTERVAL 100
+
+/*
+ * With locking enabled, a single thread waits for reader events and turns
+ * them into slot events (slot->events) with card_detect_all(). It wakes all
+ * C_WaitForSlotEvent callers, which then take the events from the slots, so
+ * that concurrent waiters and CKF_DONT_BLOCK polling cause no reader traffic.
+ * The pump blocks in sc_wait_for_event() until a card or reader changes and
+ * only reads or changes the reader list with the global lock held. The state
+ * of the pump is protected by event_m.
+ */
+static pthread_mutex_t event_m = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cv = PTHREAD_COND_INITIALIZER;
+static pthread_t event_pump_thread;
+static int event_pump_started = 0;	/* thread not joined yet */
+static int event_pump_running = 0;
+static int event_pump_stop = 0;
+static int event_pump_error = SC_SUCCESS;
+static unsigned long event_generation = 0;
+
+static int event_pump_stopping(void)
+{
+	int stop;
+
+	pthread_mutex_lock(&event_m);
+	stop = event_pump_stop;
+	pthread_mutex_unlock(&event_m);
+
+	return stop;
+}
+
+/* Changes when readers are added, removed or attached again */
+static unsigned long reader_list_mark(void)
+{
+	unsigned long count = sc_ctx_get_reader_count(context), removed = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		if (sc_ctx_get_reader(context, i)->flags & SC_READER_REMOVED)
+			removed++;
+
+	return count << 16 | removed;
+}
+
+static void *event_pump(void *arg)
+{
+	unsigned int mask = SC_EVENT_CARD_EVENTS | SC_EVENT_READER_EVENTS
+		| SC_EVENT_NO_READER_DETECTION, events;
+	void *reader_states = NULL;
+	unsigned long watched = 0;
+	sc_reader_t *found;
+	int r = SC_SUCCESS;
+
+	(void) arg;
+	while (!event_pump_stopping()) {
+		if (reader_states == NULL) {
+			/* Collecting the readers to watch reads the reader list */
+			if (sc_pkcs11_lock() != CKR_OK) {
+				r = SC_ERROR_INTERNAL;
+				break;
+			}
+			watched = reader_list_mark();
+			r = sc_wait_for_event(context, mask, &found, &events, 0, &reader_states);
+			sc_pkcs11_unlock();
+		} else {
+			r = sc_wait_for_event(context, mask, &found, &events, -1, &reader_states);
+		}
+		if (event_pump_stopping())
+			break;
+		if (r == SC_ERROR_EVENT_TIMEOUT)
+			continue;
+		if (r != SC_SUCCESS) {
+			sc_log(context, "sc_wait_for_event() returned %d", r);
+			break;
+		}
+
+		if (sc_pkcs11_lock() != CKR_OK) {
+			r = SC_ERROR_INTERNAL;
+			break;
+		}
+		if (events & SC_EVENT_READER_EVENTS) {
+			sc_ctx_detect_readers(context);
+			/* Watch the new reader list from the next wait on */
+			if (reader_list_mark() != watched && reader_states)
+				sc_wait_for_event(context, 0, NULL, NULL, -1, &reader_states);
+		}
+		card_detect_all();
+		sc_pkcs11_unlock();
+
+		pthread_mutex_lock(&event_m);
+		event_generation++;
+		pthread_cond_broadcast(&event_cv);
+		pthread_mutex_unlock(&event_m);
+	}
+
+	if (reader_states)
+		sc_wait_for_event(context, 0, NULL, NULL, -1, &reader_states);
+
+	pthread_mutex_lock(&event_m);
+	event_pump_running = 0;
+	event_pump_error = r;
+	pthread_cond_broadcast(&event_cv);
+	pthread_mutex_unlock(&event_m);
+
+	return NULL;
+}
+
+/* Called with the global lock held */
+static CK_RV event_pump_start(void)
+{
+	CK_RV rv = CKR_OK;
+
+	pthread_mutex_lock(&event_m);
+	if (event_pump_running)
+		goto out;
+	if (event_pump_stop) {
+		/* C_Finalize is stopping the pump */
+		rv = CKR_CRYPTOKI_NOT_INITIALIZED;
+		goto out;
+	}
+
+	/* the previous pump stopped on an error and no longer uses event_m */
+	if (event_pump_started) {
+		pthread_join(event_pump_thread, NULL);
+		event_pump_started = 0;
+	}
+
+	event_pump_running = 1;
+	event_pump_error = SC_SUCCESS;
+	if (pthread_create(&event_pump_thread, NULL, event_pump, NULL) != 0) {
+		event_pump_running = 0;
+		sc_log(context, "Cannot start the event pump");
+		rv = CKR_FUNCTION_FAILED;
+		goto out;
+	}
+	event_pump_started = 1;
+
+out:
+	pthread_mutex_unlock(&event_m);
+	return rv;
+}
+
+/* Called without the global lock, before the context is released. Once it
+ * began, event_pump_start() does not start the pump again until
+ * event_pump_reset(). */
+static void event_pump_shutdown(void)
+{
+	pthread_t thread;
+	struct timespec ts;
+	int started;
+
+	pthread_mutex_lock(&event_m);
+	event_pump_stop = 1;
+	started = event_pump_started;
+	thread = event_pump_thread;
+	pthread_cond_broadcast(&event_cv);
+	while (event_pump_running) {
+		sc_cancel(context);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += EVENT_PUMP_CANCEL_INTERVAL * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&event_cv, &event_m, &ts);
+	}
+	pthread_mutex_unlock(&event_m);
+
+	if (!started)
+		return;
+	pthread_join(thread, NULL);
+
+	pthread_mutex_lock(&event_m);
+	event_pump_started = 0;
+	pthread_mutex_unlock(&event_m);
+}
+
+/* Allows the pump to be started again after C_Finalize */
+static void event_pump_reset(void)
+{
+	pthread_mutex_lock(&event_m);
+	event_pump_stop = 0;
+	pthread_mutex_unlock(&event_m);
+}
+
+static int event_pump_active(void)
+{
+	int running;
+
+	pthread_mutex_lock(&event_m);
+	running = event_pump_running;
+	pthread_mutex_unlock(&event_m);
+
+	return running;
+}
+
+/* Called and returns with the global lock held, unless the module was
+ * finalized in the meantime (CKR_CRYPTOKI_NOT_INITIALIZED) */
+static CK_RV event_pump_wait(CK_FLAGS flags, CK_SLOT_ID_PTR slot_id)
+{
+	unsigned int mask = SC_EVENT_CARD_EVENTS | SC_EVENT_READER_EVENTS;
+	unsigned long generation;
+	int running, stop, error = SC_SUCCESS;
+	CK_RV rv;
+
+	pthread_mutex_lock(&event_m);
+	running = event_pump_running;
+	generation = event_generation;
+	pthread_mutex_unlock(&event_m);
+
+	if (!running) {
+		/* Without a pump, changes are only known after asking the readers */
+		rv = slot_find_changed(slot_id, mask);
+		if (event_pump_start() != CKR_OK && rv != CKR_OK && !(flags & CKF_DONT_BLOCK))
+			return CKR_FUNCTION_FAILED;
+	} else {
+		rv = slot_find_event(slot_id, mask);
+	}
+
+	while (rv != CKR_OK && !(flags & CKF_DONT_BLOCK)) {
+		sc_pkcs11_unlock();
+
+		pthread_mutex_lock(&event_m);
+		while (generation == event_generation && event_pump_running && !event_pump_stop)
+			pthread_cond_wait(&event_cv, &event_m);
+		generation = event_generation;
+		running = event_pump_running;
+		stop = event_pump_stop;
+		error = event_pump_error;
+		pthread_mutex_unlock(&event_m);
+
+		/* Was C_Finalize called ? */
+		if (stop || get_in_finalize() == 1)
+			return CKR_CRYPTOKI_NOT_INITIALIZED;
+		if ((rv = sc_pkcs11_lock()) != CKR_OK)
+			return rv;
+
+		rv = slot_find_event(slot_id, mask);
+		if (rv != CKR_OK && !running) {
+			sc_log(context, "event pump stopped: %d", error);
+			rv = sc_to_cryptoki_error(error != SC_SUCCESS ? error : SC_ERROR_INTERNAL,
+					"C_WaitForSlotEvent");
+		}
+		if (!running)
+			break;
+	}
+
+	return rv;
+}
+#endif /* PKCS11_THREAD_LOCKING && HAVE_PTHREAD && PCSCLITE_GOOD */
+
 /* wrapper for the locking functions for libopensc */
 static int sc_create_mutex(void **m)
 {
@@ -297,10 +581,17 @@ CK_RV C_Initialize(CK_VOID_PTR pInitArgs)
 	if (current_pid != initialized_pid) {
 		if (context)
 			context->flags |= SC_CTX_FLAG_TERMINATE;
+#ifdef SC_PKCS11_EVENT_PUMP
+		/* the event pump thread does not exist in the child */
+		pthread_mutex_lock(&event_m);
+		event_pump_started = 0;
+		event_pump_running = 0;
+		pthread_mutex_unlock(&event_m);
+#endif
 		C_Finalize(NULL_PTR);
 	}
 	initialized_pid = current_pid;
-	in_finalize = 0;
+	set_in_finalize(0);
 #endif
 
 	/* protect from multiple threads tryng to setup locking */
@@ -315,6 +606,9 @@ CK_RV C_Initialize(CK_VOID_PTR pInitArgs)
 	rv = sc_pkcs11_init_lock((CK_C_INITIALIZE_ARGS_PTR) pInitArgs);
 	if (rv != CKR_OK)
 		goto out;
+#ifdef SC_PKCS11_EVENT_PUMP
+	event_pump_reset();
+#endif
 
 	/* set context options */
 	memset(&ctx_opts, 0, sizeof(sc_context_param_t));
@@ -345,6 +639,10 @@ CK_RV C_Initialize(CK_VOID_PTR pInitArgs)
 	}
 	list_attributes_seeker(&virtual_slots, slot_list_seeker);
 
+#ifdef ENABLE_OPENSSL
+	sc_pkcs11_openssl_init();
+#endif
+
 	card_detect_all();
 
 out:
@@ -383,6 +681,10 @@ CK_RV C_Finalize(CK_VOID_PTR pReserved)
 	if (context == NULL)
 		return CKR_CRYPTOKI_NOT_INITIALIZED;
 
+#ifdef SC_PKCS11_EVENT_PUMP
+	event_pump_shutdown();
+#endif
+
 	rv = sc_pkcs11_lock();
 	if (rv != CKR_OK)
 		return rv;
@@ -390,14 +692,18 @@ CK_RV C_Finalize(CK_VOID_PTR pReserved)
 	sc_log(context, "C_Finalize()");
 
 	/* cancel pending calls */
-	in_finalize = 1;
+	set_in_finalize(1);
 	sc_cancel(context);
 	/* remove all cards from readers */
 	for (i=0; i < (int)sc_ctx_get_reader_count(context); i++)
 		card_removed(sc_ctx_get_reader(context, i));
 
-	while ((p = list_fetch(&sessions)))
+	while ((p = list_fetch(&sessions))) {
+#ifdef ENABLE_OPENSSL
+		sc_pkcs11_openssl_md_pool_free(p);
+#endif
 		free(p);
+	}
 	list_destroy(&sessions);
 
 	while ((slot = list_fetch(&virtual_slots))) {
@@ -407,6 +713,10 @@ CK_RV C_Finalize(CK_VOID_PTR pReserved)
 	}
 	list_destroy(&virtual_slots);
 
+#ifdef ENABLE_OPENSSL
+	sc_pkcs11_openssl_cleanup();
+#endif
+
 	sc_release_context(context);
 	context = NULL;
 
@@ -490,6 +800,10 @@ CK_RV C_GetSlotList(CK_BBOOL       tokenPresent,  /* only slots with token prese
 			pSlotList==NULL_PTR? "plug-n-play":"refresh");
 	DEBUG_VSS(NULL, "C_GetSlotList before ctx_detect_detect");
 
+#ifdef SC_PKCS11_EVENT_PUMP
+	/* The event pump keeps readers and slots up to date */
+	if (!event_pump_active()) {
+#endif
 	/* Slot list can only change in v2.20 */
 	if (pSlotList == NULL_PTR)
 		sc_ctx_detect_readers(context);
@@ -497,6 +811,9 @@ CK_RV C_GetSlotList(CK_BBOOL       tokenPresent,  /* only slots with token prese
 	DEBUG_VSS(NULL, "C_GetSlotList after ctx_detect_readers");
 
 	card_detect_all();
+#ifdef SC_PKCS11_EVENT_PUMP
+	}
+#endif
 
 	if (list_empty(&virtual_slots)) {
 		sc_log(context, "returned 0 slots\n");
@@ -560,7 +877,7 @@ out:
 	return rv;
 }
 
-static sc_timestamp_t get_current_time(void)
+sc_timestamp_t get_current_time(void)
 {
 #if HAVE_GETTIMEOFDAY
 	struct timeval tv;
@@ -768,6 +1085,16 @@ CK_RV C_WaitForSlotEvent(CK_FLAGS flags,   /* blocking/nonblocking flag */
 	if (rv != CKR_OK)
 		return rv;
 
+#ifdef SC_PKCS11_EVENT_PUMP
+	/* The pump is a thread of its own, which the application may forbid */
+	if (global_lock != NULL && sc_pkcs11_can_create_threads()) {
+		rv = event_pump_wait(flags, &slot_id);
+		if (rv == CKR_CRYPTOKI_NOT_INITIALIZED)
+			return rv;
+		goto out;
+	}
+#endif
+
 	mask = SC_EVENT_CARD_EVENTS | SC_EVENT_READER_EVENTS;
 	/* Detect and add new slots for added readers v2.20 */
 
@@ -780,7 +1107,7 @@ again:
 	sc_pkcs11_unlock();
 	r = sc_wait_for_event(context, mask, &found, &events, -1, &reader_states);
 	/* Was C_Finalize called ? */
-	if (in_finalize == 1)
+	if (get_in_finalize() == 1)
 		return CKR_CRYPTOKI_NOT_INITIALIZED;
 
 	if ((rv = sc_pkcs11_lock()) != CKR_OK)
@@ -912,6 +1239,8 @@ sc_pkcs11_init_lock(CK_C_INITIALIZE_ARGS_PTR args)
 
 	int applock = 0;
 	int oslock = 0;
+
+	can_create_threads = !(args && (args->flags & CKF_LIBRARY_CANT_CREATE_OS_THREADS));
 	if (global_lock)
 		return CKR_OK;
 
@@ -959,6 +1288,11 @@ sc_pkcs11_init_lock(CK_C_INITIALIZE_ARGS_PTR args)
 	return rv;
 }
 
+int sc_pkcs11_can_create_threads(void)
+{
+	return can_create_threads;
+}
+
 CK_RV sc_pkcs11_lock(void)
 {
 	if (context == NULL)
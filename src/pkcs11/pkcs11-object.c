@@ -44,8 +44,14 @@ static sc_pkcs11_mechanism_type_t find_mechanism = {
 	NULL,		/* verif_init */
 	NULL,		/* verif_update */
 	NULL,		/* verif_final */
+	NULL,		/* encrypt_init */
+	NULL,		/* encrypt */
+	NULL,		/* encrypt_update */
+	NULL,		/* encrypt_final */
 	NULL,		/* decrypt_init */
 	NULL,		/* decrypt */
+	NULL,		/* decrypt_update */
+	NULL,		/* decrypt_final */
 	NULL,		/* derive */
 	NULL,		/* wrap */
 	NULL,		/* unwrap */
@@ -138,6 +144,13 @@ CK_RV sc_create_object_int(CK_SESSION_HANDLE hSession,	/* the session's handle *
 	else
 		rv = card->framework->create_object(session->slot, pTemplate, ulCount, phObject);
 
+	if (rv == CKR_OK && is_token == FALSE && phObject != NULL) {
+		struct sc_pkcs11_object *object = list_seek(&session->slot->objects, phObject);
+
+		if (object != NULL)
+			object->session = hSession;
+	}
+
 out:
 	if (use_lock)
 		sc_pkcs11_unlock();
@@ -668,7 +681,8 @@ C_SignInit(CK_SESSION_HANDLE hSession,		/* the session's handle */
 		goto out;
 	}
 
-	if (object->ops->sign == NULL_PTR) {
+	/* Secret keys sign (MAC) in software through get_secret */
+	if (object->ops->sign == NULL_PTR && object->ops->get_secret == NULL_PTR) {
 		rv = CKR_KEY_TYPE_INCONSISTENT;
 		goto out;
 	}
@@ -830,7 +844,50 @@ C_EncryptInit(CK_SESSION_HANDLE hSession,	/* the session's handle */
 		CK_MECHANISM_PTR pMechanism,	/* the encryption mechanism */
 		CK_OBJECT_HANDLE hKey)		/* handle of encryption key */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	CK_BBOOL can_encrypt;
+	CK_KEY_TYPE key_type;
+	CK_ATTRIBUTE encrypt_attribute = { CKA_ENCRYPT,	&can_encrypt,	sizeof(can_encrypt) };
+	CK_ATTRIBUTE key_type_attr = { CKA_KEY_TYPE,	&key_type,	sizeof(key_type) };
+	struct sc_pkcs11_session *session;
+	struct sc_pkcs11_object *object;
+	CK_RV rv;
+
+	if (pMechanism == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_object_from_session(hSession, hKey, &session, &object);
+	if (rv != CKR_OK) {
+		if (rv == CKR_OBJECT_HANDLE_INVALID)
+			rv = CKR_KEY_HANDLE_INVALID;
+		goto out;
+	}
+
+	if (object->ops->encrypt == NULL_PTR) {
+		rv = CKR_KEY_TYPE_INCONSISTENT;
+		goto out;
+	}
+
+	rv = object->ops->get_attribute(session, object, &encrypt_attribute);
+	if (rv != CKR_OK || !can_encrypt) {
+		rv = CKR_KEY_TYPE_INCONSISTENT;
+		goto out;
+	}
+	rv = object->ops->get_attribute(session, object, &key_type_attr);
+	if (rv != CKR_OK) {
+		rv = CKR_KEY_TYPE_INCONSISTENT;
+		goto out;
+	}
+
+	rv = sc_pkcs11_encr_init(session, pMechanism, object, key_type);
+
+out:
+	SC_LOG_RV("C_EncryptInit() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 
@@ -840,7 +897,24 @@ CK_RV C_Encrypt(CK_SESSION_HANDLE hSession,	/* the session's handle */
 		CK_BYTE_PTR pEncryptedData,	/* receives encrypted data */
 		CK_ULONG_PTR pulEncryptedDataLen)
 {				/* receives encrypted byte count */
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	CK_RV rv;
+	struct sc_pkcs11_session *session;
+
+	if (pulEncryptedDataLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_encr(session, pData, ulDataLen,
+				pEncryptedData, pulEncryptedDataLen);
+
+	SC_LOG_RV("C_Encrypt() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_EncryptUpdate(CK_SESSION_HANDLE hSession,	/* the session's handle */
@@ -849,14 +923,47 @@ CK_RV C_EncryptUpdate(CK_SESSION_HANDLE hSession,	/* the session's handle */
 		      CK_BYTE_PTR pEncryptedPart,	/* receives encrypted data */
 		      CK_ULONG_PTR pulEncryptedPartLen)
 {				/* receives encrypted byte count */
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	CK_RV rv;
+	struct sc_pkcs11_session *session;
+
+	if (pulEncryptedPartLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_encr_update(session, pPart, ulPartLen,
+				pEncryptedPart, pulEncryptedPartLen);
+
+	SC_LOG_RV("C_EncryptUpdate() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_EncryptFinal(CK_SESSION_HANDLE hSession,	/* the session's handle */
 		     CK_BYTE_PTR pLastEncryptedPart,	/* receives encrypted last part */
 		     CK_ULONG_PTR pulLastEncryptedPartLen)
 {				/* receives byte count */
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	CK_RV rv;
+	struct sc_pkcs11_session *session;
+
+	if (pulLastEncryptedPartLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_encr_final(session, pLastEncryptedPart, pulLastEncryptedPartLen);
+
+	SC_LOG_RV("C_EncryptFinal() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_DecryptInit(CK_SESSION_HANDLE hSession,	/* the session's handle */
@@ -948,14 +1055,47 @@ CK_RV C_DecryptUpdate(CK_SESSION_HANDLE hSession,	/* the session's handle */
 		      CK_BYTE_PTR pPart,	/* receives decrypted output */
 		      CK_ULONG_PTR pulPartLen)
 {				/* receives decrypted byte count */
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	CK_RV rv;
+	struct sc_pkcs11_session *session;
+
+	if (pulPartLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_decr_update(session, pEncryptedPart, ulEncryptedPartLen,
+				pPart, pulPartLen);
+
+	SC_LOG_RV("C_DecryptUpdate() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_DecryptFinal(CK_SESSION_HANDLE hSession,	/* the session's handle */
 		     CK_BYTE_PTR pLastPart,	/* receives decrypted output */
 		     CK_ULONG_PTR pulLastPartLen)
 {				/* receives decrypted byte count */
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	CK_RV rv;
+	struct sc_pkcs11_session *session;
+
+	if (pulLastPartLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_decr_final(session, pLastPart, pulLastPartLen);
+
+	SC_LOG_RV("C_DecryptFinal() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
 }
 
 CK_RV C_DigestEncryptUpdate(CK_SESSION_HANDLE hSession,	/* the session's handle */
@@ -1476,11 +1616,158 @@ CK_RV C_VerifyRecover(CK_SESSION_HANDLE hSession,	/* the session's handle */
 }
 
 /* PKCS #11 3.0 only */
+static CK_RV
+message_crypt_init(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism,
+		CK_OBJECT_HANDLE hKey, int op_type)
+{
+	CK_BBOOL can_do;
+	CK_KEY_TYPE key_type;
+	CK_ATTRIBUTE usage_attribute = { op_type == SC_PKCS11_OPERATION_MESSAGE_ENCRYPT
+		? CKA_ENCRYPT : CKA_DECRYPT, &can_do, sizeof(can_do) };
+	CK_ATTRIBUTE key_type_attr = { CKA_KEY_TYPE,	&key_type,	sizeof(key_type) };
+	struct sc_pkcs11_session *session;
+	struct sc_pkcs11_object *object;
+	CK_RV rv;
+
+	if (pMechanism == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_object_from_session(hSession, hKey, &session, &object);
+	if (rv != CKR_OK) {
+		if (rv == CKR_OBJECT_HANDLE_INVALID)
+			rv = CKR_KEY_HANDLE_INVALID;
+		goto out;
+	}
+
+	if (object->ops->get_secret == NULL_PTR) {
+		rv = CKR_KEY_TYPE_INCONSISTENT;
+		goto out;
+	}
+
+	rv = object->ops->get_attribute(session, object, &usage_attribute);
+	if (rv != CKR_OK || !can_do) {
+		rv = CKR_KEY_TYPE_INCONSISTENT;
+		goto out;
+	}
+	rv = object->ops->get_attribute(session, object, &key_type_attr);
+	if (rv != CKR_OK) {
+		rv = CKR_KEY_TYPE_INCONSISTENT;
+		goto out;
+	}
+
+	rv = sc_pkcs11_msg_init(session, op_type, pMechanism, object, key_type);
+
+out:
+	SC_LOG_RV("C_Message*Init() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
+}
+
+static CK_RV
+message_crypt(CK_SESSION_HANDLE hSession, int op_type,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pAssociatedData, CK_ULONG ulAssociatedDataLen,
+		CK_BYTE_PTR pIn, CK_ULONG ulInLen,
+		CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+	CK_RV rv;
+	struct sc_pkcs11_session *session;
+
+	if (pulOutLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_msg_crypt(session, op_type, pParameter, ulParameterLen,
+				pAssociatedData, ulAssociatedDataLen,
+				pIn, ulInLen, pOut, pulOutLen);
+
+	SC_LOG_RV("C_*Message() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
+}
+
+static CK_RV
+message_crypt_begin(CK_SESSION_HANDLE hSession, int op_type,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pAssociatedData, CK_ULONG ulAssociatedDataLen)
+{
+	CK_RV rv;
+	struct sc_pkcs11_session *session;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_msg_begin(session, op_type, pParameter, ulParameterLen,
+				pAssociatedData, ulAssociatedDataLen);
+
+	SC_LOG_RV("C_*MessageBegin() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
+}
+
+static CK_RV
+message_crypt_next(CK_SESSION_HANDLE hSession, int op_type,
+		CK_VOID_PTR pParameter, CK_ULONG ulParameterLen,
+		CK_BYTE_PTR pIn, CK_ULONG ulInLen,
+		CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen,
+		CK_FLAGS flags)
+{
+	CK_RV rv;
+	struct sc_pkcs11_session *session;
+
+	if (pulOutLen == NULL_PTR)
+		return CKR_ARGUMENTS_BAD;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_msg_next(session, op_type, pParameter, ulParameterLen,
+				pIn, ulInLen, pOut, pulOutLen, flags);
+
+	SC_LOG_RV("C_*MessageNext() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
+}
+
+static CK_RV
+message_crypt_final(CK_SESSION_HANDLE hSession, int op_type)
+{
+	CK_RV rv;
+	struct sc_pkcs11_session *session;
+
+	rv = sc_pkcs11_lock();
+	if (rv != CKR_OK)
+		return rv;
+
+	rv = get_session(hSession, &session);
+	if (rv == CKR_OK)
+		rv = sc_pkcs11_msg_final(session, op_type);
+
+	SC_LOG_RV("C_Message*Final() = %s", rv);
+	sc_pkcs11_unlock();
+	return rv;
+}
+
 CK_RV C_MessageEncryptInit(CK_SESSION_HANDLE hSession,    /* the session's handle */
 			   CK_MECHANISM_PTR pMechanism,  /* the encryption mechanism */
 			   CK_OBJECT_HANDLE hKey)         /* handle of encryption key */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	return message_crypt_init(hSession, pMechanism, hKey, SC_PKCS11_OPERATION_MESSAGE_ENCRYPT);
 }
 
 CK_RV C_EncryptMessage(CK_SESSION_HANDLE hSession,   /* the session's handle */
@@ -1493,7 +1780,9 @@ CK_RV C_EncryptMessage(CK_SESSION_HANDLE hSession,   /* the session's handle */
 		       CK_BYTE_PTR pCiphertext,      /* gets cipher text */
 		       CK_ULONG_PTR pulCiphertextLen) /* gets cipher text length */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	return message_crypt(hSession, SC_PKCS11_OPERATION_MESSAGE_ENCRYPT,
+			pParameter, ulParameterLen, pAssociatedData, ulAssociatedDataLen,
+			pPlaintext, ulPlaintextLen, pCiphertext, pulCiphertextLen);
 }
 
 CK_RV C_EncryptMessageBegin(CK_SESSION_HANDLE hSession,   /* the session's handle */
@@ -1502,7 +1791,8 @@ CK_RV C_EncryptMessageBegin(CK_SESSION_HANDLE hSession,   /* the session's handl
 			    CK_BYTE_PTR pAssociatedData,  /* AEAD Associated data */
 			    CK_ULONG ulAssociatedDataLen)  /* AEAD Associated data length */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	return message_crypt_begin(hSession, SC_PKCS11_OPERATION_MESSAGE_ENCRYPT,
+			pParameter, ulParameterLen, pAssociatedData, ulAssociatedDataLen);
 }
 
 CK_RV C_EncryptMessageNext(CK_SESSION_HANDLE hSession,        /* the session's handle */
@@ -1514,19 +1804,21 @@ CK_RV C_EncryptMessageNext(CK_SESSION_HANDLE hSession,        /* the session's h
 			   CK_ULONG_PTR pulCiphertextPartLen, /* gets cipher text length */
 			   CK_FLAGS flags)                     /* multi mode flag */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	return message_crypt_next(hSession, SC_PKCS11_OPERATION_MESSAGE_ENCRYPT,
+			pParameter, ulParameterLen, pPlaintextPart, ulPlaintextPartLen,
+			pCiphertextPart, pulCiphertextPartLen, flags);
 }
 
 CK_RV C_MessageEncryptFinal(CK_SESSION_HANDLE hSession)        /* the session's handle */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	return message_crypt_final(hSession, SC_PKCS11_OPERATION_MESSAGE_ENCRYPT);
 }
 
 CK_RV C_MessageDecryptInit(CK_SESSION_HANDLE hSession,    /* the session's handle */
 			   CK_MECHANISM_PTR pMechanism,  /* the decryption mechanism */
 			   CK_OBJECT_HANDLE hKey)         /* handle of decryption key */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	return message_crypt_init(hSession, pMechanism, hKey, SC_PKCS11_OPERATION_MESSAGE_DECRYPT);
 }
 
 CK_RV C_DecryptMessage(CK_SESSION_HANDLE hSession,    /* the session's handle */
@@ -1539,7 +1831,9 @@ CK_RV C_DecryptMessage(CK_SESSION_HANDLE hSession,    /* the session's handle */
 		       CK_BYTE_PTR pPlaintext,       /* gets plain text */
 		       CK_ULONG_PTR pulPlaintextLen)  /* gets plain text length */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	return message_crypt(hSession, SC_PKCS11_OPERATION_MESSAGE_DECRYPT,
+			pParameter, ulParameterLen, pAssociatedData, ulAssociatedDataLen,
+			pCiphertext, ulCiphertextLen, pPlaintext, pulPlaintextLen);
 }
 
 CK_RV C_DecryptMessageBegin(CK_SESSION_HANDLE hSession,    /* the session's handle */
@@ -1548,7 +1842,8 @@ CK_RV C_DecryptMessageBegin(CK_SESSION_HANDLE hSession,    /* the session's hand
 			    CK_BYTE_PTR pAssociatedData,  /* AEAD Associated data */
 			    CK_ULONG ulAssociatedDataLen)  /* AEAD Associated data length */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	return message_crypt_begin(hSession, SC_PKCS11_OPERATION_MESSAGE_DECRYPT,
+			pParameter, ulParameterLen, pAssociatedData, ulAssociatedDataLen);
 }
 
 CK_RV C_DecryptMessageNext(CK_SESSION_HANDLE hSession,    /* the session's handle */
@@ -1560,12 +1855,14 @@ CK_RV C_DecryptMessageNext(CK_SESSION_HANDLE hSession,    /* the session's handl
 			   CK_ULONG_PTR pulPlaintextPartLen,  /* gets plain text length */
 			   CK_FLAGS flags)                     /* multi mode flag */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	return message_crypt_next(hSession, SC_PKCS11_OPERATION_MESSAGE_DECRYPT,
+			pParameter, ulParameterLen, pCiphertextPart, ulCiphertextPartLen,
+			pPlaintextPart, pulPlaintextPartLen, flags);
 }
 
 CK_RV C_MessageDecryptFinal(CK_SESSION_HANDLE hSession)    /* the session's handle */
 {
-	return CKR_FUNCTION_NOT_SUPPORTED;
+	return message_crypt_final(hSession, SC_PKCS11_OPERATION_MESSAGE_DECRYPT);
 }
 
 CK_RV C_MessageSignInit(CK_SESSION_HANDLE hSession,    /* the session's handle */
@@ -99,12 +99,48 @@ out:
 	return rv;
 }
 
+/* Destroy the session objects created by the session */
+static void
+session_destroy_objects(struct sc_pkcs11_session *session)
+{
+	struct sc_pkcs11_slot *slot = session->slot;
+	struct sc_pkcs11_object *object;
+	unsigned int i = 0;
+	CK_RV rv;
+
+	if (slot->p11card == NULL)
+		return;
+
+	while (i < list_size(&slot->objects)) {
+		object = list_get_at(&slot->objects, i);
+		if (object->session != session->handle) {
+			i++;
+			continue;
+		}
+		/* tried once, even if the object cannot be destroyed */
+		object->session = 0;
+		if (object->ops->destroy_object == NULL)
+			rv = CKR_FUNCTION_NOT_SUPPORTED;
+		else
+			rv = object->ops->destroy_object(session, object);
+		if (rv != CKR_OK) {
+			sc_log(context, "Cannot destroy session object 0x%lx: rv 0x%lX",
+					object->handle, rv);
+			i++;
+			continue;
+		}
+		/* related objects may have left the list as well */
+		i = 0;
+	}
+}
+
 /* Internal version of C_CloseSession that gets called with
  * the global lock held */
 static CK_RV sc_pkcs11_close_session(CK_SESSION_HANDLE hSession)
 {
 	struct sc_pkcs11_slot *slot;
 	struct sc_pkcs11_session *session;
+	int i;
 
 	sc_log(context, "real C_CloseSession(0x%lx)", hSession);
 
@@ -112,6 +148,8 @@ static CK_RV sc_pkcs11_close_session(CK_SESSION_HANDLE hSession)
 	if (!session)
 		return CKR_SESSION_HANDLE_INVALID;
 
+	session_destroy_objects(session);
+
 	/* If we're the last session using this slot, make sure
 	 * we log out */
 	slot = session->slot;
@@ -129,6 +167,11 @@ static CK_RV sc_pkcs11_close_session(CK_SESSION_HANDLE hSession)
 
 	if (list_delete(&sessions, session) != 0)
 		sc_log(context, "Could not delete session from list!");
+	for (i = 0; i < SC_PKCS11_OPERATION_MAX; i++)
+		session_stop_operation(session, i);
+#ifdef ENABLE_OPENSSL
+	sc_pkcs11_openssl_md_pool_free(session);
+#endif
 	free(session);
 	return CKR_OK;
 }
@@ -139,13 +182,21 @@ CK_RV sc_pkcs11_close_all_sessions(CK_SLOT_ID slotID)
 {
 	CK_RV rv = CKR_OK, error;
 	struct sc_pkcs11_session *session;
-	unsigned int i;
+	unsigned int i, count;
 	sc_log(context, "real C_CloseAllSessions(0x%lx) %d", slotID, list_size(&sessions));
-	for (i = 0; i < list_size(&sessions); i++) {
+	i = 0;
+	while (i < list_size(&sessions)) {
 		session = list_get_at(&sessions, i);
-		if (session->slot->id == slotID)
-			if ((error = sc_pkcs11_close_session(session->handle)) != CKR_OK)
-				rv = error;
+		if (session->slot->id != slotID) {
+			i++;
+			continue;
+		}
+		/* a closed session leaves the list, the next one takes its place */
+		count = list_size(&sessions);
+		if ((error = sc_pkcs11_close_session(session->handle)) != CKR_OK)
+			rv = error;
+		if (list_size(&sessions) == count)
+			i++;
 	}
 	return rv;
 }
@@ -206,7 +257,7 @@ CK_RV C_SessionCancel(CK_SESSION_HANDLE hSession,  /* the session's handle */
 	/* Ignore return value of the cancel operation as it is valid to
 	 * cancel not started operation and it can not fail for other reasons */
 	if (flags & CKF_ENCRYPT) {
-		 /* unused */
+		session_stop_operation(session, SC_PKCS11_OPERATION_ENCRYPT);
 	}
 	if (flags & CKF_DECRYPT) {
 		session_stop_operation(session, SC_PKCS11_OPERATION_DECRYPT);
@@ -238,6 +289,12 @@ CK_RV C_SessionCancel(CK_SESSION_HANDLE hSession,  /* the session's handle */
 	if (flags & CKF_DERIVE) {
 		session_stop_operation(session, SC_PKCS11_OPERATION_DERIVE);
 	}
+	if (flags & CKF_MESSAGE_ENCRYPT) {
+		session_stop_operation(session, SC_PKCS11_OPERATION_MESSAGE_ENCRYPT);
+	}
+	if (flags & CKF_MESSAGE_DECRYPT) {
+		session_stop_operation(session, SC_PKCS11_OPERATION_MESSAGE_DECRYPT);
+	}
 
 out:
 	sc_pkcs11_unlock();
@@ -370,6 +370,7 @@ typedef unsigned long ck_key_type_t;
 #define CKK_GOSTR3410		(0x30UL)
 #define CKK_GOSTR3411		(0x31UL)
 #define CKK_GOST28147		(0x32UL)
+#define CKK_CHACHA20		(0x33UL)
 #define CKK_EC_EDWARDS		(0x40UL)
 #define CKK_EC_MONTGOMERY	(0x41UL)
 #define CKK_VENDOR_DEFINED	(1UL << 31)
@@ -781,6 +782,7 @@ typedef unsigned long ck_mechanism_type_t;
 #define CKM_DH_PKCS_PARAMETER_GEN	(0x2001UL)
 #define CKM_X9_42_DH_PARAMETER_GEN	(0x2002UL)
 #define CKM_AES_KEY_WRAP		(0x2109UL)
+#define CKM_CHACHA20_POLY1305		(0x4021UL)
 #define CKM_XEDDSA			(0x4029UL)
 #define CKM_VENDOR_DEFINED		(1UL << 31)
 
@@ -801,6 +803,11 @@ struct ck_mechanism_info
 };
 
 #define CKF_HW			(1UL << 0)
+#define CKF_MESSAGE_ENCRYPT	(1UL << 1)
+#define CKF_MESSAGE_DECRYPT	(1UL << 2)
+#define CKF_MESSAGE_SIGN	(1UL << 3)
+#define CKF_MESSAGE_VERIFY	(1UL << 4)
+#define CKF_MULTI_MESSAGE	(1UL << 5)
 #define CKF_ENCRYPT		(1UL << 8)
 #define CKF_DECRYPT		(1UL << 9)
 #define CKF_DIGEST		(1UL << 10)
@@ -890,6 +897,41 @@ typedef struct CK_GCM_PARAMS {
 	unsigned long ulTagBits;
 } CK_GCM_PARAMS;
 
+typedef struct CK_AES_CTR_PARAMS {
+	unsigned long ulCounterBits;
+	unsigned char cb[16];
+} CK_AES_CTR_PARAMS;
+
+/* IV generation in the message-based API */
+typedef unsigned long CK_GENERATOR_FUNCTION;
+#define CKG_NO_GENERATE			(0x00000000UL)
+#define CKG_GENERATE			(0x00000001UL)
+#define CKG_GENERATE_COUNTER		(0x00000002UL)
+#define CKG_GENERATE_RANDOM		(0x00000003UL)
+#define CKG_GENERATE_COUNTER_XOR	(0x00000004UL)
+
+typedef struct CK_GCM_MESSAGE_PARAMS {
+	void * pIv;
+	unsigned long ulIvLen;
+	unsigned long ulIvFixedBits;
+	CK_GENERATOR_FUNCTION ivGenerator;
+	void * pTag;
+	unsigned long ulTagBits;
+} CK_GCM_MESSAGE_PARAMS;
+
+typedef struct CK_SALSA20_CHACHA20_POLY1305_PARAMS {
+	unsigned char * pNonce;
+	unsigned long ulNonceLen;
+	unsigned char * pAAD;
+	unsigned long ulAADLen;
+} CK_SALSA20_CHACHA20_POLY1305_PARAMS;
+
+typedef struct CK_SALSA20_CHACHA20_POLY1305_MSG_PARAMS {
+	unsigned char * pNonce;
+	unsigned long ulNonceLen;
+	unsigned char * pTag;
+} CK_SALSA20_CHACHA20_POLY1305_MSG_PARAMS;
+
 /* EDDSA */
 typedef struct CK_EDDSA_PARAMS {
 	unsigned char phFlag;
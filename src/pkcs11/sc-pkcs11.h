@@ -56,6 +56,14 @@ extern "C" {
 #define USE_PKCS15_INIT
 #endif
 
+#ifdef ENABLE_OPENSSL
+#include <openssl/opensslv.h>
+#include <openssl/opensslconf.h>
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+#define HAVE_OPENSSL_CHACHA20_POLY1305
+#endif
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -74,6 +82,9 @@ struct sc_pkcs11_config {
 	unsigned int create_puk_slot;
 	unsigned int create_slots_flags;
 	unsigned char ignore_pin_length;
+	unsigned int pin_status_ttl;
+	unsigned int random_reseed_interval;
+	unsigned char session_key_mechanisms;
 };
 
 /*
@@ -122,6 +133,16 @@ struct sc_pkcs11_object_ops {
 			void*,
 			CK_BYTE_PTR pData, CK_ULONG_PTR ulDataLen);
 
+	CK_RV (*encrypt)(struct sc_pkcs11_session *, void *,
+			CK_MECHANISM_PTR,
+			CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+			CK_BYTE_PTR pEncryptedData, CK_ULONG_PTR pulEncryptedDataLen);
+
+	/* Value of a secret key held in host memory, for the software
+	 * mechanisms. Fails for keys that never leave the card. */
+	CK_RV (*get_secret)(struct sc_pkcs11_session *, void *,
+			const CK_BYTE **pValue, CK_ULONG_PTR pulValueLen);
+
 	/* Others to be added when implemented */
 };
 
@@ -129,6 +150,9 @@ struct sc_pkcs11_object {
 	CK_OBJECT_HANDLE handle;
 	int flags;
 	struct sc_pkcs11_object_ops *ops;
+	/* Session that created this session object (CKA_TOKEN false), the
+	 * object is destroyed when it is closed. 0 for token objects */
+	CK_SESSION_HANDLE session;
 };
 
 #define SC_PKCS11_OBJECT_SEEN	0x0001
@@ -198,6 +222,17 @@ struct sc_pkcs11_card {
 	/* List of supported mechanisms */
 	struct sc_pkcs11_mechanism_type **mechanisms;
 	unsigned int nmechanisms;
+
+	/* Identity of the bound card, to recognize it after a reset */
+	struct sc_serial_number serialnr;
+	struct sc_uid uid;
+
+	/* Incremented when state cached by the framework, like the PIN status,
+	 * may have changed on the card */
+	unsigned int cache_generation;
+	/* Set when the framework saw SC_READER_CARD_CHANGED, which card_detect()
+	 * has not handled yet */
+	int card_changed;
 };
 
 /* If the slot did already show with `C_GetSlotList`, then we need to keep this
@@ -257,13 +292,19 @@ enum {
 	SC_PKCS11_OPERATION_SIGN,
 	SC_PKCS11_OPERATION_VERIFY,
 	SC_PKCS11_OPERATION_DIGEST,
+	SC_PKCS11_OPERATION_ENCRYPT,
 	SC_PKCS11_OPERATION_DECRYPT,
 	SC_PKCS11_OPERATION_DERIVE,
 	SC_PKCS11_OPERATION_WRAP,
 	SC_PKCS11_OPERATION_UNWRAP,
+	SC_PKCS11_OPERATION_MESSAGE_ENCRYPT,
+	SC_PKCS11_OPERATION_MESSAGE_DECRYPT,
 	SC_PKCS11_OPERATION_MAX
 };
 
+/* A digest, and the digest of a hash-and-sign or hash-and-verify */
+#define SC_PKCS11_MD_CTX_POOL_SIZE	2
+
 #define MAX_KEY_TYPES 2
 
 /* This describes a PKCS11 mechanism */
@@ -297,11 +338,26 @@ struct sc_pkcs11_mechanism_type {
 					CK_BYTE_PTR, CK_ULONG);
 	CK_RV		  (*verif_final)(sc_pkcs11_operation_t *,
 					CK_BYTE_PTR, CK_ULONG);
+	CK_RV		  (*encrypt_init)(sc_pkcs11_operation_t *,
+					struct sc_pkcs11_object *);
+	CK_RV		  (*encrypt)(sc_pkcs11_operation_t *,
+					CK_BYTE_PTR, CK_ULONG,
+					CK_BYTE_PTR, CK_ULONG_PTR);
+	CK_RV		  (*encrypt_update)(sc_pkcs11_operation_t *,
+					CK_BYTE_PTR, CK_ULONG,
+					CK_BYTE_PTR, CK_ULONG_PTR);
+	CK_RV		  (*encrypt_final)(sc_pkcs11_operation_t *,
+					CK_BYTE_PTR, CK_ULONG_PTR);
 	CK_RV		  (*decrypt_init)(sc_pkcs11_operation_t *,
 					struct sc_pkcs11_object *);
 	CK_RV		  (*decrypt)(sc_pkcs11_operation_t *,
 					CK_BYTE_PTR, CK_ULONG,
 					CK_BYTE_PTR, CK_ULONG_PTR);
+	CK_RV		  (*decrypt_update)(sc_pkcs11_operation_t *,
+					CK_BYTE_PTR, CK_ULONG,
+					CK_BYTE_PTR, CK_ULONG_PTR);
+	CK_RV		  (*decrypt_final)(sc_pkcs11_operation_t *,
+					CK_BYTE_PTR, CK_ULONG_PTR);
 	CK_RV		  (*derive)(sc_pkcs11_operation_t *,
 					struct sc_pkcs11_object *,
 					CK_BYTE_PTR, CK_ULONG,
@@ -331,6 +387,9 @@ struct sc_pkcs11_operation {
 	union {
 		CK_RSA_PKCS_PSS_PARAMS pss;
 		CK_RSA_PKCS_OAEP_PARAMS oaep;
+		CK_GCM_PARAMS gcm;
+		CK_AES_CTR_PARAMS ctr;
+		CK_SALSA20_CHACHA20_POLY1305_PARAMS chacha20;
 	} mechanism_params;
 	struct sc_pkcs11_session *session;
 	void *		  priv_data;
@@ -358,6 +417,10 @@ struct sc_pkcs11_session {
 	CK_VOID_PTR notify_data;
 	/* Active operations - one per type */
 	struct sc_pkcs11_operation *operation[SC_PKCS11_OPERATION_MAX];
+#ifdef ENABLE_OPENSSL
+	/* Digest contexts of finished operations, reused by the next ones */
+	void *md_ctx_pool[SC_PKCS11_MD_CTX_POOL_SIZE];
+#endif
 };
 typedef struct sc_pkcs11_session sc_pkcs11_session_t;
 
@@ -374,6 +437,7 @@ extern struct sc_pkcs11_framework_ops framework_pkcs15init;
 
 void strcpy_bp(u8 *dst, const char *src, size_t dstsize);
 CK_RV sc_to_cryptoki_error(int rc, const char *ctx);
+sc_timestamp_t get_current_time(void);
 void sc_pkcs11_print_attrs(int level, const char *file, unsigned int line, const char *function,
 		const char *info, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount);
 #define dump_template(level, info, pTemplate, ulCount) \
@@ -391,6 +455,7 @@ CK_RV slot_get_token(CK_SLOT_ID id, struct sc_pkcs11_slot **);
 CK_RV slot_token_removed(CK_SLOT_ID id);
 CK_RV slot_allocate(struct sc_pkcs11_slot **, struct sc_pkcs11_card *);
 CK_RV slot_find_changed(CK_SLOT_ID_PTR idp, int mask);
+CK_RV slot_find_event(CK_SLOT_ID_PTR idp, int mask);
 int slot_get_logged_in_state(struct sc_pkcs11_slot *slot);
 
 /* Login tracking functions */
@@ -454,6 +519,19 @@ CK_RV sc_pkcs11_verif_final(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG);
 #endif
 CK_RV sc_pkcs11_decr_init(struct sc_pkcs11_session *, CK_MECHANISM_PTR, struct sc_pkcs11_object *, CK_KEY_TYPE);
 CK_RV sc_pkcs11_decr(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_decr_update(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_decr_final(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_encr_init(struct sc_pkcs11_session *, CK_MECHANISM_PTR, struct sc_pkcs11_object *, CK_KEY_TYPE);
+CK_RV sc_pkcs11_encr(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_encr_update(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_encr_final(struct sc_pkcs11_session *, CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_msg_init(struct sc_pkcs11_session *, int, CK_MECHANISM_PTR, struct sc_pkcs11_object *, CK_KEY_TYPE);
+CK_RV sc_pkcs11_msg_crypt(struct sc_pkcs11_session *, int, CK_VOID_PTR, CK_ULONG,
+			CK_BYTE_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_msg_begin(struct sc_pkcs11_session *, int, CK_VOID_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG);
+CK_RV sc_pkcs11_msg_next(struct sc_pkcs11_session *, int, CK_VOID_PTR, CK_ULONG,
+			CK_BYTE_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG_PTR, CK_FLAGS);
+CK_RV sc_pkcs11_msg_final(struct sc_pkcs11_session *, int);
 CK_RV sc_pkcs11_wrap(struct sc_pkcs11_session *,CK_MECHANISM_PTR, struct sc_pkcs11_object *, CK_KEY_TYPE, struct sc_pkcs11_object *, CK_BYTE_PTR, CK_ULONG_PTR);
 CK_RV sc_pkcs11_unwrap(struct sc_pkcs11_session *,CK_MECHANISM_PTR, struct sc_pkcs11_object *, CK_KEY_TYPE, CK_BYTE_PTR, CK_ULONG, struct sc_pkcs11_object *);
 CK_RV sc_pkcs11_deri(struct sc_pkcs11_session *, CK_MECHANISM_PTR,
@@ -481,6 +559,28 @@ CK_RV sc_pkcs11_verify_data(const unsigned char *pubkey, unsigned int pubkey_len
 	CK_MECHANISM_PTR mech, sc_pkcs11_operation_t *md,
 	unsigned char *inp, unsigned int inp_len,
 	unsigned char *signat, unsigned int signat_len);
+
+/* Software AES and HMAC for secret keys held in host memory (openssl.c) */
+CK_RV sc_pkcs11_openssl_cipher_init(CK_MECHANISM_PTR, const CK_BYTE *, CK_ULONG,
+				int, void **);
+CK_RV sc_pkcs11_openssl_cipher_update(void *, CK_BYTE_PTR, CK_ULONG,
+				CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_openssl_cipher_final(void *, CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_openssl_cipher(void *, CK_BYTE_PTR, CK_ULONG,
+				CK_BYTE_PTR, CK_ULONG_PTR);
+void sc_pkcs11_openssl_cipher_free(void *);
+CK_RV sc_pkcs11_openssl_message_init(CK_MECHANISM_TYPE, const CK_BYTE *, CK_ULONG, int,
+				CK_VOID_PTR, CK_ULONG, CK_BYTE_PTR, CK_ULONG, void **);
+CK_RV sc_pkcs11_openssl_message_params(void *, CK_VOID_PTR, CK_ULONG);
+CK_RV sc_pkcs11_openssl_mac_init(CK_MECHANISM_TYPE, const CK_BYTE *, CK_ULONG, void **);
+CK_RV sc_pkcs11_openssl_mac_update(void *, CK_BYTE_PTR, CK_ULONG);
+CK_RV sc_pkcs11_openssl_mac_final(void *, CK_BYTE_PTR, CK_ULONG_PTR);
+CK_RV sc_pkcs11_openssl_mac_verify(void *, CK_BYTE_PTR, CK_ULONG);
+CK_ULONG sc_pkcs11_openssl_mac_size(void *);
+void sc_pkcs11_openssl_mac_free(void *);
+void sc_pkcs11_openssl_init(void);
+void sc_pkcs11_openssl_cleanup(void);
+void sc_pkcs11_openssl_md_pool_free(struct sc_pkcs11_session *);
 #endif
 
 /* Load configuration defaults */
@@ -491,6 +591,8 @@ CK_RV sc_pkcs11_init_lock(CK_C_INITIALIZE_ARGS_PTR);
 CK_RV sc_pkcs11_lock(void);
 void sc_pkcs11_unlock(void);
 void sc_pkcs11_free_lock(void);
+/* Whether the library may create its own threads */
+int sc_pkcs11_can_create_threads(void);
 
 #ifdef __cplusplus
 }
@@ -205,6 +205,69 @@ CK_RV card_removed(sc_reader_t * reader)
 }
 
 
+/* Remembers what identifies the card once its tokens are bound */
+static void card_save_identity(struct sc_pkcs11_card *p11card)
+{
+	struct sc_serial_number serialnr;
+
+	p11card->uid = p11card->reader->uid;
+	if (sc_card_ctl(p11card->card, SC_CARDCTL_GET_SERIALNR, &serialnr) == SC_SUCCESS)
+		p11card->serialnr = serialnr;
+}
+
+/* After a reset or a reattached reader, checks whether the bound card is
+ * still there. sc_lock() reconnects, reopens SM and lets the card driver
+ * select its application again. The tokens, objects and login state are kept,
+ * a lost login is handled like an expired one. Only cards whose driver reads
+ * the serial number from the card again (SC_CARDCTL_READ_SERIALNR) are
+ * identified, any other card is handled as removed. */
+static int card_reidentify(sc_reader_t *reader)
+{
+	struct sc_pkcs11_card *p11card = NULL;
+	struct sc_serial_number serialnr;
+	sc_card_t *card;
+	unsigned int i;
+	int rc, same;
+
+	for (i=0; i<list_size(&virtual_slots); i++) {
+		sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
+		if (slot->reader == reader) {
+			p11card = slot->p11card;
+			break;
+		}
+	}
+	if (!p11card || !p11card->card || !p11card->framework
+			|| !p11card->serialnr.len)
+		return 0;
+
+	card = p11card->card;
+	if (reader->atr.len != card->atr.len
+			|| memcmp(reader->atr.value, card->atr.value, card->atr.len) != 0)
+		return 0;
+
+	rc = sc_lock(card);
+	if (rc != SC_SUCCESS) {
+		sc_log(context, "%s: card not usable after reset: %s", reader->name, sc_strerror(rc));
+		return 0;
+	}
+
+	same = reader->uid.len == p11card->uid.len
+		&& memcmp(reader->uid.value, p11card->uid.value, p11card->uid.len) == 0;
+	if (same) {
+		rc = sc_card_ctl(card, SC_CARDCTL_READ_SERIALNR, &serialnr);
+		if (rc == SC_ERROR_NOT_SUPPORTED)
+			sc_log(context, "%s: serial number cannot be read again", reader->name);
+		same = rc == SC_SUCCESS && serialnr.len == p11card->serialnr.len
+			&& memcmp(serialnr.value, p11card->serialnr.value, serialnr.len) == 0;
+	}
+	sc_unlock(card);
+	if (same)
+		p11card->cache_generation++;
+
+	sc_log(context, "%s: %s card after reset", reader->name, same ? "same" : "different");
+	return same;
+}
+
 CK_RV card_detect(sc_reader_t *reader)
 {
 	struct sc_pkcs11_card *p11card = NULL;
@@ -228,6 +291,16 @@ again:
 		return CKR_TOKEN_NOT_PRESENT;
 	}
 
+	/* A change may have been reported to the framework already */
+	for (i = 0; i < list_size(&virtual_slots); i++) {
+		sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
+		if (slot->reader == reader && slot->p11card != NULL
+				&& slot->p11card->card_changed) {
+			slot->p11card->card_changed = 0;
+			rc |= SC_READER_CARD_CHANGED;
+		}
+	}
+
 	/* If the card was changed, disconnect the current one */
 	if (rc & SC_READER_CARD_CHANGED) {
 		sc_log(context, "%s: Card changed", reader->name);
@@ -236,6 +309,10 @@ again:
 		 * So better be fussy.
 		if (!retry--)
 			return CKR_TOKEN_NOT_PRESENT; */
+		if (card_reidentify(reader)) {
+			sc_log(context, "%s: Keeping the bound tokens", reader->name);
+			return CKR_OK;
+		}
 		card_removed(reader);
 		goto again;
 	}
@@ -369,6 +446,9 @@ again:
 			/* p11card is now bound to some slot */
 			free_p11card = 0;
 		}
+
+		if (!free_p11card)
+			card_save_identity(p11card);
 	}
 
 	sc_log(context, "%s: Detection ended", reader->name);
@@ -387,8 +467,11 @@ CK_RV
 card_detect_all(void)
 {
 	unsigned int i, j;
+	CK_RV rv = CKR_OK;
 
 	sc_log(context, "Detect all cards");
+	/* Query all readers at once, card_detect() then uses the result */
+	sc_ctx_detect_card_presence(context);
 	/* Detect cards in all initialized readers */
 	for (i=0; i< sc_ctx_get_reader_count(context); i++) {
 		sc_reader_t *reader = sc_ctx_get_reader(context, i);
@@ -418,17 +501,23 @@ card_detect_all(void)
 				}
 			}
 			if (!found) {
-				for (j = 0; j < sc_pkcs11_conf.slots_per_card; j++) {
-					CK_RV rv = create_slot(reader);
-					if (rv != CKR_OK)
-						return rv;
+				CK_RV r = CKR_OK;
+				for (j = 0; r == CKR_OK && j < sc_pkcs11_conf.slots_per_card; j++)
+					r = create_slot(reader);
+				if (r != CKR_OK) {
+					/* Drop the state queried above so that it is not
+					 * reported as current later, and go on with the
+					 * other readers */
+					sc_detect_card_presence(reader);
+					rv = r;
+					continue;
 				}
 			}
 			card_detect(reader);
 		}
 	}
 	sc_log(context, "All cards detected");
-	return CKR_OK;
+	return rv;
 }
 
 /* Allocates an existing slot to a card */
@@ -443,8 +532,9 @@ CK_RV slot_allocate(struct sc_pkcs11_slot ** slot, struct sc_pkcs11_card * p11ca
 		if (tmp_slot->reader == p11card->reader && tmp_slot->p11card == NULL)
 			break;
 	}
-	if (!tmp_slot || (i == list_size(&virtual_slots)))
+	if (!tmp_slot || (i == list_size(&virtual_slots))) {
 		return CKR_FUNCTION_FAILED;
+	}
 	sc_log(context, "Allocated slot 0x%lx for card in reader %s", tmp_slot->id, p11card->reader->name);
 	tmp_slot->p11card = p11card;
 	tmp_slot->events = SC_EVENT_CARD_INSERTED;
@@ -536,11 +626,18 @@ CK_RV slot_token_removed(CK_SLOT_ID id)
 
 /* Called from C_WaitForSlotEvent */
 CK_RV slot_find_changed(CK_SLOT_ID_PTR idp, int mask)
+{
+	card_detect_all();
+	return slot_find_event(idp, mask);
+}
+
+/* Returns and clears an event already recorded in the slots, without
+ * querying the readers */
+CK_RV slot_find_event(CK_SLOT_ID_PTR idp, int mask)
 {
 	unsigned int i;
 	LOG_FUNC_CALLED(context);
 
-	card_detect_all();
 	for (i=0; i<list_size(&virtual_slots); i++) {
 		sc_pkcs11_slot_t *slot = (sc_pkcs11_slot_t *) list_get_at(&virtual_slots, i);
 		sc_log(context, "slot 0x%lx token: %lu events: 0x%02X",
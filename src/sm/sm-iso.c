@@ -304,7 +304,8 @@ static int sm_encrypt(const struct iso_sm_ctx *ctx, sc_card_t *card,
 		goto err;
 	}
 	sm_apdu->control = apdu->control;
-	sm_apdu->flags = apdu->flags;
+	/* the response of the SM APDU is not received into the plain buffer */
+	sm_apdu->flags = apdu->flags & ~SC_APDU_FLAGS_RESP_IN_PLACE;
 	sm_apdu->cla = apdu->cla|0x0C;
 	sm_apdu->ins = apdu->ins;
 	sm_apdu->p1 = apdu->p1;
@@ -0,0 +1,247 @@
+/*
+ * threadtest.c: Stress test for parallel card operations in one context
+ *
+ * Copyright (C) 2026 OpenSC Project developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Every card found in the readers of a single context is first exercised
+ * alone, then all of them at the same time, one thread per card. With
+ * independent readers the parallel throughput is close to the sum of the
+ * throughputs measured alone.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <getopt.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include "libopensc/opensc.h"
+
+#define MAX_CARDS 16
+
+struct card_worker {
+	sc_card_t *card;
+	pthread_t thread;
+	unsigned long seconds;
+	unsigned long ops;
+	int error;
+};
+
+static const struct option options[] = {
+	{ "seconds",		1, NULL,	's' },
+	{ "driver",		1, NULL,	'c' },
+	{ "debug",		0, NULL,	'd' },
+	{ NULL, 0, NULL, 0 }
+};
+
+static int mutex_create(void **mutex)
+{
+	pthread_mutex_t *m = calloc(1, sizeof(pthread_mutex_t));
+
+	if (m == NULL)
+		return SC_ERROR_OUT_OF_MEMORY;
+	pthread_mutex_init(m, NULL);
+	*mutex = m;
+	return SC_SUCCESS;
+}
+
+static int mutex_lock(void *mutex)
+{
+	return pthread_mutex_lock((pthread_mutex_t *) mutex) ? SC_ERROR_INTERNAL : SC_SUCCESS;
+}
+
+static int mutex_unlock(void *mutex)
+{
+	return pthread_mutex_unlock((pthread_mutex_t *) mutex) ? SC_ERROR_INTERNAL : SC_SUCCESS;
+}
+
+static int mutex_destroy(void *mutex)
+{
+	pthread_mutex_destroy((pthread_mutex_t *) mutex);
+	free(mutex);
+	return SC_SUCCESS;
+}
+
+static sc_thread_context_t thread_ctx = {
+	0, mutex_create, mutex_lock, mutex_unlock, mutex_destroy, NULL
+};
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void *worker(void *arg)
+{
+	struct card_worker *w = arg;
+	double end = now() + w->seconds;
+	u8 buf[8];
+
+	w->ops = 0;
+	w->error = 0;
+	while (now() < end) {
+		int r = sc_lock(w->card);
+
+		if (r == SC_SUCCESS) {
+			r = sc_get_challenge(w->card, buf, sizeof(buf));
+			sc_unlock(w->card);
+		}
+		if (r != SC_SUCCESS) {
+			w->error = r;
+			break;
+		}
+		w->ops++;
+	}
+
+	return NULL;
+}
+
+static int run(struct card_worker *workers, size_t count)
+{
+	size_t i;
+	int r = 0;
+
+	for (i = 0; i < count; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker, &workers[i]) != 0) {
+			fprintf(stderr, "pthread_create() failed: %s\n", strerror(errno));
+			count = i;
+			r = 1;
+			break;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].error) {
+			fprintf(stderr, "Card in '%s' failed: %s\n",
+					workers[i].card->reader->name, sc_strerror(workers[i].error));
+			r = 1;
+		}
+	}
+
+	return r;
+}
+
+int main(int argc, char *argv[])
+{
+	struct card_worker workers[MAX_CARDS];
+	sc_context_param_t ctx_param;
+	sc_context_t *ctx = NULL;
+	const char *opt_driver = NULL;
+	unsigned long seconds = 10;
+	char *end;
+	int opt_debug = 0;
+	double alone = 0, parallel = 0;
+	size_t count = 0, i;
+	int c, r;
+
+	while ((c = getopt_long(argc, argv, "s:c:d", options, NULL)) != -1) {
+		switch (c) {
+		case 's':
+			seconds = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' || seconds == 0) {
+				fprintf(stderr, "%s: invalid number of seconds '%s'\n", argv[0], optarg);
+				return 1;
+			}
+			break;
+		case 'c':
+			opt_driver = optarg;
+			break;
+		case 'd':
+			opt_debug++;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s seconds] [-c driver] [-d]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	memset(&ctx_param, 0, sizeof(ctx_param));
+	ctx_param.app_name = "threadtest";
+	ctx_param.thread_ctx = &thread_ctx;
+	r = sc_context_create(&ctx, &ctx_param);
+	if (r != SC_SUCCESS) {
+		fprintf(stderr, "Failed to establish context: %s\n", sc_strerror(r));
+		return 1;
+	}
+	ctx->debug = opt_debug;
+	if (opt_driver != NULL && sc_set_card_driver(ctx, opt_driver) != SC_SUCCESS) {
+		fprintf(stderr, "Card driver '%s' not found\n", opt_driver);
+		sc_release_context(ctx);
+		return 1;
+	}
+
+	memset(workers, 0, sizeof(workers));
+	for (i = 0; i < sc_ctx_get_reader_count(ctx) && count < MAX_CARDS; i++) {
+		sc_reader_t *reader = sc_ctx_get_reader(ctx, i);
+
+		if (sc_detect_card_presence(reader) <= 0)
+			continue;
+		r = sc_connect_card(reader, &workers[count].card);
+		if (r != SC_SUCCESS) {
+			fprintf(stderr, "Connecting to card in '%s' failed: %s\n",
+					reader->name, sc_strerror(r));
+			continue;
+		}
+		workers[count].seconds = seconds;
+		count++;
+	}
+	if (count == 0) {
+		fprintf(stderr, "No cards found\n");
+		sc_release_context(ctx);
+		return 1;
+	}
+
+	r = 0;
+	for (i = 0; i < count && r == 0; i++) {
+		r = run(&workers[i], 1);
+		alone += (double) workers[i].ops / seconds;
+		printf("%-40.40s alone:    %8.1f ops/s\n",
+				workers[i].card->reader->name, (double) workers[i].ops / seconds);
+	}
+
+	if (r == 0) {
+		r = run(workers, count);
+		for (i = 0; i < count; i++) {
+			parallel += (double) workers[i].ops / seconds;
+			printf("%-40.40s parallel: %8.1f ops/s\n",
+					workers[i].card->reader->name, (double) workers[i].ops / seconds);
+		}
+		printf("%lu readers: %.1f ops/s alone, %.1f ops/s in parallel (%.0f%%)\n",
+				(unsigned long) count, alone, parallel,
+				alone > 0 ? 100.0 * parallel / alone : 0.0);
+	}
+
+	for (i = 0; i < count; i++)
+		sc_disconnect_card(workers[i].card);
+	sc_release_context(ctx);
+
+	return r;
+}
@@ -0,0 +1,408 @@
+/*
+ * card-block-cipher.c: Unit tests for AES with a secret key of the card
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "torture.h"
+#include "pkcs11/mechanism.c"
+#include <openssl/evp.h>
+
+struct sc_context *context = NULL;
+
+/* The session layer is not used by the code under test */
+CK_RV session_start_operation(struct sc_pkcs11_session *session, int type,
+		sc_pkcs11_mechanism_type_t *mech, struct sc_pkcs11_operation **operation)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV session_get_operation(struct sc_pkcs11_session *session, int type,
+		struct sc_pkcs11_operation **operation)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV session_stop_operation(struct sc_pkcs11_session *session, int type)
+{
+	return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+static const unsigned char key_value[16] = "0123456789abcdef";
+static const unsigned char start_iv[16] = "fedcba9876543210";
+
+/* The card: whole blocks only, no padding, as with card_block_cipher() */
+static CK_RV
+card_crypt(int encrypt, CK_MECHANISM_PTR pMechanism,
+		CK_BYTE_PTR pIn, CK_ULONG ulInLen, CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen)
+{
+	EVP_CIPHER_CTX *ctx;
+	const EVP_CIPHER *cipher;
+	int len, final_len;
+
+	if (pMechanism->mechanism != CKM_AES_ECB && pMechanism->mechanism != CKM_AES_CBC)
+		return CKR_MECHANISM_INVALID;
+	if (ulInLen == 0 || ulInLen % 16 != 0)
+		return CKR_DATA_LEN_RANGE;
+	if (*pulOutLen < ulInLen)
+		return CKR_BUFFER_TOO_SMALL;
+
+	cipher = pMechanism->mechanism == CKM_AES_ECB ? EVP_aes_128_ecb() : EVP_aes_128_cbc();
+	ctx = EVP_CIPHER_CTX_new();
+	if (ctx == NULL)
+		return CKR_HOST_MEMORY;
+	if (!EVP_CipherInit_ex(ctx, cipher, NULL, key_value, pMechanism->pParameter, encrypt)
+			|| !EVP_CIPHER_CTX_set_padding(ctx, 0)
+			|| !EVP_CipherUpdate(ctx, pOut, &len, pIn, (int) ulInLen)
+			|| !EVP_CipherFinal_ex(ctx, pOut + len, &final_len)) {
+		EVP_CIPHER_CTX_free(ctx);
+		return CKR_DEVICE_ERROR;
+	}
+	EVP_CIPHER_CTX_free(ctx);
+	*pulOutLen = len + final_len;
+	return CKR_OK;
+}
+
+static CK_RV
+card_encrypt(struct sc_pkcs11_session *session, void *object,
+		CK_MECHANISM_PTR pMechanism, CK_BYTE_PTR pData, CK_ULONG ulDataLen,
+		CK_BYTE_PTR pEncryptedData, CK_ULONG_PTR pulEncryptedDataLen)
+{
+	return card_crypt(1, pMechanism, pData, ulDataLen, pEncryptedData, pulEncryptedDataLen);
+}
+
+static CK_RV
+card_decrypt(struct sc_pkcs11_session *session, void *object,
+		CK_MECHANISM_PTR pMechanism, CK_BYTE_PTR pEncryptedData, CK_ULONG ulEncryptedDataLen,
+		CK_BYTE_PTR pData, CK_ULONG_PTR pulDataLen)
+{
+	return card_crypt(0, pMechanism, pEncryptedData, ulEncryptedDataLen, pData, pulDataLen);
+}
+
+static struct sc_pkcs11_object_ops card_key_ops;
+static struct sc_pkcs11_object card_key;
+
+/* The expected result, from OpenSSL in one go */
+static size_t
+reference(int encrypt, CK_MECHANISM_TYPE mech,
+		const unsigned char *in, size_t in_len, unsigned char *out)
+{
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	int len, final_len;
+
+	assert_non_null(ctx);
+	assert_int_equal(EVP_CipherInit_ex(ctx,
+			mech == CKM_AES_ECB ? EVP_aes_128_ecb() : EVP_aes_128_cbc(),
+			NULL, key_value, start_iv, encrypt), 1);
+	EVP_CIPHER_CTX_set_padding(ctx, mech == CKM_AES_CBC_PAD);
+	assert_int_equal(EVP_CipherUpdate(ctx, out, &len, in, (int) in_len), 1);
+	assert_int_equal(EVP_CipherFinal_ex(ctx, out + len, &final_len), 1);
+	EVP_CIPHER_CTX_free(ctx);
+	return len + final_len;
+}
+
+static void
+fill(unsigned char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (unsigned char) (i * 7 + 3);
+}
+
+/* Set up an operation as sc_pkcs11_encr_init()/sc_pkcs11_decr_init() would */
+static int setup_operation(void **state)
+{
+	sc_pkcs11_operation_t *op;
+	struct signature_data *data;
+
+	card_key_ops.encrypt = card_encrypt;
+	card_key_ops.decrypt = card_decrypt;
+	card_key.ops = &card_key_ops;
+
+	op = calloc(1, sizeof(*op));
+	assert_non_null(op);
+	data = new_signature_data();
+	assert_non_null(data);
+	data->key = &card_key;
+	op->priv_data = data;
+	memcpy(&op->mechanism_params, start_iv, sizeof(start_iv));
+	op->mechanism.pParameter = &op->mechanism_params;
+	op->mechanism.ulParameterLen = sizeof(start_iv);
+
+	*state = op;
+	return 0;
+}
+
+static int teardown_operation(void **state)
+{
+	sc_pkcs11_operation_t *op = *state;
+
+	signature_data_release((struct signature_data *) op->priv_data);
+	free(op);
+	return 0;
+}
+
+/* A partial block is held back until the next part completes it */
+static void torture_partial_block(void **state)
+{
+	sc_pkcs11_operation_t *op = *state;
+	unsigned char in[40], out[64], expected[64];
+	CK_ULONG len, total = 0;
+	size_t expected_len;
+
+	op->mechanism.mechanism = CKM_AES_CBC;
+	fill(in, 32);
+	expected_len = reference(1, CKM_AES_CBC, in, 32, expected);
+
+	len = sizeof(out);
+	assert_int_equal(card_block_cipher_update(op, 1, in, 5, out, &len), CKR_OK);
+	assert_int_equal(len, 0);
+
+	/* the size query counts the held bytes */
+	assert_int_equal(card_block_cipher_update(op, 1, in + 5, 20, NULL, &len), CKR_OK);
+	assert_int_equal(len, 16);
+	len = 15;
+	assert_int_equal(card_block_cipher_update(op, 1, in + 5, 20, out, &len), CKR_BUFFER_TOO_SMALL);
+	assert_int_equal(len, 16);
+
+	len = sizeof(out);
+	assert_int_equal(card_block_cipher_update(op, 1, in + 5, 20, out, &len), CKR_OK);
+	assert_int_equal(len, 16);
+	total += len;
+	len = sizeof(out) - total;
+	assert_int_equal(card_block_cipher_update(op, 1, in + 25, 7, out + total, &len), CKR_OK);
+	assert_int_equal(len, 16);
+	total += len;
+	len = sizeof(out) - total;
+	assert_int_equal(card_block_cipher_final(op, 1, out + total, &len), CKR_OK);
+	assert_int_equal(len, 0);
+
+	assert_int_equal(total, expected_len);
+	assert_memory_equal(out, expected, expected_len);
+}
+
+/* A partial block left at the end is an error without padding */
+static void torture_partial_block_final(void **state)
+{
+	sc_pkcs11_operation_t *op = *state;
+	unsigned char in[16] = {0}, out[16];
+	CK_ULONG len = sizeof(out);
+
+	op->mechanism.mechanism = CKM_AES_ECB;
+	assert_int_equal(card_block_cipher_update(op, 1, in, 9, out, &len), CKR_OK);
+	assert_int_equal(len, 0);
+	len = sizeof(out);
+	assert_int_equal(card_block_cipher_final(op, 1, out, &len), CKR_DATA_LEN_RANGE);
+}
+
+/* CBC_PAD encryption adds a full block of padding to whole blocks */
+static void torture_cbc_pad_encrypt(void **state)
+{
+	sc_pkcs11_operation_t *op = *state;
+	unsigned char in[32], out[64], expected[64];
+	CK_ULONG len, total;
+	size_t expected_len;
+
+	op->mechanism.mechanism = CKM_AES_CBC_PAD;
+	fill(in, sizeof(in));
+	expected_len = reference(1, CKM_AES_CBC_PAD, in, sizeof(in), expected);
+	assert_int_equal(expected_len, 48);
+
+	len = sizeof(out);
+	assert_int_equal(card_block_cipher_update(op, 1, in, sizeof(in), out, &len), CKR_OK);
+	assert_int_equal(len, 32);
+	total = len;
+	len = 15;
+	assert_int_equal(card_block_cipher_final(op, 1, out + total, &len), CKR_BUFFER_TOO_SMALL);
+	assert_int_equal(len, 16);
+	assert_int_equal(card_block_cipher_final(op, 1, out + total, &len), CKR_OK);
+	total += len;
+
+	assert_int_equal(total, expected_len);
+	assert_memory_equal(out, expected, expected_len);
+}
+
+/* CBC_PAD decryption keeps the last block until the final call, which
+ * strips the padding; a too small buffer there must not lose the IV */
+static void torture_cbc_pad_last_block(void **state)
+{
+	sc_pkcs11_operation_t *op = *state;
+	unsigned char plain[37], in[48], out[48];
+	CK_ULONG len, total;
+
+	op->mechanism.mechanism = CKM_AES_CBC_PAD;
+	fill(plain, sizeof(plain));
+	assert_int_equal(reference(1, CKM_AES_CBC_PAD, plain, sizeof(plain), in), sizeof(in));
+
+	len = sizeof(out);
+	assert_int_equal(card_block_cipher_update(op, 0, in, sizeof(in), out, &len), CKR_OK);
+	assert_int_equal(len, 32);
+	total = len;
+
+	len = 0;
+	assert_int_equal(card_block_cipher_final(op, 0, NULL, &len), CKR_OK);
+	assert_int_equal(len, 16);
+	len = 4;
+	assert_int_equal(card_block_cipher_final(op, 0, out + total, &len), CKR_BUFFER_TOO_SMALL);
+	assert_int_equal(len, 5);
+	assert_int_equal(card_block_cipher_final(op, 0, out + total, &len), CKR_OK);
+	assert_int_equal(len, 5);
+	total += len;
+
+	assert_int_equal(total, sizeof(plain));
+	assert_memory_equal(out, plain, sizeof(plain));
+}
+
+/* Broken padding is reported, not returned */
+static void torture_cbc_pad_invalid(void **state)
+{
+	sc_pkcs11_operation_t *op = *state;
+	unsigned char plain[16], in[16], out[16];
+	CK_ULONG len = sizeof(out);
+
+	op->mechanism.mechanism = CKM_AES_CBC_PAD;
+	fill(plain, sizeof(plain));
+	plain[15] = 0x11;
+	assert_int_equal(reference(1, CKM_AES_CBC, plain, sizeof(plain), in), sizeof(in));
+
+	assert_int_equal(card_block_cipher_update(op, 0, in, sizeof(in), out, &len), CKR_OK);
+	assert_int_equal(len, 0);
+	len = sizeof(out);
+	assert_int_equal(card_block_cipher_final(op, 0, out, &len), CKR_ENCRYPTED_DATA_INVALID);
+}
+
+/* pIn and pOut may be the same buffer */
+static void torture_in_place(void **state)
+{
+	sc_pkcs11_operation_t *op = *state;
+	unsigned char plain[80], buf[80], expected[80];
+	CK_ULONG len, total = 0;
+
+	op->mechanism.mechanism = CKM_AES_CBC;
+	fill(plain, sizeof(plain));
+	assert_int_equal(reference(1, CKM_AES_CBC, plain, sizeof(plain), expected), sizeof(expected));
+	memcpy(buf, expected, sizeof(buf));
+
+	/* parts not on block boundaries: the output trails the input */
+	len = sizeof(buf);
+	assert_int_equal(card_block_cipher_update(op, 0, buf, 20, buf, &len), CKR_OK);
+	assert_int_equal(len, 16);
+	total += len;
+	len = sizeof(buf) - total;
+	assert_int_equal(card_block_cipher_update(op, 0, buf + 20, 40, buf + total, &len), CKR_OK);
+	assert_int_equal(len, 32);
+	total += len;
+	len = sizeof(buf) - total;
+	assert_int_equal(card_block_cipher_update(op, 0, buf + 60, 20, buf + total, &len), CKR_OK);
+	assert_int_equal(len, 32);
+	total += len;
+	len = 0;
+	assert_int_equal(card_block_cipher_final(op, 0, NULL, &len), CKR_OK);
+	assert_int_equal(len, 0);
+
+	assert_int_equal(total, sizeof(plain));
+	assert_memory_equal(buf, plain, sizeof(plain));
+}
+
+/* The chaining value goes from part to part in the IV of the mechanism */
+static void torture_iv_carry_over(void **state)
+{
+	sc_pkcs11_operation_t *op = *state;
+	unsigned char in[64], out[64], expected[64];
+	CK_ULONG len, total = 0;
+	int i;
+
+	op->mechanism.mechanism = CKM_AES_CBC;
+	fill(in, sizeof(in));
+	assert_int_equal(reference(1, CKM_AES_CBC, in, sizeof(in), expected), sizeof(expected));
+
+	for (i = 0; i < 4; i++) {
+		len = sizeof(out) - total;
+		assert_int_equal(card_block_cipher_update(op, 1, in + total, 16, out + total, &len), CKR_OK);
+		assert_int_equal(len, 16);
+		total += len;
+		assert_memory_equal(op->mechanism.pParameter, expected + total - 16, 16);
+	}
+	assert_memory_equal(out, expected, sizeof(expected));
+}
+
+/* The same for decryption, where the card overwrites the input in place */
+static void torture_iv_carry_over_decrypt(void **state)
+{
+	sc_pkcs11_operation_t *op = *state;
+	unsigned char plain[48], in[48], out[48];
+	CK_ULONG len, total = 0;
+	int i;
+
+	op->mechanism.mechanism = CKM_AES_CBC;
+	fill(plain, sizeof(plain));
+	assert_int_equal(reference(1, CKM_AES_CBC, plain, sizeof(plain), in), sizeof(in));
+
+	for (i = 0; i < 3; i++) {
+		len = sizeof(out) - total;
+		assert_int_equal(card_block_cipher_update(op, 0, in + total, 16, out + total, &len), CKR_OK);
+		assert_int_equal(len, 16);
+		total += len;
+		assert_memory_equal(op->mechanism.pParameter, in + total - 16, 16);
+	}
+	assert_memory_equal(out, plain, sizeof(plain));
+}
+
+/* Single-part operations go through the same code */
+static void torture_oneshot(void **state)
+{
+	sc_pkcs11_operation_t *op = *state;
+	unsigned char in[37], out[48], expected[48];
+	CK_ULONG len;
+
+	op->mechanism.mechanism = CKM_AES_CBC_PAD;
+	fill(in, sizeof(in));
+	assert_int_equal(reference(1, CKM_AES_CBC_PAD, in, sizeof(in), expected), sizeof(expected));
+
+	assert_int_equal(card_block_cipher_oneshot(op, 1, in, sizeof(in), NULL, &len), CKR_OK);
+	assert_int_equal(len, 48);
+	len = 47;
+	assert_int_equal(card_block_cipher_oneshot(op, 1, in, sizeof(in), out, &len), CKR_BUFFER_TOO_SMALL);
+	assert_int_equal(len, 48);
+	assert_int_equal(card_block_cipher_oneshot(op, 1, in, sizeof(in), out, &len), CKR_OK);
+	assert_int_equal(len, 48);
+	assert_memory_equal(out, expected, sizeof(expected));
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(torture_partial_block,
+				setup_operation, teardown_operation),
+		cmocka_unit_test_setup_teardown(torture_partial_block_final,
+				setup_operation, teardown_operation),
+		cmocka_unit_test_setup_teardown(torture_cbc_pad_encrypt,
+				setup_operation, teardown_operation),
+		cmocka_unit_test_setup_teardown(torture_cbc_pad_last_block,
+				setup_operation, teardown_operation),
+		cmocka_unit_test_setup_teardown(torture_cbc_pad_invalid,
+				setup_operation, teardown_operation),
+		cmocka_unit_test_setup_teardown(torture_in_place,
+				setup_operation, teardown_operation),
+		cmocka_unit_test_setup_teardown(torture_iv_carry_over,
+				setup_operation, teardown_operation),
+		cmocka_unit_test_setup_teardown(torture_iv_carry_over_decrypt,
+				setup_operation, teardown_operation),
+		cmocka_unit_test_setup_teardown(torture_oneshot,
+				setup_operation, teardown_operation),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -87,7 +87,7 @@ static const char *option_help[] = {
 	"Lists readers",
 	"Lists all installed card drivers",
 	"Recursively lists files stored on card",
-	"Sends an APDU (may need '-c default')",
+	"Sends an APDU, or the APDUs of script @<file> (may need '-c default')",
 	"Uses reader number <arg> [0]",
 	"Does card reset of type <cold|warm> [cold]",
 	"Forces a card driver (use '?' for list)",
@@ -492,45 +492,170 @@ static int list_files(void)
 	return r;
 }
 
+/* APDUs collected from the command line and script files */
+static sc_apdu_t *script_apdus = NULL;
+static u8 **script_bufs = NULL;
+static size_t *script_lens = NULL;
+static size_t script_count = 0;
+
+static int add_apdu(const char *hex)
+{
+	u8 buf[SC_MAX_EXT_APDU_BUFFER_SIZE];
+	size_t len0 = sizeof(buf);
+	sc_apdu_t *apdus;
+	u8 **bufs;
+	size_t *lens;
+	int r;
+
+	r = sc_hex_to_bin(hex, buf, &len0);
+	if (r) {
+		fprintf(stderr, "Invalid APDU '%s': %s\n", hex, sc_strerror(r));
+		return 2;
+	}
+
+	apdus = realloc(script_apdus, (script_count + 1) * sizeof(sc_apdu_t));
+	if (apdus)
+		script_apdus = apdus;
+	bufs = realloc(script_bufs, (script_count + 1) * sizeof(u8 *));
+	if (bufs)
+		script_bufs = bufs;
+	lens = realloc(script_lens, (script_count + 1) * sizeof(size_t));
+	if (lens)
+		script_lens = lens;
+	if (!apdus || !bufs || !lens) {
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+
+	/* the APDU refers to its command data: keep a copy of it */
+	script_bufs[script_count] = malloc(len0);
+	if (!script_bufs[script_count]) {
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+	memcpy(script_bufs[script_count], buf, len0);
+	script_lens[script_count] = len0;
+
+	r = sc_bytes2apdu(card->ctx, script_bufs[script_count], len0, &script_apdus[script_count]);
+	if (r) {
+		free(script_bufs[script_count]);
+		fprintf(stderr, "Invalid APDU '%s': %s\n", hex, sc_strerror(r));
+		return 2;
+	}
+	script_apdus[script_count].resp = malloc(SC_MAX_EXT_APDU_BUFFER_SIZE);
+	if (!script_apdus[script_count].resp) {
+		free(script_bufs[script_count]);
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+	script_apdus[script_count].resplen = SC_MAX_EXT_APDU_BUFFER_SIZE;
+	script_count++;
+
+	return 0;
+}
+
+/* Reads an APDU script: one APDU per line, '#' starts a comment */
+static int add_apdu_script(const char *filename)
+{
+	static char line[3 * SC_MAX_EXT_APDU_BUFFER_SIZE + 2];
+	FILE *f;
+	int r = 0;
+
+	f = fopen(filename, "r");
+	if (!f) {
+		fprintf(stderr, "Cannot open APDU script '%s': %s\n", filename, strerror(errno));
+		return 2;
+	}
+	while (r == 0 && fgets(line, sizeof(line), f)) {
+		char *p = strchr(line, '#');
+		char *start = line;
+		size_t len;
+
+		if (p)
+			*p = '\0';
+		while (isspace((unsigned char) *start))
+			start++;
+		len = strlen(start);
+		while (len > 0 && isspace((unsigned char) start[len - 1]))
+			start[--len] = '\0';
+		if (len)
+			r = add_apdu(start);
+	}
+	fclose(f);
+
+	return r;
+}
+
+static void free_apdus(void)
+{
+	size_t i;
+
+	for (i = 0; i < script_count; i++) {
+		free(script_bufs[i]);
+		free(script_apdus[i].resp);
+	}
+	free(script_apdus);
+	free(script_bufs);
+	free(script_lens);
+	script_apdus = NULL;
+	script_bufs = NULL;
+	script_lens = NULL;
+	script_count = 0;
+}
+
 static int send_apdu(void)
 {
-	sc_apdu_t apdu;
-	u8 buf[SC_MAX_EXT_APDU_BUFFER_SIZE],
-	  rbuf[SC_MAX_EXT_APDU_BUFFER_SIZE];
-	size_t len0, r;
-	int c;
-
-	for (c = 0; c < opt_apdu_count; c++) {
-		len0 = sizeof(buf);
-		sc_hex_to_bin(opt_apdus[c], buf, &len0);
-
-		r = sc_bytes2apdu(card->ctx, buf, len0, &apdu);
-		if (r) {
-			fprintf(stderr, "Invalid APDU: %s\n", sc_strerror(r));
-			return 2;
+	size_t done = 0, i, r;
+	int c, err = 0;
+
+	/* '@file' reads the APDUs from a script file */
+	for (c = 0; c < opt_apdu_count && err == 0; c++) {
+		if (opt_apdus[c][0] == '@')
+			err = add_apdu_script(opt_apdus[c] + 1);
+		else
+			err = add_apdu(opt_apdus[c]);
+	}
+	if (err)
+		goto end;
+
+	/* report inconsistent APDUs here, not as a failed transmit */
+	for (i = 0; i < script_count; i++) {
+		c = sc_check_apdu(card, &script_apdus[i]);
+		if (c != SC_SUCCESS) {
+			fprintf(stderr, "Invalid APDU #%"SC_FORMAT_LEN_SIZE_T"u: ", i);
+			for (r = 0; r < script_lens[i]; r++)
+				fprintf(stderr, "%02X ", script_bufs[i][r]);
+			fprintf(stderr, "\n%s\n", sc_strerror(c));
+			err = 1;
+			goto end;
 		}
+	}
 
-		apdu.resp = rbuf;
-		apdu.resplen = sizeof(rbuf);
+	/* all APDUs are sent under a single card lock */
+	c = sc_transmit_apdu_list(card, script_apdus, script_count,
+			SC_APDU_LIST_CONTINUE_ON_ERROR, &done);
+
+	for (i = 0; i < script_count && i <= done; i++) {
+		sc_apdu_t *apdu = &script_apdus[i];
 
 		printf("Sending: ");
-		for (r = 0; r < len0; r++)
-			printf("%02X ", buf[r]);
+		for (r = 0; r < script_lens[i]; r++)
+			printf("%02X ", script_bufs[i][r]);
 		printf("\n");
-		r = sc_lock(card);
-		if (r == SC_SUCCESS)
-			r = sc_transmit_apdu(card, &apdu);
-		sc_unlock(card);
-		if (r) {
-			fprintf(stderr, "APDU transmit failed: %s\n", sc_strerror(r));
-			return 1;
+		if (i == done) {
+			fprintf(stderr, "APDU transmit failed: %s\n", sc_strerror(c));
+			err = 1;
+			break;
 		}
-		printf("Received (SW1=0x%02X, SW2=0x%02X)%s\n", apdu.sw1, apdu.sw2,
-		      apdu.resplen ? ":" : "");
-		if (apdu.resplen)
-			util_hex_dump_asc(stdout, apdu.resp, apdu.resplen, -1);
+		printf("Received (SW1=0x%02X, SW2=0x%02X)%s\n", apdu->sw1, apdu->sw2,
+		      apdu->resplen ? ":" : "");
+		if (apdu->resplen)
+			util_hex_dump_asc(stdout, apdu->resp, apdu->resplen, -1);
 	}
-	return 0;
+
+end:
+	free_apdus();
+	return err;
 }
 
 static void print_serial(sc_card_t *in_card)
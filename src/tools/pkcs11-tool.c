@@ -25,6 +25,10 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
 
 #ifndef _WIN32
 #include <sys/types.h>
@@ -2404,10 +2408,33 @@ static void verify_signature(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 		printf("Cryptoki returned error: %s\n", CKR2Str(rv));
 }
 
+static double get_seconds(void)
+{
+#ifdef HAVE_SYS_TIME_H
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+#else
+	return (double)time(NULL);
+#endif
+}
+
+static void print_throughput(const char *action, size_t bytes, double start)
+{
+	double elapsed = get_seconds() - start;
+
+	fprintf(stderr, "%s %lu bytes in %.2f s", action, (unsigned long)bytes, elapsed);
+	if (elapsed > 0)
+		fprintf(stderr, ", %.2f kB/s", bytes / elapsed / 1024);
+	fprintf(stderr, "\n");
+}
+
 static void decrypt_data(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 		CK_OBJECT_HANDLE key)
 {
-	unsigned char	in_buffer[1024], out_buffer[1024];
+	/* a part may come out with a block held back from the previous one */
+	unsigned char	in_buffer[1024], out_buffer[1024 + 16];
 	CK_MECHANISM	mech;
 	CK_RV		rv;
 	CK_RSA_PKCS_OAEP_PARAMS oaep_params;
@@ -2416,6 +2443,8 @@ static void decrypt_data(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 	int		r;
 	CK_BYTE_PTR	iv = NULL;
 	size_t		iv_size = 0;
+	size_t		total = 0;
+	double		start;
 
 	if (!opt_mechanism_used)
 		if (!find_mechanism(slot, CKF_DECRYPT|opt_allow_sw, NULL, 0, &opt_mechanism))
@@ -2515,6 +2544,8 @@ static void decrypt_data(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 	if (r < 0)
 		util_fatal("Cannot read from %s: %m", opt_input);
 
+	start = get_seconds();
+
 	rv = CKR_CANCEL;
 	if (r < (int) sizeof(in_buffer)) {
 		out_len = sizeof(out_buffer);
@@ -2532,6 +2563,7 @@ static void decrypt_data(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 		if (getALWAYS_AUTHENTICATE(session, key))
 			login(session, CKU_CONTEXT_SPECIFIC);
 		do {
+			total += in_len;
 			out_len = sizeof(out_buffer);
 			rv = p11->C_DecryptUpdate(session, in_buffer, in_len, out_buffer, &out_len);
 			if (rv != CKR_OK)
@@ -2552,6 +2584,8 @@ static void decrypt_data(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 		if (r != (int) out_len)
 			util_fatal("Cannot write to %s: %m", opt_output);
 	}
+	if (verbose)
+		print_throughput("Decrypted", total ? total : (size_t) in_len, start);
 	if (fd_in != 0)
 		close(fd_in);
 	if (fd_out != 1)
@@ -2563,7 +2597,8 @@ static void decrypt_data(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 static void encrypt_data(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 		CK_OBJECT_HANDLE key)
 {
-	unsigned char	in_buffer[1024], out_buffer[1024];
+	/* a part may come out with a block held back from the previous one */
+	unsigned char	in_buffer[1024], out_buffer[1024 + 16];
 	CK_MECHANISM	mech;
 	CK_RV		rv;
 	CK_ULONG	in_len, out_len;
@@ -2571,6 +2606,8 @@ static void encrypt_data(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 	int		r;
 	CK_BYTE_PTR	iv = NULL;
 	size_t		iv_size = 0;
+	size_t		total = 0;
+	double		start;
 
 	if (!opt_mechanism_used)
 		if (!find_mechanism(slot, CKF_ENCRYPT | opt_allow_sw, NULL, 0, &opt_mechanism))
@@ -2615,6 +2652,8 @@ static void encrypt_data(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 	if (r < 0)
 		util_fatal("Cannot read from %s: %m", opt_input);
 
+	start = get_seconds();
+
 	rv = CKR_CANCEL;
 	if (r < (int) sizeof(in_buffer)) {
 		out_len = sizeof(out_buffer);
@@ -2633,6 +2672,7 @@ static void encrypt_data(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 		if (getALWAYS_AUTHENTICATE(session, key))
 			login(session, CKU_CONTEXT_SPECIFIC);
 		do {
+			total += in_len;
 			out_len = sizeof(out_buffer);
 			rv = p11->C_EncryptUpdate(session, in_buffer, in_len, out_buffer, &out_len);
 			if (rv != CKR_OK)
@@ -2653,6 +2693,8 @@ static void encrypt_data(CK_SLOT_ID slot, CK_SESSION_HANDLE session,
 		if (r != (int) out_len)
 			util_fatal("Cannot write to %s: %m", opt_output);
 	}
+	if (verbose)
+		print_throughput("Encrypted", total ? total : (size_t) in_len, start);
 	if (fd_in != 0)
 		close(fd_in);
 	if (fd_out != 1)
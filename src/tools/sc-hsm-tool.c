@@ -29,7 +29,11 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <time.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
 
 /* Requires openssl for dkek import */
 #include <openssl/opensslv.h>
@@ -65,6 +69,7 @@ static int	verbose = 0;
 #define MAX_PRKD		256
 #define MAX_KEY			1500
 #define MAX_WRAPPED_KEY	(MAX_CERT + MAX_PRKD + MAX_KEY)
+#define MAX_ARCHIVE_ENTRY	(MAX_WRAPPED_KEY + 16)
 
 #define SEED_LENGTH 16
 
@@ -76,7 +81,10 @@ enum {
 	OPT_BIO2,
 	OPT_PASSWORD,
 	OPT_PASSWORD_SHARES_THRESHOLD,
-	OPT_PASSWORD_SHARES_TOTAL
+	OPT_PASSWORD_SHARES_TOTAL,
+	OPT_WRAP_KEYS,
+	OPT_UNWRAP_KEYS,
+	OPT_KEY_REFERENCES
 };
 
 static const struct option options[] = {
@@ -88,6 +96,8 @@ static const struct option options[] = {
 #endif
 	{ "wrap-key",				1, NULL,		'W' },
 	{ "unwrap-key",				1, NULL,		'U' },
+	{ "wrap-keys",				1, NULL,		OPT_WRAP_KEYS },
+	{ "unwrap-keys",			1, NULL,		OPT_UNWRAP_KEYS },
 	{ "dkek-shares",			1, NULL,		's' },
 	{ "so-pin",					1, NULL,		OPT_SO_PIN },
 	{ "pin",					1, NULL,		OPT_PIN },
@@ -98,6 +108,7 @@ static const struct option options[] = {
 	{ "pwd-shares-threshold",	1, NULL,		OPT_PASSWORD_SHARES_THRESHOLD },
 	{ "pwd-shares-total",		1, NULL,		OPT_PASSWORD_SHARES_TOTAL },
 	{ "key-reference",			1, NULL,		'i' },
+	{ "key-references",			1, NULL,		OPT_KEY_REFERENCES },
 	{ "label",					1, NULL,		'l' },
 	{ "force",					0, NULL,		'f' },
 	{ "reader",					1, NULL,		'r' },
@@ -115,6 +126,8 @@ static const char *option_help[] = {
 #endif
 	"Wrap key and save to <filename>",
 	"Unwrap key read from <filename>",
+	"Wrap all keys and save them to the archive <filename>",
+	"Unwrap all keys read from the archive <filename>",
 	"Number of DKEK shares [No DKEK]",
 	"Define security officer PIN (SO-PIN)",
 	"Define user PIN",
@@ -125,6 +138,7 @@ static const char *option_help[] = {
 	"Define threshold for number of password shares required for reconstruction",
 	"Define number of password shares",
 	"Key reference for key wrap/unwrap",
+	"Key references for --wrap-keys/--unwrap-keys, e.g. 1,3,5-9 [all]",
 	"Token label for --initialize",
 	"Force replacement of key and certificate",
 	"Uses reader number <arg> [0]",
@@ -1290,32 +1304,11 @@ static int wrap_with_tag(u8 tag, u8 *indata, size_t inlen, u8 **outdata, size_t
 
 
 
-static int wrap_key(sc_context_t *ctx, sc_card_t *card, int keyid, const char *outf, const char *pin)
+static int verify_user_pin(sc_card_t *card, const char *pin)
 {
-	sc_cardctl_sc_hsm_wrapped_key_t wrapped_key;
 	struct sc_pin_cmd_data data;
-	sc_path_t path;
-	FILE *out = NULL;
-	u8 fid[2];
-	u8 ef_prkd[MAX_PRKD];
-	u8 ef_cert[MAX_CERT];
-	u8 wrapped_key_buff[MAX_KEY];
-	u8 keyblob[MAX_WRAPPED_KEY];
-	u8 *key;
-	u8 *ptr;
 	char *lpin = NULL;
-	size_t key_len;
-	int r, ef_prkd_len, ef_cert_len;
-
-	if ((keyid < 1) || (keyid > 255)) {
-		fprintf(stderr, "Invalid key reference (must be 0 < keyid <= 255)\n");
-		return -1;
-	}
-
-	if (outf == NULL) {
-		fprintf(stderr, "No file name specified for wrapped key\n");
-		return -1;
-	}
+	int r;
 
 	if (pin == NULL) {
 		printf("Enter User PIN : ");
@@ -1334,14 +1327,44 @@ static int wrap_key(sc_context_t *ctx, sc_card_t *card, int keyid, const char *o
 
 	r = sc_pin_cmd(card, &data, NULL);
 
+	if (pin == NULL) {
+		free(lpin);
+	}
+
 	if (r < 0) {
 		fprintf(stderr, "PIN verification failed with %s\n", sc_strerror(r));
 		return -1;
 	}
 
-	if (pin == NULL) {
-		free(lpin);
-	}
+	return 0;
+}
+
+
+
+/**
+ * Wrap a key and encode it together with the key description and certificate
+ *
+ * The user PIN must have been verified before.
+ *
+ * @param ctx the context used for logging
+ * @param card the card
+ * @param keyid the key reference
+ * @param outdata pointer to the allocated key blob
+ * @param outlen the size of the key blob
+ */
+static int wrap_key_blob(sc_context_t *ctx, sc_card_t *card, int keyid, u8 **outdata, size_t *outlen)
+{
+	sc_cardctl_sc_hsm_wrapped_key_t wrapped_key;
+	sc_path_t path;
+	u8 fid[2];
+	u8 ef_prkd[MAX_PRKD];
+	u8 ef_cert[MAX_CERT];
+	u8 wrapped_key_buff[MAX_KEY];
+	u8 keyblob[MAX_WRAPPED_KEY];
+	u8 *key;
+	u8 *ptr;
+	size_t key_len;
+	int r, ef_prkd_len, ef_cert_len;
 
 	wrapped_key.key_id = keyid;
 	wrapped_key.wrapped_key = wrapped_key_buff;
@@ -1426,9 +1449,38 @@ static int wrap_key(sc_context_t *ctx, sc_card_t *card, int keyid, const char *o
 	}
 
 	// Encode key, key description and certificate object in sequence
-	r = wrap_with_tag(0x30, keyblob, ptr - keyblob, &key, &key_len);
+	r = wrap_with_tag(0x30, keyblob, ptr - keyblob, outdata, outlen);
 	LOG_TEST_RET(ctx, r, "Out of memory");
 
+	return 0;
+}
+
+
+
+static int wrap_key(sc_context_t *ctx, sc_card_t *card, int keyid, const char *outf, const char *pin)
+{
+	FILE *out = NULL;
+	u8 *key;
+	size_t key_len;
+
+	if ((keyid < 1) || (keyid > 255)) {
+		fprintf(stderr, "Invalid key reference (must be 0 < keyid <= 255)\n");
+		return -1;
+	}
+
+	if (outf == NULL) {
+		fprintf(stderr, "No file name specified for wrapped key\n");
+		return -1;
+	}
+
+	if (verify_user_pin(card, pin) < 0) {
+		return -1;
+	}
+
+	if (wrap_key_blob(ctx, card, keyid, &key, &key_len) < 0) {
+		return -1;
+	}
+
 	out = fopen(outf, "wb");
 
 	if (out == NULL) {
@@ -1490,43 +1542,16 @@ static int update_ef(sc_card_t *card, u8 prefix, u8 id, int erase, const u8 *buf
 
 
 
-static int unwrap_key(sc_card_t *card, int keyid, const char *inf, const char *pin, int force)
+/**
+ * Split a key blob into the wrapped key, the key description and the certificate
+ */
+static int parse_key_blob(const u8 *keyblob, size_t keybloblen,
+		sc_cardctl_sc_hsm_wrapped_key_t *wrapped_key,
+		const u8 **prkd, size_t *prkd_len, const u8 **cert, size_t *cert_len)
 {
-	sc_cardctl_sc_hsm_wrapped_key_t wrapped_key;
-	struct sc_pin_cmd_data data;
-	u8 keyblob[MAX_WRAPPED_KEY];
-	const u8 *ptr,*prkd,*cert;
-	FILE *in = NULL;
-	sc_path_t path;
-	u8 fid[2];
-	char *lpin = NULL;
+	const u8 *ptr;
 	unsigned int cla, tag;
-	int r, keybloblen;
-	size_t len, olen, prkd_len, cert_len;
-
-	if ((keyid < 1) || (keyid > 255)) {
-		fprintf(stderr, "Invalid key reference (must be 0 < keyid <= 255)\n");
-		return -1;
-	}
-
-	if (inf == NULL) {
-		fprintf(stderr, "No file name specified for wrapped key\n");
-		return -1;
-	}
-
-	in = fopen(inf, "rb");
-
-	if (in == NULL) {
-		perror(inf);
-		return -1;
-	}
-
-	keybloblen = fread(keyblob, 1, sizeof(keyblob), in);
-	fclose(in);
-	if (keybloblen < 0) {
-		perror(inf);
-		return -1;
-	}
+	size_t len, olen;
 
 	ptr = keyblob;
 	if ((sc_asn1_read_tag(&ptr, keybloblen, &cla, &tag, &len) != SC_SUCCESS)
@@ -1543,27 +1568,32 @@ static int unwrap_key(sc_card_t *card, int keyid, const char *inf, const char *p
 		return -1;
 	}
 
-	wrapped_key.wrapped_key = (u8 *)ptr;
-	wrapped_key.wrapped_key_length = olen;
+	wrapped_key->wrapped_key = (u8 *)ptr;
+	wrapped_key->wrapped_key_length = olen;
 
 	ptr += olen;
-	prkd = ptr;
-	prkd_len = determineLength(ptr, keybloblen - (ptr - keyblob));
+	*prkd = ptr;
+	*prkd_len = determineLength(ptr, keybloblen - (ptr - keyblob));
 
-	ptr += prkd_len;
-	cert = ptr;
-	cert_len = determineLength(ptr, keybloblen - (ptr - keyblob));
+	ptr += *prkd_len;
+	*cert = ptr;
+	*cert_len = determineLength(ptr, keybloblen - (ptr - keyblob));
+
+	return 0;
+}
 
-	printf("Wrapped key contains:\n");
-	printf("  Key blob\n");
-	if (prkd_len > 0) {
-		printf("  Private Key Description (PRKD)\n");
-	}
-	if (cert_len > 0) {
-		printf("  Certificate\n");
-	}
 
-	if ((prkd_len > 0) && !force) {
+
+/**
+ * Check that neither key description nor certificate will be overwritten
+ */
+static int check_key_slot(sc_card_t *card, int keyid, size_t prkd_len, size_t cert_len)
+{
+	sc_path_t path;
+	u8 fid[2];
+	int r;
+
+	if (prkd_len > 0) {
 		fid[0] = PRKD_PREFIX;
 		fid[1] = (unsigned char)keyid;
 
@@ -1577,7 +1607,7 @@ static int unwrap_key(sc_card_t *card, int keyid, const char *inf, const char *p
 		}
 	}
 
-	if ((cert_len > 0) && !force) {
+	if (cert_len > 0) {
 		fid[0] = EE_CERTIFICATE_PREFIX;
 		fid[1] = (unsigned char)keyid;
 
@@ -1591,31 +1621,22 @@ static int unwrap_key(sc_card_t *card, int keyid, const char *inf, const char *p
 		}
 	}
 
-	if (pin == NULL) {
-		printf("Enter User PIN : ");
-		util_getpass(&lpin, NULL, stdin);
-		printf("\n");
-	} else {
-		lpin = (char *)pin;
-	}
-
-	memset(&data, 0, sizeof(data));
-	data.cmd = SC_PIN_CMD_VERIFY;
-	data.pin_type = SC_AC_CHV;
-	data.pin_reference = ID_USER_PIN;
-	data.pin1.data = (u8 *)lpin;
-	data.pin1.len = strlen(lpin);
+	return 0;
+}
 
-	r = sc_pin_cmd(card, &data, NULL);
 
-	if (r < 0) {
-		fprintf(stderr, "PIN verification failed with %s\n", sc_strerror(r));
-		return -1;
-	}
 
-	if (pin == NULL) {
-		free(lpin);
-	}
+/**
+ * Import a parsed key blob
+ *
+ * The user PIN must have been verified before.
+ */
+static int import_key_blob(sc_card_t *card, int keyid, sc_cardctl_sc_hsm_wrapped_key_t *wrapped_key,
+		const u8 *prkd, size_t prkd_len, const u8 *cert, size_t cert_len, int force)
+{
+	sc_path_t path;
+	u8 fid[2];
+	int r;
 
 	if (force) {
 		fid[0] = KEY_PREFIX;
@@ -1625,9 +1646,9 @@ static int unwrap_key(sc_card_t *card, int keyid, const char *inf, const char *p
 		sc_delete_file(card, &path);
 	}
 
-	wrapped_key.key_id = keyid;
+	wrapped_key->key_id = keyid;
 
-	r = sc_card_ctl(card, SC_CARDCTL_SC_HSM_UNWRAP_KEY, (void *)&wrapped_key);
+	r = sc_card_ctl(card, SC_CARDCTL_SC_HSM_UNWRAP_KEY, (void *)wrapped_key);
 
 	if (r == SC_ERROR_INS_NOT_SUPPORTED) {			// Not supported or not initialized for key shares
 		fprintf(stderr, "Card not initialized for key wrap\n");
@@ -1662,12 +1683,396 @@ static int unwrap_key(sc_card_t *card, int keyid, const char *inf, const char *p
 		}
 	}
 
+	return 0;
+}
+
+
+
+static int unwrap_key(sc_card_t *card, int keyid, const char *inf, const char *pin, int force)
+{
+	sc_cardctl_sc_hsm_wrapped_key_t wrapped_key;
+	u8 keyblob[MAX_WRAPPED_KEY];
+	const u8 *prkd,*cert;
+	FILE *in = NULL;
+	int keybloblen;
+	size_t prkd_len, cert_len;
+
+	if ((keyid < 1) || (keyid > 255)) {
+		fprintf(stderr, "Invalid key reference (must be 0 < keyid <= 255)\n");
+		return -1;
+	}
+
+	if (inf == NULL) {
+		fprintf(stderr, "No file name specified for wrapped key\n");
+		return -1;
+	}
+
+	in = fopen(inf, "rb");
+
+	if (in == NULL) {
+		perror(inf);
+		return -1;
+	}
+
+	keybloblen = fread(keyblob, 1, sizeof(keyblob), in);
+	fclose(in);
+	if (keybloblen < 0) {
+		perror(inf);
+		return -1;
+	}
+
+	if (parse_key_blob(keyblob, keybloblen, &wrapped_key, &prkd, &prkd_len, &cert, &cert_len) < 0) {
+		return -1;
+	}
+
+	printf("Wrapped key contains:\n");
+	printf("  Key blob\n");
+	if (prkd_len > 0) {
+		printf("  Private Key Description (PRKD)\n");
+	}
+	if (cert_len > 0) {
+		printf("  Certificate\n");
+	}
+
+	if (!force && (check_key_slot(card, keyid, prkd_len, cert_len) < 0)) {
+		return -1;
+	}
+
+	if (verify_user_pin(card, pin) < 0) {
+		return -1;
+	}
+
+	if (import_key_blob(card, keyid, &wrapped_key, prkd, prkd_len, cert, cert_len, force) < 0) {
+		return -1;
+	}
+
 	printf("Key successfully imported\n");
 	return 0;
 }
 
 
 
+/**
+ * Parse a list of key references like "1,3,5-9" into a map indexed by key reference
+ *
+ * @param list the list of key references, NULL selects all keys
+ * @param map the map with one entry per key reference
+ */
+static int parse_key_references(const char *list, u8 map[256])
+{
+	const char *p = list;
+	char *end;
+	long from, to;
+
+	if (list == NULL) {
+		memset(map, 1, 256);
+		map[0] = 0;
+		return 0;
+	}
+
+	memset(map, 0, 256);
+
+	while (*p) {
+		from = strtol(p, &end, 10);
+		if (end == p) {
+			break;
+		}
+		to = from;
+		p = end;
+		if (*p == '-') {
+			p++;
+			to = strtol(p, &end, 10);
+			if (end == p) {
+				break;
+			}
+			p = end;
+		}
+		if ((from < 1) || (to > 255) || (from > to)) {
+			break;
+		}
+		memset(map + from, 1, to - from + 1);
+		if (*p == ',') {
+			p++;
+		} else if (*p) {
+			break;
+		}
+	}
+
+	if (*p) {
+		fprintf(stderr, "Invalid list of key references \"%s\" (must be like 1,3,5-9 with 0 < keyid <= 255)\n", list);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+static double get_seconds(void)
+{
+#ifdef HAVE_SYS_TIME_H
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+#else
+	return (double)time(NULL);
+#endif
+}
+
+
+
+static void print_throughput(const char *action, int done, int total, size_t bytes, double start)
+{
+	double elapsed = get_seconds() - start;
+
+	printf("%s %d of %d keys (%lu bytes) in %.2f s", action, done, total, (unsigned long)bytes, elapsed);
+	if (elapsed > 0) {
+		printf(", %.2f keys/s, %.2f kB/s", done / elapsed, bytes / elapsed / 1024);
+	}
+	printf("\n");
+}
+
+
+
+/*
+ * A key archive is a sequence of entries, each entry being
+ *
+ * SEQUENCE {
+ *   INTEGER keyReference,
+ *   SEQUENCE wrappedKey -- as written by --wrap-key
+ * }
+ *
+ * Entries are written one by one while keys are wrapped and read one by one while keys are unwrapped,
+ * so that the size of the archive is not limited by the available memory.
+ */
+static int wrap_keys(sc_context_t *ctx, sc_card_t *card, const char *outf, const char *pin, const char *keyrefs)
+{
+	u8 filelist[MAX_EXT_APDU_LENGTH];
+	u8 selected[256];
+	u8 entry[MAX_ARCHIVE_ENTRY];
+	u8 keyref;
+	u8 *key, *ptr;
+	size_t key_len, entry_len, bytes = 0;
+	FILE *out = NULL;
+	double start;
+	int r, i, keys = 0, done = 0;
+
+	if (outf == NULL) {
+		fprintf(stderr, "No file name specified for key archive\n");
+		return -1;
+	}
+
+	if (parse_key_references(keyrefs, selected) < 0) {
+		return -1;
+	}
+
+	r = sc_list_files(card, filelist, sizeof(filelist));
+	if (r < 0) {
+		fprintf(stderr, "Enumerating keys failed with %s\n", sc_strerror(r));
+		return -1;
+	}
+
+	if (verify_user_pin(card, pin) < 0) {
+		return -1;
+	}
+
+	out = fopen(outf, "wb");
+
+	if (out == NULL) {
+		perror(outf);
+		return -1;
+	}
+
+	start = get_seconds();
+
+	for (i = 0; i + 1 < r; i += 2) {
+		if ((filelist[i] != KEY_PREFIX) || !selected[filelist[i + 1]]) {
+			continue;
+		}
+
+		keyref = filelist[i + 1];
+		keys++;
+
+		if (wrap_key_blob(ctx, card, keyref, &key, &key_len) < 0) {
+			printf("Key %3d: wrap failed\n", keyref);
+			continue;
+		}
+
+		if (key_len + 4 > sizeof(entry)) {
+			printf("Key %3d: wrapped key too large\n", keyref);
+			free(key);
+			continue;
+		}
+
+		// Encode key reference as positive INTEGER
+		ptr = entry;
+		*ptr++ = 0x02;
+		if (keyref & 0x80) {
+			*ptr++ = 0x02;
+			*ptr++ = 0x00;
+		} else {
+			*ptr++ = 0x01;
+		}
+		*ptr++ = keyref;
+		memcpy(ptr, key, key_len);
+		ptr += key_len;
+		free(key);
+
+		if ((sc_asn1_put_tag(0x30, entry, ptr - entry, NULL, 0, NULL) > (int)sizeof(entry))
+				|| (wrap_with_tag(0x30, entry, ptr - entry, &key, &entry_len) < 0)) {
+			printf("Key %3d: encoding failed\n", keyref);
+			continue;
+		}
+
+		if (fwrite(key, 1, entry_len, out) != entry_len) {
+			perror(outf);
+			free(key);
+			fclose(out);
+			return -1;
+		}
+		free(key);
+
+		printf("Key %3d: wrapped (%lu bytes)\n", keyref, (unsigned long)key_len);
+		bytes += entry_len;
+		done++;
+	}
+
+	fclose(out);
+
+	print_throughput("Wrapped", done, keys, bytes, start);
+	return done == keys ? 0 : -1;
+}
+
+
+
+/**
+ * Read the next entry from a key archive
+ *
+ * @return 1 if an entry was read, 0 at the end of the archive or -1 on error
+ */
+static int read_archive_entry(FILE *in, u8 *buf, size_t bufsize, size_t *entry_len)
+{
+	size_t hlen = 2, len, i;
+	int c;
+
+	c = fgetc(in);
+	if (c == EOF) {
+		return 0;
+	}
+	buf[0] = (u8)c;
+
+	if ((buf[0] != 0x30) || (fread(buf + 1, 1, 1, in) != 1)) {
+		return -1;
+	}
+
+	len = buf[1];
+	if (len & 0x80) {
+		i = len & 0x7F;
+		if ((i < 1) || (i > 3) || (fread(buf + 2, 1, i, in) != i)) {
+			return -1;
+		}
+		for (len = 0; hlen < 2 + i; hlen++) {
+			len = (len << 8) | buf[hlen];
+		}
+	}
+
+	if ((len > bufsize - hlen) || (fread(buf + hlen, 1, len, in) != len)) {
+		return -1;
+	}
+
+	*entry_len = hlen + len;
+	return 1;
+}
+
+
+
+static int unwrap_keys(sc_card_t *card, const char *inf, const char *pin, int force, const char *keyrefs)
+{
+	sc_cardctl_sc_hsm_wrapped_key_t wrapped_key;
+	u8 selected[256];
+	u8 entry[MAX_ARCHIVE_ENTRY];
+	const u8 *ptr, *prkd, *cert;
+	FILE *in = NULL;
+	unsigned int cla, tag;
+	size_t entry_len, len, prkd_len, cert_len, bytes = 0;
+	double start;
+	int r, keyref, keys = 0, done = 0;
+
+	if (inf == NULL) {
+		fprintf(stderr, "No file name specified for key archive\n");
+		return -1;
+	}
+
+	if (parse_key_references(keyrefs, selected) < 0) {
+		return -1;
+	}
+
+	in = fopen(inf, "rb");
+
+	if (in == NULL) {
+		perror(inf);
+		return -1;
+	}
+
+	if (verify_user_pin(card, pin) < 0) {
+		fclose(in);
+		return -1;
+	}
+
+	start = get_seconds();
+
+	while ((r = read_archive_entry(in, entry, sizeof(entry), &entry_len)) > 0) {
+		ptr = entry;
+		if ((sc_asn1_read_tag(&ptr, entry_len, &cla, &tag, &len) != SC_SUCCESS)
+				|| (sc_asn1_read_tag(&ptr, len, &cla, &tag, &len) != SC_SUCCESS)
+				|| (tag != SC_ASN1_TAG_INTEGER) || (len < 1) || (len > 2)) {
+			r = -1;
+			break;
+		}
+
+		keyref = ptr[len - 1];
+		ptr += len;
+		if ((keyref < 1) || !selected[keyref]) {
+			continue;
+		}
+
+		keys++;
+
+		if (parse_key_blob(ptr, entry_len - (ptr - entry), &wrapped_key, &prkd, &prkd_len, &cert, &cert_len) < 0) {
+			printf("Key %3d: invalid key blob\n", keyref);
+			continue;
+		}
+
+		if (!force && (check_key_slot(card, keyref, prkd_len, cert_len) < 0)) {
+			printf("Key %3d: skipped\n", keyref);
+			continue;
+		}
+
+		if (import_key_blob(card, keyref, &wrapped_key, prkd, prkd_len, cert, cert_len, force) < 0) {
+			printf("Key %3d: unwrap failed\n", keyref);
+			continue;
+		}
+
+		printf("Key %3d: unwrapped%s%s\n", keyref,
+				prkd_len > 0 ? ", PRKD" : "",
+				cert_len > 0 ? ", certificate" : "");
+		bytes += entry_len;
+		done++;
+	}
+
+	fclose(in);
+
+	if (r < 0) {
+		fprintf(stderr, "Invalid key archive format in %s\n", inf);
+	}
+
+	print_throughput("Unwrapped", done, keys, bytes, start);
+	return (r == 0) && (done == keys) ? 0 : -1;
+}
+
+
+
 int main(int argc, char *argv[])
 {
 	int err = 0, r, c, long_optind = 0;
@@ -1678,6 +2083,8 @@ int main(int argc, char *argv[])
 	int do_create_dkek_share = 0;
 	int do_wrap_key = 0;
 	int do_unwrap_key = 0;
+	int do_wrap_keys = 0;
+	int do_unwrap_keys = 0;
 	sc_path_t path;
 	sc_file_t *file = NULL;
 	const char *opt_so_pin = NULL;
@@ -1686,6 +2093,7 @@ int main(int argc, char *argv[])
 	const char *opt_password = NULL;
 	const char *opt_bio1 = NULL;
 	const char *opt_bio2 = NULL;
+	const char *opt_key_references = NULL;
 	int opt_retry_counter = 3;
 	int opt_dkek_shares = -1;
 	int opt_key_reference = -1;
@@ -1733,6 +2141,19 @@ int main(int argc, char *argv[])
 			opt_filename = optarg;
 			action_count++;
 			break;
+		case OPT_WRAP_KEYS:
+			do_wrap_keys = 1;
+			opt_filename = optarg;
+			action_count++;
+			break;
+		case OPT_UNWRAP_KEYS:
+			do_unwrap_keys = 1;
+			opt_filename = optarg;
+			action_count++;
+			break;
+		case OPT_KEY_REFERENCES:
+			opt_key_references = optarg;
+			break;
 		case OPT_PASSWORD:
 			util_get_pin(optarg, &opt_password);
 			break;
@@ -1835,6 +2256,12 @@ int main(int argc, char *argv[])
 	if (do_unwrap_key && unwrap_key(card, opt_key_reference, opt_filename, opt_pin, opt_force))
 		goto fail;
 
+	if (do_wrap_keys && wrap_keys(ctx, card, opt_filename, opt_pin, opt_key_references))
+		goto fail;
+
+	if (do_unwrap_keys && unwrap_keys(card, opt_filename, opt_pin, opt_force, opt_key_references))
+		goto fail;
+
 	if (action_count == 0) {
 		print_info(card, file);
 	}